@@ -1,4 +1,6 @@
 // stating all required libraries for the code here
+// _GNU_SOURCE has to come before every include so that O_DIRECT is declared for the read engine
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,12 +13,30 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <libgen.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <poll.h>
+#include "path_resolver.h"
+#include "membership_filter.h"
+#include "read_engine.h"
+#include "listing_page.h"
+#include "tiering.h"
+#include "local_transport.h"
+#include "shm_ring.h"
+#include "delta_transfer.h"
+#include "file_version.h"
+#include "file_stat.h"
+#include "storage_engine.h"
+#include "route_ring.h"
 // defining all necessary self defined macros which will be used through out the code
 #define PORT 8053
 #define string_storage_SIZE 1024
 // text and pdf servers will be accessed through smain only
 // these servers are hidden from client and client has no knowledge of it
 // all server sockets will have different ports to run on like smain, stext and spdf
+// these are the built in routes, smain.conf can replace them and add more servers
 // PORT for pdf server to run on
 #define SPDF_PORT 8094
 // port for text server to run on
@@ -26,6 +46,110 @@
 #define TEXT_ADDRESS "127.0.0.2"
 // IP address which will be used for pdf server
 #define PDF_ADDRESS "127.0.0.3"
+// hot object cache for .txt and .pdf files fetched from stext and spdf
+// cache lives in shared memory so that every forked client process sees the same objects
+// number of objects which can be kept in the cache at the same time
+#define HOT_CACHE_SLOTS 128
+// biggest object which can be cached, bigger files are always fetched from the backend
+#define HOT_CACHE_SLOT_BYTES (512 * 1024)
+// how long to sleep while another client process is filling the same object
+#define HOT_CACHE_WAIT_USEC 2000
+// give up on waiting for another process after this many polls (around 60 seconds)
+#define HOT_CACHE_WAIT_ROUNDS 30000
+// states of a cache slot
+#define HOT_CACHE_EMPTY 0
+#define HOT_CACHE_FILLING 1
+#define HOT_CACHE_READY 2
+// results of looking up an object in the cache
+#define HOT_CACHE_HIT 0
+#define HOT_CACHE_FILL 1
+#define HOT_CACHE_BYPASS 2
+// membership filters of stext and spdf copied into smain, so missing files can be answered without asking them
+// number of backend servers smain keeps a copy of the filter for
+#define BACKEND_FILTER_SLOTS 8
+// a copy older than this is fetched again, files removed in the meantime only cost a trip to the backend
+#define BACKEND_FILTER_REFRESH_SECONDS 60
+// a fetch which takes longer than this is treated as dead and another process may start over
+#define BACKEND_FILTER_FETCH_TIMEOUT 30
+// uploads which can happen while a copy is being fetched and still be added to it afterwards
+#define BACKEND_FILTER_LOG 4096
+// first line of the reply to a dfile for a file which is not stored
+#define FILE_NOT_FOUND_MARKER "FILE_NOT_FOUND\n"
+// number of open .c files (with their stat) each client process keeps around
+#define LOCAL_FD_CACHE_SLOTS 32
+// an uploaded .c file is written under this name next to its place and renamed over it once it arrived complete
+#define LOCAL_UPLOAD_TEMP_PREFIX ".upload."
+// routing of file extensions to the pool of servers storing them, read from smain.conf at start up
+// file read when SMAIN_CONFIG is not set, the built in routes are used when it does not exist
+#define SMAIN_CONFIG_FILE "smain.conf"
+// name of the pool for files which smain stores itself in ~/smain
+#define ROUTE_LOCAL_POOL "local"
+// number of pools, of servers in one pool and of extensions which can be routed
+#define ROUTE_POOL_SLOTS 16
+#define ROUTE_POOL_BACKENDS 8
+// size of the extension hash table, a power of two bigger than the number of routes
+#define ROUTE_TABLE_SLOTS 64
+#define ROUTE_EXTENSION_SIZE 16
+// background process which moves files to the server of their pool that owns them after the pools changed
+// bytes per second it copies at most when smain.conf has no "rebalance" line, 0 there turns it off
+#define REBALANCE_DEFAULT_RATE (8LL * 1024 * 1024)
+// a full pass over all servers is repeated this often to pick up anything left over
+#define REBALANCE_INTERVAL_SECONDS 600
+// downloads and removals also ask the other servers of a pool until this long after the last file was moved
+#define REBALANCE_FORWARD_SECONDS 120
+// last line of the answer to list
+#define END_OF_LIST "END_OF_LIST\n"
+// biggest manifest a client may send with sync, about a million files
+#define SYNC_MANIFEST_MAXIMUM (64 * 1024 * 1024)
+// .c files not read for this long move from ~/smain to ~/smain-cold when smain.conf has no "tier" line
+#define LOCAL_COLD_FOLDER "smain-cold"
+// servers of smain.conf which smain runs itself with the storage engine ("embed" in smain.conf)
+#define EMBEDDED_SERVER_SLOTS 8
+// write-back pools ("writeback" in smain.conf) have their uploads and removals kept in a journal below the home folder,
+// the client is answered once the entry is on disk and a background process passes the entries on to the servers in order
+#define WRITEBACK_FOLDER ".smain-journal"
+// entries which can wait in the journal at the same time, an upload arriving when all are taken is passed on right away
+#define WRITEBACK_SLOTS 1024
+// name of an entry which is still being written, left overs of a crash are removed when smain starts
+#define WRITEBACK_TEMP_PREFIX ".spool."
+// the forwarder looks for new entries this often
+#define WRITEBACK_POLL_USEC 100000
+// and tries a pool again this long after its servers did not take an entry
+#define WRITEBACK_RETRY_SECONDS 2
+// states of a journal slot
+#define WRITEBACK_FREE 0
+#define WRITEBACK_PENDING 1
+// replication, a pool can keep every file on several of its servers ("replicas" in smain.conf)
+// load and latency are tracked in shared memory for every server of the routing table
+#define BACKEND_STATS_SLOTS (ROUTE_POOL_SLOTS * ROUTE_POOL_BACKENDS)
+// number of recent answers of a server its 95th percentile latency is worked out from
+#define BACKEND_LATENCY_SAMPLES 64
+// below this many answers the percentile means nothing yet and HEDGE_DEFAULT_DELAY_MS is used
+#define BACKEND_LATENCY_MIN_SAMPLES 16
+// a download asks the next replica as well when the first one has not answered after its 95th percentile
+#define HEDGE_DEFAULT_DELAY_MS 50
+// but never sooner than this, so that a very fast server does not get every request twice
+#define HEDGE_MINIMUM_DELAY_MS 2
+// health of the backend servers, a server which keeps failing is skipped for a while by a circuit breaker
+// connecting to a backend gives up after this long
+#define BACKEND_CONNECT_TIMEOUT_MS 500
+// a backend which sends or takes nothing for this long has failed, it has to be longer than the 5 second pause before its end message
+#define BACKEND_IO_TIMEOUT_SECONDS 15
+// this many failed requests in a row open the breaker of a server
+#define BACKEND_BREAKER_FAILURES 3
+// and so does an error rate of this many percent once the current window had BACKEND_ERROR_RATE_MINIMUM requests
+#define BACKEND_ERROR_RATE_PERCENT 50
+#define BACKEND_ERROR_RATE_MINIMUM 10
+// requests and failures are counted in windows of this length
+#define BACKEND_HEALTH_WINDOW_SECONDS 30
+// an open breaker lets requests through again after this long, a server which could not be reached is let back as soon as a probe reaches it
+#define BACKEND_BREAKER_OPEN_SECONDS 10
+// the health checker connects to every server this often
+#define BACKEND_PROBE_INTERVAL_SECONDS 2
+// outcome of a request to a backend, a cancelled request (like the slower one of a hedged pair) says nothing about its server
+#define REQUEST_SUCCEEDED 0
+#define REQUEST_FAILED 1
+#define REQUEST_CANCELLED 2
 // redefining already defined data types in system
 #define character char
 #define constant const
@@ -41,6 +165,247 @@ const char *DOWNLOAD_FILE = "dfile";
 const char *REMOVE_FILE = "rmfile";
 const char *GENERATE_TAR = "dtar";
 const char *DISPLAY_LIST = "display";
+// one cached object, key is the file path relative to the storage folder
+object hot_cache_slot
+{
+    // HOT_CACHE_EMPTY, HOT_CACHE_FILLING or HOT_CACHE_READY
+    number state;
+    // number of client processes sending this object right now, pinned slots are never evicted
+    number pins;
+    // reference bit for the CLOCK eviction
+    number referenced;
+    // set when ufile or rmfile touched the object while it was pinned or being filled
+    number stale;
+    // process which is fetching the object from the backend
+    pid_t filler;
+    // bytes of the object stored in the arena
+    size_t length;
+    // size of the file, the object has one more byte when that ends the file on a short chunk
+    long long file_size;
+    // hash of the key to skip most string compares
+    unsigned long key_hash;
+    character key[string_storage_SIZE];
+};
+// header of the shared cache, data of slot i is at hot_cache_arena + i * HOT_CACHE_SLOT_BYTES
+object hot_cache_table
+{
+    // spin lock protecting all slots
+    volatile number lock;
+    // position of the CLOCK hand
+    number clock_hand;
+    object hot_cache_slot slots[HOT_CACHE_SLOTS];
+};
+// both are mapped once in main() and inherited by every forked client process
+object hot_cache_table *hot_cache = NULL;
+character *hot_cache_arena = NULL;
+// one open file of the local .c store with the stat taken when it was opened
+object local_fd_cache_entry
+{
+    // open read only descriptor, -1 when the entry is free
+    number fd;
+    // stat of the file when it was opened, the size is used to send the file
+    object stat info;
+    // tick of the last use for the LRU eviction
+    unsigned long last_used;
+    character key[string_storage_SIZE];
+};
+// copy of the membership filter of one backend server, kept in shared memory for all client processes
+object backend_filter
+{
+    character ip[64];
+    number port;
+    // start time of the fetch in progress, ZERO when nobody is fetching
+    volatile time_t refreshing;
+    // time of the last fetch, failed or not
+    volatile time_t fetched_at;
+    // ZERO until a fetch succeeded, the bits are not used then
+    volatile number valid;
+    // odd while the bits are being replaced, readers which see it change do not trust what they read
+    volatile unsigned long version;
+    // uploads done through smain, the hashes of the last BACKEND_FILTER_LOG are kept to be added again after a fetch
+    volatile unsigned long upload_count;
+    unsigned int log_h1[BACKEND_FILTER_LOG];
+    unsigned int log_h2[BACKEND_FILTER_LOG];
+    unsigned char bits[MEMBERSHIP_FILTER_BYTES];
+};
+object backend_filter *backend_filters = NULL;
+// load and latency of one backend server, kept in shared memory for all client processes
+object backend_stats
+{
+    character ip[64];
+    number port;
+    // requests of client processes which wait for or read an answer of this server right now
+    volatile number in_flight;
+    // microseconds from sending a request to the first byte of the answer, for the last BACKEND_LATENCY_SAMPLES answers
+    volatile unsigned long sample_count;
+    volatile unsigned int samples[BACKEND_LATENCY_SAMPLES];
+    // failed requests since the last one which worked
+    volatile number consecutive_failures;
+    // set when the last failure was a connection which could not be made
+    volatile number unreachable;
+    // requests and failures in the window started then
+    volatile time_t window_started;
+    volatile number window_requests;
+    volatile number window_failures;
+    // the circuit breaker is open until then and the server is left out, ZERO when it is closed
+    volatile time_t open_until;
+};
+object backend_stats *backend_stats_table = NULL;
+// one server of a pool
+object route_backend
+{
+    character ip[64];
+    number port;
+};
+// servers which store the files of some extensions, the local pool has no servers and means ~/smain
+object route_pool
+{
+    character name[32];
+    number local;
+    // every file is written to the first replicas servers after its key on the ring
+    // an upload succeeds when write_quorum of them stored it, both are 1 unless smain.conf says otherwise
+    number replicas;
+    number write_quorum;
+    // uploads and removals go through the journal and are passed on by the forwarder, ZERO unless smain.conf says "writeback"
+    number writeback;
+    // dfile and ufile hand the client connection to a server on this host which moves the file itself ("handoff" in smain.conf)
+    number handoff;
+    // dfile reads the file of a server on this host out of a shared memory ring instead of a socket ("sharedmemory" in smain.conf)
+    number shared_memory;
+    number backend_count;
+    object route_backend backends[ROUTE_POOL_BACKENDS];
+    // consistent hash ring sorted by hash, a key belongs to the server of the first point at or after its hash
+    number ring_size;
+    object route_ring_point ring[ROUTE_POOL_BACKENDS * ROUTE_VIRTUAL_NODES];
+};
+// one place display reads names from: the find over ~/smain or one backend server
+object listing_source
+{
+    // pipe of the find or socket of the server, -1 once the source is finished
+    number fd;
+    FILE *find;
+    object route_backend *backend;
+    // the names of a replicated pool come from several servers and are only sent once
+    number deduplicate;
+    // start of a name which has not arrived completely yet
+    character pending[string_storage_SIZE * 4];
+    size_t pending_length;
+};
+// names which display has sent already, open addressing with a power of two slots
+object name_set
+{
+    character **slots;
+    size_t capacity;
+    size_t used;
+};
+// one path of a stat request
+object stat_lookup
+{
+    character *path;
+    character *key;
+    object route_pool *pool;
+    // servers of the pool in ring order, the first asked of them may have the file
+    number order[ROUTE_POOL_BACKENDS];
+    number asked;
+    // ZERO while servers are still to be asked, 1 once the file was found and -1 when it is not stored
+    number state;
+    object file_stat stat;
+};
+// the files of a stat request which one server is asked for in one index request
+object stat_batch
+{
+    object route_backend *backend;
+    // indexes into the lookups of the request
+    number *lookups;
+    number count;
+    number capacity;
+    number sock;
+};
+// one slot of the extension hash table, pool is -1 when the slot is free
+object route_entry
+{
+    character extension[ROUTE_EXTENSION_SIZE];
+    number pool;
+};
+// filled once in main() before forking and only read afterwards
+object route_pool route_pools[ROUTE_POOL_SLOTS];
+number route_pool_count = ZERO;
+object route_entry route_table[ROUTE_TABLE_SLOTS];
+// set by the SIGHUP handler, smain.conf is read again by the accept loop
+volatile sig_atomic_t routing_reload_requested = ZERO;
+// progress of the rebalancer, in shared memory so client processes know when to forward
+object rebalance_state
+{
+    // until then a file missing on its server is also looked for on the other servers of its pool
+    volatile time_t forwarding_until;
+    volatile unsigned long moved_files;
+    volatile unsigned long long moved_bytes;
+};
+object rebalance_state *rebalance = NULL;
+// bytes per second the rebalancer copies, from smain.conf
+long long rebalance_rate = REBALANCE_DEFAULT_RATE;
+// seconds without a read before a local file goes to the cold folder and that folder, from smain.conf ("" is ~/smain-cold)
+// both are only used at start up, a changed "tier" line needs a restart of smain
+long long local_cold_seconds = TIERING_DEFAULT_COLD_SECONDS;
+character local_cold_folder[string_storage_SIZE] = "";
+// cold tier of ~/smain
+object tiering_store local_tiers;
+// a text or pdf server which smain runs itself, the engine's state is set up before forking and shared by every client process
+object embedded_server
+{
+    character ip[64];
+    number port;
+    character folder[64];
+    character extension[ROUTE_EXTENSION_SIZE];
+    // set once its port is bound, a server which could not be started is reached like any other one
+    number started;
+    // the process accepting connections of the server for the background processes and other hosts
+    pid_t pid;
+    object storage_engine engine;
+};
+// read from smain.conf at start up only, a changed "embed" line needs a restart of smain
+object embedded_server embedded_servers[EMBEDDED_SERVER_SLOTS];
+number embedded_server_count = ZERO;
+number embedded_servers_running = ZERO;
+// one upload or removal waiting in the journal, its file is named after sequence
+object writeback_entry
+{
+    volatile number state;
+    unsigned long long sequence;
+    // 1 for a rmfile, ZERO for a ufile
+    number removal;
+    character key[string_storage_SIZE];
+};
+// the journal of the write-back pools, in shared memory so that every client process and the forwarder see the same entries
+object writeback_journal
+{
+    volatile number lock;
+    // entries of the same key are passed on in the order of their sequence
+    unsigned long long next_sequence;
+    object writeback_entry entries[WRITEBACK_SLOTS];
+};
+object writeback_journal *writeback = NULL;
+// directory descriptor of ~/.smain-journal
+number writeback_dir_fd = -1;
+// the process passing the journal on to the servers, only known to the parent
+pid_t writeback_pid = -1;
+// the rebalancer process, only known to the parent
+pid_t rebalancer_pid = -1;
+// the process probing the backend servers, only known to the parent
+pid_t health_checker_pid = -1;
+// counting filter of the .c files stored in ~/smain
+object membership_filter *local_paths = NULL;
+// directory descriptor of ~/smain, files are opened relative to it with openat()
+number local_store_fd = -1;
+// folders of ~/smain which this process has open already, uploads create their files relative to them
+object path_resolver local_store_dirs;
+// bumped in shared memory by every process which uploads or removes a .c file
+// each process drops its open files when it sees a different value than last time
+volatile unsigned long *local_store_generation = NULL;
+// the per process cache itself, it cannot be shared because descriptors belong to one process
+object local_fd_cache_entry local_fd_cache[LOCAL_FD_CACHE_SLOTS];
+unsigned long local_fd_cache_generation = ZERO;
+unsigned long local_fd_cache_tick = ZERO;
 // these are the function declaration, also can be called a list of functions which will be used through this file
 constant character *return_home_value();
 empty_return_function manage_client_interaction(number channel_for_client);
@@ -49,7 +414,129 @@ empty_return_function manage_download_file_to_server(number channel_for_client,
 empty_return_function manage_remove_file_from_server(number channel_for_client, character *document_name, character *string_storage);
 empty_return_function manage_add_tar_for_file_types_local(number channel_for_client, character *document_type);
 empty_return_function manage_display_list_document_names_in_folder(number channel_for_client, character *pathname);
-empty_return_function link_to_server(constant character *ip, number port, number *sock);
+number link_to_server(constant character *ip, number port, number *sock);
+empty_return_function setup_hot_object_cache();
+unsigned long hot_cache_key_hash(constant character *key);
+empty_return_function hot_cache_lock();
+empty_return_function hot_cache_unlock();
+number hot_cache_filler_is_gone(object hot_cache_slot *slot);
+empty_return_function setup_local_store();
+empty_return_function local_fd_cache_flush();
+object local_fd_cache_entry *local_fd_cache_open(constant character *key);
+empty_return_function local_store_changed();
+empty_return_function setup_local_tiers();
+number extension_match(constant character *name, empty_return_function *argument);
+empty_return_function build_store_key(constant character *folder, constant character *document_name, character *key, size_t key_size);
+number hot_cache_acquire(constant character *key, number *slot_index);
+number hot_cache_pin(constant character *key, number *slot_index);
+long long hot_cache_send(number channel_for_client, number slot_index, number sized);
+empty_return_function hot_cache_append(number slot_index, constant character *data, size_t length, number *overflow);
+empty_return_function hot_cache_complete_fill(number slot_index, number keep, long long file_size);
+empty_return_function hot_cache_release(number slot_index);
+empty_return_function hot_cache_invalidate(constant character *key);
+number relay_download_from_pool(number channel_for_client, object route_pool *pool, character *document_name, character *initial_command);
+number backend_request(object route_backend *backend, constant character *command);
+number hedged_request(object route_pool *pool, number first, number second, constant character *command, number *winner);
+empty_return_function setup_backend_stats();
+object backend_stats *backend_stats_find(constant character *ip, number port);
+empty_return_function backend_stats_record(object backend_stats *stats, long long elapsed);
+long long backend_hedge_delay(object backend_stats *stats);
+number backend_sample_compare(constant empty_return_function *left, constant empty_return_function *right);
+empty_return_function backend_stats_done(object route_backend *backend, number outcome);
+empty_return_function backend_health_report(constant character *ip, number port, number outcome);
+number backend_healthy(constant character *ip, number port);
+empty_return_function start_health_checker();
+empty_return_function health_check_pass();
+long long monotonic_usec();
+number relay_remove_to_backend(constant character *ip, number port, character *document_name, character *initial_command, character *reply_from_server, size_t reply_size);
+empty_return_function send_file_not_found(number channel_for_client, constant character *document_name);
+empty_return_function send_file_unavailable(number channel_for_client, constant character *document_name);
+number recv_exact(number sock, empty_return_function *data, size_t length);
+number recv_line(number sock, character *line, size_t size);
+empty_return_function setup_membership_filters();
+object backend_filter *backend_filter_find(constant character *ip, number port);
+empty_return_function backend_filter_refresh(object backend_filter *filter);
+number backend_filter_rules_out(constant character *ip, number port, constant character *key);
+empty_return_function backend_filter_note_upload(constant character *ip, number port, constant character *key);
+empty_return_function setup_routing_table();
+number load_routing_table();
+empty_return_function reload_routing_table();
+empty_return_function request_routing_reload(number signal_number);
+number route_backends_for(object route_pool *pool, constant character *key, number *order);
+empty_return_function register_backends();
+empty_return_function setup_rebalancer();
+empty_return_function start_rebalancer();
+number rebalance_forwarding();
+empty_return_function rebalance_pass(number first_pass);
+character **rebalance_list(object route_backend *backend, number *count);
+number rebalance_copy(object route_backend *source, object route_backend *target, constant character *key, object timespec *started, long long *copied);
+empty_return_function rebalance_throttle(object timespec *started, long long *copied, long long size);
+number rebalance_key_compare(constant empty_return_function *left, constant empty_return_function *right);
+number rebalance_remove(object route_backend *backend, constant character *key);
+number route_add_backend(constant character *pool_name, constant character *ip, number port);
+number route_add(constant character *extension, constant character *pool_name);
+number route_set_replicas(constant character *pool_name, constant character *copies, number write_quorum);
+number route_replica_count(object route_pool *pool);
+empty_return_function route_order_by_load(object route_pool *pool, number *order, number count);
+object route_pool *route_pool_find(constant character *pool_name);
+constant character *route_extension(constant character *document_name);
+object route_pool *route_lookup(constant character *document_name);
+object route_pool *route_lookup_extension(constant character *extension);
+empty_return_function route_build_rings();
+number route_backend_is_first(number pool_index, number backend_index);
+number start_local_listing(object listing_source *source, character *pathname);
+number start_backend_listing(object listing_source *source, object route_backend *backend, character *pathname, number deduplicate);
+number read_listing_source(object listing_source *source, FILE *out, object name_set *sent_names, unsigned long *names);
+empty_return_function finish_listing_source(object listing_source *source);
+number name_set_add(object name_set *set, constant character *name);
+empty_return_function name_set_free(object name_set *set);
+empty_return_function manage_page_request(number channel_for_client, character *pathname, character *cursor);
+number collect_folder_page(character *pathname, constant character *cursor, constant character *after, object listing_entry **entries, number *more);
+empty_return_function free_folder_page(object listing_entry *entries, number count);
+empty_return_function manage_sync_request(number channel_for_client, character *pathname, character *manifest_size);
+empty_return_function sync_client_file(FILE *out, object listing_entry *file, number *sent, number *skipped);
+empty_return_function manage_delta_upload(number channel_for_client, character *document_name, character *target_location, character *string_storage);
+number relay_delta_to_backend(number channel_for_client, object route_backend *backend, character *initial_command);
+empty_return_function manage_conditional_download(number channel_for_client, character *document_name, character *version, character *string_storage);
+empty_return_function send_download_size(number channel_for_client, number sized, long long size);
+number pool_file_version(object route_pool *pool, constant character *cache_key, character *version, size_t version_size);
+empty_return_function manage_stat_request(number channel_for_client, character *count_text, character *length_text);
+empty_return_function stat_lookup_prepare(object stat_lookup *lookup);
+number stat_lookup_round(object stat_lookup *lookups, number count, number round);
+empty_return_function stat_batch_send(object stat_batch *batch, object stat_lookup *lookups);
+empty_return_function stat_batch_receive(object stat_batch *batch, object stat_lookup *lookups);
+empty_return_function discard_request_body(number channel_for_client, long long length);
+number writeback_file_stat(constant character *cache_key, object file_stat *stat);
+number local_page_match(constant character *name, empty_return_function *argument);
+number request_backend_page(object route_backend *backend, character *pathname, character *cursor);
+number read_backend_page(number backend_sock, object listing_entry *entries, number *count, number *more);
+number write_all(number fd, constant character *data, size_t length);
+number relay_upload_to_pool(object route_pool *pool, constant character *cache_key, constant character *document_name, character *initial_command, number source_fd, character *reply_from_server, size_t reply_size);
+number remove_from_pool(object route_pool *pool, character *document_name, character *initial_command, character *reply_from_server, size_t reply_size, number *unreached);
+number route_set_writeback(constant character *pool_name);
+number route_set_handoff(constant character *pool_name);
+number handoff_to_backend(number channel_for_client, object route_pool *pool, constant character *cache_key, character *initial_command, number upload);
+number route_set_shared_memory(constant character *pool_name);
+number embedded_server_add(constant character *line);
+empty_return_function setup_embedded_servers();
+object storage_engine *embedded_engine_for(constant character *ip, number port);
+number route_pool_embedded(object route_pool *pool);
+number ring_download_from_pool(number channel_for_client, object route_pool *pool, character *document_name, constant character *cache_key, number lookup, number slot_index);
+empty_return_function setup_writeback();
+empty_return_function writeback_lock();
+empty_return_function writeback_unlock();
+empty_return_function writeback_recover();
+number writeback_free_slots();
+number writeback_latest(constant character *key, unsigned long long *sequence, number *removal);
+number writeback_spool(constant character *command, number source, character *spool_name, size_t spool_name_size);
+number writeback_commit(constant character *spool_name, constant character *key, number removal);
+number writeback_upload(number channel_for_client, object route_pool *pool, character *document_name, constant character *cache_key, character *string_storage);
+number writeback_download(number channel_for_client, character *document_name, constant character *cache_key);
+number writeback_remove(number channel_for_client, character *document_name, constant character *cache_key, character *string_storage);
+empty_return_function start_writeback_forwarder();
+number writeback_forward_pass();
+number writeback_forward(object route_pool *pool, unsigned long long sequence, number removal, constant character *key);
+number writeback_sequence_compare(constant empty_return_function *left, constant empty_return_function *right);
 // entry point of code
 number main()
 {
@@ -59,6 +546,8 @@ number main()
     object sockaddr_in server_channel_address, client_channel_address;
     // initializing variable to store length of client channel or socket address
     channel_length addr_len = sizeof(client_channel_address);
+    // read which pool of servers stores which extension first, a broken configuration stops smain before it binds
+    setup_routing_table();
     // creating a socket for server
     // here socket() would create a socket and return a file_descriptor for this socket on success otherwise -1
     // AF_INET stands for "Address family internet". Here we are taking it from IPv4 addresses
@@ -91,10 +580,10 @@ number main()
         exit(EXIT_FAILURE);
     }
     // listen() prepares a sockets to accept incoming connection requests
-    // here 3 specifies that how many pending request can be hold in a queue. By pending here, its the requests or connections which has not been accepted
-    // server channel can have at most 3 pending connection requests here
+    // SOMAXCONN specifies how many pending request can be hold in a queue. By pending here, its the requests or connections which has not been accepted
+    // a client using the connection pool of dfs_client.h (or a batch) connects many times at once, with a short queue the rest would wait for a retry
     // if listen fails
-    if (listen(channel_for_server, 3) < ZERO)
+    if (listen(channel_for_server, SOMAXCONN) < ZERO)
     {
         // the print this error message with appending actual error
         perror("Listen failed");
@@ -103,14 +592,50 @@ number main()
         // exit out of code
         exit(EXIT_FAILURE);
     }
+    // map the hot object cache before forking any client process so all of them share it
+    setup_hot_object_cache();
+    // open ~/smain once so that .c files are opened relative to it in every client process
+    setup_local_store();
+    // move the local files which nobody reads to the cold folder in the background
+    setup_local_tiers();
+    // start the text and pdf servers smain runs itself before the health checker probes them
+    setup_embedded_servers();
+    // build the filter of local .c files and make room for the copies of the backend filters
+    setup_membership_filters();
+    // count the requests and time the answers of every backend server so downloads pick the least busy replica
+    setup_backend_stats();
+    // probe the backend servers in the background so the ones which are down are skipped right away
+    start_health_checker();
+    // start moving files whose server changed with the pools in smain.conf
+    setup_rebalancer();
+    // pick up the journal of the write-back pools and pass on what a previous run left in it
+    setup_writeback();
+    // SIGHUP reads smain.conf again, without SA_RESTART so that it wakes up accept()
+    object sigaction reload_action;
+    memset(&reload_action, ZERO, sizeof(reload_action));
+    reload_action.sa_handler = request_routing_reload;
+    sigaction(SIGHUP, &reload_action, NULL);
+    // a client leaving in the middle of a download should only fail that send() and not kill the process holding cache pins
+    signal(SIGPIPE, SIG_IGN);
     // if all went good then print this message to state to user that server is created successfully and listening to the desgnated port
     show_on_cmd("Main server channel listening at %d port!!!\n", PORT);
     // to accept conncetion requests after one anohter we have given accept() in a while loop
     // this while loop will check as long as socket is recieving connection requests and they are being accepted this loop will continue to go on
     // if we dont put accept in a never ending while loop then socket would listen limited connection requests
     // here accept() will accept the r=connection requests coming from client channel
-    while ((channel_for_client = accept(channel_for_server, (object sockaddr *)&client_channel_address, &addr_len)) >= ZERO)
+    while ((channel_for_client = accept(channel_for_server, (object sockaddr *)&client_channel_address, &addr_len)) >= ZERO || errno == EINTR)
     {
+        // smain.conf changed and smain got SIGHUP, clients connecting from now on use the new routes
+        if (routing_reload_requested)
+        {
+            routing_reload_requested = ZERO;
+            reload_routing_table();
+        }
+        // accept() was only interrupted by a signal
+        if (channel_for_client < ZERO)
+        {
+            continue;
+        }
         // print this message on server that  a client has been added and entered in this server from which this server will be accepting or recieving messages
         show_on_cmd("New client connected to Smain\n");
         // to keep child independent of parent we create a child here so that each client can be run separately
@@ -120,6 +645,8 @@ number main()
         {
             // if it's a child process for client execution then close server channel
             close(channel_for_server);
+            // only the parent reloads the routes
+            signal(SIGHUP, SIG_DFL);
             // then go to manage_client_interaction function to see what type of operation or command needs to be executed
             // like ufile/ dfile/ rmfile/ dtar/ display
             manage_client_interaction(channel_for_client);
@@ -260,6 +787,31 @@ empty_return_function manage_client_interaction(number channel_for_client)
             // to to this function to perform specified fucntionality in if condition
             manage_display_list_document_names_in_folder(channel_for_client, parameter_1);
         }
+        // if its page then send one sorted page of the folder, parameter_2 is the cursor the last page ended with
+        else if (strcmp(instruction_from_user, "page") == ZERO)
+        {
+            manage_page_request(channel_for_client, parameter_1, parameter_2);
+        }
+        // if its sync then compare the manifest of the client's folder which follows the command with the stored files
+        else if (strcmp(instruction_from_user, "sync") == ZERO)
+        {
+            manage_sync_request(channel_for_client, parameter_1, parameter_2);
+        }
+        // if its stat then the paths which follow the command get their size, time, hash and tier, without any file content
+        else if (strcmp(instruction_from_user, FILE_STAT_COMMAND) == ZERO)
+        {
+            manage_stat_request(channel_for_client, parameter_1, parameter_2);
+        }
+        // if its cdfile then the file is only sent when the client's cached copy of it has another version
+        else if (strcmp(instruction_from_user, FILE_VERSION_CONDITIONAL) == ZERO)
+        {
+            manage_conditional_download(channel_for_client, parameter_1, parameter_2, string_storage);
+        }
+        // if its delta then only the changes of a file which is stored already come from the client
+        else if (strcmp(instruction_from_user, DELTA_COMMAND) == ZERO)
+        {
+            manage_delta_upload(channel_for_client, parameter_1, parameter_2, string_storage);
+        }
         // if its invalid or out of scope command then enter this else condition
         else
         {
@@ -270,56 +822,11 @@ empty_return_function manage_client_interaction(number channel_for_client)
         }
     }
 }
-// this function is a common fucntion to create a recursive directory if it's not there in the system
-number create_directory_recursive(constant character *directory_to_be_created_path)
-{
-    // folder/folder_1/folder_2................
-    // iinitializing string for temporary name of file
-    character file_name_temporary[256];
-    // a null pointer initialization
-    character *temp_name_pointer = NULL;
-    size_t file_name_length;
-    // snprintf is to scan values and then add it to a single string
-    // it works like concatenation of string
-    // here file_name_temporary will be assigned with value of:  directory_to_be_created_path
-    snprintf(file_name_temporary, sizeof(file_name_temporary), "%s", directory_to_be_created_path);
-    // get file_name_temporary length and store it to file_name_length
-    file_name_length = strlen(file_name_temporary);
-    // set last char as null of file_name_temporary
-    if (file_name_temporary[file_name_length - 1] == '/')
-    {
-        file_name_temporary[file_name_length - 1] = '\0';
-    }
-    // loop to create all non existed folder
-    for (temp_name_pointer = file_name_temporary + 1; *temp_name_pointer; temp_name_pointer++)
-    {
-        if (*temp_name_pointer == '/')
-        {
-            *temp_name_pointer = '\0';
-            if (mkdir(file_name_temporary, 0755) != ZERO && errno != EEXIST)
-            {
-                perror("mkdir");
-                // on error return -1
-                return -1;
-            }
-            *temp_name_pointer = '/';
-        }
-    }
-    // make last folder as well through this
-    if (mkdir(file_name_temporary, 0755) != ZERO && errno != EEXIST)
-    {
-        perror("mkdir");
-        return -1;
-    }
-    // on success return 0
-    return ZERO;
-}
 // function manage_upload_file_to_server is to perform ufile
 empty_return_function manage_upload_file_to_server(number channel_for_client, character *document_name, character *target_location, character *string_storage)
 {
     // initializing all required variables
     character document_location[string_storage_SIZE];
-    character destination_path[string_storage_SIZE];
     FILE *document_a4;
     character reply_from_server[string_storage_SIZE];
     character file_string_storage[string_storage_SIZE];
@@ -328,29 +835,61 @@ empty_return_function manage_upload_file_to_server(number channel_for_client, ch
     character folder_name[1024];
     // base_filena is to store the end file name
     character base_filename[1024];
-    // if the file type is c them communicate with smain
-    if (strstr(document_name, ".c") != NULL)
+    // key of the file in the hot object cache
+    character cache_key[string_storage_SIZE];
+    // the routing table tells from the extension where this file is stored
+    object route_pool *pool = route_lookup(document_name);
+    // files of the local pool (like .c) are stored by smain itself
+    if (pool != NULL && pool->local)
     {
-        // construct the folder path- directory_to_be_created_path -  on the server
-        // ufile           pwd_folder/z.c      t_folder/t_folder_1
-        // target_location - t_folder/t_folder_1
-        snprintf(destination_path, sizeof(destination_path), "%s/smain/%s", return_home_value(), target_location);
-        // Create the destination directory if it doesn't exist
-        // if error then return
-        if (create_directory_recursive(destination_path) != ZERO)
-        {
-            return;
-        }
         // only fetch file name and ignore any directory path
         split_path(document_name, folder_name, base_filename);
-        // we are using return_home_value() function here to get HOME variable value to keep it dynamic
-        // scan multiple strings to build document_location
+        // document_location is only used for messages now - home/smain/t_folder/t_folder_1/z.c
         snprintf(document_location, sizeof(document_location), "%s/smain/%s/%s", return_home_value(), target_location, base_filename);
-        // document_location- home/smain/t_folder/t_folder_1/z.c
-        document_a4 = fopen(document_location, "wb");
+        // ufile           pwd_folder/z.c      t_folder/t_folder_1
+        // the folder t_folder/t_folder_1 is looked up in the open folders of ~/smain and created if it is missing
+        // the content goes to a temporary file in that folder, a client reading the file meanwhile keeps getting the old one
+        character temp_name[64];
+        number owned = ZERO;
+        number dir_fd = -1;
+        number document_fd = -1;
+        build_store_key(target_location, base_filename, cache_key, sizeof(cache_key));
+        snprintf(temp_name, sizeof(temp_name), "%s%d.tmp", LOCAL_UPLOAD_TEMP_PREFIX, getpid());
+        // a cached folder may have been removed by someone else in the meantime, then it is looked up once more
+        for (number attempt = ZERO; attempt < 2 && document_fd < ZERO; attempt++)
+        {
+            if (dir_fd >= ZERO)
+            {
+                if (owned)
+                {
+                    close(dir_fd);
+                }
+                path_resolver_forget(&local_store_dirs);
+            }
+            dir_fd = path_resolver_open_dir(&local_store_dirs, target_location, &owned);
+            if (dir_fd < ZERO)
+            {
+                break;
+            }
+            document_fd = openat(dir_fd, temp_name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (document_fd < ZERO && errno != ENOENT)
+            {
+                break;
+            }
+        }
+        document_a4 = document_fd >= ZERO ? fdopen(document_fd, "wb") : NULL;
         // if no document found then
         if (document_a4 == NULL)
         {
+            if (document_fd >= ZERO)
+            {
+                close(document_fd);
+                unlinkat(dir_fd, temp_name, ZERO);
+            }
+            if (dir_fd >= ZERO && owned)
+            {
+                close(dir_fd);
+            }
             // return this message to client using send()
             snprintf(reply_from_server, sizeof(reply_from_server), "Failed to open file %s for writing\n", document_location);
             send(channel_for_client, reply_from_server, strlen(reply_from_server), ZERO);
@@ -359,6 +898,11 @@ empty_return_function manage_upload_file_to_server(number channel_for_client, ch
         }
         // Receive file data from the client
         show_on_cmd("Receiving file: %s\n", document_location);
+        // the command gives the size of the file, the byte which ends a file on a short chunk is not stored
+        long long size = dfs_protocol_upload_size(string_storage, string_storage_SIZE);
+        long long received = ZERO;
+        // set once the short chunk which ends the file has arrived, a connection which broke off before leaves the stored file alone
+        number complete = ZERO;
         // start reading this file from client and then wait for recieving this data
         // file will be read in chunks
         // recv() will ensure to wait for the send() call from client
@@ -367,519 +911,4319 @@ empty_return_function manage_upload_file_to_server(number channel_for_client, ch
             // this will print the message on server that how many bytes will be written at the targetfile location
             show_on_cmd("Received %d bytes\n", document_byte_size);
             // fwrite to wrrite the content in new file name - file_string_storage
-            fwrite(file_string_storage, 1, document_byte_size, document_a4);
+            fwrite(file_string_storage, 1, dfs_protocol_file_part(size, received, document_byte_size), document_a4);
+            received += document_byte_size;
             // if file ahs been read completely then break out of loop
             if (document_byte_size < sizeof(file_string_storage))
             {
                 show_on_cmd("End of file detected\n");
+                complete = 1;
                 break; // End of file
             }
         }
+        // the new content is on disk before it takes the place of the old file
+        complete = fflush(document_a4) == ZERO && fsync(document_fd) == ZERO && complete;
+        fclose(document_a4);
+        // a path which was not stored before goes into the membership filter, the rename only succeeds without replacing for those
+        number stored = ZERO;
+        if (complete && renameat2(dir_fd, temp_name, dir_fd, base_filename, RENAME_NOREPLACE) == ZERO)
+        {
+            stored = 1;
+            if (local_paths != NULL)
+            {
+                membership_filter_add(local_paths, cache_key);
+            }
+        }
+        else if (complete && errno == EEXIST && renameat(dir_fd, temp_name, dir_fd, base_filename) == ZERO)
+        {
+            stored = 1;
+            // the new content replaces a stub as well, its cold copy is not needed anymore
+            tiering_forget(&local_tiers, cache_key);
+        }
+        if (!stored)
+        {
+            unlinkat(dir_fd, temp_name, ZERO);
+        }
+        if (owned)
+        {
+            close(dir_fd);
+        }
+        if (!stored)
+        {
+            snprintf(reply_from_server, sizeof(reply_from_server), "File %s upload failed, the stored file is unchanged\n", document_name);
+            send(channel_for_client, reply_from_server, strlen(reply_from_server), ZERO);
+            return;
+        }
+        // tell every client process that its open copy of the file may be stale
+        local_store_changed();
         // on success scan this response and send it to client to state that new file at destinated location has been created and content has been added
         snprintf(reply_from_server, sizeof(reply_from_server), "File %s uploaded successfully\n", document_name);
         send(channel_for_client, reply_from_server, strlen(reply_from_server), ZERO);
     }
-    // if file type is .txt then use stext
-    else if (strstr(document_name, ".txt") != NULL)
+    // every other routed file is passed on to the servers of its pool which keep a copy of its key
+    else if (pool != NULL)
     {
-        // here we are initializing text socket
-        number stext_sock;
-        // this is a common function to build the conection
-        link_to_server(TEXT_ADDRESS, STEXT_PORT, &stext_sock);
-        // after successfull connection send this command i.e. string_storage to stext server
-        // if not able to send it to stext then
-        if (send(stext_sock, string_storage, string_storage_SIZE, ZERO) == -1)
+        split_path(document_name, folder_name, base_filename);
+        build_store_key(target_location, base_filename, cache_key, sizeof(cache_key));
+        // the cached copy is dropped before anything is stored, a server which takes the client answers it itself
+        hot_cache_invalidate(cache_key);
+        // a write-back pool answers from the journal, the upload only goes to the servers right away when the journal is full
+        // and so does a pool which stopped being write-back while some of its entries still wait, they must not be overtaken
+        if ((pool->writeback || (writeback != NULL && writeback_latest(cache_key, NULL, NULL) == ZERO)) && writeback_upload(channel_for_client, pool, document_name, cache_key, string_storage) == ZERO)
         {
-            // build this error message and send it to client that there was an error
-            snprintf(reply_from_server, sizeof(reply_from_server), "Not able to connect socket for text files", document_name);
-            send(channel_for_client, reply_from_server, strlen(reply_from_server), ZERO);
+            return;
         }
-        // get file content from client and then use that content
-        while ((document_byte_size = recv(channel_for_client, file_string_storage, sizeof(file_string_storage), ZERO)) > ZERO)
+        // with one copy per file nothing has to be fanned out, so a server on this host can take the file from the client itself
+        if ((pool->handoff || route_pool_embedded(pool)) && !pool->writeback && route_replica_count(pool) == 1 && handoff_to_backend(channel_for_client, pool, cache_key, string_storage, 1) == ZERO)
         {
-            // to send it to the stext server
-            send(stext_sock, file_string_storage, document_byte_size, ZERO);
-            // break if file contentas been read completely
-            if (document_byte_size < sizeof(file_string_storage))
+            return;
+        }
+        relay_upload_to_pool(pool, cache_key, document_name, string_storage, channel_for_client, reply_from_server, sizeof(reply_from_server));
+        // a download which filled the cache from the old copy meanwhile is dropped too, before the client hears about the new one
+        hot_cache_invalidate(cache_key);
+        send(channel_for_client, reply_from_server, strlen(reply_from_server), ZERO);
+    }
+    // if any other file type has been given then state that it is not supported
+    else
+    {
+        snprintf(reply_from_server, sizeof(reply_from_server), "File %s not supported for this process.\n", document_name);
+        printf("File %s not supported for this process.\n", document_name);
+        send(channel_for_client, reply_from_server, strlen(reply_from_server), ZERO);
+    }
+}
+// function manage_delta_upload takes a new version of a stored file as its changes only (delta_transfer.h)
+// smain rebuilds files of the local pool and of a server it runs itself right here, for another server which keeps the
+// only copy it passes the signature to the client and the changes to the server, so only checksums and changes move
+// every other file (more copies, a write-back journal, a server which cannot do it) gets DELTA_REFUSED and the client
+// sends it with ufile instead, a file which is not stored yet gets DELTA_NONE for the same
+empty_return_function manage_delta_upload(number channel_for_client, character *document_name, character *target_location, character *string_storage)
+{
+    character folder_name[1024];
+    character base_filename[1024];
+    character cache_key[string_storage_SIZE];
+    character reply_from_server[string_storage_SIZE * 2];
+    number order[ROUTE_POOL_BACKENDS];
+    object route_pool *pool = route_lookup(document_name);
+    split_path(document_name, folder_name, base_filename);
+    build_store_key(target_location, base_filename, cache_key, sizeof(cache_key));
+    show_on_cmd("Delta command : Received file: %s folder: %s\n", document_name, target_location);
+    if (pool != NULL && pool->local)
+    {
+        number owned = ZERO;
+        // a stub in the cold tier is brought back, the new version is built from the blocks of the whole file
+        number old_file = local_paths == NULL || membership_filter_may_contain(local_paths, cache_key) ? tiering_open(&local_tiers, cache_key) : -1;
+        number dir_fd = old_file >= ZERO ? path_resolver_open_dir(&local_store_dirs, target_location, &owned) : -1;
+        if (dir_fd < ZERO)
+        {
+            if (old_file >= ZERO)
             {
-                break;
+                close(old_file);
             }
+            send(channel_for_client, DELTA_NONE, strlen(DELTA_NONE), ZERO);
+            return;
         }
-        // recieve end message from stext stating evrything went smoothly and then
-        number len = recv(stext_sock, reply_from_server, sizeof(reply_from_server) - 1, ZERO);
-        // sedn that message to client
-        send(channel_for_client, reply_from_server, len, ZERO);
-        // close stext connection
-        close(stext_sock);
+        show_on_cmd("Receiving changes of: %s\n", cache_key);
+        if (delta_receive(channel_for_client, dir_fd, base_filename, old_file) == ZERO)
+        {
+            // a cold copy of the old version is not needed anymore and open copies kept by any client process are stale
+            tiering_forget(&local_tiers, cache_key);
+            local_store_changed();
+            snprintf(reply_from_server, sizeof(reply_from_server), "File %s uploaded successfully\n", document_name);
+        }
+        else
+        {
+            snprintf(reply_from_server, sizeof(reply_from_server), "Changes of %s could not be applied, the stored file is unchanged\n", document_name);
+        }
+        send(channel_for_client, reply_from_server, strlen(reply_from_server), ZERO);
+        close(old_file);
+        if (owned)
+        {
+            close(dir_fd);
+        }
+        return;
     }
-    // if file type is .pdf then enter spdf
-    else if (strstr(document_name, ".pdf") != NULL)
+    if (pool == NULL)
     {
-        // here we are initializing pdf socket
-        number spdf_sock;
-        // this is a common function to build the conection
-        link_to_server(PDF_ADDRESS, SPDF_PORT, &spdf_sock);
-        // after successfull connection send this command i.e. string_storage to stext server
-        // if not able to send it to stext then
-        if (send(spdf_sock, string_storage, string_storage_SIZE, ZERO) == -1)
+        snprintf(reply_from_server, sizeof(reply_from_server), "File %s not supported for this process.\n", document_name);
+        send(channel_for_client, reply_from_server, strlen(reply_from_server), ZERO);
+        return;
+    }
+    // the changes go to one server, so the file has to have one copy, on its owner, and nothing newer waiting in the journal
+    number refused = pool->writeback || (writeback != NULL && writeback_latest(cache_key, NULL, NULL) == ZERO) || route_replica_count(pool) != 1 ||
+                     rebalance_forwarding() || route_backends_for(pool, cache_key, order) < 1;
+    object route_backend *backend = refused ? NULL : &pool->backends[order[ZERO]];
+    object storage_engine *engine = backend != NULL ? embedded_engine_for(backend->ip, backend->port) : NULL;
+    // the server answers the client itself, so the cached copy is dropped before it starts and again once it is done
+    if (backend != NULL)
+    {
+        hot_cache_invalidate(cache_key);
+    }
+    if (engine != NULL)
+    {
+        storage_engine_delta(engine, channel_for_client, document_name, target_location);
+    }
+    else if (backend == NULL || relay_delta_to_backend(channel_for_client, backend, string_storage) == -1)
+    {
+        send(channel_for_client, DELTA_REFUSED, strlen(DELTA_REFUSED), ZERO);
+        return;
+    }
+    // the backend copy may have changed so drop any cached copy of it
+    hot_cache_invalidate(cache_key);
+}
+// this function passes a delta upload between the client and backend: the signature to the client, the changes to the server
+// and the server's answer back to the client
+// returns ZERO when the client got the answer of the server, -1 when the server did not start (nothing reached the client,
+// it can still be refused) and -2 when it broke off in the middle, the client connection is shut down then
+number relay_delta_to_backend(number channel_for_client, object route_backend *backend, character *initial_command)
+{
+    character line[string_storage_SIZE];
+    character chunk[string_storage_SIZE * 16];
+    number backend_sock;
+    long long size, blocks;
+    number block;
+    if (!backend_healthy(backend->ip, backend->port) || link_to_server(backend->ip, backend->port, &backend_sock) != ZERO)
+    {
+        return -1;
+    }
+    // nothing follows the command until the signature came back, so it goes to the server as it came from the client
+    if (send(backend_sock, initial_command, strlen(initial_command), ZERO) < ZERO || recv_line(backend_sock, line, sizeof(line)) != ZERO)
+    {
+        close(backend_sock);
+        backend_health_report(backend->ip, backend->port, REQUEST_FAILED);
+        return -1;
+    }
+    if (strncmp(line, DELTA_NONE, strlen(DELTA_NONE) - 1) == ZERO)
+    {
+        close(backend_sock);
+        send(channel_for_client, DELTA_NONE, strlen(DELTA_NONE), ZERO);
+        return ZERO;
+    }
+    // a server which does not know the command (spdf) answers something else
+    if (sscanf(line, DELTA_SIGNATURE " %lld %d %lld", &size, &block, &blocks) != 3 || blocks < ZERO)
+    {
+        close(backend_sock);
+        return -1;
+    }
+    number result = -2;
+    strcat(line, "\n");
+    long long left = blocks * DELTA_RECORD_BYTES;
+    number relayed = read_engine_send_all(channel_for_client, line, strlen(line)) == ZERO;
+    while (relayed && left > ZERO)
+    {
+        ssize_t got = recv(backend_sock, chunk, left < (long long)sizeof(chunk) ? left : (long long)sizeof(chunk), ZERO);
+        relayed = got > ZERO && read_engine_send_all(channel_for_client, chunk, got) == ZERO;
+        left -= got;
+    }
+    // the changes go on to the server until it answers, the end of them is only known to the server
+    object pollfd waiting[2] = {{channel_for_client, POLLIN, ZERO}, {backend_sock, POLLIN, ZERO}};
+    while (relayed)
+    {
+        number ready = poll(waiting, 2, BACKEND_IO_TIMEOUT_SECONDS * 1000);
+        if (ready < ZERO && errno == EINTR)
         {
-            // build this error message and send it to client that there was an error
-            snprintf(reply_from_server, sizeof(reply_from_server), "Not able to connect socket for pdf files", document_name);
-            send(channel_for_client, reply_from_server, strlen(reply_from_server), ZERO);
+            continue;
         }
-        // get file content from client and then use that content
-        while ((document_byte_size = recv(channel_for_client, file_string_storage, sizeof(file_string_storage), ZERO)) > ZERO)
+        if (ready <= ZERO)
         {
-            // to send it to the spdf server
-            send(spdf_sock, file_string_storage, document_byte_size, ZERO);
-            // break if file contentas been read completely
-            if (document_byte_size < sizeof(file_string_storage))
+            break;
+        }
+        if (waiting[1].revents != ZERO)
+        {
+            ssize_t got = recv(backend_sock, chunk, sizeof(chunk), ZERO);
+            if (got > ZERO && read_engine_send_all(channel_for_client, chunk, got) == ZERO)
             {
-                break;
+                result = ZERO;
             }
+            break;
         }
-        // recieve end message from spdf stating evrything went smoothly and then
-        number len = recv(spdf_sock, reply_from_server, sizeof(reply_from_server) - 1, ZERO);
-        // sedn that message to client
-        send(channel_for_client, reply_from_server, len, ZERO);
-        // close spdf connection
-        close(spdf_sock);
+        ssize_t got = recv(channel_for_client, chunk, sizeof(chunk), ZERO);
+        relayed = got > ZERO && read_engine_send_all(backend_sock, chunk, got) == ZERO;
     }
-    // if any other file type has been given then state that it is not supported
-    else
+    close(backend_sock);
+    backend_health_report(backend->ip, backend->port, result == ZERO ? REQUEST_SUCCEEDED : REQUEST_FAILED);
+    if (result != ZERO)
     {
-        snprintf(reply_from_server, sizeof(reply_from_server), "File %s not supported for this process.\n", document_name);
-        printf("File %s not supported for this process.\n", document_name);
-        send(channel_for_client, reply_from_server, strlen(reply_from_server), ZERO);
+        // the client is somewhere in the middle of the exchange and cannot be told, it sees the connection end instead
+        show_on_cmd("Delta upload through %s:%d broke off\n", backend->ip, backend->port);
+        shutdown(channel_for_client, SHUT_RDWR);
     }
+    return result;
 }
 // function manage_download_file_to_serverfor dfile comamd
 empty_return_function manage_download_file_to_server(number channel_for_client, character *document_name, character *initial_command)
 {
     // initializing all required variables
-    // this is a buffer string to add content into it from any file
-    character string_storage[string_storage_SIZE];
     character document_location[string_storage_SIZE];
-    number document_a4;
-    number file_size;
     character reply_from_server[string_storage_SIZE];
-    // if the file type is c them communicate with smain
-    if (strstr(document_name, ".c") != NULL)
+    // the routing table tells from the extension where this file is stored
+    object route_pool *pool = route_lookup(document_name);
+    // a client which asked for a sized answer is told the size of the file before it, or -1 when smain does not know it
+    number sized = dfs_protocol_sized(initial_command, string_storage_SIZE);
+    number slot_index = -1;
+    // files of the local pool (like .c) are sent by smain itself
+    if (pool != NULL && pool->local)
     {
-        // construct the folder path- document_location -  on the server
-        snprintf(document_location, sizeof(document_location), "%s/smain/%s", return_home_value(), document_name);
+        // the file is looked up by its key inside ~/smain, hot files are already open with their stat
+        build_store_key("", document_name, document_location, sizeof(document_location));
         show_on_cmd("File: %s\n", document_location);
-        // open file with only read access
-        document_a4 = open(document_location, O_RDONLY);
+        // a path the membership filter has never seen is not stored, so not even the descriptor cache is asked
+        if (local_paths != NULL && !membership_filter_may_contain(local_paths, document_location))
+        {
+            send_download_size(channel_for_client, sized, -1);
+            send_file_not_found(channel_for_client, document_name);
+            return;
+        }
+        object local_fd_cache_entry *entry = local_fd_cache_open(document_location);
         // if no file has been found
-        if (document_a4 < ZERO)
+        if (entry == NULL)
         {
             perror("Failed to open file");
+            send_download_size(channel_for_client, sized, -1);
+            send_file_not_found(channel_for_client, document_name);
             return;
         }
-        // read file in chunks and then send the to client
-        while ((file_size = read(document_a4, string_storage, sizeof(string_storage))) >= ZERO)
+        send_download_size(channel_for_client, sized, entry->info.st_size);
+        // the read engine picks pread(), mmap() or O_DIRECT depending on the size of the file and on the page cache
+        // it only uses pread() and mmap() at explicit offsets so the shared descriptor never needs a seek
+        if (read_engine_send_file(entry->fd, entry->info.st_size, channel_for_client) != ZERO)
         {
-            if (file_size == ZERO)
-            {
-                // send it to client whoo is waiting to recieve this signal
-                send(channel_for_client, string_storage, 1, ZERO);
-            }
-            else
-            {
-                // send it to client whoo is waiting to recieve this signal
-                send(channel_for_client, string_storage, file_size, ZERO);
-            }
-            // if file has been read completely then break the loop
-            if (file_size < sizeof(string_storage))
-            {
-                break; // End of file
-            }
+            perror("send file");
         }
-        // close the file after use
-        close(document_a4);
-        // sleep for 5 seconds
-        sleep(5);
-        // prepare the required success message for client
-        snprintf(reply_from_server, sizeof(reply_from_server), "File %s downloaded successfully\n", document_name);
+        // client waits for a chunk shorter than its buffer, so a file ending on a full chunk gets one more byte
+        // and then the pause, a sized client knows where the file ends and needs neither
+        if (!sized && entry->info.st_size % string_storage_SIZE == ZERO)
+        {
+            send(channel_for_client, "", 1, ZERO);
+        }
+        if (!sized)
+        {
+            // sleep for 5 seconds
+            sleep(5);
+        }
+        // prepare the required success message for client, the size tells it whether the last byte was padding
+        snprintf(reply_from_server, sizeof(reply_from_server), "File %s downloaded successfully" DFS_PROTOCOL_FILE_SIZE "\n", document_name, (long long)entry->info.st_size);
         // send the prepared message to client to know that file has been downloaded
         send(channel_for_client, reply_from_server, strlen(reply_from_server), ZERO);
     }
-    // If file is .txt  fetch from Stext server
-    else if (strstr(document_name, ".txt") != NULL)
+    // every other routed file is fetched from a replica in its pool (or from the hot object cache)
+    else if (pool != NULL)
     {
-        // here we are initializing text socket
-        number stext_sock;
-        // this is a common function to build the conection
-        link_to_server(TEXT_ADDRESS, STEXT_PORT, &stext_sock);
-        // after successfull connection send this command i.e. string_storage to stext server
-        send(stext_sock, initial_command, strlen(initial_command), ZERO);
-        // get file content from client and then use that content
-        while ((file_size = recv(stext_sock, string_storage, string_storage_SIZE, ZERO)) >= ZERO)
+        build_store_key("", document_name, document_location, sizeof(document_location));
+        // a cached copy knows its size, a sized client gets it without the pause before the end message
+        if (sized && (writeback == NULL || writeback_latest(document_location, NULL, NULL) != ZERO) && hot_cache_pin(document_location, &slot_index) == ZERO)
         {
-            // to send it to the stext server
-            send(channel_for_client, string_storage, file_size, ZERO);
-            // break if file contentas been read completely
-            if (file_size < sizeof(string_storage))
-            {
-                break;
-            }
+            long long cached_size = hot_cache_send(channel_for_client, slot_index, sized);
+            snprintf(reply_from_server, sizeof(reply_from_server), "File %s downloaded successfully" DFS_PROTOCOL_FILE_SIZE "\n", document_name, cached_size);
+            send(channel_for_client, reply_from_server, strlen(reply_from_server), ZERO);
+            return;
         }
-        // recieve end message from stext stating evrything went smoothly and then
-        number len = recv(stext_sock, reply_from_server, sizeof(reply_from_server), ZERO);
-        // send that message to client
-        send(channel_for_client, reply_from_server, strlen(reply_from_server), ZERO);
-        // close stext connection
-        close(stext_sock);
-    }
-    // if file type is .pdf then enter spdf
-    else if (strstr(document_name, ".pdf") != NULL)
-    {
-        // here we are initializing pdf socket
-        number spdf_sock;
-        // this is a common function to build the conection
-        link_to_server(PDF_ADDRESS, SPDF_PORT, &spdf_sock);
-        // after successfull connection send this command i.e. string_storage to stext server
-        send(spdf_sock, initial_command, strlen(initial_command), ZERO);
-        // receive file content from client and then use that content
-        while ((file_size = recv(spdf_sock, string_storage, string_storage_SIZE, ZERO)) >= ZERO)
+        // everything else comes framed like for any dfile
+        send_download_size(channel_for_client, sized, -1);
+        // an upload or removal still waiting in the journal is newer than anything the servers have
+        if (writeback_download(channel_for_client, document_name, document_location) == ZERO)
         {
-            // to send it to the spdf server
-            send(channel_for_client, string_storage, file_size, ZERO);
-            // break if file contentas been read completely
-            if (file_size < sizeof(string_storage))
-            {
-                break;
-            }
+            return;
+        }
+        // a server on this host sends the file to the client itself, unless the file may still be on a server which does not own it
+        if ((pool->handoff || route_pool_embedded(pool)) && !rebalance_forwarding() && handoff_to_backend(channel_for_client, pool, document_location, initial_command, ZERO) == ZERO)
+        {
+            return;
+        }
+        // relay the file from the backend to the client, keeping a copy in the cache for the next download
+        number served = relay_download_from_pool(channel_for_client, pool, document_name, initial_command);
+        if (served == -1)
+        {
+            send_file_not_found(channel_for_client, document_name);
+        }
+        else if (served != ZERO)
+        {
+            send_file_unavailable(channel_for_client, document_name);
         }
-        // recieve end message from spdf stating evrything went smoothly and then
-        number len = recv(spdf_sock, reply_from_server, sizeof(reply_from_server), ZERO);
-        // sedn that message to client
-        send(channel_for_client, reply_from_server, sizeof(reply_from_server), ZERO);
-        // close spdf connection
-        close(spdf_sock);
     }
     // if any other file type has been given then state that it is not supported
     else
     {
+        send_download_size(channel_for_client, sized, -1);
         snprintf(reply_from_server, sizeof(reply_from_server), "File %s not supported for this process.\n", document_name);
         printf("File %s not supported for this process.\n", document_name);
         send(channel_for_client, reply_from_server, strlen(reply_from_server), ZERO);
     }
 }
-// function manage_remove_file_from_server for rmfile comamd
-empty_return_function manage_remove_file_from_server(number channel_for_client, character *document_name, character *string_storage)
+// function manage_conditional_download handles cdfile, a dfile for a file the client has a cached copy of with version
+// only the version is looked up, a file which did not change costs one short answer and neither the file nor the pause
+// before the end message of a dfile, any other file is sent like for dfile after a line with its version
+// string_storage is the command as it was read, a sized cdfile gets a sized download
+empty_return_function manage_conditional_download(number channel_for_client, character *document_name, character *version, character *string_storage)
 {
-    // initializing all required variables
-    character reply_from_server[string_storage_SIZE];
-    // if the file type is c them communicate with smain
-    if (strstr(document_name, ".c") != NULL)
+    character cache_key[string_storage_SIZE];
+    character current[FILE_VERSION_SIZE] = FILE_VERSION_UNKNOWN;
+    character line[FILE_VERSION_SIZE * 2];
+    // the download itself is an ordinary dfile, that is the command passed on to the servers
+    character initial_command[string_storage_SIZE];
+    object route_pool *pool = route_lookup(document_name);
+    build_store_key("", document_name, cache_key, sizeof(cache_key));
+    show_on_cmd("Conditional download : Received file: %s version: %s\n", document_name, version);
+    memset(initial_command, ZERO, sizeof(initial_command));
+    snprintf(initial_command, sizeof(initial_command), "dfile %s", document_name);
+    // a file type nobody stores only gets the answer of dfile, without a version (and without a size)
+    if (pool == NULL)
     {
-        // variable to store file location
-        character document_location[string_storage_SIZE];
-        // build document_location out of HOME, docuemnt_name given by client
-        snprintf(document_location, sizeof(document_location), "%s/smain/%s", return_home_value(), document_name);
-        // run remove() operation on it
-        if (remove(document_location) < 0)
-        {
-            snprintf(reply_from_server, sizeof(reply_from_server), "File %s not found.\n", document_name);
-            send(channel_for_client, reply_from_server, strlen(reply_from_server), ZERO);
-        }
-        else
-        {
-            // send() successfull message to client
-            snprintf(reply_from_server, sizeof(reply_from_server), "File %s deleted successfully.\n", document_name);
-            send(channel_for_client, reply_from_server, strlen(reply_from_server), ZERO);
-        }
-        // send() successfull message to client
-        snprintf(reply_from_server, sizeof(reply_from_server), "File %s deleted successfully.\n", document_name);
-        send(channel_for_client, reply_from_server, strlen(reply_from_server), ZERO);
+        manage_download_file_to_server(channel_for_client, document_name, initial_command);
+        return;
     }
-    // Request removal from Stext if the file is .txt
-    if (strstr(document_name, ".txt") != NULL)
+    if (dfs_protocol_sized(string_storage, string_storage_SIZE))
     {
-        // here we are initializing text socket
-        number stext_sock;
-        // this is a common function to build the conection
-        link_to_server(TEXT_ADDRESS, STEXT_PORT, &stext_sock);
-        // after successfull connection send this command i.e. string_storage to stext server
-        send(stext_sock, string_storage, strlen(string_storage), ZERO);
-        // recieve end message from stext stating evrything went smoothly and then
-        number len = recv(stext_sock, reply_from_server, string_storage_SIZE, ZERO);
-        // send that message to client
-        send(channel_for_client, reply_from_server, strlen(reply_from_server), ZERO);
-        // close stext connection
-        close(stext_sock);
+        dfs_protocol_set_sized(initial_command);
     }
-    // if file type is .pdf then enter spdf
-    else if (strstr(document_name, ".pdf") != NULL)
+    if (pool->local)
     {
-        // here we are initializing pdf socket
-        number spdf_sock;
-        // this is a common function to build the conection
-        link_to_server(PDF_ADDRESS, SPDF_PORT, &spdf_sock);
-        // after successfull connection send this command i.e. string_storage to stext server
-        send(spdf_sock, string_storage, strlen(string_storage), ZERO);
-        // recieve end message from spdf stating evrything went smoothly and then
-        number len = recv(spdf_sock, reply_from_server, string_storage_SIZE, ZERO);
-        // send that message to client
-        send(channel_for_client, reply_from_server, strlen(reply_from_server), ZERO);
-        // close spdf connection
-        close(spdf_sock);
+        file_version_of(local_store_fd, cache_key, current, sizeof(current));
     }
-    else {
-        snprintf(reply_from_server, sizeof(reply_from_server), "File %s not supported for this process.\n", document_name);
-        printf("File %s not supported for this process.\n", document_name);
-        send(channel_for_client, reply_from_server, strlen(reply_from_server), ZERO);
+    // an upload or removal still waiting in the journal is newer than any version the servers have
+    else if ((writeback == NULL || writeback_latest(cache_key, NULL, NULL) != ZERO))
+    {
+        pool_file_version(pool, cache_key, current, sizeof(current));
     }
+    if (strcmp(current, FILE_VERSION_UNKNOWN) != ZERO && strcmp(current, version) == ZERO)
+    {
+        show_on_cmd("Conditional download: %s has not changed\n", cache_key);
+        send(channel_for_client, FILE_VERSION_NOT_MODIFIED, strlen(FILE_VERSION_NOT_MODIFIED), ZERO);
+        return;
+    }
+    snprintf(line, sizeof(line), "%s %s\n", FILE_VERSION_REPLY, current);
+    send(channel_for_client, line, strlen(line), ZERO);
+    manage_download_file_to_server(channel_for_client, document_name, initial_command);
 }
-// this function handles the dtar command of the project
-// this takes in the socket desc of the client and the type of file we want to tar
-empty_return_function manage_add_tar_for_file_types_local(number channel_for_client, character *document_type)
+// function manage_stat_request answers stat with a line of size, time, content hash and tier for every path after the command
+// smain looks at its own files itself and asks the servers for theirs with one index request per server,
+// every server gets its request before any answer is read so they all look their files up at the same time
+empty_return_function manage_stat_request(number channel_for_client, character *count_text, character *length_text)
 {
-    // this is a buffer string to add content into it from any file
-    character string_storage[string_storage_SIZE]; // this stores the data that is sent or received via socket
-    FILE *tar_file;                                // this is a pointer to the tar file that we will be making
-    size_t file_size;                              // this var will store the size of the tar file.
-    // this compares the agruement we have put to .c and  if it is true then we enter the if statement
-    if (strcmp(document_type, ".c") == ZERO)
-    {
-        // Now we will handle .c files locally on Smain server
-        // using this system call we will use find and find the c files in server and
-        // then tar file is created which has all the c files
-        system("find ~/smain -name '*.c' | tar -cvf cfiles.tar -T -");
-        tar_file = fopen("cfiles.tar", "rb"); // this opens the tar file in read binary mode and tar file pointe
-    }
-    else if (strcmp(document_type, ".pdf") == ZERO) // this compares the agruement we have put to pdf and  if it is true then we enter the if statement
-    {
-        // Now we will handle pdf files locally on spdf server
-        number spdf_sock;                                   // we are declaring socket descriptor
-        link_to_server(PDF_ADDRESS, SPDF_PORT, &spdf_sock); // this establishes connection to the pdf server
-        // now we send the command to spdf server to create the tar file
-        send(spdf_sock, "dtar .pdf", strlen("dtar .pdf"), ZERO);
-        // now we close the socket descriptor as our work is done
-        close(spdf_sock);
-    }
-    else if (strcmp(document_type, ".txt") == ZERO)
-    {
-        // Now we will handle text files locally on stext server
-        // we are declaring socket descriptor
-        number stext_sock;
-        // this establishes connection to the text server
-        link_to_server(TEXT_ADDRESS, STEXT_PORT, &stext_sock);
-        // Send instruction_from_user to Stext server to create the tar file
-        send(stext_sock, "dtar .txt", strlen("dtar .txt"), ZERO);
-        // close the socket descriptor
-        close(stext_sock);
+    long long length = atoll(length_text);
+    number count = atoi(count_text);
+    character *body = count > ZERO && count <= FILE_STAT_PATHS && length > ZERO && length <= FILE_STAT_MAXIMUM ? malloc(length + 1) : NULL;
+    object stat_lookup *lookups = body != NULL ? calloc(count, sizeof(object stat_lookup)) : NULL;
+    number out_channel = lookups != NULL ? dup(channel_for_client) : -1;
+    FILE *out = out_channel >= ZERO ? fdopen(out_channel, "w") : NULL;
+    show_on_cmd("Stat command : Received %d paths in %lld bytes\n", count, length);
+    if (out == NULL && out_channel >= ZERO)
+    {
+        close(out_channel);
     }
-    else
-    { // if user enters any unsupported file type then this message is printed
-        character *msg = "Unsupported file type\n";
-        send(channel_for_client, msg, strlen(msg), ZERO);
-        // the function then returns ending the execution
+    // paths which are not taken are still read off the connection, they must not be taken for commands
+    if (out == NULL)
+    {
+        discard_request_body(channel_for_client, length);
+        character *reply = "ERROR paths not taken\n" END_OF_LIST;
+        send(channel_for_client, reply, strlen(reply), ZERO);
+        free(body);
+        free(lookups);
         return;
     }
-    // declare a reply_from_server buffer to store the end reply_from_server to send to the client
-    character reply_from_server[string_storage_SIZE];
-    // this formats and stores the buffer in reply_from_server
-    snprintf(reply_from_server, sizeof(reply_from_server), "File uploaded successfully\n");
-    // now we send our reply_from_server to the client
-    send(channel_for_client, reply_from_server, strlen(reply_from_server), ZERO);
-}
-// this function handles the display command
-empty_return_function manage_display_list_document_names_in_folder(number channel_for_client, character *pathname)
+    if (recv_exact(channel_for_client, body, length) != ZERO)
+    {
+        show_on_cmd("Stat command: the paths broke off\n");
+        free(body);
+        free(lookups);
+        fclose(out);
+        return;
+    }
+    body[length] = '\0';
+    number paths = ZERO;
+    for (character *line = body, *end; paths < count && (end = strchr(line, '\n')) != NULL; line = end + 1)
+    {
+        *end = '\0';
+        lookups[paths++].path = line;
+    }
+    for (number i = ZERO; i < paths; i++)
+    {
+        stat_lookup_prepare(&lookups[i]);
+    }
+    // round r asks the r-th server in ring order of every file which was not found before, the first round finds nearly all
+    for (number round = ZERO; round < ROUTE_POOL_BACKENDS && stat_lookup_round(lookups, paths, round) > ZERO; round++)
+    {
+    }
+    for (number i = ZERO; i < paths; i++)
+    {
+        object stat_lookup *lookup = &lookups[i];
+        if (lookup->state == 1)
+        {
+            fprintf(out, FILE_STAT_LINE, lookup->stat.size, (long long)lookup->stat.mtime.tv_sec, lookup->stat.hash, lookup->stat.tier, lookup->path);
+        }
+        else
+        {
+            fprintf(out, FILE_STAT_NOT_STORED, lookup->path);
+        }
+        free(lookup->key);
+    }
+    fputs(END_OF_LIST, out);
+    fclose(out);
+    free(body);
+    free(lookups);
+}
+// this function routes one path of a stat request, a file of smain itself or one waiting in the journal is looked up right away
+// for any other file it leaves the servers to ask in lookup->order
+empty_return_function stat_lookup_prepare(object stat_lookup *lookup)
+{
+    character cache_key[string_storage_SIZE];
+    lookup->state = -1;
+    lookup->pool = route_lookup(lookup->path);
+    build_store_key("", lookup->path, cache_key, sizeof(cache_key));
+    if (lookup->pool == NULL || (lookup->key = strdup(cache_key)) == NULL)
+    {
+        return;
+    }
+    if (lookup->pool->local)
+    {
+        number known = local_paths == NULL || membership_filter_may_contain(local_paths, cache_key);
+        lookup->state = known && file_stat_of(local_store_fd, cache_key, &lookup->stat) == ZERO ? 1 : -1;
+        return;
+    }
+    // an upload or removal still waiting in the journal is newer than anything the servers have
+    number journal = writeback_file_stat(cache_key, &lookup->stat);
+    if (journal >= ZERO)
+    {
+        lookup->state = journal == ZERO ? 1 : -1;
+        return;
+    }
+    lookup->asked = route_backends_for(lookup->pool, cache_key, lookup->order);
+    // other servers than the copies may only have the file while the rebalancer moves files
+    if (!rebalance_forwarding() && lookup->asked > route_replica_count(lookup->pool))
+    {
+        lookup->asked = route_replica_count(lookup->pool);
+    }
+    lookup->state = lookup->asked > ZERO ? ZERO : -1;
+}
+// this function asks the round-th server in ring order of every file which was not found yet, with one index request
+// per server, a server which is down or whose membership filter rules the file out is left for the next round
+// returns how many files are still looked for after this round
+number stat_lookup_round(object stat_lookup *lookups, number count, number round)
+{
+    object stat_batch batches[ROUTE_POOL_SLOTS * ROUTE_POOL_BACKENDS];
+    number batch_count = ZERO;
+    number left = ZERO;
+    for (number i = ZERO; i < count; i++)
+    {
+        object stat_lookup *lookup = &lookups[i];
+        if (lookup->state != ZERO)
+        {
+            continue;
+        }
+        if (round >= lookup->asked)
+        {
+            lookup->state = -1;
+            continue;
+        }
+        object route_backend *backend = &lookup->pool->backends[lookup->order[round]];
+        if (!backend_healthy(backend->ip, backend->port) || backend_filter_rules_out(backend->ip, backend->port, lookup->key))
+        {
+            continue;
+        }
+        number b = ZERO;
+        while (b < batch_count && batches[b].backend != backend)
+        {
+            b++;
+        }
+        if (b == batch_count)
+        {
+            memset(&batches[b], ZERO, sizeof(batches[b]));
+            batches[b].backend = backend;
+            batches[b].sock = -1;
+            batch_count++;
+        }
+        if (batches[b].count == batches[b].capacity)
+        {
+            number capacity = batches[b].capacity == ZERO ? 64 : batches[b].capacity * 2;
+            number *grown = realloc(batches[b].lookups, capacity * sizeof(number));
+            if (grown == NULL)
+            {
+                continue;
+            }
+            batches[b].lookups = grown;
+            batches[b].capacity = capacity;
+        }
+        batches[b].lookups[batches[b].count++] = i;
+    }
+    // every server gets its keys before any answer is read, so they look them up side by side
+    for (number b = ZERO; b < batch_count; b++)
+    {
+        stat_batch_send(&batches[b], lookups);
+    }
+    for (number b = ZERO; b < batch_count; b++)
+    {
+        stat_batch_receive(&batches[b], lookups);
+        free(batches[b].lookups);
+    }
+    for (number i = ZERO; i < count; i++)
+    {
+        left += lookups[i].state == ZERO && round + 1 < lookups[i].asked;
+    }
+    return left;
+}
+// this function sends the index request of batch with its keys, batch->sock is the connection to read the answer from
+// or -1 when the server did not take the request
+empty_return_function stat_batch_send(object stat_batch *batch, object stat_lookup *lookups)
+{
+    character command[string_storage_SIZE];
+    character line[string_storage_SIZE];
+    size_t length = ZERO;
+    for (number i = ZERO; i < batch->count; i++)
+    {
+        length += strlen(lookups[batch->lookups[i]].key) + 1;
+    }
+    character *keys = malloc(length);
+    if (keys == NULL)
+    {
+        return;
+    }
+    for (size_t used = ZERO, i = ZERO; i < (size_t)batch->count; i++)
+    {
+        size_t key_length = strlen(lookups[batch->lookups[i]].key);
+        memcpy(keys + used, lookups[batch->lookups[i]].key, key_length);
+        keys[used + key_length] = '\n';
+        used += key_length + 1;
+    }
+    snprintf(command, sizeof(command), "%s %d %zu", FILE_STAT_INDEX, batch->count, length);
+    batch->sock = backend_request(batch->backend, command);
+    if (batch->sock >= ZERO)
+    {
+        // a server which does not know index answers something else, it is up but cannot tell
+        number ready = delta_recv_line(batch->sock, line, sizeof(line)) == ZERO;
+        if (!ready || strcmp(line, FILE_STAT_READY) != ZERO || delta_send_all(batch->sock, keys, length) != ZERO)
+        {
+            close(batch->sock);
+            batch->sock = -1;
+            backend_stats_done(batch->backend, ready ? REQUEST_SUCCEEDED : REQUEST_FAILED);
+        }
+    }
+    free(keys);
+}
+// this function reads the answer to the index request of batch, a file its server has is found,
+// the others stay for the next server in ring order
+empty_return_function stat_batch_receive(object stat_batch *batch, object stat_lookup *lookups)
+{
+    character *line = NULL;
+    size_t line_size = ZERO;
+    number answered = ZERO;
+    FILE *in = batch->sock >= ZERO ? fdopen(batch->sock, "r") : NULL;
+    if (in == NULL)
+    {
+        if (batch->sock >= ZERO)
+        {
+            close(batch->sock);
+            backend_stats_done(batch->backend, REQUEST_FAILED);
+        }
+        return;
+    }
+    while (answered < batch->count && getline(&line, &line_size, in) > ZERO)
+    {
+        object stat_lookup *lookup = &lookups[batch->lookups[answered++]];
+        if (file_stat_read(line, &lookup->stat) == ZERO)
+        {
+            lookup->state = 1;
+        }
+    }
+    // END_OF_LIST closes the answer
+    number complete = answered == batch->count && getline(&line, &line_size, in) > ZERO && strcmp(line, END_OF_LIST) == ZERO;
+    free(line);
+    fclose(in);
+    backend_stats_done(batch->backend, complete ? REQUEST_SUCCEEDED : REQUEST_FAILED);
+}
+// this function reads length bytes which follow a command off the connection when the command is not served,
+// so they are not taken for the next commands
+empty_return_function discard_request_body(number channel_for_client, long long length)
+{
+    character discarded[string_storage_SIZE];
+    for (long long left = length > ZERO ? length : ZERO; left > ZERO;)
+    {
+        ssize_t got = recv(channel_for_client, discarded, left < (long long)sizeof(discarded) ? left : (long long)sizeof(discarded), ZERO);
+        if (got <= ZERO)
+        {
+            break;
+        }
+        left -= got;
+    }
+}
+// this function asks the servers of pool for the version of cache_key, the copies in ring order so the same server
+// answers every time while it is up, the copies of a replicated file are written at different times and so have different versions
+// returns ZERO with the version filled in, or -1 when no server answered with one
+number pool_file_version(object route_pool *pool, constant character *cache_key, character *version, size_t version_size)
+{
+    character command[string_storage_SIZE];
+    character line[string_storage_SIZE];
+    number order[ROUTE_POOL_BACKENDS];
+    number count = route_backends_for(pool, cache_key, order);
+    // other servers than the copies may only have the file while the rebalancer moves files
+    number asked = rebalance_forwarding() ? count : route_replica_count(pool);
+    snprintf(command, sizeof(command), "%s %s", FILE_VERSION_COMMAND, cache_key);
+    for (number i = ZERO; i < count && i < asked; i++)
+    {
+        object route_backend *backend = &pool->backends[order[i]];
+        number backend_sock;
+        if (!backend_healthy(backend->ip, backend->port) || backend_filter_rules_out(backend->ip, backend->port, cache_key))
+        {
+            continue;
+        }
+        if ((backend_sock = backend_request(backend, command)) < ZERO)
+        {
+            continue;
+        }
+        number answered = recv_line(backend_sock, line, sizeof(line)) == ZERO;
+        close(backend_sock);
+        backend_stats_done(backend, answered ? REQUEST_SUCCEEDED : REQUEST_FAILED);
+        if (answered && strncmp(line, FILE_VERSION_REPLY " ", strlen(FILE_VERSION_REPLY) + 1) == ZERO)
+        {
+            snprintf(version, version_size, "%s", line + strlen(FILE_VERSION_REPLY) + 1);
+            return ZERO;
+        }
+    }
+    return -1;
+}
+// function manage_remove_file_from_server for rmfile comamd
+empty_return_function manage_remove_file_from_server(number channel_for_client, character *document_name, character *string_storage)
+{
+    // initializing all required variables
+    character reply_from_server[string_storage_SIZE];
+    // the routing table tells from the extension where this file is stored
+    object route_pool *pool = route_lookup(document_name);
+    // files of the local pool (like .c) are removed by smain itself
+    if (pool != NULL && pool->local)
+    {
+        // variable to store file location
+        character document_location[string_storage_SIZE];
+        // build document_location as the key of the file inside ~/smain
+        build_store_key("", document_name, document_location, sizeof(document_location));
+        // a path the membership filter has never seen is not stored, otherwise run unlinkat() on it relative to ~/smain
+        number known = local_paths == NULL || membership_filter_may_contain(local_paths, document_location);
+        if (!known || unlinkat(local_store_fd, document_location, ZERO) < 0)
+        {
+            snprintf(reply_from_server, sizeof(reply_from_server), "File %s not found.\n", document_name);
+            send(channel_for_client, reply_from_server, strlen(reply_from_server), ZERO);
+        }
+        else
+        {
+            // the path is not stored anymore and open copies of the file kept by any client process are stale now
+            if (local_paths != NULL)
+            {
+                membership_filter_remove(local_paths, document_location);
+            }
+            tiering_forget(&local_tiers, document_location);
+            local_store_changed();
+            // send() successfull message to client
+            snprintf(reply_from_server, sizeof(reply_from_server), "File %s deleted successfully.\n", document_name);
+            send(channel_for_client, reply_from_server, strlen(reply_from_server), ZERO);
+        }
+    }
+    // every other routed file is removed from the servers of its pool which keep a copy
+    else if (pool != NULL)
+    {
+        character document_location[string_storage_SIZE];
+        number unreached = ZERO;
+        build_store_key("", document_name, document_location, sizeof(document_location));
+        // a removal of a file whose upload still waits in the journal has to wait behind it
+        if (writeback_remove(channel_for_client, document_name, document_location, string_storage) == ZERO)
+        {
+            return;
+        }
+        remove_from_pool(pool, document_name, string_storage, reply_from_server, sizeof(reply_from_server), &unreached);
+        send(channel_for_client, reply_from_server, strlen(reply_from_server), ZERO);
+    }
+    else {
+        snprintf(reply_from_server, sizeof(reply_from_server), "File %s not supported for this process.\n", document_name);
+        printf("File %s not supported for this process.\n", document_name);
+        send(channel_for_client, reply_from_server, strlen(reply_from_server), ZERO);
+    }
+}
+// this function handles the dtar command of the project
+// this takes in the socket desc of the client and the type of file we want to tar
+empty_return_function manage_add_tar_for_file_types_local(number channel_for_client, character *document_type)
 {
     // this is a buffer string to add content into it from any file
-    character string_storage[string_storage_SIZE];
-    // Large string_storage to store the combined list
-    character file_list[string_storage_SIZE * 10] = "";
-    // pipe is pointing to a file object
-    FILE *pipe;
-    size_t file_size;             // declaring file size var
-    number spdf_sock, stext_sock; // declaring socket descriptors
+    character string_storage[string_storage_SIZE]; // this stores the data that is sent or received via socket
+    // the routing table tells which pool stores this type of file
+    object route_pool *pool = route_lookup_extension(document_type);
+    // if the type is stored locally then we enter the if statement
+    if (pool != NULL && pool->local)
+    {
+        // Now we will handle these files locally on Smain server
+        // using this system call we will use find and find the files in server and
+        // then tar file is created which has all of them, like cfiles.tar for .c
+        // tar reads the files itself, so the cold ones are brought back first
+        tiering_promote_all(&local_tiers, extension_match, document_type);
+        snprintf(string_storage, sizeof(string_storage), "find ~/smain -name '*%s' | tar -cvf %sfiles.tar -T -", document_type, document_type + 1);
+        system(string_storage);
+    }
+    else if (pool != NULL) // every other routed type is tarred by the servers of its pool
+    {
+        // each server of the pool holds a part of the files, so all of them are asked
+        for (number i = ZERO; i < pool->backend_count; i++)
+        {
+            number backend_sock;                                                     // we are declaring socket descriptor
+            // this establishes connection to the backend server, one which is down is left out
+            if (!backend_healthy(pool->backends[i].ip, pool->backends[i].port) || link_to_server(pool->backends[i].ip, pool->backends[i].port, &backend_sock) != ZERO)
+            {
+                continue;
+            }
+            // now we send the command to the backend server to create the tar file
+            snprintf(string_storage, sizeof(string_storage), "dtar %s", document_type);
+            send(backend_sock, string_storage, strlen(string_storage), ZERO);
+            // now we close the socket descriptor as our work is done
+            close(backend_sock);
+        }
+    }
+    else
+    { // if user enters any unsupported file type then this message is printed
+        character *msg = "Unsupported file type\n";
+        send(channel_for_client, msg, strlen(msg), ZERO);
+        // the function then returns ending the execution
+        return;
+    }
+    // declare a reply_from_server buffer to store the end reply_from_server to send to the client
+    character reply_from_server[string_storage_SIZE];
+    // this formats and stores the buffer in reply_from_server
+    snprintf(reply_from_server, sizeof(reply_from_server), "File uploaded successfully\n");
+    // now we send our reply_from_server to the client
+    send(channel_for_client, reply_from_server, strlen(reply_from_server), ZERO);
+}
+// this function handles the display command
+// the local find and every backend server are asked at the same time and their names are passed on to the client
+// as they arrive, so display takes as long as its slowest source and not as long as all of them together
+// the client reads names until END_OF_LIST
+empty_return_function manage_display_list_document_names_in_folder(number channel_for_client, character *pathname)
+{
+    // one source for the local files and one for every server which can be asked
+    number capacity = 1 + route_pool_count * ROUTE_POOL_BACKENDS;
+    object listing_source *sources = calloc(capacity, sizeof(object listing_source));
+    object pollfd *waiting = calloc(capacity, sizeof(object pollfd));
+    object name_set sent_names = {NULL, ZERO, ZERO};
+    number source_count = ZERO;
+    unsigned long names = ZERO;
+    // the names are written through a stdio stream which is flushed after every round, so they leave in big packets
+    number out_channel = dup(channel_for_client);
+    FILE *out = out_channel >= ZERO ? fdopen(out_channel, "w") : NULL;
     // this will print the received pathname from client
     show_on_cmd("Display command : Received pathname: %s\n", pathname);
-    // Step 1: Check if the directory exists locally for .c files
-    character local_path[string_storage_SIZE];
-    snprintf(local_path, sizeof(local_path), "%s/smain/%s", return_home_value(), pathname);
-    object stat st;
-    // check if directory exists
-
-    // file_size, file_name, file_type
-    if (stat(local_path, &st) == ZERO && S_ISDIR(st.st_mode))
-    {
-        // Directory exists, proceed to find .c files
-        character instruction_from_user[string_storage_SIZE];
-        // build the path and find the files in that folder/directory that are files
-        snprintf(instruction_from_user, sizeof(instruction_from_user), "find %s/smain/%s -type f -name '*.c'", return_home_value(), pathname);
-        // print that now we are executing the command
-        show_on_cmd("Display command: Executing instruction_from_user: %s\n", instruction_from_user);
-        // craetes the pipe and output of the find is written into this pipe
-        pipe = popen(instruction_from_user, "r");
-        if (pipe)
-        {
-            // read from the pipe using fgets and do the steps
-            while (fgets(string_storage, sizeof(string_storage), pipe) != NULL)
-            {
-                string_storage[strcspn(string_storage, "\n")] = ZERO;               // Remove newline characteracter
-                character *document_name = basename(string_storage);                // Extract the file name
-                show_on_cmd("Display command: Found .c file: %s\n", document_name); // print the found files
-                // append to the file_list the file names that we have found
-                strncat(file_list, document_name, sizeof(file_list) - strlen(file_list) - 1);
-                strncat(file_list, "\n", sizeof(file_list) - strlen(file_list) - 1);
-            }
-            pclose(pipe); // close pipe
+    if (sources == NULL || waiting == NULL || out == NULL)
+    {
+        perror("display");
+        if (out != NULL)
+        {
+            fclose(out);
         }
-        else
+        else if (out_channel >= ZERO)
         {
-            perror("popen failed for smain");
+            close(out_channel);
         }
+        send(channel_for_client, END_OF_LIST, strlen(END_OF_LIST), ZERO);
+        free(sources);
+        free(waiting);
+        return;
     }
-    else
-    { // if directory not found print this
-        show_on_cmd("Display command: Directory %s not found in smain\n", local_path);
+    // Step 1: start the find over ~/smain and send display to every backend server, each server once
+    if (start_local_listing(&sources[source_count], pathname) == ZERO)
+    {
+        source_count++;
     }
-    // Step 2: Communicate with Spdf server to get the list of .pdf files
-    // connect to the pdf server
-    link_to_server(PDF_ADDRESS, SPDF_PORT, &spdf_sock);
-    // build the arguement string
-    snprintf(string_storage, sizeof(string_storage), "display %s", pathname);
-    // send the command to the spdf server
-    send(spdf_sock, string_storage, strlen(string_storage), ZERO);
-    // print on the server if send was successfully
-    show_on_cmd("Display command: Sent display command to Spdf server\n");
-    // var to keep count if we receive anything from spdf server
-    // this is for the case if directory does not exist in the spdf server
-    number received_anything_spdf = ZERO;
-    // to receive from the server
-    while ((file_size = recv(spdf_sock, string_storage, sizeof(string_storage) - 1, ZERO)) > ZERO)
-    {
-        // to make sure its null terminated
-        string_storage[file_size] = '\0';
-        // checks if directory empty
-        if (strcmp(string_storage, "DIRECTORY_NOT_FOUND\n") == ZERO)
-        {
-            show_on_cmd("Display command: Directory not found on Spdf for %s\n", pathname);
-            break; // break from the loop
-        }
-        // this means we have receieved files from the server
-        received_anything_spdf = 1;
-        // tokenize the string so that we get the file names properly
-        character *line = strtok(string_storage, "\n");
-        while (line != NULL)
-        {
-            character *document_name = basename(line);                                         // Extract the file name from the path
-            show_on_cmd("Display command: Received .pdf file from Spdf: %s\n", document_name); // print the files receieved
-            // append to the file_list the name pdf files
-            strncat(file_list, document_name, sizeof(file_list) - strlen(file_list) - 1);
-            strncat(file_list, "\n", sizeof(file_list) - strlen(file_list) - 1);
-            line = strtok(NULL, "\n");
-            // if we reach the end of file then break from loop
-            if (file_size < sizeof(string_storage))
+    for (number i = ZERO; i < route_pool_count; i++)
+    {
+        for (number j = ZERO; j < route_pools[i].backend_count; j++)
+        {
+            // the servers of a replicated pool hold the same files, each file is listed once
+            if (route_backend_is_first(i, j) && start_backend_listing(&sources[source_count], &route_pools[i].backends[j], pathname, route_pools[i].replicas > 1) == ZERO)
             {
-                show_on_cmd("End of file detected\n");
-                break; // End of file
+                source_count++;
             }
         }
-        break;
     }
-    close(spdf_sock); // close the socket
-    if (received_anything_spdf == ZERO)
+    // Step 2: pass the names on in whatever order the sources answer
+    number open_sources = source_count;
+    while (open_sources > ZERO)
     {
-        show_on_cmd("Display command: No .pdf files received from Spdf for %s\n", pathname);
-    }
-    // Step 3: Communicate with Stext server to get the list of .txt files
-    // connect to the text server
-    link_to_server(TEXT_ADDRESS, STEXT_PORT, &stext_sock);
-    memset(string_storage, ZERO, string_storage_SIZE); 
-    // build the arguement string
-    snprintf(string_storage, sizeof(string_storage), "display %s", pathname);
-    // send the command to the text server
-    send(stext_sock, string_storage, strlen(string_storage), ZERO);
-    // print on the server if send was successfully
-    show_on_cmd("Display command: Sent display command to Stext server\n");
-    // var to keep count if we receive anything from stext server
-    // this is for the case if directory does not exist in the stext server
-    number received_anything_stext = ZERO;
-    // to receive from the server
-    while ((file_size = recv(stext_sock, string_storage, sizeof(string_storage) - 1, ZERO)) > ZERO)
-    {
-        // to make sure its null terminated
-        string_storage[file_size] = '\0';
-        // checks if directory empty
-        if (strcmp(string_storage, "DIRECTORY_NOT_FOUND\n") == ZERO)
-        {
-            show_on_cmd("Display command: Directory not found on Stext for %s\n", pathname);
-            break; // break from the loop
-        }
-        // var to keep count if we receive anything from stext server
-        // this is for the case if directory does not exist in the stext server
-        received_anything_stext = 1;
-        // tokenize the string so that we get the file names properly
-        character *line = strtok(string_storage, "\n");
-        while (line != NULL)
-        {
-            character *document_name = basename(line); // Extract the file name
-            show_on_cmd("manage_display_list_document_names_in_folder: Received .txt file from Stext: %s\n", document_name);
-            // append to the file_list the name text files
-            strncat(file_list, document_name, sizeof(file_list) - strlen(file_list) - 1);
-            strncat(file_list, "\n", sizeof(file_list) - strlen(file_list) - 1);
-            line = strtok(NULL, "\n");
-            // if we reach the end of file then break from loop
-            if (file_size < sizeof(string_storage))
+        for (number i = ZERO; i < source_count; i++)
+        {
+            // poll() leaves out the sources which are finished, their descriptor is -1
+            waiting[i].fd = sources[i].fd;
+            waiting[i].events = POLLIN;
+            waiting[i].revents = ZERO;
+        }
+        number ready = poll(waiting, source_count, BACKEND_IO_TIMEOUT_SECONDS * 1000);
+        if (ready < ZERO && errno == EINTR)
+        {
+            continue;
+        }
+        if (ready <= ZERO)
+        {
+            show_on_cmd("Display command: %d sources did not finish their list in time\n", open_sources);
+            break;
+        }
+        for (number i = ZERO; i < source_count; i++)
+        {
+            if (waiting[i].revents != ZERO && read_listing_source(&sources[i], out, &sent_names, &names) != ZERO)
             {
-                show_on_cmd("End of file detected\n");
-                break; // End of file
+                finish_listing_source(&sources[i]);
+                open_sources--;
             }
         }
-        break;
+        fflush(out);
     }
-    close(stext_sock); // close socket
-    if (received_anything_stext == ZERO)
+    for (number i = ZERO; i < source_count; i++)
     {
-        show_on_cmd("Display command: No .txt files received from Stext for %s\n", pathname);
+        finish_listing_source(&sources[i]);
     }
-    // Step 4: Send the combined list back to the client
-    if (strlen(file_list) > 0)
+    // Step 3: end the list for the client
+    if (names == ZERO)
     {
-        show_on_cmd("Display command: Sending combined file list to client:\n%s", file_list);
-        send(channel_for_client, file_list, strlen(file_list), ZERO);
+        fputs("Display command: No files were found.\n", out);
     }
-    else {
-        send(channel_for_client, "Display command: No files were found.", strlen("Display command: No files were found."), ZERO);
+    fputs(END_OF_LIST, out);
+    fclose(out);
+    show_on_cmd("Display command: Sent %lu names for %s\n", names, pathname);
+    name_set_free(&sent_names);
+    free(sources);
+    free(waiting);
+}
+// this function starts the find over the local files of pathname, returns ZERO or -1 when there is nothing to list
+number start_local_listing(object listing_source *source, character *pathname)
+{
+    character local_path[string_storage_SIZE];
+    object stat st;
+    if (snprintf(local_path, sizeof(local_path), "%s/smain/%s", return_home_value(), pathname) >= (number)sizeof(local_path))
+    {
+        show_on_cmd("Display command: Path %s is too long\n", pathname);
+        return -1;
+    }
+    // the find expression matches every extension routed to the local pool, like -name '*.c'
+    // there is room for " -o -name '*<extension>'" of every route
+    character name_patterns[ROUTE_TABLE_SLOTS * (ROUTE_EXTENSION_SIZE + 16)] = "";
+    for (number i = ZERO; i < ROUTE_TABLE_SLOTS; i++)
+    {
+        if (route_table[i].pool >= ZERO && route_pools[route_table[i].pool].local)
+        {
+            size_t used = strlen(name_patterns);
+            snprintf(name_patterns + used, sizeof(name_patterns) - used, "%s-name '*%s'", used > ZERO ? " -o " : "", route_table[i].extension);
+        }
+    }
+    // check if directory exists
+    if (name_patterns[ZERO] == '\0' || stat(local_path, &st) != ZERO || !S_ISDIR(st.st_mode))
+    {
+        show_on_cmd("Display command: Directory %s not found in smain\n", local_path);
+        return -1;
+    }
+    // build the path and find the files in that folder/directory that are files
+    character instruction_from_user[sizeof(local_path) + sizeof(name_patterns) + 32];
+    snprintf(instruction_from_user, sizeof(instruction_from_user), "find %s -type f \\( %s \\)", local_path, name_patterns);
+    show_on_cmd("Display command: Executing instruction_from_user: %s\n", instruction_from_user);
+    // the output of the find is read from this pipe together with the answers of the servers
+    source->find = popen(instruction_from_user, "r");
+    if (source->find == NULL)
+    {
+        perror("popen failed for smain");
+        return -1;
     }
+    source->fd = fileno(source->find);
+    source->backend = NULL;
+    source->deduplicate = ZERO;
+    source->pending_length = ZERO;
+    return ZERO;
 }
-// this function establishes connection with the server
-empty_return_function link_to_server(constant character *ip, number port, number *sock)
+// this function sends display for pathname to one backend server, returns ZERO or -1 when the server cannot be reached
+// with deduplicate a name which has been sent already is not sent again
+number start_backend_listing(object listing_source *source, object route_backend *backend, character *pathname, number deduplicate)
 {
-    // make socket structure
-    object sockaddr_in server_channel_address;
-
-    // make socket here - TCP/IP socket
-    if ((*sock = socket(AF_INET, SOCK_STREAM, ZERO)) < ZERO)
+    character string_storage[string_storage_SIZE];
+    number backend_sock;
+    // connect to the backend server, the files of a server which is down are left out of the list
+    if (!backend_healthy(backend->ip, backend->port) || link_to_server(backend->ip, backend->port, &backend_sock) != ZERO)
     {
-        perror("Socket creation error");
-        exit(EXIT_FAILURE);
+        show_on_cmd("Display command: %s:%d cannot be reached, its files are not listed\n", backend->ip, backend->port);
+        return -1;
     }
-
-    // set up server address
-    server_channel_address.sin_family = AF_INET; // ipv4 address family
-    // this converts the port number from host byte order to network byte order
-    
-    server_channel_address.sin_port = htons(port);
-    // this function converts the IP address from text to binary form and stores it in sin_addr structure
-    if (inet_pton(AF_INET, ip, &server_channel_address.sin_addr) <= ZERO)
+    // build the arguement string and send the command to the backend server
+    snprintf(string_storage, sizeof(string_storage), "display %s", pathname);
+    if (send(backend_sock, string_storage, strlen(string_storage), ZERO) < ZERO)
     {
-        perror("Invalid address");
-        exit(EXIT_FAILURE);
+        close(backend_sock);
+        return -1;
     }
-
-    // connect the socket here
-    if (connect(*sock, (object sockaddr *)&server_channel_address, sizeof(server_channel_address)) < ZERO)
+    show_on_cmd("Display command: Sent display command to %s:%d\n", backend->ip, backend->port);
+    source->fd = backend_sock;
+    source->find = NULL;
+    source->backend = backend;
+    source->deduplicate = deduplicate;
+    source->pending_length = ZERO;
+    return ZERO;
+}
+// this function reads what the source has sent and writes every complete name to out
+// returns ZERO while more is to come, and 1 once the source has ended its list or closed
+number read_listing_source(object listing_source *source, FILE *out, object name_set *sent_names, unsigned long *names)
+{
+    ssize_t got = read(source->fd, source->pending + source->pending_length, sizeof(source->pending) - 1 - source->pending_length);
+    if (got <= ZERO)
     {
-        perror("Connection failed");
-        exit(EXIT_FAILURE);
+        return 1;
+    }
+    source->pending_length += got;
+    character *line = source->pending;
+    character *end;
+    while ((end = memchr(line, '\n', source->pending + source->pending_length - line)) != NULL)
+    {
+        // a backend ends its answer with END_OF_LIST, the find just closes its pipe
+        if ((size_t)(end - line + 1) == strlen(END_OF_LIST) && strncmp(line, END_OF_LIST, end - line + 1) == ZERO)
+        {
+            return 1;
+        }
+        *end = '\0';
+        if (strcmp(line, "DIRECTORY_NOT_FOUND") == ZERO)
+        {
+            show_on_cmd("Display command: Directory not found on %s:%d\n", source->backend->ip, source->backend->port);
+        }
+        else if (line[ZERO] != '\0')
+        {
+            // the servers send the path below the listed folder, the copies of a replicated pool have the same one
+            if (!source->deduplicate || name_set_add(sent_names, line))
+            {
+                character *document_name = basename(line); // Extract the file name from the path
+                fprintf(out, "%s\n", document_name);
+                (*names)++;
+            }
+        }
+        line = end + 1;
+    }
+    // the start of the next name is kept for the next read, a line which fills the whole buffer is no file name
+    source->pending_length -= line - source->pending;
+    memmove(source->pending, line, source->pending_length);
+    if (source->pending_length == sizeof(source->pending) - 1)
+    {
+        source->pending_length = ZERO;
+    }
+    return ZERO;
+}
+// this function closes the pipe or the socket of a source
+empty_return_function finish_listing_source(object listing_source *source)
+{
+    if (source->fd < ZERO)
+    {
+        return;
+    }
+    if (source->find != NULL)
+    {
+        pclose(source->find);
+    }
+    else
+    {
+        close(source->fd);
+    }
+    source->fd = -1;
+}
+// this function adds name to the set and returns 1 when it was not in there yet, ZERO when it was
+// the set doubles when it is half full, so it holds any number of names
+number name_set_add(object name_set *set, constant character *name)
+{
+    unsigned int h1, h2;
+    if ((set->used + 1) * 2 > set->capacity)
+    {
+        size_t bigger = set->capacity == ZERO ? 256 : set->capacity * 2;
+        character **grown = calloc(bigger, sizeof(character *));
+        // without memory the name is sent, a name twice is better than a name missing
+        if (grown == NULL)
+        {
+            return 1;
+        }
+        for (size_t i = ZERO; i < set->capacity; i++)
+        {
+            if (set->slots[i] != NULL)
+            {
+                membership_filter_hash(set->slots[i], &h1, &h2);
+                size_t slot = h1 & (bigger - 1);
+                while (grown[slot] != NULL)
+                {
+                    slot = (slot + 1) & (bigger - 1);
+                }
+                grown[slot] = set->slots[i];
+            }
+        }
+        free(set->slots);
+        set->slots = grown;
+        set->capacity = bigger;
+    }
+    membership_filter_hash(name, &h1, &h2);
+    size_t slot = h1 & (set->capacity - 1);
+    while (set->slots[slot] != NULL)
+    {
+        if (strcmp(set->slots[slot], name) == ZERO)
+        {
+            return ZERO;
+        }
+        slot = (slot + 1) & (set->capacity - 1);
+    }
+    set->slots[slot] = strdup(name);
+    set->used += set->slots[slot] != NULL;
+    return 1;
+}
+// this function frees every name of the set
+empty_return_function name_set_free(object name_set *set)
+{
+    for (size_t i = ZERO; i < set->capacity; i++)
+    {
+        free(set->slots[i]);
+    }
+    free(set->slots);
+    set->slots = NULL;
+    set->capacity = ZERO;
+    set->used = ZERO;
+}
+// function manage_page_request sends the files of pathname after cursor, sorted by path, one "path size mtime" line each
+// a page stays the same size however big the folder is, so neither smain nor the client holds more than one page
+// when more files follow, the page ends with "NEXT <cursor>" and the client sends page again with that cursor
+empty_return_function manage_page_request(number channel_for_client, character *pathname, character *cursor)
+{
+    character after[string_storage_SIZE];
+    object listing_entry *entries = NULL;
+    number more = ZERO;
+    number unique = -1;
+    number out_channel = dup(channel_for_client);
+    FILE *out = out_channel >= ZERO ? fdopen(out_channel, "w") : NULL;
+    show_on_cmd("Page command : Received pathname: %s cursor: %s\n", pathname, cursor);
+    if (out != NULL && listing_cursor_decode(cursor, after, sizeof(after)) == ZERO)
+    {
+        unique = collect_folder_page(pathname, cursor, after, &entries, &more);
+    }
+    if (unique < ZERO)
+    {
+        show_on_cmd("Page command: cannot list %s after cursor %s\n", pathname, cursor);
+        if (out != NULL)
+        {
+            fclose(out);
+        }
+        else if (out_channel >= ZERO)
+        {
+            close(out_channel);
+        }
+        send(channel_for_client, END_OF_LIST, strlen(END_OF_LIST), ZERO);
+        return;
+    }
+    number sent = unique < LISTING_PAGE_SIZE ? unique : LISTING_PAGE_SIZE;
+    for (number i = ZERO; i < sent; i++)
+    {
+        fprintf(out, "%s %lld %lld\n", entries[i].path, entries[i].size, entries[i].mtime);
+    }
+    if (more && sent > ZERO)
+    {
+        // the cursor has to fit into one command of the client, twice the path in hex plus "page" and the folder
+        character next[string_storage_SIZE];
+        if (strlen(pathname) + 8 < sizeof(next) && listing_cursor_encode(entries[sent - 1].path, next, sizeof(next) - strlen(pathname) - 8) == ZERO)
+        {
+            fprintf(out, "NEXT %s\n", next);
+        }
+        else
+        {
+            show_on_cmd("Page command: path %s is too long for a cursor, the listing of %s ends here\n", entries[sent - 1].path, pathname);
+        }
+    }
+    fputs(END_OF_LIST, out);
+    fclose(out);
+    show_on_cmd("Page command: Sent %d files of %s%s\n", sent, pathname, more ? ", more follow" : "");
+    free_folder_page(entries, unique);
+}
+// this function collects the page of pathname after cursor (after is the same cursor decoded) from ~/smain and every server
+// every server is asked for its own first page after the cursor and the smallest LISTING_PAGE_SIZE paths of all of them
+// are the page, only those are complete, so callers use no more than the first LISTING_PAGE_SIZE entries
+// returns the number of entries in *entries, sorted by path and without duplicates, or -1 when memory ran out
+// *more is set when files follow the page
+number collect_folder_page(character *pathname, constant character *cursor, constant character *after, object listing_entry **entries, number *more)
+{
+    // every server answers one page at most, the local one is the first
+    number capacity = (1 + route_pool_count * ROUTE_POOL_BACKENDS) * LISTING_PAGE_SIZE;
+    object listing_entry *collected = calloc(capacity, sizeof(object listing_entry));
+    number *backend_socks = calloc(route_pool_count * ROUTE_POOL_BACKENDS + 1, sizeof(number));
+    number backend_count = ZERO, count = ZERO;
+    *more = ZERO;
+    *entries = NULL;
+    if (collected == NULL || backend_socks == NULL)
+    {
+        free(collected);
+        free(backend_socks);
+        return -1;
+    }
+    // Step 1: ask every backend server first, each server once, so they walk their folders while smain walks its own
+    for (number i = ZERO; i < route_pool_count; i++)
+    {
+        for (number j = ZERO; j < route_pools[i].backend_count; j++)
+        {
+            number backend_sock = route_backend_is_first(i, j) ? request_backend_page(&route_pools[i].backends[j], pathname, (character *)cursor) : -1;
+            if (backend_sock >= ZERO)
+            {
+                backend_socks[backend_count++] = backend_sock;
+            }
+        }
+    }
+    // Step 2: the page of ~/smain, only files of the local pool are listed like display does
+    number folder_fd = listing_page_open_folder(local_store_fd, pathname);
+    if (folder_fd >= ZERO)
+    {
+        object listing_page *page = malloc(sizeof(object listing_page));
+        if (page != NULL)
+        {
+            listing_page_collect(page, folder_fd, after, local_page_match, NULL);
+            // a file in the cold tier is listed with its own size and time and not with those of its stub
+            for (number i = ZERO; i < page->count; i++)
+            {
+                number file = page->entries[i].size <= TIERING_STUB_MAXIMUM ? openat(folder_fd, page->entries[i].path, O_RDONLY | O_CLOEXEC) : -1;
+                long long size = file >= ZERO ? tiering_stub_size(file, &page->entries[i].mtime) : -1;
+                if (size >= ZERO)
+                {
+                    page->entries[i].size = size;
+                }
+                if (file >= ZERO)
+                {
+                    close(file);
+                }
+            }
+            // the paths move over to collected and are freed with them
+            memcpy(collected, page->entries, page->count * sizeof(object listing_entry));
+            count = page->count;
+            *more = page->more;
+            free(page);
+        }
+        close(folder_fd);
+    }
+    // Step 3: the pages of the servers, a server which breaks off is left out of this page
+    for (number i = ZERO; i < backend_count; i++)
+    {
+        read_backend_page(backend_socks[i], collected, &count, more);
+    }
+    free(backend_socks);
+    // Step 4: merge, a file of a replicated pool comes from several servers and is kept once
+    number unique = listing_page_merge(collected, count);
+    // each server sent its smallest paths, so the smallest LISTING_PAGE_SIZE of all of them are the smallest of the whole folder
+    if (unique > LISTING_PAGE_SIZE)
+    {
+        *more = 1;
+    }
+    *entries = collected;
+    return unique;
+}
+// this function frees a page made by collect_folder_page()
+empty_return_function free_folder_page(object listing_entry *entries, number count)
+{
+    for (number i = ZERO; i < count; i++)
+    {
+        free(entries[i].path);
+    }
+    free(entries);
+}
+// function manage_sync_request compares the files of a client's folder with the files stored below pathname
+// the command is followed by manifest_size bytes of "path size mtime" lines, one for every file of the client, path relative to its folder
+// the manifest and the stored files are walked in path order side by side, the stored ones a page at a time like page does,
+// so every server lists the folder once and smain holds the manifest and one page
+// the answer has a line for every file which differs and ends with END_OF_LIST:
+//   SEND <path>    the file is not stored, or stored with another size or before the client changed it last
+//   EXTRA <path>   the file is stored but the client does not have it
+//   SKIP <path>    no pool takes files of that extension
+// servers do not keep a checksum of their files, so size and time decide, a stored file is as old as its upload
+empty_return_function manage_sync_request(number channel_for_client, character *pathname, character *manifest_size)
+{
+    character cursor[string_storage_SIZE] = LISTING_FIRST_CURSOR;
+    character after[string_storage_SIZE] = "";
+    long long length = atoll(manifest_size);
+    character *manifest = length >= ZERO && length <= SYNC_MANIFEST_MAXIMUM ? malloc(length + 1) : NULL;
+    object listing_entry *files = NULL;
+    number file_count = ZERO, next_file = ZERO, sent = ZERO, extra = ZERO, skipped = ZERO;
+    number out_channel = dup(channel_for_client);
+    FILE *out = out_channel >= ZERO ? fdopen(out_channel, "w") : NULL;
+    show_on_cmd("Sync command : Received pathname: %s manifest of %lld bytes\n", pathname, length);
+    if (out == NULL && out_channel >= ZERO)
+    {
+        close(out_channel);
+    }
+    // a manifest which is not taken is still read off the connection, its lines must not be taken for commands
+    if (manifest == NULL || out == NULL)
+    {
+        discard_request_body(channel_for_client, length);
+        show_on_cmd("Sync command: manifest of %s not taken\n", pathname);
+        character *reply = "ERROR manifest not taken\n" END_OF_LIST;
+        send(channel_for_client, reply, strlen(reply), ZERO);
+        free(manifest);
+        if (out != NULL)
+        {
+            fclose(out);
+        }
+        return;
+    }
+    if (recv_exact(channel_for_client, manifest, length) != ZERO)
+    {
+        show_on_cmd("Sync command: the manifest of %s broke off\n", pathname);
+        free(manifest);
+        fclose(out);
+        return;
+    }
+    manifest[length] = '\0';
+    // the lines are cut in place, the paths of files point into manifest
+    number lines = ZERO;
+    for (long long i = ZERO; i < length; i++)
+    {
+        lines += manifest[i] == '\n';
+    }
+    files = calloc(lines + 1, sizeof(object listing_entry));
+    for (character *line = manifest, *end; files != NULL && (end = strchr(line, '\n')) != NULL; line = end + 1)
+    {
+        *end = '\0';
+        // a path can hold spaces, the two numbers are taken from the end of the line like in a page
+        character *mtime_text = strrchr(line, ' ');
+        character *size_text = NULL;
+        if (mtime_text != NULL)
+        {
+            *mtime_text++ = '\0';
+            size_text = strrchr(line, ' ');
+        }
+        if (size_text == NULL || size_text == line)
+        {
+            continue;
+        }
+        *size_text++ = '\0';
+        files[file_count].path = line;
+        files[file_count].size = atoll(size_text);
+        files[file_count].mtime = atoll(mtime_text);
+        file_count++;
+    }
+    if (files != NULL)
+    {
+        qsort(files, file_count, sizeof(object listing_entry), listing_entry_compare);
+    }
+    // the stored files a page at a time, every page is matched against the part of the manifest up to its last path
+    while (files != NULL)
+    {
+        object listing_entry *entries;
+        number more;
+        number unique = collect_folder_page(pathname, cursor, after, &entries, &more);
+        if (unique < ZERO)
+        {
+            break;
+        }
+        number usable = unique < LISTING_PAGE_SIZE ? unique : LISTING_PAGE_SIZE;
+        for (number i = ZERO; i < usable; i++)
+        {
+            number order = -1;
+            // files of the client before this stored one are not stored
+            while (next_file < file_count && (order = strcmp(files[next_file].path, entries[i].path)) < ZERO)
+            {
+                sync_client_file(out, &files[next_file++], &sent, &skipped);
+            }
+            if (next_file < file_count && order == ZERO)
+            {
+                object listing_entry *file = &files[next_file++];
+                if (file->size != entries[i].size || file->mtime > entries[i].mtime)
+                {
+                    fprintf(out, "SEND %s\n", file->path);
+                    sent++;
+                }
+            }
+            else
+            {
+                fprintf(out, "EXTRA %s\n", entries[i].path);
+                extra++;
+            }
+        }
+        // the next page starts after the last path of this one, the cursor has to fit into the page command to the servers
+        number last_page = !more || usable == ZERO || strlen(pathname) + 8 >= sizeof(cursor) ||
+                           listing_cursor_encode(entries[usable - 1].path, cursor, sizeof(cursor) - strlen(pathname) - 8) != ZERO;
+        if (!last_page)
+        {
+            snprintf(after, sizeof(after), "%s", entries[usable - 1].path);
+        }
+        else if (more && usable > ZERO)
+        {
+            show_on_cmd("Sync command: path %s is too long for a cursor, the stored files of %s after it are not compared\n", entries[usable - 1].path, pathname);
+        }
+        free_folder_page(entries, unique);
+        if (last_page)
+        {
+            break;
+        }
+    }
+    // files of the client after the last stored one
+    while (files != NULL && next_file < file_count)
+    {
+        sync_client_file(out, &files[next_file++], &sent, &skipped);
+    }
+    if (files == NULL)
+    {
+        fputs("ERROR manifest not taken\n", out);
+    }
+    fputs(END_OF_LIST, out);
+    fclose(out);
+    show_on_cmd("Sync command: %d of %d files of %s to send, %d only stored, %d not supported\n", sent, file_count, pathname, extra, skipped);
+    free(files);
+    free(manifest);
+}
+// this function writes the line for a file of the client which is not stored, SEND or SKIP when no pool takes it
+empty_return_function sync_client_file(FILE *out, object listing_entry *file, number *sent, number *skipped)
+{
+    if (route_lookup(file->path) == NULL)
+    {
+        fprintf(out, "SKIP %s\n", file->path);
+        (*skipped)++;
+        return;
+    }
+    fprintf(out, "SEND %s\n", file->path);
+    (*sent)++;
+}
+// the local page lists the files whose extension is routed to the local pool
+number local_page_match(constant character *name, empty_return_function *argument)
+{
+    (empty_return_function)argument;
+    object route_pool *pool = route_lookup(name);
+    return pool != NULL && pool->local;
+}
+// this function sends page for pathname and cursor to one backend server, returns its socket or -1 when it cannot be reached
+number request_backend_page(object route_backend *backend, character *pathname, character *cursor)
+{
+    character string_storage[string_storage_SIZE];
+    number backend_sock;
+    if (!backend_healthy(backend->ip, backend->port) || link_to_server(backend->ip, backend->port, &backend_sock) != ZERO)
+    {
+        show_on_cmd("Page command: %s:%d cannot be reached, its files are not listed\n", backend->ip, backend->port);
+        return -1;
+    }
+    snprintf(string_storage, sizeof(string_storage), "page %s %s", pathname, cursor[ZERO] != '\0' ? cursor : LISTING_FIRST_CURSOR);
+    if (send(backend_sock, string_storage, strlen(string_storage), ZERO) < ZERO)
+    {
+        close(backend_sock);
+        return -1;
+    }
+    return backend_sock;
+}
+// this function adds the "path size mtime" lines of one server to entries and closes its socket
+// returns ZERO when the server ended its page with END_OF_LIST and -1 when it broke off
+number read_backend_page(number backend_sock, object listing_entry *entries, number *count, number *more)
+{
+    FILE *in = fdopen(backend_sock, "r");
+    if (in == NULL)
+    {
+        close(backend_sock);
+        return -1;
+    }
+    character *line = NULL;
+    size_t line_size = ZERO;
+    ssize_t length;
+    number result = -1;
+    number added = ZERO;
+    while ((length = getline(&line, &line_size, in)) > ZERO)
+    {
+        if (strcmp(line, END_OF_LIST) == ZERO)
+        {
+            result = ZERO;
+            break;
+        }
+        if (strcmp(line, LISTING_MORE) == ZERO)
+        {
+            *more = 1;
+            continue;
+        }
+        // a server sends one page at most, entries has no room for more of its lines
+        if (added == LISTING_PAGE_SIZE)
+        {
+            continue;
+        }
+        // a path can hold spaces, the two numbers are taken from the end of the line
+        line[length - 1] = '\0';
+        character *mtime_text = strrchr(line, ' ');
+        if (mtime_text == NULL)
+        {
+            continue;
+        }
+        *mtime_text++ = '\0';
+        character *size_text = strrchr(line, ' ');
+        if (size_text == NULL)
+        {
+            continue;
+        }
+        *size_text++ = '\0';
+        character *path = strdup(line);
+        if (path == NULL)
+        {
+            continue;
+        }
+        entries[*count].path = path;
+        entries[*count].size = atoll(size_text);
+        entries[*count].mtime = atoll(mtime_text);
+        (*count)++;
+        added++;
+    }
+    free(line);
+    fclose(in);
+    return result;
+}
+// this function establishes connection with the server
+// connecting gives up after BACKEND_CONNECT_TIMEOUT_MS and every later send() or recv() on the socket after
+// BACKEND_IO_TIMEOUT_SECONDS, so a dead or hanging server never blocks the client's session for long
+// it returns ZERO with the socket in *sock, or -1 when the server cannot be reached, which counts against its health
+// a server on this host is reached over its unix socket, TCP is only used for one which does not have it
+number link_to_server(constant character *ip, number port, number *sock)
+{
+    // make socket structure
+    object sockaddr_in server_channel_address;
+    object timeval io_timeout = {BACKEND_IO_TIMEOUT_SECONDS, ZERO};
+
+    // stext and spdf listen on a unix socket named after their address and port, that skips the loopback TCP stack
+    if ((*sock = local_transport_connect(ip, port)) >= ZERO)
+    {
+        setsockopt(*sock, SOL_SOCKET, SO_RCVTIMEO, &io_timeout, sizeof(io_timeout));
+        setsockopt(*sock, SOL_SOCKET, SO_SNDTIMEO, &io_timeout, sizeof(io_timeout));
+        return ZERO;
+    }
+    // make socket here - TCP/IP socket
+    if ((*sock = socket(AF_INET, SOCK_STREAM, ZERO)) < ZERO)
+    {
+        perror("Socket creation error");
+        return -1;
+    }
+
+    // set up server address
+    server_channel_address.sin_family = AF_INET; // ipv4 address family
+    // this converts the port number from host byte order to network byte order
+    
+    server_channel_address.sin_port = htons(port);
+    // this function converts the IP address from text to binary form and stores it in sin_addr structure
+    if (inet_pton(AF_INET, ip, &server_channel_address.sin_addr) <= ZERO)
+    {
+        perror("Invalid address");
+        close(*sock);
+        return -1;
+    }
+
+    // connect the socket here, without blocking so that the wait for the server can be cut short
+    number flags = fcntl(*sock, F_GETFL);
+    fcntl(*sock, F_SETFL, flags | O_NONBLOCK);
+    number connected = connect(*sock, (object sockaddr *)&server_channel_address, sizeof(server_channel_address));
+    if (connected < ZERO && errno == EINPROGRESS)
+    {
+        object pollfd waiting = {*sock, POLLOUT, ZERO};
+        number error = ETIMEDOUT;
+        socklen_t error_size = sizeof(error);
+        if (poll(&waiting, 1, BACKEND_CONNECT_TIMEOUT_MS) == 1)
+        {
+            getsockopt(*sock, SOL_SOCKET, SO_ERROR, &error, &error_size);
+        }
+        connected = error == ZERO ? ZERO : -1;
+        errno = error;
+    }
+    if (connected < ZERO)
+    {
+        object backend_stats *stats = backend_stats_find(ip, port);
+        show_on_cmd("Connection to %s:%d failed: %s\n", ip, port, strerror(errno));
+        close(*sock);
+        if (stats != NULL)
+        {
+            stats->unreachable = 1;
+        }
+        backend_health_report(ip, port, REQUEST_FAILED);
+        return -1;
+    }
+    fcntl(*sock, F_SETFL, flags);
+    setsockopt(*sock, SOL_SOCKET, SO_RCVTIMEO, &io_timeout, sizeof(io_timeout));
+    setsockopt(*sock, SOL_SOCKET, SO_SNDTIMEO, &io_timeout, sizeof(io_timeout));
+    return ZERO;
+}
+// this function maps the shared memory used by the hot object cache
+// it is called once by the parent so that every forked client process works on the same cache
+empty_return_function setup_hot_object_cache()
+{
+    // MAP_SHARED | MAP_ANONYMOUS memory survives fork() and is seen by all children
+    // the kernel only hands out pages which are actually touched, so an idle cache costs nothing
+    hot_cache = mmap(NULL, sizeof(object hot_cache_table), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, ZERO);
+    hot_cache_arena = mmap(NULL, (size_t)HOT_CACHE_SLOTS * HOT_CACHE_SLOT_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, ZERO);
+    // if any of the mappings failed then run without the cache
+    if (hot_cache == MAP_FAILED || hot_cache_arena == MAP_FAILED)
+    {
+        perror("Hot object cache disabled, mmap failed");
+        hot_cache = NULL;
+        hot_cache_arena = NULL;
+        return;
+    }
+    show_on_cmd("Hot object cache ready: %d objects of up to %d bytes\n", HOT_CACHE_SLOTS, HOT_CACHE_SLOT_BYTES);
+}
+// this function builds the key of a file inside a storage folder like stext or spdf
+// folder and document_name are joined and empty or "." parts are dropped, so "f1//a.txt" and "./f1/a.txt" give the same key
+empty_return_function build_store_key(constant character *folder, constant character *document_name, character *key, size_t key_size)
+{
+    // folder and file name joined together before cleaning
+    character joined[string_storage_SIZE * 2];
+    // used by strtok_r so callers can use strtok themselves
+    character *save_pointer = NULL;
+    // length of the key built so far
+    size_t used = ZERO;
+    snprintf(joined, sizeof(joined), "%s/%s", folder, document_name);
+    key[ZERO] = '\0';
+    // walk the path part by part and only keep the meaningful ones
+    for (character *part = strtok_r(joined, "/", &save_pointer); part != NULL; part = strtok_r(NULL, "/", &save_pointer))
+    {
+        if (strcmp(part, ".") == ZERO)
+        {
+            continue;
+        }
+        used += snprintf(key + used, used < key_size ? key_size - used : ZERO, "%s%s", used > ZERO ? "/" : "", part);
+        // stop if the key does not fit anymore
+        if (used >= key_size)
+        {
+            key[key_size - 1] = '\0';
+            break;
+        }
+    }
+}
+// djb2 hash of a cache key so that most slots can be skipped without comparing strings
+unsigned long hot_cache_key_hash(constant character *key)
+{
+    unsigned long hash = 5381;
+    while (*key)
+    {
+        hash = hash * 33 + (unsigned char)*key++;
+    }
+    return hash;
+}
+// the cache lock is a plain spin lock, sections under it never block so a yield is enough while waiting
+empty_return_function hot_cache_lock()
+{
+    while (__sync_lock_test_and_set(&hot_cache->lock, 1))
+    {
+        sched_yield();
+    }
+}
+empty_return_function hot_cache_unlock()
+{
+    __sync_lock_release(&hot_cache->lock);
+}
+// a slot being filled by a process which has died would stay FILLING forever, so check the owner is still around
+number hot_cache_filler_is_gone(object hot_cache_slot *slot)
+{
+    return kill(slot->filler, ZERO) != ZERO && errno == ESRCH;
+}
+// this function looks up key in the cache
+// HOT_CACHE_HIT: the object is in slot_index and pinned, send it and then call hot_cache_release()
+// HOT_CACHE_FILL: the object is missing and slot_index is reserved for it, fetch it with hot_cache_append() and then call hot_cache_complete_fill()
+// HOT_CACHE_BYPASS: no cache or no free slot, fetch the object from the backend without caching
+// when another process is already fetching the same object we wait for it instead of fetching it a second time
+number hot_cache_acquire(constant character *key, number *slot_index)
+{
+    unsigned long key_hash = hot_cache_key_hash(key);
+    // keys which cannot be stored completely are never cached
+    if (hot_cache == NULL || strlen(key) >= string_storage_SIZE)
+    {
+        return HOT_CACHE_BYPASS;
+    }
+    for (number round = ZERO; round < HOT_CACHE_WAIT_ROUNDS; round++)
+    {
+        number found = -1;
+        hot_cache_lock();
+        // step 1: look for the object itself, stale copies do not count
+        for (number i = ZERO; i < HOT_CACHE_SLOTS; i++)
+        {
+            object hot_cache_slot *slot = &hot_cache->slots[i];
+            if (slot->state != HOT_CACHE_EMPTY && !slot->stale && slot->key_hash == key_hash && strcmp(slot->key, key) == ZERO)
+            {
+                found = i;
+                break;
+            }
+        }
+        if (found >= ZERO)
+        {
+            object hot_cache_slot *slot = &hot_cache->slots[found];
+            // ready objects are pinned and handed back to the caller
+            if (slot->state == HOT_CACHE_READY)
+            {
+                slot->pins++;
+                slot->referenced = 1;
+                hot_cache_unlock();
+                *slot_index = found;
+                return HOT_CACHE_HIT;
+            }
+            // another process is fetching it, wait for that fetch unless that process is gone
+            if (!hot_cache_filler_is_gone(slot))
+            {
+                hot_cache_unlock();
+                usleep(HOT_CACHE_WAIT_USEC);
+                continue;
+            }
+            slot->state = HOT_CACHE_EMPTY;
+        }
+        // step 2: the object is not cached, find a slot for it with the CLOCK hand
+        // a slot used since the last sweep gets a second chance, pinned and filling slots are skipped
+        number victim = -1;
+        for (number scanned = ZERO; scanned < 2 * HOT_CACHE_SLOTS && victim < ZERO; scanned++)
+        {
+            number candidate = hot_cache->clock_hand;
+            object hot_cache_slot *slot = &hot_cache->slots[candidate];
+            hot_cache->clock_hand = (candidate + 1) % HOT_CACHE_SLOTS;
+            if (slot->state == HOT_CACHE_FILLING && hot_cache_filler_is_gone(slot))
+            {
+                slot->state = HOT_CACHE_EMPTY;
+            }
+            if (slot->state == HOT_CACHE_EMPTY)
+            {
+                victim = candidate;
+            }
+            else if (slot->state == HOT_CACHE_READY && slot->pins == ZERO)
+            {
+                if (slot->referenced)
+                {
+                    slot->referenced = ZERO;
+                }
+                else
+                {
+                    victim = candidate;
+                }
+            }
+        }
+        // every slot is busy right now so just fetch without caching
+        if (victim < ZERO)
+        {
+            hot_cache_unlock();
+            return HOT_CACHE_BYPASS;
+        }
+        // reserve the slot so that other processes wait for us instead of fetching the same object
+        object hot_cache_slot *slot = &hot_cache->slots[victim];
+        slot->state = HOT_CACHE_FILLING;
+        slot->pins = ZERO;
+        slot->referenced = 1;
+        slot->stale = ZERO;
+        slot->filler = getpid();
+        slot->length = ZERO;
+        slot->key_hash = key_hash;
+        snprintf(slot->key, sizeof(slot->key), "%s", key);
+        hot_cache_unlock();
+        *slot_index = victim;
+        return HOT_CACHE_FILL;
+    }
+    // waited too long for another process, fetch it ourselves
+    return HOT_CACHE_BYPASS;
+}
+// this function adds the next piece of an object being filled, the slot belongs to this process so no lock is needed
+// objects bigger than a slot set overflow and are not kept
+empty_return_function hot_cache_append(number slot_index, constant character *data, size_t length, number *overflow)
+{
+    object hot_cache_slot *slot = &hot_cache->slots[slot_index];
+    if (*overflow || slot->length + length > HOT_CACHE_SLOT_BYTES)
+    {
+        *overflow = 1;
+        return;
+    }
+    memcpy(hot_cache_arena + (size_t)slot_index * HOT_CACHE_SLOT_BYTES + slot->length, data, length);
+    slot->length += length;
+}
+// this function finishes a fill of a file of file_size bytes, keep is ZERO when the fetch failed or the object did not fit
+empty_return_function hot_cache_complete_fill(number slot_index, number keep, long long file_size)
+{
+    object hot_cache_slot *slot = &hot_cache->slots[slot_index];
+    hot_cache_lock();
+    slot->file_size = file_size;
+    // an upload or delete which came in during the fetch makes the fetched copy useless
+    slot->state = (keep && !slot->stale) ? HOT_CACHE_READY : HOT_CACHE_EMPTY;
+    slot->stale = ZERO;
+    hot_cache_unlock();
+}
+// this function pins the ready copy of key like HOT_CACHE_HIT does, it returns ZERO then and -1 when there is none
+// unlike hot_cache_acquire() it neither waits for a fill nor reserves a slot, a miss is fetched the usual way after it
+number hot_cache_pin(constant character *key, number *slot_index)
+{
+    unsigned long key_hash = hot_cache_key_hash(key);
+    if (hot_cache == NULL || strlen(key) >= string_storage_SIZE)
+    {
+        return -1;
+    }
+    hot_cache_lock();
+    for (number i = ZERO; i < HOT_CACHE_SLOTS; i++)
+    {
+        object hot_cache_slot *slot = &hot_cache->slots[i];
+        if (slot->state == HOT_CACHE_READY && !slot->stale && slot->key_hash == key_hash && strcmp(slot->key, key) == ZERO)
+        {
+            slot->pins++;
+            slot->referenced = 1;
+            hot_cache_unlock();
+            *slot_index = i;
+            return ZERO;
+        }
+    }
+    hot_cache_unlock();
+    return -1;
+}
+// this function sends the pinned copy in slot_index to the client and unpins it, it returns the size of the file
+// the cached bytes are exactly what the backend sent last time, ending with the short chunk the client waits for,
+// a sized answer starts with the size line instead and leaves out the byte a file ending on a full chunk was padded with
+long long hot_cache_send(number channel_for_client, number slot_index, number sized)
+{
+    object hot_cache_slot *slot = &hot_cache->slots[slot_index];
+    constant character *data = hot_cache_arena + (size_t)slot_index * HOT_CACHE_SLOT_BYTES;
+    long long file_size = slot->file_size;
+    size_t length = sized && (size_t)file_size < slot->length ? (size_t)file_size : slot->length;
+    show_on_cmd("Serving %s from the hot object cache (%zu bytes)\n", slot->key, length);
+    send_download_size(channel_for_client, sized, (long long)length);
+    for (size_t sent = ZERO; sent < length;)
+    {
+        ssize_t written = send(channel_for_client, data + sent, length - sent, ZERO);
+        if (written <= ZERO)
+        {
+            perror("send cached file");
+            break;
+        }
+        sent += written;
+    }
+    hot_cache_release(slot_index);
+    return sized ? (long long)length : file_size;
+}
+// this function unpins a slot returned by HOT_CACHE_HIT
+empty_return_function hot_cache_release(number slot_index)
+{
+    object hot_cache_slot *slot = &hot_cache->slots[slot_index];
+    hot_cache_lock();
+    slot->pins--;
+    // the object was invalidated while we were sending it, the last reader frees the slot
+    if (slot->pins == ZERO && slot->stale)
+    {
+        slot->state = HOT_CACHE_EMPTY;
+        slot->stale = ZERO;
+    }
+    hot_cache_unlock();
+}
+// this function drops every cached copy of key, ufile and rmfile call it before the client is told that they are done
+empty_return_function hot_cache_invalidate(constant character *key)
+{
+    unsigned long key_hash = hot_cache_key_hash(key);
+    if (hot_cache == NULL)
+    {
+        return;
+    }
+    hot_cache_lock();
+    for (number i = ZERO; i < HOT_CACHE_SLOTS; i++)
+    {
+        object hot_cache_slot *slot = &hot_cache->slots[i];
+        if (slot->state == HOT_CACHE_EMPTY || slot->key_hash != key_hash || strcmp(slot->key, key) != ZERO)
+        {
+            continue;
+        }
+        // slots nobody is using are freed right away, the others once their readers or filler are done
+        if (slot->state == HOT_CACHE_READY && slot->pins == ZERO)
+        {
+            slot->state = HOT_CACHE_EMPTY;
+        }
+        else
+        {
+            slot->stale = 1;
+        }
+    }
+    hot_cache_unlock();
+}
+// this function makes sure ~/smain exists and opens it as the directory all .c files are opened from
+// it also maps the shared counter which tells client processes that the local store has changed
+empty_return_function setup_local_store()
+{
+    character store_path[string_storage_SIZE];
+    snprintf(store_path, sizeof(store_path), "%s/smain", return_home_value());
+    // first run on this machine, there is no store folder yet
+    if (mkdir(store_path, 0755) != ZERO && errno != EEXIST)
+    {
+        perror("mkdir smain");
+    }
+    local_store_fd = open(store_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (local_store_fd < ZERO)
+    {
+        perror("Failed to open smain folder");
+    }
+    path_resolver_init(&local_store_dirs, local_store_fd);
+    local_store_generation = mmap(NULL, sizeof(*local_store_generation), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, ZERO);
+    // without the shared counter changes made by other clients could not be seen, so run without the descriptor cache
+    if (local_store_generation == MAP_FAILED)
+    {
+        perror("Local descriptor cache disabled, mmap failed");
+        local_store_generation = NULL;
+    }
+    for (number i = ZERO; i < LOCAL_FD_CACHE_SLOTS; i++)
+    {
+        local_fd_cache[i].fd = -1;
+    }
+}
+// this function opens the cold folder of ~/smain and starts the process which moves the files nobody reads there
+empty_return_function setup_local_tiers()
+{
+    character cold_path[string_storage_SIZE];
+    if (local_cold_folder[ZERO] != '\0')
+    {
+        snprintf(cold_path, sizeof(cold_path), "%s", local_cold_folder);
+    }
+    else
+    {
+        snprintf(cold_path, sizeof(cold_path), "%s/%s", return_home_value(), LOCAL_COLD_FOLDER);
+    }
+    if (tiering_setup(&local_tiers, local_store_fd, cold_path, local_cold_seconds) != ZERO)
+    {
+        perror("Tiering disabled, cold folder cannot be used");
+        return;
+    }
+    if (local_tiers.table != NULL)
+    {
+        show_on_cmd("Local files not read for %lld seconds move to %s\n", local_cold_seconds, cold_path);
+        tiering_start(&local_tiers);
+    }
+}
+// this function tells tiering_promote_all() which files dtar packs, argument is the extension like ".c"
+number extension_match(constant character *name, empty_return_function *argument)
+{
+    size_t length = strlen(name);
+    size_t extension_length = strlen((constant character *)argument);
+    return length >= extension_length && strcmp(name + length - extension_length, (constant character *)argument) == ZERO;
+}
+// this function closes every file kept open by this process
+empty_return_function local_fd_cache_flush()
+{
+    for (number i = ZERO; i < LOCAL_FD_CACHE_SLOTS; i++)
+    {
+        if (local_fd_cache[i].fd >= ZERO)
+        {
+            close(local_fd_cache[i].fd);
+            local_fd_cache[i].fd = -1;
+        }
+    }
+}
+// this function is called after a .c file was uploaded or removed
+// the change is seen by other client processes the next time they look at their cache
+empty_return_function local_store_changed()
+{
+    if (local_store_generation != NULL)
+    {
+        __sync_fetch_and_add(local_store_generation, 1);
+    }
+    local_fd_cache_flush();
+}
+// this function returns the open descriptor and stat of the .c file key inside ~/smain, or NULL when there is no such file
+// a hot file costs no syscall at all here, a cold one is opened with openat() relative to ~/smain and kept for next time
+object local_fd_cache_entry *local_fd_cache_open(constant character *key)
+{
+    object local_fd_cache_entry *victim = &local_fd_cache[ZERO];
+    // without the shared counter we would never hear about changes, so nothing is kept between requests
+    if (local_store_generation == NULL)
+    {
+        local_fd_cache_flush();
+    }
+    // some client process changed the store since we last looked, nothing we hold can be trusted
+    else if (*local_store_generation != local_fd_cache_generation)
+    {
+        local_fd_cache_flush();
+        local_fd_cache_generation = *local_store_generation;
+    }
+    local_fd_cache_tick++;
+    for (number i = ZERO; i < LOCAL_FD_CACHE_SLOTS; i++)
+    {
+        object local_fd_cache_entry *entry = &local_fd_cache[i];
+        if (entry->fd >= ZERO && strcmp(entry->key, key) == ZERO)
+        {
+            entry->last_used = local_fd_cache_tick;
+            tiering_note_read(&local_tiers, key);
+            return entry;
+        }
+        // remember the free or least recently used entry in case the file is not cached
+        if (victim->fd >= ZERO && (entry->fd < ZERO || entry->last_used < victim->last_used))
+        {
+            victim = entry;
+        }
+    }
+    // a file in the cold tier is brought back first, a descriptor kept here always has the whole file
+    number fd = tiering_open(&local_tiers, key);
+    if (fd < ZERO)
+    {
+        return NULL;
+    }
+    object stat info;
+    // only regular files can be downloaded
+    if (fstat(fd, &info) != ZERO || !S_ISREG(info.st_mode))
+    {
+        close(fd);
+        errno = EISDIR;
+        return NULL;
+    }
+    if (victim->fd >= ZERO)
+    {
+        close(victim->fd);
+    }
+    victim->fd = fd;
+    victim->info = info;
+    victim->last_used = local_fd_cache_tick;
+    snprintf(victim->key, sizeof(victim->key), "%s", key);
+    return victim;
+}
+// this function sends a file stored in pool to the client
+// the file comes from the hot object cache when it is there, otherwise from the least busy replica of its key
+// and a copy of it is kept in the cache for the next client asking for it
+// a replica which does not answer within its usual time gets company from the next one and the faster answer is used
+// it returns ZERO when the file was sent, -1 when no server has it and -2 when the servers which may have it are down
+// nothing is sent to the client in the last two cases
+number relay_download_from_pool(number channel_for_client, object route_pool *pool, character *document_name, character *initial_command)
+{
+    // this is a buffer string to add content into it from any file
+    character string_storage[string_storage_SIZE];
+    character reply_from_server[string_storage_SIZE];
+    // key of the file in the hot object cache
+    character cache_key[string_storage_SIZE];
+    number order[ROUTE_POOL_BACKENDS];
+    // servers still worth asking, in the order they are asked, and whether they were asked already
+    number candidates[ROUTE_POOL_BACKENDS];
+    number asked[ROUTE_POOL_BACKENDS];
+    number candidate_count = ZERO, replica_candidates = ZERO;
+    number file_size;
+    number slot_index = -1;
+    // set when the file turned out to be bigger than a cache slot
+    number overflow = ZERO;
+    build_store_key("", document_name, cache_key, sizeof(cache_key));
+    number lookup = hot_cache_acquire(cache_key, &slot_index);
+    // cache hit: no connection to the backend at all
+    if (lookup == HOT_CACHE_HIT)
+    {
+        long long cached_size = hot_cache_send(channel_for_client, slot_index, ZERO);
+        // the client reads the file until a short chunk and then reads the end message on its own, nothing tells it where
+        // the file stops inside one read, so the end message has to come after the client took the last chunk
+        // this is the same pause the backends make, a client which asks for a sized download is served before this without it
+        sleep(5);
+        snprintf(reply_from_server, sizeof(reply_from_server), "File %s downloaded successfully" DFS_PROTOCOL_FILE_SIZE "\n", document_name, cached_size);
+        send(channel_for_client, reply_from_server, strlen(reply_from_server), ZERO);
+        return ZERO;
+    }
+    // a replica on this host puts the file into shared memory, anything that goes wrong before the first byte ends up below
+    if (pool->shared_memory && ring_download_from_pool(channel_for_client, pool, document_name, cache_key, lookup, slot_index) == ZERO)
+    {
+        return ZERO;
+    }
+    // the replicas come first, least busy first, then the other servers of the pool in ring order
+    // those are only asked while the rebalancer moves files or when a replica is down, an upload may have put the file there instead
+    number count = route_backends_for(pool, cache_key, order);
+    number replicas = route_replica_count(pool);
+    number widen = rebalance_forwarding();
+    // set when a server which may have the file could not be asked
+    number failed = ZERO;
+    route_order_by_load(pool, order, replicas);
+    for (number i = ZERO; i < count; i++)
+    {
+        object route_backend *backend = &pool->backends[order[i]];
+        // a server whose breaker is open or whose membership filter says the file is not there is not asked at all
+        if (!backend_healthy(backend->ip, backend->port))
+        {
+            widen |= i < replicas;
+            failed = 1;
+        }
+        else if (!backend_filter_rules_out(backend->ip, backend->port, cache_key))
+        {
+            asked[candidate_count] = ZERO;
+            candidates[candidate_count++] = order[i];
+            replica_candidates += i < replicas;
+        }
+    }
+    for (number first = ZERO; first < candidate_count && (first < replica_candidates || widen); first++)
+    {
+        number second = -1;
+        number winner = -1;
+        if (asked[first])
+        {
+            continue;
+        }
+        // a second replica which has not been asked yet can be hedged against the first
+        for (number i = first + 1; i < replica_candidates && first < replica_candidates && second < ZERO; i++)
+        {
+            second = asked[i] ? -1 : i;
+        }
+        number backend_sock = hedged_request(pool, candidates[first], second >= ZERO ? candidates[second] : -1, initial_command, &winner);
+        // neither server answered in time, the next ones are tried
+        if (backend_sock < ZERO)
+        {
+            asked[first] = 1;
+            if (second >= ZERO)
+            {
+                asked[second] = 1;
+            }
+            widen = 1;
+            failed = 1;
+            continue;
+        }
+        // the server which lost the race stays unasked and may still be tried when the winner does not have the file
+        object route_backend *backend = &pool->backends[winner];
+        asked[winner == candidates[first] ? first : second] = 1;
+        // first is looked at again by the next round of the loop then
+        if (winner != candidates[first])
+        {
+            first--;
+        }
+        // receive file content from the backend, pass it on to the client and keep a copy if we own a cache slot
+        number missing = ZERO;
+        number streamed = ZERO;
+        while ((file_size = recv(backend_sock, string_storage, string_storage_SIZE, ZERO)) > ZERO)
+        {
+            // the backend does not have the file, its whole answer was in this chunk and there is no end message
+            if (!streamed && file_size >= strlen(FILE_NOT_FOUND_MARKER) && strncmp(string_storage, FILE_NOT_FOUND_MARKER, strlen(FILE_NOT_FOUND_MARKER)) == ZERO)
+            {
+                missing = 1;
+                break;
+            }
+            send(channel_for_client, string_storage, file_size, ZERO);
+            streamed = 1;
+            if (lookup == HOT_CACHE_FILL)
+            {
+                hot_cache_append(slot_index, string_storage, file_size, &overflow);
+            }
+            // break if file contentas been read completely
+            if (file_size < sizeof(string_storage))
+            {
+                break;
+            }
+        }
+        if (missing || (file_size <= ZERO && !streamed))
+        {
+            // an answer which broke off before the first byte can still be fetched from another server
+            close(backend_sock);
+            backend_stats_done(backend, missing ? REQUEST_SUCCEEDED : REQUEST_FAILED);
+            widen |= !missing;
+            failed |= !missing;
+            continue;
+        }
+        if (file_size <= ZERO)
+        {
+            // the server stopped in the middle of the file, the client is told so after a short chunk ends the file it writes
+            show_on_cmd("Download of %s from %s:%d broke off\n", cache_key, backend->ip, backend->port);
+            close(backend_sock);
+            backend_stats_done(backend, REQUEST_FAILED);
+            if (lookup == HOT_CACHE_FILL)
+            {
+                hot_cache_complete_fill(slot_index, ZERO, -1);
+            }
+            send(channel_for_client, "", 1, ZERO);
+            sleep(5);
+            snprintf(reply_from_server, sizeof(reply_from_server), "File %s download failed, its server stopped answering\n", document_name);
+            send(channel_for_client, reply_from_server, strlen(reply_from_server), ZERO);
+            return ZERO;
+        }
+        // recieve end message from the backend stating evrything went smoothly and then
+        number len = recv(backend_sock, reply_from_server, sizeof(reply_from_server) - 1, ZERO);
+        reply_from_server[len > ZERO ? len : ZERO] = '\0';
+        // send that message to client, the file is complete even when the server did not confirm it in time
+        if (len <= ZERO)
+        {
+            len = snprintf(reply_from_server, sizeof(reply_from_server), "File %s downloaded successfully\n", document_name);
+        }
+        send(channel_for_client, reply_from_server, len, ZERO);
+        // only a transfer which ended with a short chunk and an end message with the size of the file is a complete copy worth keeping
+        long long backend_size = dfs_protocol_reply_size(reply_from_server);
+        if (lookup == HOT_CACHE_FILL)
+        {
+            hot_cache_complete_fill(slot_index, !overflow && backend_size >= ZERO, backend_size);
+        }
+        // close backend connection
+        close(backend_sock);
+        backend_stats_done(backend, REQUEST_SUCCEEDED);
+        return ZERO;
+    }
+    if (lookup == HOT_CACHE_FILL)
+    {
+        hot_cache_complete_fill(slot_index, ZERO, -1);
+    }
+    // a server which could not be asked may have the file, that is not the same as the file not being stored
+    return failed ? -2 : -1;
+}
+// this function connects to backend and sends command, it returns the socket or -1 when backend cannot be reached
+// the request counts as in flight on backend until backend_stats_done() is called
+number backend_request(object route_backend *backend, constant character *command)
+{
+    number backend_sock;
+    object backend_stats *stats = backend_stats_find(backend->ip, backend->port);
+    // this is a common function to build the conection
+    if (link_to_server(backend->ip, backend->port, &backend_sock) != ZERO)
+    {
+        return -1;
+    }
+    if (stats != NULL)
+    {
+        __sync_fetch_and_add(&stats->in_flight, 1);
+    }
+    // after successfull connection send this command to the backend server
+    if (send(backend_sock, command, strlen(command), ZERO) < ZERO)
+    {
+        close(backend_sock);
+        backend_stats_done(backend, REQUEST_FAILED);
+        return -1;
+    }
+    return backend_sock;
+}
+// this function sends command to the server first of pool and returns the socket once its answer starts
+// when second is a server too and first has not answered after its 95th percentile the command goes to second as well
+// a first server which cannot be reached is replaced by second right away
+// the server which answers first is left in winner and the other request is dropped
+// it returns -1 when no server answered within BACKEND_IO_TIMEOUT_SECONDS
+number hedged_request(object route_pool *pool, number first, number second, constant character *command, number *winner)
+{
+    object pollfd waiting[2];
+    long long started[2];
+    number servers[2] = {first, second};
+    number asked = 1;
+    long long waited = ZERO;
+    *winner = -1;
+    started[ZERO] = monotonic_usec();
+    waiting[ZERO].fd = backend_request(&pool->backends[first], command);
+    waiting[ZERO].events = POLLIN;
+    waiting[1].fd = -1;
+    waiting[1].events = POLLIN;
+    if (waiting[ZERO].fd < ZERO && second >= ZERO)
+    {
+        servers[ZERO] = second;
+        second = -1;
+        started[ZERO] = monotonic_usec();
+        waiting[ZERO].fd = backend_request(&pool->backends[servers[ZERO]], command);
+    }
+    if (waiting[ZERO].fd < ZERO)
+    {
+        return -1;
+    }
+    if (second >= ZERO)
+    {
+        waited = backend_hedge_delay(backend_stats_find(pool->backends[first].ip, pool->backends[first].port));
+    }
+    number ready = poll(waiting, 1, second >= ZERO ? (number)waited : BACKEND_IO_TIMEOUT_SECONDS * 1000);
+    if (ready == ZERO && second >= ZERO)
+    {
+        show_on_cmd("No answer from %s:%d after %lld ms, asking %s:%d too\n", pool->backends[first].ip, pool->backends[first].port, waited, pool->backends[second].ip, pool->backends[second].port);
+        started[1] = monotonic_usec();
+        waiting[1].fd = backend_request(&pool->backends[second], command);
+        asked = waiting[1].fd >= ZERO ? 2 : 1;
+        ready = poll(waiting, asked, BACKEND_IO_TIMEOUT_SECONDS * 1000 - (number)waited);
+    }
+    number won = -1;
+    for (number i = ZERO; i < asked && ready > ZERO; i++)
+    {
+        if (won < ZERO && waiting[i].revents != ZERO)
+        {
+            won = i;
+        }
+    }
+    // the slower server of a hedged pair is not to blame, a server which did not answer at all is
+    for (number i = ZERO; i < asked; i++)
+    {
+        if (i == won)
+        {
+            continue;
+        }
+        close(waiting[i].fd);
+        backend_stats_done(&pool->backends[servers[i]], won >= ZERO ? REQUEST_CANCELLED : REQUEST_FAILED);
+    }
+    if (won < ZERO)
+    {
+        return -1;
+    }
+    backend_stats_record(backend_stats_find(pool->backends[servers[won]].ip, pool->backends[servers[won]].port), monotonic_usec() - started[won]);
+    *winner = servers[won];
+    return waiting[won].fd;
+}
+// this function passes a rmfile for a .txt or .pdf file on to the backend server at ip and port
+// a file the backend's membership filter has never seen is answered as not found right here
+// the answer for the client is left in reply_from_server, it returns ZERO when the backend deleted the file and -1 otherwise
+number relay_remove_to_backend(constant character *ip, number port, character *document_name, character *initial_command, character *reply_from_server, size_t reply_size)
+{
+    // key of the file in the hot object cache and in the membership filter
+    character cache_key[string_storage_SIZE];
+    number backend_sock;
+    build_store_key("", document_name, cache_key, sizeof(cache_key));
+    if (backend_filter_rules_out(ip, port, cache_key))
+    {
+        snprintf(reply_from_server, reply_size, "File %s not found.\n", document_name);
+        return -1;
+    }
+    // this is a common function to build the conection
+    if (!backend_healthy(ip, port) || link_to_server(ip, port, &backend_sock) != ZERO)
+    {
+        snprintf(reply_from_server, reply_size, "File %s could not be removed, its server cannot be reached.\n", document_name);
+        return -1;
+    }
+    // after successfull connection send this command to the backend server
+    send(backend_sock, initial_command, strlen(initial_command), ZERO);
+    // recieve end message from the backend stating evrything went smoothly
+    number len = recv(backend_sock, reply_from_server, reply_size - 1, ZERO);
+    reply_from_server[len > ZERO ? len : ZERO] = '\0';
+    // close backend connection
+    close(backend_sock);
+    backend_health_report(ip, port, len > ZERO ? REQUEST_SUCCEEDED : REQUEST_FAILED);
+    if (len <= ZERO)
+    {
+        snprintf(reply_from_server, reply_size, "File %s could not be removed, its server did not answer.\n", document_name);
+    }
+    // the file is gone (or never existed) so drop any cached copy of it
+    hot_cache_invalidate(cache_key);
+    return strstr(reply_from_server, "deleted successfully") != NULL ? ZERO : -1;
+}
+// this function writes the upload of document_name to the servers of pool which keep a copy of cache_key
+// initial_command is the string_storage_SIZE bytes of the ufile command, the servers get the first string_storage_SIZE - 1 of them
+// like smain gets them from its clients, and the file content is read from source_fd
+// until a chunk shorter than string_storage_SIZE (or its end), that is the client socket or an entry of the journal
+// the answer for the client is left in reply_from_server, it returns ZERO when write_quorum copies were stored and -1 otherwise
+number relay_upload_to_pool(object route_pool *pool, constant character *cache_key, constant character *document_name, character *initial_command, number source_fd, character *reply_from_server, size_t reply_size)
+{
+    character file_string_storage[string_storage_SIZE];
+    ssize_t document_byte_size;
+    // one socket for every replica, -1 once that replica failed
+    number backend_socks[ROUTE_POOL_BACKENDS];
+    // the servers written to, the owners of the key unless some of them are down
+    number targets[ROUTE_POOL_BACKENDS];
+    number order[ROUTE_POOL_BACKENDS];
+    number written = ZERO, replicas = ZERO;
+    number count = route_backends_for(pool, cache_key, order);
+    // an owner which is down is replaced by the next server on the ring, the rebalancer moves the copy to the owner once it is back
+    for (number i = ZERO; i < count && replicas < route_replica_count(pool); i++)
+    {
+        object route_backend *backend = &pool->backends[order[i]];
+        // this is a common function to build the conection
+        if (!backend_healthy(backend->ip, backend->port) || link_to_server(backend->ip, backend->port, &backend_socks[replicas]) != ZERO)
+        {
+            continue;
+        }
+        if (i >= route_replica_count(pool))
+        {
+            show_on_cmd("Storing %s on %s:%d in place of a server which is down\n", cache_key, backend->ip, backend->port);
+        }
+        // after successfull connection send this command to the replica
+        targets[replicas] = order[i];
+        if (send(backend_socks[replicas], initial_command, string_storage_SIZE - 1, ZERO) == -1)
+        {
+            close(backend_socks[replicas]);
+            backend_socks[replicas] = -1;
+            backend_health_report(backend->ip, backend->port, REQUEST_FAILED);
+        }
+        replicas++;
+    }
+    // get file content from the client (or the journal) and pass every chunk on to each replica still there
+    while ((document_byte_size = read(source_fd, file_string_storage, sizeof(file_string_storage))) > ZERO)
+    {
+        for (number i = ZERO; i < replicas; i++)
+        {
+            if (backend_socks[i] >= ZERO && read_engine_send_all(backend_socks[i], file_string_storage, document_byte_size) != ZERO)
+            {
+                close(backend_socks[i]);
+                backend_socks[i] = -1;
+                backend_health_report(pool->backends[targets[i]].ip, pool->backends[targets[i]].port, REQUEST_FAILED);
+            }
+        }
+        // break if file contentas been read completely
+        if (document_byte_size < sizeof(file_string_storage))
+        {
+            break;
+        }
+    }
+    // a journal entry holds the file without the byte which ends it on a short chunk, the servers still wait for that
+    for (number i = ZERO; document_byte_size == ZERO && i < replicas; i++)
+    {
+        if (backend_socks[i] >= ZERO)
+        {
+            send(backend_socks[i], "", 1, ZERO);
+        }
+    }
+    // recieve end message from every replica, the client gets the first one which says the file was stored
+    for (number i = ZERO; i < replicas; i++)
+    {
+        character backend_reply[string_storage_SIZE];
+        if (backend_socks[i] < ZERO)
+        {
+            continue;
+        }
+        object route_backend *backend = &pool->backends[targets[i]];
+        number len = recv(backend_socks[i], backend_reply, sizeof(backend_reply) - 1, ZERO);
+        backend_reply[len > ZERO ? len : ZERO] = '\0';
+        close(backend_socks[i]);
+        // no answer within BACKEND_IO_TIMEOUT_SECONDS counts against the server, a refused file does not
+        backend_health_report(backend->ip, backend->port, len > ZERO ? REQUEST_SUCCEEDED : REQUEST_FAILED);
+        if (strstr(backend_reply, "uploaded successfully") != NULL)
+        {
+            if (written++ == ZERO)
+            {
+                snprintf(reply_from_server, reply_size, "%s", backend_reply);
+            }
+            // smain's copy of the backend membership filter has to know about the new file right away
+            backend_filter_note_upload(backend->ip, backend->port, cache_key);
+        }
+    }
+    // replicas which missed the upload get their copy from the rebalancer on its next pass
+    if (written < pool->write_quorum)
+    {
+        show_on_cmd("Upload of %s reached %d of %d replicas, %d needed\n", cache_key, written, route_replica_count(pool), pool->write_quorum);
+        snprintf(reply_from_server, reply_size, "File %s upload failed, only %d of %d copies were written\n", document_name, written, route_replica_count(pool));
+    }
+    return written < pool->write_quorum ? -1 : ZERO;
+}
+// this function removes document_name from the servers of pool which may keep a copy
+// the answer for the client is left in reply_from_server, it returns ZERO when some server deleted the file and -1 otherwise
+// unreached is set when a server which may have a copy could not be asked, so the file may still be stored
+number remove_from_pool(object route_pool *pool, character *document_name, character *initial_command, character *reply_from_server, size_t reply_size, number *unreached)
+{
+    character document_location[string_storage_SIZE];
+    character backend_reply[string_storage_SIZE];
+    number order[ROUTE_POOL_BACKENDS];
+    number removed = -1;
+    build_store_key("", document_name, document_location, sizeof(document_location));
+    number candidates = route_backends_for(pool, document_location, order);
+    number widen = rebalance_forwarding();
+    *unreached = ZERO;
+    // every replica has a copy, and while the rebalancer moves files or a replica is down (so an upload
+    // went to the next server instead) a copy may be on another server of the pool too
+    for (number i = ZERO; i < route_replica_count(pool); i++)
+    {
+        widen |= !backend_healthy(pool->backends[order[i]].ip, pool->backends[order[i]].port);
+    }
+    if (!widen)
+    {
+        candidates = route_replica_count(pool);
+    }
+    for (number i = ZERO; i < candidates; i++)
+    {
+        // the client gets the answer of the first server which deleted the file, or the last not found
+        if (relay_remove_to_backend(pool->backends[order[i]].ip, pool->backends[order[i]].port, document_name, initial_command, backend_reply, sizeof(backend_reply)) == ZERO && removed != ZERO)
+        {
+            removed = ZERO;
+            snprintf(reply_from_server, reply_size, "%s", backend_reply);
+        }
+        else if (removed != ZERO)
+        {
+            snprintf(reply_from_server, reply_size, "%s", backend_reply);
+        }
+        *unreached |= strstr(backend_reply, "could not be removed") != NULL;
+    }
+    return removed;
+}
+// this function passes the client connection to a server of pool on this host with SCM_RIGHTS, for a dfile or ufile of cache_key
+// the server sends or takes the file and the answers itself, smain only waits until the server gives the connection back
+// a download goes to the least busy copy, an upload to the owner or the next server when the owner is down, like relaying does
+// it returns ZERO when the server served the command and -1 when smain relays it, nothing was read from the client then
+number handoff_to_backend(number channel_for_client, object route_pool *pool, constant character *cache_key, character *initial_command, number upload)
+{
+    number order[ROUTE_POOL_BACKENDS];
+    character message[string_storage_SIZE + 16];
+    character reply[string_storage_SIZE];
+    number count = route_backends_for(pool, cache_key, order);
+    if (!upload)
+    {
+        count = route_replica_count(pool);
+        route_order_by_load(pool, order, count);
+    }
+    // the size of an uploaded file is behind the words of the command, so the command goes on up to the end of that
+    // a command which does not fit into the read of the server with it is relayed instead
+    size_t words = strlen(initial_command) + 1;
+    size_t length = words < string_storage_SIZE ? words + strnlen(initial_command + words, string_storage_SIZE - words) + 1 : string_storage_SIZE;
+    size_t prefix = snprintf(message, sizeof(message), "%s ", LOCAL_TRANSPORT_HANDOFF);
+    if (prefix + length > string_storage_SIZE - 1)
+    {
+        return -1;
+    }
+    memcpy(message + prefix, initial_command, length);
+    for (number i = ZERO; i < count; i++)
+    {
+        object route_backend *backend = &pool->backends[order[i]];
+        if (!backend_healthy(backend->ip, backend->port))
+        {
+            continue;
+        }
+        // a server smain runs itself serves the client right in this process, there is nothing to hand over
+        object storage_engine *engine = embedded_engine_for(backend->ip, backend->port);
+        if (engine != NULL)
+        {
+            if (storage_engine_client(engine, channel_for_client, initial_command, string_storage_SIZE) != ZERO)
+            {
+                return -1;
+            }
+            if (upload)
+            {
+                backend_filter_note_upload(backend->ip, backend->port, cache_key);
+                hot_cache_invalidate(cache_key);
+            }
+            return ZERO;
+        }
+        // only a server on this host has the unix socket, the client connection cannot be passed over TCP
+        // a download looks on for another copy on this host, an upload goes where relaying would write it, so it is relayed then
+        number backend_sock = local_transport_connect(backend->ip, backend->port);
+        if (backend_sock < ZERO)
+        {
+            if (upload)
+            {
+                break;
+            }
+            continue;
+        }
+        if (local_transport_send_fds(backend_sock, message, prefix + length, &channel_for_client, 1) != ZERO)
+        {
+            close(backend_sock);
+            if (upload)
+            {
+                break;
+            }
+            continue;
+        }
+        // no timeout here, the server is busy with the client for as long as the file takes
+        number len = recv(backend_sock, reply, sizeof(reply) - 1, ZERO);
+        reply[len > ZERO ? len : ZERO] = '\0';
+        close(backend_sock);
+        if (strcmp(reply, LOCAL_TRANSPORT_HANDOFF_REFUSED) == ZERO)
+        {
+            return -1;
+        }
+        // a server which died with the connection leaves the client without an answer, like a relay which broke off would
+        backend_health_report(backend->ip, backend->port, len > ZERO ? REQUEST_SUCCEEDED : REQUEST_FAILED);
+        if (upload)
+        {
+            backend_filter_note_upload(backend->ip, backend->port, cache_key);
+            hot_cache_invalidate(cache_key);
+        }
+        return ZERO;
+    }
+    // no server on this host could take the client
+    return -1;
+}
+// this function sends the file cache_key of pool to the client out of a shared memory ring filled by its least busy replica
+// the replica has to run on this host, the ring goes to it over the unix socket and it reads the file straight into the ring
+// lookup and slot_index come from hot_cache_acquire(), a FILL slot gets the file like it would from the socket relay
+// it returns ZERO once the client got its answer, and -1 when nothing was sent because the replica is not on this host,
+// refused the ring or does not have the file, the caller then relays the file over a socket as usual
+number ring_download_from_pool(number channel_for_client, object route_pool *pool, character *document_name, constant character *cache_key, number lookup, number slot_index)
+{
+    number order[ROUTE_POOL_BACKENDS];
+    character message[string_storage_SIZE + 16];
+    character line[string_storage_SIZE];
+    object shm_ring ring;
+    object route_backend *backend = NULL;
+    long long size;
+    number overflow = ZERO;
+    number count = route_replica_count(pool);
+    route_backends_for(pool, cache_key, order);
+    route_order_by_load(pool, order, count);
+    for (number i = ZERO; i < count && backend == NULL; i++)
+    {
+        object route_backend *replica = &pool->backends[order[i]];
+        if (backend_healthy(replica->ip, replica->port) && !backend_filter_rules_out(replica->ip, replica->port, cache_key))
+        {
+            backend = replica;
+        }
+    }
+    if (backend == NULL)
+    {
+        return -1;
+    }
+    number backend_sock = local_transport_connect(backend->ip, backend->port);
+    if (backend_sock < ZERO)
+    {
+        return -1;
+    }
+    object timeval io_timeout = {BACKEND_IO_TIMEOUT_SECONDS, ZERO};
+    setsockopt(backend_sock, SOL_SOCKET, SO_RCVTIMEO, &io_timeout, sizeof(io_timeout));
+    if (shm_ring_create(&ring, SHM_RING_BYTES) != ZERO)
+    {
+        close(backend_sock);
+        return -1;
+    }
+    number fds[3] = {ring.memfd, ring.data_event, ring.space_event};
+    snprintf(message, sizeof(message), "%s fetch %s", SHM_RING_COMMAND, cache_key);
+    if (local_transport_send_fds(backend_sock, message, strlen(message), fds, 3) != ZERO || recv_line(backend_sock, line, sizeof(line)) != ZERO || sscanf(line, "SIZE %lld", &size) != 1)
+    {
+        shm_ring_destroy(&ring);
+        close(backend_sock);
+        return -1;
+    }
+    show_on_cmd("Sending %s from %s:%d through shared memory (%lld bytes)\n", cache_key, backend->ip, backend->port, size);
+    // the bytes go from the ring to the client without another copy, and into the cache slot when we own one
+    long long sent = ZERO;
+    ssize_t ready;
+    constant unsigned character *data;
+    while ((ready = shm_ring_peek(&ring, &data, BACKEND_IO_TIMEOUT_SECONDS * 1000)) > ZERO)
+    {
+        send(channel_for_client, data, ready, ZERO);
+        if (lookup == HOT_CACHE_FILL)
+        {
+            hot_cache_append(slot_index, (constant character *)data, ready, &overflow);
+        }
+        shm_ring_consume(&ring, ready);
+        sent += ready;
+    }
+    shm_ring_destroy(&ring);
+    close(backend_sock);
+    character reply_from_server[string_storage_SIZE];
+    if (sent != size)
+    {
+        // the server stopped in the middle of the file, the client is told so after a short chunk ends the file it writes
+        show_on_cmd("Download of %s from %s:%d broke off\n", cache_key, backend->ip, backend->port);
+        backend_health_report(backend->ip, backend->port, REQUEST_FAILED);
+        if (lookup == HOT_CACHE_FILL)
+        {
+            hot_cache_complete_fill(slot_index, ZERO, -1);
+        }
+        send(channel_for_client, "", 1, ZERO);
+        sleep(5);
+        snprintf(reply_from_server, sizeof(reply_from_server), "File %s download failed, its server stopped answering\n", document_name);
+        send(channel_for_client, reply_from_server, strlen(reply_from_server), ZERO);
+        return ZERO;
+    }
+    // the servers end a file whose size is a multiple of a chunk with one more byte, the client stops at a short chunk
+    if (size % string_storage_SIZE == ZERO)
+    {
+        send(channel_for_client, "", 1, ZERO);
+        if (lookup == HOT_CACHE_FILL)
+        {
+            hot_cache_append(slot_index, "", 1, &overflow);
+        }
+    }
+    // the whole file is in the slot now, other downloads waiting for it do not have to sit through the pause below
+    if (lookup == HOT_CACHE_FILL)
+    {
+        hot_cache_complete_fill(slot_index, !overflow, size);
+    }
+    backend_health_report(backend->ip, backend->port, REQUEST_SUCCEEDED);
+    // same pause as the backends so that the reply does not end up inside the client's file
+    sleep(5);
+    snprintf(reply_from_server, sizeof(reply_from_server), "File %s downloaded successfully" DFS_PROTOCOL_FILE_SIZE "\n", document_name, size);
+    send(channel_for_client, reply_from_server, strlen(reply_from_server), ZERO);
+    return ZERO;
+}
+// this function starts the answer to a sized download (DFS_PROTOCOL_SIZED) with the size of the file, -1 when it is
+// not known and the file comes framed like for any dfile, nothing is sent to a client which did not ask for it
+empty_return_function send_download_size(number channel_for_client, number sized, long long size)
+{
+    character line[64];
+    if (sized)
+    {
+        snprintf(line, sizeof(line), DFS_PROTOCOL_SIZE_LINE, size);
+        send(channel_for_client, line, strlen(line), ZERO);
+    }
+}
+// this function tells the client that document_name is not stored
+// marker and message go in one send() so the client gets them together and does not wait for a separate end message
+empty_return_function send_file_not_found(number channel_for_client, constant character *document_name)
+{
+    character reply_from_server[string_storage_SIZE];
+    snprintf(reply_from_server, sizeof(reply_from_server), "%sFile %s not found.\n", FILE_NOT_FOUND_MARKER, document_name);
+    send(channel_for_client, reply_from_server, strlen(reply_from_server), ZERO);
+}
+// this function tells the client that document_name cannot be fetched because its servers are down
+// the client treats it like a missing file, there is no file data and no separate end message
+empty_return_function send_file_unavailable(number channel_for_client, constant character *document_name)
+{
+    character reply_from_server[string_storage_SIZE];
+    snprintf(reply_from_server, sizeof(reply_from_server), "%sFile %s is not available right now, its servers cannot be reached.\n", FILE_NOT_FOUND_MARKER, document_name);
+    send(channel_for_client, reply_from_server, strlen(reply_from_server), ZERO);
+}
+// this function receives exactly length bytes, it returns ZERO on success and -1 when the connection ended early
+number recv_exact(number sock, empty_return_function *data, size_t length)
+{
+    for (size_t received = ZERO; received < length;)
+    {
+        ssize_t got = recv(sock, (character *)data + received, length - received, ZERO);
+        if (got <= ZERO)
+        {
+            return -1;
+        }
+        received += got;
+    }
+    return ZERO;
+}
+// this function writes length bytes from data to the file fd, it returns ZERO on success and -1 when the write failed
+number write_all(number fd, constant character *data, size_t length)
+{
+    while (length > ZERO)
+    {
+        ssize_t written = write(fd, data, length);
+        if (written < ZERO && errno == EINTR)
+        {
+            continue;
+        }
+        if (written <= ZERO)
+        {
+            return -1;
+        }
+        data += written;
+        length -= written;
+    }
+    return ZERO;
+}
+// this function receives one line ending with '\n' one byte at a time so nothing after it is taken from the socket
+// the '\n' is replaced by the terminating zero, it returns -1 when the connection ended or the line does not fit
+number recv_line(number sock, character *line, size_t size)
+{
+    for (size_t used = ZERO; used + 1 < size; used++)
+    {
+        if (recv(sock, line + used, 1, ZERO) != 1)
+        {
+            return -1;
+        }
+        if (line[used] == '\n')
+        {
+            line[used] = '\0';
+            return ZERO;
+        }
+    }
+    return -1;
+}
+// this function creates the membership filter of ~/smain and the shared copies of the stext and spdf filters
+empty_return_function setup_membership_filters()
+{
+    // the local filter starts with every file already stored, uploads and removals keep it up to date
+    local_paths = membership_filter_create();
+    if (local_paths == NULL)
+    {
+        perror("Local membership filter disabled, mmap failed");
+    }
+    else if (local_store_fd >= ZERO)
+    {
+        membership_filter_load_tree(local_paths, local_store_fd);
+    }
+    backend_filters = mmap(NULL, sizeof(object backend_filter) * BACKEND_FILTER_SLOTS, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, ZERO);
+    if (backend_filters == MAP_FAILED)
+    {
+        perror("Backend membership filters disabled, mmap failed");
+        backend_filters = NULL;
+        return;
+    }
+    register_backends();
+}
+// this function gives every backend server of the routing table a filter slot and a stats slot, servers added by a reload get free ones
+// the filter copies themselves are fetched the first time they are needed
+empty_return_function register_backends()
+{
+    number slot = ZERO;
+    for (number i = ZERO; backend_stats_table != NULL && i < route_pool_count; i++)
+    {
+        for (number j = ZERO; j < route_pools[i].backend_count; j++)
+        {
+            object route_backend *backend = &route_pools[i].backends[j];
+            if (backend_stats_find(backend->ip, backend->port) != NULL)
+            {
+                continue;
+            }
+            while (slot < BACKEND_STATS_SLOTS && backend_stats_table[slot].port != ZERO)
+            {
+                slot++;
+            }
+            if (slot == BACKEND_STATS_SLOTS)
+            {
+                break;
+            }
+            snprintf(backend_stats_table[slot].ip, sizeof(backend_stats_table[slot].ip), "%s", backend->ip);
+            __sync_synchronize();
+            backend_stats_table[slot].port = backend->port;
+        }
+    }
+    slot = ZERO;
+    for (number i = ZERO; backend_filters != NULL && i < route_pool_count; i++)
+    {
+        for (number j = ZERO; j < route_pools[i].backend_count; j++)
+        {
+            object route_backend *backend = &route_pools[i].backends[j];
+            if (backend_filter_find(backend->ip, backend->port) != NULL)
+            {
+                continue;
+            }
+            while (slot < BACKEND_FILTER_SLOTS && backend_filters[slot].port != ZERO)
+            {
+                slot++;
+            }
+            if (slot == BACKEND_FILTER_SLOTS)
+            {
+                return;
+            }
+            // the ip goes in before the port, client processes only look at slots with a port
+            snprintf(backend_filters[slot].ip, sizeof(backend_filters[slot].ip), "%s", backend->ip);
+            __sync_synchronize();
+            backend_filters[slot].port = backend->port;
+        }
+    }
+}
+// returns the filter copy of the backend server at ip and port, or NULL when there is none
+object backend_filter *backend_filter_find(constant character *ip, number port)
+{
+    for (number i = ZERO; backend_filters != NULL && i < BACKEND_FILTER_SLOTS; i++)
+    {
+        if (backend_filters[i].port == port && strcmp(backend_filters[i].ip, ip) == ZERO)
+        {
+            return &backend_filters[i];
+        }
+    }
+    return NULL;
+}
+// this function fetches a new copy of the backend's filter with the "bloom" command
+// only one client process fetches at a time, the others keep using the old copy meanwhile
+empty_return_function backend_filter_refresh(object backend_filter *filter)
+{
+    time_t now = time(NULL);
+    time_t started = filter->refreshing;
+    character header[string_storage_SIZE];
+    unsigned long size = ZERO;
+    number backend_sock;
+    if (started != ZERO && now - started < BACKEND_FILTER_FETCH_TIMEOUT)
+    {
+        return;
+    }
+    if (!__sync_bool_compare_and_swap(&filter->refreshing, started, now))
+    {
+        return;
+    }
+    // uploads finishing from here on may be missing from the fetched bits, they are added again below
+    unsigned long first_upload = filter->upload_count;
+    unsigned char *bits = malloc(MEMBERSHIP_FILTER_BYTES);
+    number fetched = ZERO;
+    if (bits != NULL)
+    {
+        // a server which is down keeps its old copy, the next fetch is tried after BACKEND_FILTER_REFRESH_SECONDS
+        if (backend_healthy(filter->ip, filter->port) && link_to_server(filter->ip, filter->port, &backend_sock) == ZERO)
+        {
+            send(backend_sock, "bloom", strlen("bloom"), ZERO);
+            // the answer is "BLOOM <bytes>\n" and the bits, a backend without a filter answers with zero bytes
+            fetched = recv_line(backend_sock, header, sizeof(header)) == ZERO && sscanf(header, "BLOOM %lu", &size) == 1 && size == MEMBERSHIP_FILTER_BYTES && recv_exact(backend_sock, bits, size) == ZERO;
+            close(backend_sock);
+        }
+    }
+    if (fetched)
+    {
+        // readers which overlap with the copy see an odd or changed version and do not trust the bits
+        __sync_fetch_and_add(&filter->version, 1);
+        memcpy(filter->bits, bits, MEMBERSHIP_FILTER_BYTES);
+        unsigned long last_upload = filter->upload_count;
+        // too many uploads to add again means the copy cannot be trusted
+        fetched = last_upload - first_upload <= BACKEND_FILTER_LOG;
+        for (unsigned long upload = first_upload; fetched && upload < last_upload; upload++)
+        {
+            membership_bits_set(filter->bits, filter->log_h1[upload % BACKEND_FILTER_LOG], filter->log_h2[upload % BACKEND_FILTER_LOG]);
+        }
+        __sync_fetch_and_add(&filter->version, 1);
+        filter->valid = fetched;
+    }
+    else
+    {
+        // the copy held so far stays in use, every upload through smain has been added to it
+        show_on_cmd("Membership filter of %s:%d not available\n", filter->ip, filter->port);
+    }
+    filter->fetched_at = now;
+    free(bits);
+    filter->refreshing = ZERO;
+}
+// returns 1 when the backend at ip and port certainly does not store key, ZERO when it may
+number backend_filter_rules_out(constant character *ip, number port, constant character *key)
+{
+    object backend_filter *filter = backend_filter_find(ip, port);
+    if (filter == NULL)
+    {
+        return ZERO;
+    }
+    if (time(NULL) - filter->fetched_at >= BACKEND_FILTER_REFRESH_SECONDS)
+    {
+        backend_filter_refresh(filter);
+    }
+    unsigned long version = filter->version;
+    if (!filter->valid || (version & 1))
+    {
+        return ZERO;
+    }
+    number missing = !membership_bits_may_contain(filter->bits, key);
+    __sync_synchronize();
+    return missing && filter->version == version;
+}
+// this function adds a file just uploaded to the backend at ip and port to smain's copy of its filter
+// the hashes are logged first so a fetch running at the same time adds them again after replacing the bits
+empty_return_function backend_filter_note_upload(constant character *ip, number port, constant character *key)
+{
+    object backend_filter *filter = backend_filter_find(ip, port);
+    unsigned int h1, h2;
+    if (filter == NULL)
+    {
+        return;
+    }
+    membership_filter_hash(key, &h1, &h2);
+    unsigned long upload = __sync_fetch_and_add(&filter->upload_count, 1);
+    filter->log_h1[upload % BACKEND_FILTER_LOG] = h1;
+    filter->log_h2[upload % BACKEND_FILTER_LOG] = h2;
+    membership_bits_set(filter->bits, h1, h2);
+}
+// this function maps the shared load and latency table of the backend servers
+empty_return_function setup_backend_stats()
+{
+    backend_stats_table = mmap(NULL, sizeof(object backend_stats) * BACKEND_STATS_SLOTS, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, ZERO);
+    if (backend_stats_table == MAP_FAILED)
+    {
+        perror("Load balancing of replicas disabled, mmap failed");
+        backend_stats_table = NULL;
+        return;
+    }
+    register_backends();
+}
+// returns the stats of the backend server at ip and port, or NULL when there are none
+object backend_stats *backend_stats_find(constant character *ip, number port)
+{
+    for (number i = ZERO; backend_stats_table != NULL && i < BACKEND_STATS_SLOTS; i++)
+    {
+        if (backend_stats_table[i].port == port && strcmp(backend_stats_table[i].ip, ip) == ZERO)
+        {
+            return &backend_stats_table[i];
+        }
+    }
+    return NULL;
+}
+// this function remembers that a server took elapsed microseconds to start its answer
+// several processes may write the same sample at once, a lost sample does not matter for the percentile
+empty_return_function backend_stats_record(object backend_stats *stats, long long elapsed)
+{
+    if (stats == NULL)
+    {
+        return;
+    }
+    unsigned long sample = __sync_fetch_and_add(&stats->sample_count, 1);
+    stats->samples[sample % BACKEND_LATENCY_SAMPLES] = elapsed > 0xffffffffLL ? 0xffffffffu : (unsigned int)elapsed;
+}
+// orders two latency samples for qsort
+number backend_sample_compare(constant empty_return_function *left, constant empty_return_function *right)
+{
+    unsigned int a = *(constant unsigned int *)left, b = *(constant unsigned int *)right;
+    return a < b ? -1 : a > b;
+}
+// returns how many milliseconds to wait for the server of stats before asking another replica too
+// that is the 95th percentile of its recent answers, so only the slowest 5 out of 100 requests are sent twice
+long long backend_hedge_delay(object backend_stats *stats)
+{
+    unsigned int samples[BACKEND_LATENCY_SAMPLES];
+    unsigned long count = stats != NULL ? stats->sample_count : ZERO;
+    if (count < BACKEND_LATENCY_MIN_SAMPLES)
+    {
+        return HEDGE_DEFAULT_DELAY_MS;
+    }
+    if (count > BACKEND_LATENCY_SAMPLES)
+    {
+        count = BACKEND_LATENCY_SAMPLES;
+    }
+    for (unsigned long i = ZERO; i < count; i++)
+    {
+        samples[i] = stats->samples[i];
+    }
+    qsort(samples, count, sizeof(samples[ZERO]), backend_sample_compare);
+    long long delay = (samples[count * 95 / 100] + 999) / 1000;
+    return delay > HEDGE_MINIMUM_DELAY_MS ? delay : HEDGE_MINIMUM_DELAY_MS;
+}
+// this function ends a request started with backend_request(), outcome tells the health of the server how it went
+empty_return_function backend_stats_done(object route_backend *backend, number outcome)
+{
+    object backend_stats *stats = backend_stats_find(backend->ip, backend->port);
+    if (stats != NULL)
+    {
+        __sync_fetch_and_sub(&stats->in_flight, 1);
+    }
+    backend_health_report(backend->ip, backend->port, outcome);
+}
+// this function counts a request to the server at ip and port and opens its breaker when it fails too often
+empty_return_function backend_health_report(constant character *ip, number port, number outcome)
+{
+    object backend_stats *stats = backend_stats_find(ip, port);
+    time_t now = time(NULL);
+    if (stats == NULL || outcome == REQUEST_CANCELLED)
+    {
+        return;
+    }
+    // a new window forgets the old rate, several processes may start it at once and lose a count or two
+    time_t window = stats->window_started;
+    if (now - window >= BACKEND_HEALTH_WINDOW_SECONDS && __sync_bool_compare_and_swap(&stats->window_started, window, now))
+    {
+        stats->window_requests = ZERO;
+        stats->window_failures = ZERO;
+    }
+    number requests = __sync_add_and_fetch(&stats->window_requests, 1);
+    if (outcome == REQUEST_SUCCEEDED)
+    {
+        stats->consecutive_failures = ZERO;
+        stats->unreachable = ZERO;
+        return;
+    }
+    number failures = __sync_add_and_fetch(&stats->window_failures, 1);
+    number in_a_row = __sync_add_and_fetch(&stats->consecutive_failures, 1);
+    number rate_too_high = requests >= BACKEND_ERROR_RATE_MINIMUM && failures * 100 >= requests * BACKEND_ERROR_RATE_PERCENT;
+    time_t open_until = stats->open_until;
+    // only the process which opens the breaker says so, requests let through after it expired open it again right away
+    if ((in_a_row >= BACKEND_BREAKER_FAILURES || rate_too_high) && open_until <= now && __sync_bool_compare_and_swap(&stats->open_until, open_until, now + BACKEND_BREAKER_OPEN_SECONDS))
+    {
+        show_on_cmd("Backend %s:%d failed %d times in a row (%d of %d requests), leaving it out for %d seconds\n", ip, port, in_a_row, failures, requests, BACKEND_BREAKER_OPEN_SECONDS);
+        fflush(stdout);
+    }
+}
+// returns ZERO while the breaker of the server at ip and port is open and 1 when requests may go to it
+number backend_healthy(constant character *ip, number port)
+{
+    object backend_stats *stats = backend_stats_find(ip, port);
+    return stats == NULL || stats->open_until <= time(NULL);
+}
+// this function (re)starts the background process which probes every backend server of the routing table
+// a server which cannot be reached gets its breaker opened before a client has to find out, and closed again once it is back
+empty_return_function start_health_checker()
+{
+    if (health_checker_pid > ZERO)
+    {
+        kill(health_checker_pid, SIGTERM);
+        waitpid(health_checker_pid, NULL, ZERO);
+        health_checker_pid = -1;
+    }
+    if (backend_stats_table == NULL)
+    {
+        return;
+    }
+    health_checker_pid = fork();
+    if (health_checker_pid == ZERO)
+    {
+        signal(SIGHUP, SIG_DFL);
+        for (;;)
+        {
+            health_check_pass();
+            sleep(BACKEND_PROBE_INTERVAL_SECONDS);
+        }
+    }
+    if (health_checker_pid < ZERO)
+    {
+        perror("Health checker not started, fork failed");
+    }
+}
+// this function connects once to every backend server, link_to_server() counts the ones which cannot be reached
+// the backends fork a process for every connection behind a SOMAXCONN backlog, so a busy one still accepts the probe
+// and only one which is down (or whose backlog is full) fails it
+empty_return_function health_check_pass()
+{
+    for (number i = ZERO; i < route_pool_count; i++)
+    {
+        for (number j = ZERO; j < route_pools[i].backend_count; j++)
+        {
+            object route_backend *backend = &route_pools[i].backends[j];
+            object backend_stats *stats = backend_stats_find(backend->ip, backend->port);
+            number probe_sock;
+            if (!route_backend_is_first(i, j) || stats == NULL || link_to_server(backend->ip, backend->port, &probe_sock) != ZERO)
+            {
+                continue;
+            }
+            close(probe_sock);
+            // a server left out because it could not be reached is back, one which answered too slowly waits for its breaker to expire
+            if (stats->unreachable)
+            {
+                stats->unreachable = ZERO;
+                stats->consecutive_failures = ZERO;
+                if (stats->open_until != ZERO)
+                {
+                    stats->open_until = ZERO;
+                    show_on_cmd("Backend %s:%d can be reached again\n", backend->ip, backend->port);
+                    fflush(stdout);
+                }
+            }
+        }
+    }
+}
+// returns a monotonic clock in microseconds for timing the backend servers
+long long monotonic_usec()
+{
+    object timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+// this function fills the routing table at start up, a broken configuration stops smain
+empty_return_function setup_routing_table()
+{
+    if (load_routing_table() != ZERO)
+    {
+        exit(EXIT_FAILURE);
+    }
+}
+// this function fills the routing table from the file named by SMAIN_CONFIG or from smain.conf
+// every line is "backend <pool> <ip> <port>", "route <.extension> <pool>", "replicas <pool> <copies> <write quorum>"
+// "rebalance <bytes per second>", "writeback <pool>", "handoff <pool>", "sharedmemory <pool>",
+// "embed <ip> <port> <folder> <.extension>" or "tier <seconds> [cold folder]", '#' starts a comment
+// without a configuration file .c stays in smain, .txt goes to stext and .pdf goes to spdf like before
+// it returns ZERO when the table was loaded and -1 when the configuration is missing or invalid
+number load_routing_table()
+{
+    constant character *config_path = getenv("SMAIN_CONFIG");
+    character line[string_storage_SIZE];
+    number line_number = ZERO;
+    // the table is filled from scratch, also when smain.conf is read again after SIGHUP
+    memset(route_pools, ZERO, sizeof(route_pools));
+    route_pool_count = ZERO;
+    for (number i = ZERO; i < ROUTE_TABLE_SLOTS; i++)
+    {
+        route_table[i].pool = -1;
+    }
+    rebalance_rate = REBALANCE_DEFAULT_RATE;
+    local_cold_seconds = TIERING_DEFAULT_COLD_SECONDS;
+    local_cold_folder[ZERO] = '\0';
+    // the servers smain runs keep running over a reload, only the lines of the first load start them
+    if (!embedded_servers_running)
+    {
+        embedded_server_count = ZERO;
+    }
+    FILE *config = fopen(config_path != NULL ? config_path : SMAIN_CONFIG_FILE, "r");
+    if (config == NULL)
+    {
+        // a configuration asked for by name has to be there
+        if (config_path != NULL)
+        {
+            perror(config_path);
+            return -1;
+        }
+        route_add_backend("pdf", PDF_ADDRESS, SPDF_PORT);
+        route_add_backend("text", TEXT_ADDRESS, STEXT_PORT);
+        route_add(".c", ROUTE_LOCAL_POOL);
+        route_add(".txt", "text");
+        route_add(".pdf", "pdf");
+        route_build_rings();
+        show_on_cmd("No %s found, using the built in routes\n", SMAIN_CONFIG_FILE);
+        return ZERO;
+    }
+    while (fgets(line, sizeof(line), config) != NULL)
+    {
+        character keyword[32], first[64], second[64];
+        number port = ZERO;
+        number fields;
+        number failed;
+        line_number++;
+        // drop the comment and the newline and skip lines which are empty then
+        line[strcspn(line, "#\n")] = '\0';
+        fields = sscanf(line, "%31s %63s %63s %d", keyword, first, second, &port);
+        if (fields <= ZERO)
+        {
+            continue;
+        }
+        if (strcmp(keyword, "backend") == ZERO && fields == 4)
+        {
+            failed = route_add_backend(first, second, port);
+        }
+        else if (strcmp(keyword, "route") == ZERO && fields == 3)
+        {
+            failed = route_add(first, second);
+        }
+        else if (strcmp(keyword, "replicas") == ZERO && fields == 4)
+        {
+            failed = route_set_replicas(first, second, port);
+        }
+        else if (strcmp(keyword, "rebalance") == ZERO && fields == 2)
+        {
+            character *end = NULL;
+            rebalance_rate = strtoll(first, &end, 10);
+            failed = *end != '\0' || rebalance_rate < ZERO ? -1 : ZERO;
+        }
+        else if (strcmp(keyword, "writeback") == ZERO && fields == 2)
+        {
+            failed = route_set_writeback(first);
+        }
+        else if (strcmp(keyword, "handoff") == ZERO && fields == 2)
+        {
+            failed = route_set_handoff(first);
+        }
+        else if (strcmp(keyword, "sharedmemory") == ZERO && fields == 2)
+        {
+            failed = route_set_shared_memory(first);
+        }
+        else if (strcmp(keyword, "embed") == ZERO)
+        {
+            failed = embedded_server_add(line);
+        }
+        else if (strcmp(keyword, "tier") == ZERO && (fields == 2 || fields == 3))
+        {
+            character *end = NULL;
+            local_cold_seconds = strtoll(first, &end, 10);
+            snprintf(local_cold_folder, sizeof(local_cold_folder), "%s", fields == 3 ? second : "");
+            failed = *end != '\0' || local_cold_seconds < ZERO ? -1 : ZERO;
+        }
+        else
+        {
+            failed = -1;
+        }
+        // a server which routes files differently than intended must not run
+        if (failed)
+        {
+            fprintf(stderr, "%s:%d: invalid line: %s\n", config_path != NULL ? config_path : SMAIN_CONFIG_FILE, line_number, line);
+            fclose(config);
+            return -1;
+        }
+    }
+    fclose(config);
+    route_build_rings();
+    show_on_cmd("Routing table loaded with %d pools\n", route_pool_count);
+    return ZERO;
+}
+// this function reads smain.conf again after SIGHUP, client processes forked from now on use the new table
+// a broken configuration keeps the old table, a good one starts the rebalancer for the new layout of the pools
+empty_return_function reload_routing_table()
+{
+    // kept aside in case the new configuration is broken
+    static object route_pool saved_pools[ROUTE_POOL_SLOTS];
+    static object route_entry saved_table[ROUTE_TABLE_SLOTS];
+    static character saved_cold_folder[string_storage_SIZE];
+    number saved_count = route_pool_count;
+    long long saved_rate = rebalance_rate;
+    long long saved_cold_seconds = local_cold_seconds;
+    memcpy(saved_cold_folder, local_cold_folder, sizeof(local_cold_folder));
+    memcpy(saved_pools, route_pools, sizeof(route_pools));
+    memcpy(saved_table, route_table, sizeof(route_table));
+    if (load_routing_table() != ZERO)
+    {
+        memcpy(route_pools, saved_pools, sizeof(route_pools));
+        memcpy(route_table, saved_table, sizeof(route_table));
+        route_pool_count = saved_count;
+        rebalance_rate = saved_rate;
+        local_cold_seconds = saved_cold_seconds;
+        memcpy(local_cold_folder, saved_cold_folder, sizeof(local_cold_folder));
+        show_on_cmd("Keeping the old routing table\n");
+        return;
+    }
+    register_backends();
+    start_health_checker();
+    start_rebalancer();
+    setup_writeback();
+}
+// SIGHUP handler, the table is reloaded by the accept loop and not inside the handler
+empty_return_function request_routing_reload(number signal_number)
+{
+    (empty_return_function)signal_number;
+    routing_reload_requested = 1;
+}
+// this function adds the server at ip and port to the pool pool_name, creating the pool when it is new
+// returns ZERO on success and -1 when the address is invalid or there is no room left
+number route_add_backend(constant character *pool_name, constant character *ip, number port)
+{
+    object in_addr address;
+    object route_pool *pool = route_pool_find(pool_name);
+    if (strcmp(pool_name, ROUTE_LOCAL_POOL) == ZERO || inet_pton(AF_INET, ip, &address) != 1 || port <= ZERO || port > 65535)
+    {
+        return -1;
+    }
+    if (pool == NULL)
+    {
+        if (route_pool_count == ROUTE_POOL_SLOTS || strlen(pool_name) >= sizeof(pool->name))
+        {
+            return -1;
+        }
+        pool = &route_pools[route_pool_count++];
+        snprintf(pool->name, sizeof(pool->name), "%s", pool_name);
+        pool->replicas = 1;
+        pool->write_quorum = 1;
+    }
+    if (pool->backend_count == ROUTE_POOL_BACKENDS)
+    {
+        return -1;
+    }
+    snprintf(pool->backends[pool->backend_count].ip, sizeof(pool->backends[pool->backend_count].ip), "%s", ip);
+    pool->backends[pool->backend_count].port = port;
+    pool->backend_count++;
+    return ZERO;
+}
+// this function routes files ending with extension (like ".txt") to the pool pool_name
+// returns ZERO on success and -1 for an unknown pool, a bad or repeated extension or a full table
+number route_add(constant character *extension, constant character *pool_name)
+{
+    object route_pool *pool = route_pool_find(pool_name);
+    // the local pool is created the first time something is routed to it
+    if (pool == NULL && strcmp(pool_name, ROUTE_LOCAL_POOL) == ZERO && route_pool_count < ROUTE_POOL_SLOTS)
+    {
+        pool = &route_pools[route_pool_count++];
+        snprintf(pool->name, sizeof(pool->name), "%s", ROUTE_LOCAL_POOL);
+        pool->local = 1;
+    }
+    if (pool == NULL || extension[ZERO] != '.' || strchr(extension + 1, '.') != NULL || strchr(extension, '/') != NULL || strlen(extension) >= ROUTE_EXTENSION_SIZE)
+    {
+        return -1;
+    }
+    // open addressing with linear probing, the table is never full because it has more slots than routes allowed
+    for (unsigned long probe = ZERO, slot = hot_cache_key_hash(extension); probe < ROUTE_TABLE_SLOTS; probe++, slot++)
+    {
+        object route_entry *entry = &route_table[slot % ROUTE_TABLE_SLOTS];
+        if (entry->pool < ZERO)
+        {
+            snprintf(entry->extension, sizeof(entry->extension), "%s", extension);
+            entry->pool = pool - route_pools;
+            return ZERO;
+        }
+        if (strcmp(entry->extension, extension) == ZERO)
+        {
+            return -1;
+        }
+    }
+    return -1;
+}
+// this function keeps copies of every file of the pool pool_name on that many of its servers
+// an upload is reported as done once write_quorum copies were stored, the pool's backend lines have to come first
+// returns ZERO on success and -1 for an unknown pool or numbers which do not fit its servers
+number route_set_replicas(constant character *pool_name, constant character *copies, number write_quorum)
+{
+    object route_pool *pool = route_pool_find(pool_name);
+    character *end = NULL;
+    long replicas = strtol(copies, &end, 10);
+    if (pool == NULL || pool->local || *end != '\0' || replicas < 1 || replicas > pool->backend_count || write_quorum < 1 || write_quorum > replicas)
+    {
+        return -1;
+    }
+    pool->replicas = replicas;
+    pool->write_quorum = write_quorum;
+    return ZERO;
+}
+// this function lets the pool pool_name acknowledge uploads and removals from the journal and pass them on later
+// returns ZERO on success and -1 for an unknown pool or the local one, which writes to its own disk anyway
+number route_set_writeback(constant character *pool_name)
+{
+    object route_pool *pool = route_pool_find(pool_name);
+    if (pool == NULL || pool->local)
+    {
+        return -1;
+    }
+    pool->writeback = 1;
+    return ZERO;
+}
+// this function lets dfile and ufile of the pool pool_name hand the client connection to its servers on this host
+// returns ZERO on success and -1 for an unknown pool or the local one
+number route_set_handoff(constant character *pool_name)
+{
+    object route_pool *pool = route_pool_find(pool_name);
+    if (pool == NULL || pool->local)
+    {
+        return -1;
+    }
+    pool->handoff = 1;
+    return ZERO;
+}
+// this function lets dfile of the pool pool_name read the files of its servers on this host out of shared memory
+// returns ZERO on success and -1 for an unknown pool or the local one
+number route_set_shared_memory(constant character *pool_name)
+{
+    object route_pool *pool = route_pool_find(pool_name);
+    if (pool == NULL || pool->local)
+    {
+        return -1;
+    }
+    pool->shared_memory = 1;
+    return ZERO;
+}
+// this function adds the server of an "embed <ip> <port> <folder> <.extension>" line, which smain runs itself
+// for the files of extension in ~/folder, the same server also needs its "backend" line to get any files
+// returns ZERO on success and -1 for an invalid line or when there is no room left
+number embedded_server_add(constant character *line)
+{
+    object in_addr address;
+    object embedded_server server;
+    memset(&server, ZERO, sizeof(server));
+    if (sscanf(line, "%*s %63s %d %63s %15s", server.ip, &server.port, server.folder, server.extension) != 4 || inet_pton(AF_INET, server.ip, &address) != 1 ||
+        server.port <= ZERO || server.port > 65535 || server.extension[ZERO] != '.' || strchr(server.folder, '/') != NULL || server.folder[ZERO] == '.')
+    {
+        return -1;
+    }
+    // after start up the line was checked and that is all, the running servers stay as they are
+    if (embedded_servers_running)
+    {
+        return ZERO;
+    }
+    if (embedded_server_count == EMBEDDED_SERVER_SLOTS)
+    {
+        return -1;
+    }
+    embedded_servers[embedded_server_count++] = server;
+    return ZERO;
+}
+// this function binds the servers of the "embed" lines and sets up their storage folders in this process
+// a process for each of them accepts the connections of the background processes, of smains on other hosts and of
+// clients of ours which the unix socket is used for, the clients of this smain are served by their own process
+empty_return_function setup_embedded_servers()
+{
+    embedded_servers_running = 1;
+    for (number i = ZERO; i < embedded_server_count; i++)
+    {
+        object embedded_server *server = &embedded_servers[i];
+        storage_engine_init(&server->engine, "smain", server->ip, server->port, server->folder, server->extension);
+        // a server already running at that address keeps serving it, smain then talks to it like to any other
+        if (storage_engine_listen(&server->engine) != ZERO)
+        {
+            show_on_cmd("Server %s:%d of smain.conf not started here\n", server->ip, server->port);
+            continue;
+        }
+        storage_engine_setup(&server->engine);
+        // whatever is buffered for the log would be written by both processes
+        fflush(stdout);
+        server->pid = fork();
+        if (server->pid == ZERO)
+        {
+            storage_engine_run(&server->engine);
+            exit(EXIT_FAILURE);
+        }
+        // the client processes never accept on its sockets
+        close(server->engine.tcp_sock);
+        if (server->engine.local_sock >= ZERO)
+        {
+            close(server->engine.local_sock);
+        }
+        server->started = server->pid > ZERO;
+        show_on_cmd("Serving %s files in ~/%s as %s:%d in this process\n", server->extension, server->folder, server->ip, server->port);
+    }
+}
+// returns the storage engine of the server at ip and port when smain runs it itself, NULL otherwise
+object storage_engine *embedded_engine_for(constant character *ip, number port)
+{
+    for (number i = ZERO; i < embedded_server_count; i++)
+    {
+        if (embedded_servers[i].started && embedded_servers[i].port == port && strcmp(embedded_servers[i].ip, ip) == ZERO)
+        {
+            return &embedded_servers[i].engine;
+        }
+    }
+    return NULL;
+}
+// returns 1 when smain runs a server of pool itself
+number route_pool_embedded(object route_pool *pool)
+{
+    for (number i = ZERO; i < pool->backend_count; i++)
+    {
+        if (embedded_engine_for(pool->backends[i].ip, pool->backends[i].port) != NULL)
+        {
+            return 1;
+        }
+    }
+    return ZERO;
+}
+// returns how many servers of pool keep a copy of each file
+number route_replica_count(object route_pool *pool)
+{
+    return pool->replicas < pool->backend_count ? pool->replicas : pool->backend_count;
+}
+// this function sorts the first count servers of order so that the one with the fewest requests in flight comes first
+// equally busy replicas start at a different one in every client process, so idle replicas share the reads too
+empty_return_function route_order_by_load(object route_pool *pool, number *order, number count)
+{
+    number load[ROUTE_POOL_BACKENDS];
+    number rotated[ROUTE_POOL_BACKENDS];
+    if (count < 2)
+    {
+        return;
+    }
+    for (number i = ZERO; i < count; i++)
+    {
+        rotated[i] = order[(i + getpid()) % count];
+        object backend_stats *stats = backend_stats_find(pool->backends[rotated[i]].ip, pool->backends[rotated[i]].port);
+        load[i] = stats != NULL ? stats->in_flight : ZERO;
+    }
+    // insertion sort, there are only a few replicas
+    for (number i = 1; i < count; i++)
+    {
+        number server = rotated[i], busy = load[i], j = i;
+        for (; j > ZERO && load[j - 1] > busy; j--)
+        {
+            rotated[j] = rotated[j - 1];
+            load[j] = load[j - 1];
+        }
+        rotated[j] = server;
+        load[j] = busy;
+    }
+    memcpy(order, rotated, count * sizeof(number));
+}
+// returns the pool called pool_name, or NULL when there is none
+object route_pool *route_pool_find(constant character *pool_name)
+{
+    for (number i = ZERO; i < route_pool_count; i++)
+    {
+        if (strcmp(route_pools[i].name, pool_name) == ZERO)
+        {
+            return &route_pools[i];
+        }
+    }
+    return NULL;
+}
+// returns the extension of the file name at the end of document_name, like ".txt" for "f1/a.config.txt"
+// only the last '.' of the file name counts, a name without one or starting with it has no extension and NULL is returned
+constant character *route_extension(constant character *document_name)
+{
+    constant character *last_slash = strrchr(document_name, '/');
+    constant character *file_name = last_slash != NULL ? last_slash + 1 : document_name;
+    constant character *dot = strrchr(file_name, '.');
+    return dot != NULL && dot != file_name ? dot : NULL;
+}
+// returns the pool storing document_name, or NULL when its extension is not routed anywhere
+object route_pool *route_lookup(constant character *document_name)
+{
+    constant character *extension = route_extension(document_name);
+    return extension != NULL ? route_lookup_extension(extension) : NULL;
+}
+// returns the pool storing files ending with extension (like ".txt"), or NULL when it is not routed anywhere
+object route_pool *route_lookup_extension(constant character *extension)
+{
+    for (unsigned long probe = ZERO, slot = hot_cache_key_hash(extension); probe < ROUTE_TABLE_SLOTS; probe++, slot++)
+    {
+        object route_entry *entry = &route_table[slot % ROUTE_TABLE_SLOTS];
+        if (entry->pool < ZERO)
+        {
+            return NULL;
+        }
+        if (strcmp(entry->extension, extension) == ZERO)
+        {
+            return &route_pools[entry->pool];
+        }
+    }
+    return NULL;
+}
+// this function fills order with the servers of pool in the order they follow key on the pool's hash ring (route_ring.h)
+// and returns how many there are, the first ones keep the copies of the key
+number route_backends_for(object route_pool *pool, constant character *key, number *order)
+{
+    return route_ring_order(pool->ring, pool->ring_size, pool->backend_count, key, order);
+}
+// this function places ROUTE_VIRTUAL_NODES points for every server of every pool on the pool's ring
+empty_return_function route_build_rings()
+{
+    for (number i = ZERO; i < route_pool_count; i++)
+    {
+        object route_pool *pool = &route_pools[i];
+        pool->ring_size = ZERO;
+        for (number j = ZERO; j < pool->backend_count; j++)
+        {
+            route_ring_add(pool->ring, &pool->ring_size, pool->backends[j].ip, pool->backends[j].port, j);
+        }
+        route_ring_sort(pool->ring, pool->ring_size);
+    }
+}
+// returns 1 when no earlier pool or position names the same server, so loops over all servers visit each one once
+number route_backend_is_first(number pool_index, number backend_index)
+{
+    object route_backend *backend = &route_pools[pool_index].backends[backend_index];
+    for (number i = ZERO; i <= pool_index; i++)
+    {
+        for (number j = ZERO; j < (i == pool_index ? backend_index : route_pools[i].backend_count); j++)
+        {
+            if (route_pools[i].backends[j].port == backend->port && strcmp(route_pools[i].backends[j].ip, backend->ip) == ZERO)
+            {
+                return ZERO;
+            }
+        }
+    }
+    return 1;
+}
+// this function maps the shared state of the rebalancer and starts it
+empty_return_function setup_rebalancer()
+{
+    rebalance = mmap(NULL, sizeof(object rebalance_state), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, ZERO);
+    if (rebalance == MAP_FAILED)
+    {
+        perror("Rebalancer disabled, mmap failed");
+        rebalance = NULL;
+        return;
+    }
+    start_rebalancer();
+}
+// this function (re)starts the background process which moves files to the server owning them now
+// it only runs when some pool has more than one server, a pool of one server owns everything it stores
+empty_return_function start_rebalancer()
+{
+    number sharded = ZERO;
+    if (rebalancer_pid > ZERO)
+    {
+        kill(rebalancer_pid, SIGTERM);
+        waitpid(rebalancer_pid, NULL, ZERO);
+        rebalancer_pid = -1;
+    }
+    for (number i = ZERO; i < route_pool_count; i++)
+    {
+        sharded |= route_pools[i].backend_count > 1;
+    }
+    if (rebalance == NULL || rebalance_rate == ZERO || !sharded)
+    {
+        return;
+    }
+    // until the first pass is done any file may still be on its old server
+    rebalance->forwarding_until = time(NULL) + REBALANCE_FORWARD_SECONDS;
+    rebalancer_pid = fork();
+    if (rebalancer_pid == ZERO)
+    {
+        signal(SIGHUP, SIG_DFL);
+        for (number first_pass = 1;; first_pass = ZERO)
+        {
+            rebalance_pass(first_pass);
+            sleep(REBALANCE_INTERVAL_SECONDS);
+        }
+    }
+    if (rebalancer_pid < ZERO)
+    {
+        perror("Rebalancer not started, fork failed");
+    }
+}
+// returns 1 while files may still be on a server of their pool which does not own them
+number rebalance_forwarding()
+{
+    return rebalance != NULL && time(NULL) < rebalance->forwarding_until;
+}
+// this function asks every server of every sharded pool for its files and puts each file on the servers owning it
+// a file is owned by the first replicas servers after its key on the ring, missing copies are made there
+// and a copy on any other server is removed once all owners have one, that also repairs replicas an upload missed
+// during the first pass after the pools changed the forwarding window stays open until every server was looked at
+empty_return_function rebalance_pass(number first_pass)
+{
+    object timespec started;
+    long long copied = ZERO;
+    number order[ROUTE_POOL_BACKENDS];
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    for (number i = ZERO; i < route_pool_count; i++)
+    {
+        object route_pool *pool = &route_pools[i];
+        character **keys[ROUTE_POOL_BACKENDS];
+        number counts[ROUTE_POOL_BACKENDS];
+        if (pool->local || pool->backend_count < 2)
+        {
+            continue;
+        }
+        // all lists are read first and sorted, so a copy is only made where the owner does not have the file yet
+        for (number j = ZERO; j < pool->backend_count; j++)
+        {
+            keys[j] = rebalance_list(&pool->backends[j], &counts[j]);
+            if (keys[j] != NULL)
+            {
+                qsort(keys[j], counts[j], sizeof(character *), rebalance_key_compare);
+            }
+        }
+        number replicas = route_replica_count(pool);
+        for (number j = ZERO; j < pool->backend_count; j++)
+        {
+            for (number k = ZERO; k < counts[j]; k++)
+            {
+                character *key = keys[j][k];
+                number owner = ZERO, placed = 1;
+                // owners which got their copy in this pass, in case the file has to be taken back
+                number copied_to[ROUTE_POOL_BACKENDS];
+                number copies = ZERO;
+                if (first_pass)
+                {
+                    rebalance->forwarding_until = time(NULL) + REBALANCE_FORWARD_SECONDS;
+                }
+                // a server can be in several pools, every pool only moves its own extensions
+                if (route_lookup(key) != pool)
+                {
+                    continue;
+                }
+                route_backends_for(pool, key, order);
+                for (number r = ZERO; r < replicas; r++)
+                {
+                    if (order[r] == j)
+                    {
+                        owner = 1;
+                        continue;
+                    }
+                    if (keys[order[r]] != NULL && bsearch(&key, keys[order[r]], counts[order[r]], sizeof(character *), rebalance_key_compare) != NULL)
+                    {
+                        continue;
+                    }
+                    rebalance->forwarding_until = time(NULL) + REBALANCE_FORWARD_SECONDS;
+                    number result = rebalance_copy(&pool->backends[j], &pool->backends[order[r]], key, &started, &copied);
+                    if (result < ZERO)
+                    {
+                        placed = ZERO;
+                    }
+                    else if (result > ZERO)
+                    {
+                        copied_to[copies++] = order[r];
+                    }
+                }
+                if (owner || !placed)
+                {
+                    continue;
+                }
+                // every owner has the file now, the copy on this server is only in the way
+                // a client which removed the file during the copy must not see it come back on the owners
+                rebalance->forwarding_until = time(NULL) + REBALANCE_FORWARD_SECONDS;
+                if (rebalance_remove(&pool->backends[j], key) != ZERO)
+                {
+                    for (number c = ZERO; c < copies; c++)
+                    {
+                        rebalance_remove(&pool->backends[copied_to[c]], key);
+                    }
+                }
+                else
+                {
+                    rebalance->moved_files++;
+                    show_on_cmd("Rebalancer moved %s away from %s:%d\n", key, pool->backends[j].ip, pool->backends[j].port);
+                }
+            }
+        }
+        for (number j = ZERO; j < pool->backend_count; j++)
+        {
+            for (number k = ZERO; k < counts[j]; k++)
+            {
+                free(keys[j][k]);
+            }
+            free(keys[j]);
+        }
+    }
+}
+// orders the keys of a listing for qsort and bsearch
+number rebalance_key_compare(constant empty_return_function *left, constant empty_return_function *right)
+{
+    return strcmp(*(character *constant *)left, *(character *constant *)right);
+}
+// this function returns every file stored on backend as an array of count allocated keys
+// the whole list is read before anything is moved, it is sorted and looked up in to tell which owners have a copy already
+character **rebalance_list(object route_backend *backend, number *count)
+{
+    character **keys = NULL;
+    number capacity = ZERO;
+    character *line = NULL;
+    size_t line_size = ZERO;
+    number backend_sock;
+    *count = ZERO;
+    // a server which is down is looked at again in the next pass
+    if (!backend_healthy(backend->ip, backend->port) || link_to_server(backend->ip, backend->port, &backend_sock) != ZERO)
+    {
+        return NULL;
+    }
+    send(backend_sock, "list", strlen("list"), ZERO);
+    FILE *listing = fdopen(backend_sock, "r");
+    if (listing == NULL)
+    {
+        close(backend_sock);
+        return NULL;
+    }
+    while (getline(&line, &line_size, listing) > ZERO && strcmp(line, END_OF_LIST) != ZERO)
+    {
+        line[strcspn(line, "\n")] = '\0';
+        // names with spaces cannot be sent as a command argument, clients cannot create them anyway
+        if (line[ZERO] == '\0' || strchr(line, ' ') != NULL)
+        {
+            continue;
+        }
+        if (*count == capacity)
+        {
+            capacity = capacity == ZERO ? 256 : capacity * 2;
+            character **grown = realloc(keys, capacity * sizeof(character *));
+            if (grown == NULL)
+            {
+                break;
+            }
+            keys = grown;
+        }
+        keys[(*count)++] = strdup(line);
+    }
+    free(line);
+    fclose(listing);
+    return keys;
+}
+// this function copies key from source to target without replacing a newer copy there
+// started and copied keep track of the pass so the copying is slowed down to rebalance_rate bytes per second
+// it returns 1 when target stored the copy, ZERO when target had the file already and -1 when the copy failed
+number rebalance_copy(object route_backend *source, object route_backend *target, constant character *key, object timespec *started, long long *copied)
+{
+    character line[string_storage_SIZE];
+    character string_storage[string_storage_SIZE];
+    long long size = ZERO;
+    number source_sock, target_sock;
+    // nothing is copied to a server which is down, the file stays where it is until a later pass
+    if (!backend_healthy(target->ip, target->port) || link_to_server(source->ip, source->port, &source_sock) != ZERO)
+    {
+        return -1;
+    }
+    snprintf(line, sizeof(line), "fetch %s", key);
+    send(source_sock, line, strlen(line), ZERO);
+    // a file removed since the listing is simply skipped
+    if (recv_line(source_sock, line, sizeof(line)) != ZERO || sscanf(line, "SIZE %lld", &size) != 1)
+    {
+        close(source_sock);
+        return -1;
+    }
+    if (link_to_server(target->ip, target->port, &target_sock) != ZERO)
+    {
+        close(source_sock);
+        return -1;
+    }
+    snprintf(line, sizeof(line), "store %s %lld", key, size);
+    send(target_sock, line, strlen(line), ZERO);
+    if (recv_line(target_sock, line, sizeof(line)) != ZERO || strcmp(line, "READY") != ZERO)
+    {
+        close(source_sock);
+        close(target_sock);
+        // the target has its own copy, uploaded after the pool changed or by another source
+        return strcmp(line, "EXISTS") == ZERO ? ZERO : -1;
+    }
+    long long moved = ZERO;
+    while (moved < size)
+    {
+        ssize_t got = recv(source_sock, string_storage, size - moved < (long long)sizeof(string_storage) ? size - moved : (long long)sizeof(string_storage), ZERO);
+        if (got <= ZERO || read_engine_send_all(target_sock, string_storage, got) != ZERO)
+        {
+            break;
+        }
+        moved += got;
+    }
+    close(source_sock);
+    number stored = moved == size && recv_line(target_sock, line, sizeof(line)) == ZERO && strcmp(line, "STORED") == ZERO;
+    close(target_sock);
+    if (stored)
+    {
+        // smain's copy of the target's filter has to know about the file before the first download asks for it
+        backend_filter_note_upload(target->ip, target->port, key);
+        rebalance->moved_bytes += size;
+        show_on_cmd("Rebalancer copied %s from %s:%d to %s:%d\n", key, source->ip, source->port, target->ip, target->port);
+    }
+    rebalance_throttle(started, copied, size);
+    return stored ? 1 : -1;
+}
+// this function sleeps until the size bytes just copied and the bytes copied before fit into rebalance_rate
+empty_return_function rebalance_throttle(object timespec *started, long long *copied, long long size)
+{
+    *copied += size;
+    object timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = (now.tv_sec - started->tv_sec) + (now.tv_nsec - started->tv_nsec) / 1e9;
+    double allowed = (double)*copied / rebalance_rate;
+    if (allowed > elapsed)
+    {
+        usleep((useconds_t)((allowed - elapsed) * 1e6));
+    }
+}
+// this function removes key from backend with rmfile, it returns ZERO when the backend deleted it
+number rebalance_remove(object route_backend *backend, constant character *key)
+{
+    character line[string_storage_SIZE];
+    number backend_sock;
+    if (link_to_server(backend->ip, backend->port, &backend_sock) != ZERO)
+    {
+        return -1;
+    }
+    snprintf(line, sizeof(line), "rmfile %s", key);
+    send(backend_sock, line, strlen(line), ZERO);
+    number len = recv(backend_sock, line, sizeof(line) - 1, ZERO);
+    close(backend_sock);
+    line[len > ZERO ? len : ZERO] = '\0';
+    return strstr(line, "deleted successfully") != NULL ? ZERO : -1;
+}
+// this function opens the journal of the write-back pools and starts the process passing it on to the servers
+// the journal is only created for a pool marked "writeback", but entries left by an earlier run are passed on in any case
+// it is called again after a reload, a pool which became write-back then gets the journal as well
+empty_return_function setup_writeback()
+{
+    character journal_path[string_storage_SIZE];
+    number needed = ZERO;
+    if (writeback == NULL)
+    {
+        for (number i = ZERO; i < route_pool_count; i++)
+        {
+            needed |= route_pools[i].writeback;
+        }
+        snprintf(journal_path, sizeof(journal_path), "%s/%s", return_home_value(), WRITEBACK_FOLDER);
+        if (!needed && access(journal_path, F_OK) != ZERO)
+        {
+            return;
+        }
+        if (mkdir(journal_path, 0700) != ZERO && errno != EEXIST)
+        {
+            perror("mkdir journal");
+        }
+        writeback_dir_fd = open(journal_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        writeback = mmap(NULL, sizeof(object writeback_journal), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, ZERO);
+        // without the journal every upload goes to its servers right away like for any other pool
+        if (writeback_dir_fd < ZERO || writeback == MAP_FAILED)
+        {
+            perror("Write-back disabled, the journal cannot be opened");
+            if (writeback_dir_fd >= ZERO)
+            {
+                close(writeback_dir_fd);
+                writeback_dir_fd = -1;
+            }
+            if (writeback != MAP_FAILED)
+            {
+                munmap(writeback, sizeof(object writeback_journal));
+            }
+            writeback = NULL;
+            return;
+        }
+        writeback_recover();
+    }
+    start_writeback_forwarder();
+}
+// this function fills the journal table from the entries on disk, an entry is named after its sequence
+// and starts with the string_storage_SIZE bytes of its ufile or rmfile command, the key is worked out from that again
+// entries which were still being written when smain stopped were never acknowledged and are removed
+empty_return_function writeback_recover()
+{
+    number list_fd = openat(writeback_dir_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *journal = list_fd >= ZERO ? fdopendir(list_fd) : NULL;
+    object dirent *item;
+    number recovered = ZERO;
+    writeback->next_sequence = 1;
+    if (journal == NULL)
+    {
+        perror("Failed to read the journal");
+        if (list_fd >= ZERO)
+        {
+            close(list_fd);
+        }
+        return;
+    }
+    while ((item = readdir(journal)) != NULL)
+    {
+        character header[string_storage_SIZE];
+        character command[string_storage_SIZE], first[string_storage_SIZE], second[string_storage_SIZE];
+        character folder_name[string_storage_SIZE], base_filename[string_storage_SIZE];
+        character *end = NULL;
+        if (strncmp(item->d_name, WRITEBACK_TEMP_PREFIX, strlen(WRITEBACK_TEMP_PREFIX)) == ZERO)
+        {
+            unlinkat(writeback_dir_fd, item->d_name, ZERO);
+            continue;
+        }
+        unsigned long long sequence = strtoull(item->d_name, &end, 10);
+        if (item->d_name[ZERO] < '0' || item->d_name[ZERO] > '9' || *end != '\0')
+        {
+            continue;
+        }
+        number entry_fd = openat(writeback_dir_fd, item->d_name, O_RDONLY | O_CLOEXEC);
+        number got = entry_fd >= ZERO ? pread(entry_fd, header, sizeof(header), ZERO) : -1;
+        if (entry_fd >= ZERO)
+        {
+            close(entry_fd);
+        }
+        header[sizeof(header) - 1] = '\0';
+        number fields = got == sizeof(header) ? sscanf(header, "%1023s %1023s %1023s", command, first, second) : ZERO;
+        if (recovered == WRITEBACK_SLOTS || !((fields == 3 && strcmp(command, "ufile") == ZERO) || (fields >= 2 && strcmp(command, "rmfile") == ZERO)))
+        {
+            show_on_cmd("Journal entry %s is not passed on, it is damaged or the journal is full\n", item->d_name);
+            continue;
+        }
+        object writeback_entry *entry = &writeback->entries[recovered++];
+        entry->sequence = sequence;
+        entry->removal = strcmp(command, "rmfile") == ZERO;
+        if (entry->removal)
+        {
+            build_store_key("", first, entry->key, sizeof(entry->key));
+        }
+        else
+        {
+            split_path(first, folder_name, base_filename);
+            build_store_key(second, base_filename, entry->key, sizeof(entry->key));
+        }
+        entry->state = WRITEBACK_PENDING;
+        if (sequence >= writeback->next_sequence)
+        {
+            writeback->next_sequence = sequence + 1;
+        }
+    }
+    closedir(journal);
+    if (recovered > ZERO)
+    {
+        show_on_cmd("Write-back journal holds %d entries from the last run\n", recovered);
+    }
+}
+// these two guard the journal table, the forwarder is stopped with SIGTERM on a reload and must not die holding the lock
+empty_return_function writeback_lock()
+{
+    sigset_t blocked;
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGTERM);
+    sigprocmask(SIG_BLOCK, &blocked, NULL);
+    while (__sync_lock_test_and_set(&writeback->lock, 1))
+    {
+        sched_yield();
+    }
+}
+empty_return_function writeback_unlock()
+{
+    sigset_t blocked;
+    __sync_lock_release(&writeback->lock);
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGTERM);
+    sigprocmask(SIG_UNBLOCK, &blocked, NULL);
+}
+// returns the number of journal slots which can take another entry
+number writeback_free_slots()
+{
+    number free_slots = ZERO;
+    writeback_lock();
+    for (number i = ZERO; i < WRITEBACK_SLOTS; i++)
+    {
+        free_slots += writeback->entries[i].state == WRITEBACK_FREE;
+    }
+    writeback_unlock();
+    return free_slots;
+}
+// this function looks for the newest entry of key which has not been passed on yet, sequence and removal may be NULL
+// it returns ZERO when there is one and -1 when the servers are up to date for key
+number writeback_latest(constant character *key, unsigned long long *sequence, number *removal)
+{
+    number latest = -1;
+    unsigned long long latest_sequence = ZERO;
+    number latest_removal = ZERO;
+    writeback_lock();
+    for (number i = ZERO; i < WRITEBACK_SLOTS; i++)
+    {
+        object writeback_entry *entry = &writeback->entries[i];
+        if (entry->state == WRITEBACK_PENDING && (latest < ZERO || entry->sequence > latest_sequence) && strcmp(entry->key, key) == ZERO)
+        {
+            latest = i;
+            latest_sequence = entry->sequence;
+            latest_removal = entry->removal;
+        }
+    }
+    writeback_unlock();
+    if (latest >= ZERO && sequence != NULL)
+    {
+        *sequence = latest_sequence;
+    }
+    if (latest >= ZERO && removal != NULL)
+    {
+        *removal = latest_removal;
+    }
+    return latest >= ZERO ? ZERO : -1;
+}
+// this function writes a new journal entry under a temporary name, the command followed by the file read from source
+// source is the client socket of an upload and -1 for a removal, the file ends with a chunk shorter than string_storage_SIZE
+// the client data is read to its end also when the entry cannot be written, so the next command is not mixed up with it
+// it returns ZERO once the entry is on disk, spool_name then holds its name
+number writeback_spool(constant character *command, number source, character *spool_name, size_t spool_name_size)
+{
+    character file_string_storage[string_storage_SIZE];
+    ssize_t document_byte_size;
+    number complete = source < ZERO;
+    // only the file goes into the entry, not the byte which ended it on a short chunk, the forwarder adds that again
+    long long size = dfs_protocol_upload_size(command, string_storage_SIZE);
+    long long received = ZERO;
+    snprintf(spool_name, spool_name_size, "%s%d", WRITEBACK_TEMP_PREFIX, getpid());
+    number spool_fd = openat(writeback_dir_fd, spool_name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (spool_fd < ZERO)
+    {
+        perror("Failed to write to the journal");
+    }
+    // the command goes first and is sent to the servers as it is when the entry is passed on
+    number failed = spool_fd < ZERO || write_all(spool_fd, command, string_storage_SIZE) != ZERO;
+    while (source >= ZERO && (document_byte_size = recv(source, file_string_storage, sizeof(file_string_storage), ZERO)) > ZERO)
+    {
+        failed = failed || write_all(spool_fd, file_string_storage, dfs_protocol_file_part(size, received, document_byte_size)) != ZERO;
+        received += document_byte_size;
+        if (document_byte_size < sizeof(file_string_storage))
+        {
+            complete = 1;
+            break;
+        }
+    }
+    // a client which went away in the middle of its file has not uploaded anything
+    failed = failed || !complete || fsync(spool_fd) != ZERO;
+    if (spool_fd >= ZERO)
+    {
+        close(spool_fd);
+        if (failed)
+        {
+            unlinkat(writeback_dir_fd, spool_name, ZERO);
+        }
+    }
+    return failed ? -1 : ZERO;
+}
+// this function gives the entry spool_name its sequence, from then on it is part of the journal and will be passed on
+// it returns ZERO on success and -1 when the journal is full, the entry is removed then
+number writeback_commit(constant character *spool_name, constant character *key, number removal)
+{
+    character entry_name[32];
+    number slot = -1;
+    writeback_lock();
+    for (number i = ZERO; i < WRITEBACK_SLOTS && slot < ZERO; i++)
+    {
+        if (writeback->entries[i].state == WRITEBACK_FREE)
+        {
+            slot = i;
+        }
+    }
+    // the name is taken inside the lock so that two entries of the same key are numbered in the order they were acknowledged
+    snprintf(entry_name, sizeof(entry_name), "%020llu", writeback->next_sequence);
+    if (slot >= ZERO && renameat(writeback_dir_fd, spool_name, writeback_dir_fd, entry_name) == ZERO)
+    {
+        object writeback_entry *entry = &writeback->entries[slot];
+        entry->sequence = writeback->next_sequence++;
+        entry->removal = removal;
+        snprintf(entry->key, sizeof(entry->key), "%s", key);
+        entry->state = WRITEBACK_PENDING;
+    }
+    else
+    {
+        slot = -1;
+    }
+    writeback_unlock();
+    if (slot < ZERO)
+    {
+        unlinkat(writeback_dir_fd, spool_name, ZERO);
+        return -1;
+    }
+    // the new name has to be on disk as well before the client is told
+    fsync(writeback_dir_fd);
+    return ZERO;
+}
+// this function takes the upload of a file of a write-back pool into the journal and answers the client once it is on disk
+// it returns -1 without reading anything from the client when the journal cannot take it, the upload goes to the servers then
+// that is only done when nothing of the same file waits in the journal, which the direct upload would overtake
+number writeback_upload(number channel_for_client, object route_pool *pool, character *document_name, constant character *cache_key, character *string_storage)
+{
+    character spool_name[64];
+    character reply_from_server[string_storage_SIZE];
+    if (writeback == NULL || (writeback_free_slots() == ZERO && writeback_latest(cache_key, NULL, NULL) != ZERO))
+    {
+        return -1;
+    }
+    if (writeback_spool(string_storage, channel_for_client, spool_name, sizeof(spool_name)) != ZERO)
+    {
+        snprintf(reply_from_server, sizeof(reply_from_server), "File %s upload failed, it could not be written to the journal\n", document_name);
+    }
+    else if (writeback_commit(spool_name, cache_key, ZERO) != ZERO)
+    {
+        snprintf(reply_from_server, sizeof(reply_from_server), "File %s upload failed, the journal is full\n", document_name);
+    }
+    else
+    {
+        show_on_cmd("Upload of %s kept in the journal for pool %s\n", cache_key, pool->name);
+        snprintf(reply_from_server, sizeof(reply_from_server), "File %s uploaded successfully\n", document_name);
+        // the cached copy is older than the journal now
+        hot_cache_invalidate(cache_key);
+    }
+    send(channel_for_client, reply_from_server, strlen(reply_from_server), ZERO);
+    return ZERO;
+}
+// this function answers a dfile from the journal when the newest version of the file has not been passed on yet
+// it returns ZERO when the client got its answer and -1 when the servers have the newest version
+number writeback_download(number channel_for_client, character *document_name, constant character *cache_key)
+{
+    character entry_name[32];
+    character file_string_storage[string_storage_SIZE];
+    character reply_from_server[string_storage_SIZE];
+    unsigned long long sequence;
+    number removal;
+    object stat info;
+    if (writeback == NULL || writeback_latest(cache_key, &sequence, &removal) != ZERO)
+    {
+        return -1;
+    }
+    // the file was removed after it was uploaded, that removal is still on its way to the servers
+    if (removal)
+    {
+        send_file_not_found(channel_for_client, document_name);
+        return ZERO;
+    }
+    snprintf(entry_name, sizeof(entry_name), "%020llu", sequence);
+    number entry_fd = openat(writeback_dir_fd, entry_name, O_RDONLY | O_CLOEXEC);
+    // the forwarder has passed it on in the meantime, so the servers have it now
+    if (entry_fd < ZERO)
+    {
+        return -1;
+    }
+    if (fstat(entry_fd, &info) != ZERO || info.st_size < string_storage_SIZE)
+    {
+        close(entry_fd);
+        return -1;
+    }
+    show_on_cmd("Sending %s from the journal\n", cache_key);
+    // the file starts after the command of the entry
+    off_t size = info.st_size - string_storage_SIZE;
+    for (off_t offset = string_storage_SIZE; offset < info.st_size;)
+    {
+        ssize_t got = pread(entry_fd, file_string_storage, sizeof(file_string_storage), offset);
+        if (got <= ZERO || read_engine_send_all(channel_for_client, file_string_storage, got) != ZERO)
+        {
+            perror("send file");
+            break;
+        }
+        offset += got;
+    }
+    close(entry_fd);
+    // client waits for a chunk shorter than its buffer, so a file ending on a full chunk gets one more byte
+    if (size % string_storage_SIZE == ZERO)
+    {
+        send(channel_for_client, "", 1, ZERO);
+    }
+    sleep(5);
+    snprintf(reply_from_server, sizeof(reply_from_server), "File %s downloaded successfully" DFS_PROTOCOL_FILE_SIZE "\n", document_name, (long long)size);
+    send(channel_for_client, reply_from_server, strlen(reply_from_server), ZERO);
+    return ZERO;
+}
+// this function fills stat for cache_key when the journal still holds an upload or a removal of it
+// returns ZERO for an upload, 1 for a removal, the file is not stored then, and -1 when nothing of it waits in the journal
+number writeback_file_stat(constant character *cache_key, object file_stat *stat)
+{
+    character entry_name[32];
+    unsigned long long sequence;
+    number removal;
+    object stat info;
+    if (writeback == NULL || writeback_latest(cache_key, &sequence, &removal) != ZERO)
+    {
+        return -1;
+    }
+    if (removal)
+    {
+        return 1;
+    }
+    snprintf(entry_name, sizeof(entry_name), "%020llu", sequence);
+    number entry_fd = openat(writeback_dir_fd, entry_name, O_RDONLY | O_CLOEXEC);
+    // the forwarder has passed it on in the meantime, so the servers have it now
+    if (entry_fd < ZERO)
+    {
+        return -1;
+    }
+    number usable = fstat(entry_fd, &info) == ZERO && info.st_size >= string_storage_SIZE;
+    close(entry_fd);
+    if (!usable)
+    {
+        return -1;
+    }
+    // the file starts after the command of the entry, its hash is only taken once a server stores it
+    stat->size = info.st_size - string_storage_SIZE;
+    stat->mtime = info.st_mtim;
+    snprintf(stat->hash, sizeof(stat->hash), "%s", FILE_STAT_UNKNOWN);
+    stat->tier = FILE_STAT_JOURNAL;
+    return ZERO;
+}
+// this function answers a rmfile while an upload of the same file still waits in the journal, the removal is put behind it
+// it returns ZERO when the client got its answer and -1 when nothing of the file waits, the servers remove it then
+number writeback_remove(number channel_for_client, character *document_name, constant character *cache_key, character *string_storage)
+{
+    character spool_name[64];
+    character reply_from_server[string_storage_SIZE];
+    number removal;
+    if (writeback == NULL || writeback_latest(cache_key, NULL, &removal) != ZERO)
+    {
+        return -1;
+    }
+    if (removal)
+    {
+        snprintf(reply_from_server, sizeof(reply_from_server), "File %s not found.\n", document_name);
+    }
+    // removing it from the servers now would be undone when the waiting upload is passed on
+    else if (writeback_spool(string_storage, -1, spool_name, sizeof(spool_name)) != ZERO || writeback_commit(spool_name, cache_key, 1) != ZERO)
+    {
+        snprintf(reply_from_server, sizeof(reply_from_server), "File %s could not be removed, the journal cannot take the removal.\n", document_name);
+    }
+    else
+    {
+        hot_cache_invalidate(cache_key);
+        snprintf(reply_from_server, sizeof(reply_from_server), "File %s deleted successfully.\n", document_name);
+    }
+    send(channel_for_client, reply_from_server, strlen(reply_from_server), ZERO);
+    return ZERO;
+}
+// this function (re)starts the background process which passes the journal on to the servers
+empty_return_function start_writeback_forwarder()
+{
+    if (writeback_pid > ZERO)
+    {
+        kill(writeback_pid, SIGTERM);
+        waitpid(writeback_pid, NULL, ZERO);
+        writeback_pid = -1;
+    }
+    if (writeback == NULL)
+    {
+        return;
+    }
+    fflush(stdout);
+    writeback_pid = fork();
+    if (writeback_pid == ZERO)
+    {
+        signal(SIGHUP, SIG_DFL);
+        for (;;)
+        {
+            number passed_on = writeback_forward_pass();
+            if (passed_on < ZERO)
+            {
+                sleep(WRITEBACK_RETRY_SECONDS);
+            }
+            else if (passed_on == ZERO)
+            {
+                usleep(WRITEBACK_POLL_USEC);
+            }
+        }
+    }
+    if (writeback_pid < ZERO)
+    {
+        perror("Write-back forwarder not started, fork failed");
+    }
+}
+// orders journal slots by the sequence of their entries
+number writeback_sequence_compare(constant empty_return_function *left, constant empty_return_function *right)
+{
+    unsigned long long first = writeback->entries[*(constant number *)left].sequence;
+    unsigned long long second = writeback->entries[*(constant number *)right].sequence;
+    return first < second ? -1 : first > second;
+}
+// this function passes every waiting entry on to its servers, oldest first
+// once a pool did not take an entry the later entries of that pool wait for the next pass, that keeps them in order
+// it returns the number of entries passed on, or -1 when some of them have to be tried again later
+number writeback_forward_pass()
+{
+    number slots[WRITEBACK_SLOTS];
+    number stalled[ROUTE_POOL_SLOTS] = {ZERO};
+    number count = ZERO, passed_on = ZERO, failed = ZERO;
+    writeback_lock();
+    for (number i = ZERO; i < WRITEBACK_SLOTS; i++)
+    {
+        if (writeback->entries[i].state == WRITEBACK_PENDING)
+        {
+            slots[count++] = i;
+        }
+    }
+    writeback_unlock();
+    // only the forwarder frees slots, so the ones found stay put while they are passed on
+    qsort(slots, count, sizeof(slots[ZERO]), writeback_sequence_compare);
+    for (number i = ZERO; i < count; i++)
+    {
+        object writeback_entry *entry = &writeback->entries[slots[i]];
+        character key[string_storage_SIZE];
+        character entry_name[32];
+        snprintf(key, sizeof(key), "%s", entry->key);
+        snprintf(entry_name, sizeof(entry_name), "%020llu", entry->sequence);
+        object route_pool *pool = route_lookup(key);
+        // a file whose extension is not routed to servers anymore stays in the journal until smain.conf routes it again
+        if (pool == NULL || pool->local)
+        {
+            show_on_cmd("Journal entry %s for %s has no servers to go to\n", entry_name, key);
+            failed = 1;
+            continue;
+        }
+        if (stalled[pool - route_pools])
+        {
+            continue;
+        }
+        if (writeback_forward(pool, entry->sequence, entry->removal, key) != ZERO)
+        {
+            stalled[pool - route_pools] = 1;
+            failed = 1;
+            continue;
+        }
+        writeback_lock();
+        entry->state = WRITEBACK_FREE;
+        writeback_unlock();
+        // a dfile which found the entry just before has it open already, later ones go to the servers
+        unlinkat(writeback_dir_fd, entry_name, ZERO);
+        hot_cache_invalidate(key);
+        passed_on++;
+    }
+    return failed ? -1 : passed_on;
+}
+// this function sends the journal entry sequence on to the servers of pool
+// it returns ZERO when the servers took it, or when it can never be passed on, and -1 when it has to be tried again
+number writeback_forward(object route_pool *pool, unsigned long long sequence, number removal, constant character *key)
+{
+    character entry_name[32];
+    character header[string_storage_SIZE];
+    character command[string_storage_SIZE], document_name[string_storage_SIZE];
+    character reply_from_server[string_storage_SIZE];
+    number unreached = ZERO, result = ZERO;
+    snprintf(entry_name, sizeof(entry_name), "%020llu", sequence);
+    number entry_fd = openat(writeback_dir_fd, entry_name, O_RDONLY | O_CLOEXEC);
+    if (entry_fd < ZERO || pread(entry_fd, header, sizeof(header), ZERO) != sizeof(header))
+    {
+        show_on_cmd("Journal entry %s for %s cannot be read, it is dropped\n", entry_name, key);
+        if (entry_fd >= ZERO)
+        {
+            close(entry_fd);
+        }
+        return ZERO;
+    }
+    header[sizeof(header) - 1] = '\0';
+    if (removal)
+    {
+        // a file which is not on any server is as good as removed, a server which could not be asked is asked again later
+        if (sscanf(header, "%1023s %1023s", command, document_name) == 2 && remove_from_pool(pool, document_name, header, reply_from_server, sizeof(reply_from_server), &unreached) != ZERO && unreached)
+        {
+            result = -1;
+        }
+    }
+    else if (lseek(entry_fd, string_storage_SIZE, SEEK_SET) != string_storage_SIZE || relay_upload_to_pool(pool, key, key, header, entry_fd, reply_from_server, sizeof(reply_from_server)) != ZERO)
+    {
+        result = -1;
+    }
+    close(entry_fd);
+    if (result != ZERO)
+    {
+        show_on_cmd("Journal entry %s for %s kept to be tried again: %s", entry_name, key, reply_from_server);
     }
+    return result;
 }
 // to get the home path for particular client
 constant character *return_home_value()
@@ -1,4 +1,6 @@
 // stating all required libraries for the code here
+// _GNU_SOURCE has to come before every include so that O_DIRECT is declared for the read engine
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,13 +13,34 @@
 #include <sys/wait.h>
 #include <errno.h>
 #include <libgen.h>
+#include "path_resolver.h"
+#include "membership_filter.h"
+#include "read_engine.h"
+#include "erasure_code.h"
+#include "listing_page.h"
+#include "tiering.h"
+#include "local_transport.h"
+#include "shm_ring.h"
+#include "file_version.h"
+#include "file_stat.h"
+#include "dfs_protocol.h"
 // defining all necessary self defined macros which will be used through out the code
 // this is the port where spdf will be running
 #define PORT 8094
 // this is the macros for buffer_size
 #define BUFFER_SIZE 1024
+// first line of the reply to a dfile for a file which is not stored here
+#define FILE_NOT_FOUND_MARKER "FILE_NOT_FOUND\n"
 // IP address which will be used for spdf server
 #define ADDRESS "127.0.0.3"
+// files copied in by smain's rebalancer are written under this name first and linked to their real name at the end
+#define REBALANCE_TEMP_PREFIX ".rebalance."
+// last line of the answer to list
+#define END_OF_LIST "END_OF_LIST\n"
+// in the erasure coded layout the file in ~/spdf is only a stub holding this line, the bytes are in the shard folders
+#define ERASURE_STUB_FORMAT "ERASURE_CODED %llu\n"
+// a stub is never longer than this, bigger files are never taken for one
+#define ERASURE_STUB_MAXIMUM 64
 // redefining already defined data types in system
 #define character char
 #define constant const
@@ -33,20 +56,121 @@ const char *DOWNLOAD_FILE = "dfile";
 const char *REMOVE_FILE = "rmfile";
 const char *GENERATE_TAR = "dtar";
 const char *DISPLAY_LIST = "display";
+// port, address, storage folder and extension can be changed on the command line
+// so more copies of this server can be run for other pools or file types, see smain.conf
+number listen_port = PORT;
+constant character *listen_address = ADDRESS;
+// name of the storage folder inside the home folder
+constant character *store_folder = "spdf";
+// extension of the files listed by display and packed by dtar
+constant character *store_extension = ".pdf";
+// descriptor of ~/spdf, files are created relative to it
+number store_fd = -1;
+// folders of ~/spdf which are open already
+object path_resolver store_dirs;
+// counting filter of every path stored in ~/spdf, shared with the forked children
+object membership_filter *stored_paths = NULL;
+// erasure coded layout, off unless -k is given: every file is then cut into erasure_data data shards and
+// erasure_parity parity shards, each shard in its own folder (put them on different disks), and the file in ~/spdf
+// becomes a stub with the size so that display, list and the membership filter keep working as before
+number erasure_data = ZERO;
+number erasure_parity = 2;
+// comma separated shard folders given with -s, relative to the home folder unless they start with '/'
+// without -s they are ~/spdf-shard0, ~/spdf-shard1 and so on
+constant character *shard_folder_list = NULL;
+number shard_count = ZERO;
+// descriptor of every shard folder, -1 for one which cannot be opened, and the folders open below it
+number shard_fds[ERASURE_MAX_SHARDS];
+object path_resolver shard_dirs[ERASURE_MAX_SHARDS];
+// files which are not read for cold_seconds move to the cold folder (~/spdf-cold unless -c says otherwise), 0 turns that off
+// the stubs of erasure coded files are too small to be moved, so only files stored as they are go there
+constant character *cold_folder = NULL;
+long long cold_seconds = TIERING_DEFAULT_COLD_SECONDS;
+object tiering_store tiers;
+character *stored_path_key(constant character *folder, constant character *name);
+empty_return_function send_file_not_found(number channel_for_client, character *filename);
 constant character *return_home_value();
+empty_return_function setup_store();
+empty_return_function setup_shards();
+empty_return_function setup_tiers();
+empty_return_function open_shard_files(constant character *folder, constant character *name, number flags, number *fds);
+number open_shard_writer(object erasure_writer *writer, constant character *folder, constant character *name);
+number open_shard_reader(object erasure_reader *reader, constant character *key);
+empty_return_function remove_shard_files(constant character *key);
+number store_as_shards(number file, constant character *folder, constant character *name);
+long long erasure_stub_size(number file);
+empty_return_function visit_staged_file(constant character *path, empty_return_function *argument);
+empty_return_function manage_membership_filter_request(number channel_for_client);
+empty_return_function manage_list_request(number channel_for_client);
+empty_return_function visit_listed_file(constant character *path, empty_return_function *argument);
+empty_return_function manage_page_request(number channel_for_client, character *folder, character *cursor);
+number page_match(constant character *name, empty_return_function *argument);
+empty_return_function manage_version_request(number channel_for_client, character *filename);
+empty_return_function manage_index_request(number channel_for_client, character *count_text, character *length_text);
+empty_return_function keep_coded_hash(number stub, unsigned long long size, uint64_t hash);
+empty_return_function manage_fetch_request(number channel_for_client, character *filename);
+empty_return_function manage_ring_request(number channel_for_client, number *passed, character *buffer);
+empty_return_function manage_store_request(number channel_for_client, character *filename, character *size_text);
 empty_return_function manage_client_interaction(number channel_for_client);
+empty_return_function manage_handoff(number channel_for_client, number handed_over, character *buffer);
 empty_return_function manage_upload_file_to_server(number channel_for_client, character *filename, character *dest_path, character *buffer);
 empty_return_function manage_download_file_to_server(number channel_for_client, character *filename);
 empty_return_function manage_remove_file_from_server(number channel_for_client, character *filename);
 empty_return_function manage_add_tar_for_file_types_local(number channel_for_client, character *filetype);
 empty_return_function manage_display_list_document_names_in_folder(number channel_for_client, character *pathname);
-number main()
+number main(number argc, character *argv[])
 {
     // define the socket descriptors
     number channel_for_server, channel_for_client;
-    // structure for server address and client address
-    object sockaddr_in server_channel_address, client_channel_address;
-    channel_length addr_len = sizeof(client_channel_address);
+    number option;
+    // -p port -a address -d folder -e extension, all of them default to the spdf values
+    // -k data shards, -m parity shards and -s shard folders turn on the erasure coded layout
+    // -c cold folder -t seconds without a read before a file goes there
+    while ((option = getopt(argc, argv, "p:a:d:e:k:m:s:c:t:")) != -1)
+    {
+        switch (option)
+        {
+        case 'p':
+            listen_port = atoi(optarg);
+            break;
+        case 'a':
+            listen_address = optarg;
+            break;
+        case 'd':
+            store_folder = optarg;
+            break;
+        case 'e':
+            store_extension = optarg;
+            break;
+        case 'k':
+            erasure_data = atoi(optarg);
+            break;
+        case 'm':
+            erasure_parity = atoi(optarg);
+            break;
+        case 's':
+            shard_folder_list = optarg;
+            break;
+        case 'c':
+            cold_folder = optarg;
+            break;
+        case 't':
+            cold_seconds = atoll(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-p port] [-a address] [-d folder] [-e extension] [-k data shards [-m parity shards] [-s folder,folder,...]] [-c cold folder] [-t cold seconds]\n", argv[ZERO]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (erasure_data < ZERO || (erasure_data > ZERO && (erasure_parity < 1 || erasure_data + erasure_parity > ERASURE_MAX_SHARDS)))
+    {
+        fprintf(stderr, "-k and -m need at least 1 data and 1 parity shard and %d shards at most together\n", ERASURE_MAX_SHARDS);
+        exit(EXIT_FAILURE);
+    }
+    // structure for server address
+    object sockaddr_in server_channel_address;
+    // unix socket smain uses when it runs on the same host, -1 when it could not be opened
+    number channel_for_local;
     // make socket connection
     if ((channel_for_server = socket(AF_INET, SOCK_STREAM, ZERO)) == ZERO)
     {
@@ -57,9 +181,9 @@ number main()
     // ipv4 address family
     server_channel_address.sin_family = AF_INET;
     // this converts the port number from host byte order to network byte order
-    server_channel_address.sin_port = htons(PORT);
+    server_channel_address.sin_port = htons(listen_port);
     // this function converts the IP address from text to binary form and stores it in sin_addr structure
-    if (inet_pton(AF_INET, ADDRESS, &server_channel_address.sin_addr) <= ZERO)
+    if (inet_pton(AF_INET, listen_address, &server_channel_address.sin_addr) <= ZERO)
     {
         perror("The given IP address is invalid");
         exit(EXIT_FAILURE);
@@ -71,23 +195,36 @@ number main()
         close(channel_for_server);
         exit(EXIT_FAILURE);
     }
-    // listen for the incoming message or commands from the client
-    if (listen(channel_for_server, 3) < ZERO)
+    // open ~/spdf before forking so every child creates files relative to it
+    setup_store();
+    setup_tiers();
+    // listen for the incoming message or commands from the client, smain connects once for every client it serves at the same time
+    if (listen(channel_for_server, SOMAXCONN) < ZERO)
     {
         perror("Listen failed");
         close(channel_for_server);
         exit(EXIT_FAILURE);
     }
+    channel_for_local = local_transport_listen(listen_address, listen_port, SOMAXCONN);
+    if (channel_for_local < ZERO)
+    {
+        perror("Unix socket not opened, only TCP is served");
+    }
     // print if socket sucessfully formed and now waiting for command
-    show_on_cmd("Spdf server listening on port %d...\n", PORT);
+    show_on_cmd("Spdf server listening on port %d for %s files in ~/%s...\n", listen_port, store_extension, store_folder);
+    if (erasure_data > ZERO)
+    {
+        show_on_cmd("Files are erasure coded into %d data and %d parity shards\n", erasure_data, erasure_parity);
+    }
     // go into infinite loop of accept to accept commands from client
-    while ((channel_for_client = accept(channel_for_server, (object sockaddr *)&client_channel_address, &addr_len)) >= ZERO)
+    while ((channel_for_client = local_transport_accept(channel_for_server, channel_for_local)) >= ZERO)
     {
         show_on_cmd("New client connected to Spdf\n");
         // fork to handle the client commands
         if (fork() == ZERO)
         {
             close(channel_for_server);
+            close(channel_for_local);
             manage_client_interaction(channel_for_client); // using handle client do the needful actions
             close(channel_for_client);
             exit(ZERO);
@@ -95,7 +232,10 @@ number main()
         else
         {
             close(channel_for_client);
-            wait(NULL); // wait in parent till child done
+            // every connection is served by a child of its own like the clients of smain, one after the other a download
+            // would wait for every download before it, only the children which are done are collected here
+            while (waitpid(-1, NULL, WNOHANG) > ZERO)
+                ;
         }
     }
     if (channel_for_client < ZERO)
@@ -137,6 +277,8 @@ empty_return_function manage_client_interaction(number channel_for_client)
     // buffers to store command and arguements from the user
     character command[BUFFER_SIZE];
     character arg1[BUFFER_SIZE], arg2[BUFFER_SIZE];
+    // connection of a client which smain handed over with the command, or the descriptors of a shared memory ring
+    number passed[LOCAL_TRANSPORT_MAX_FDS];
     while (1)
     {
         // memset is used to clear the contents of buffer, command, arg1, and arg2
@@ -145,14 +287,31 @@ empty_return_function manage_client_interaction(number channel_for_client)
         memset(command, ZERO, BUFFER_SIZE);
         memset(arg1, ZERO, BUFFER_SIZE);
         memset(arg2, ZERO, BUFFER_SIZE);
-        // receive from client
-        if (recv(channel_for_client, buffer, BUFFER_SIZE, ZERO) <= ZERO)
+        // receive from client, smain may attach the connection of its own client over the unix socket
+        // a command is one byte shorter than the buffer, so the memset above leaves it ended by a zero for sscanf
+        if (local_transport_recv(channel_for_client, buffer, BUFFER_SIZE - 1, passed) <= ZERO)
         {
             perror("recv failed"); // if failed print this
             break;
         }
         sscanf(buffer, "%s %s %s", command, arg1, arg2);
         // compare the command and accordingly invoke the functions
+        if (strcmp(command, LOCAL_TRANSPORT_HANDOFF) == ZERO)
+        {
+            // only the first descriptor is a client connection
+            number handed_over = passed[ZERO];
+            passed[ZERO] = -1;
+            local_transport_close_fds(passed);
+            manage_handoff(channel_for_client, handed_over, buffer);
+            continue;
+        }
+        if (strcmp(command, SHM_RING_COMMAND) == ZERO)
+        {
+            manage_ring_request(channel_for_client, passed, buffer);
+            continue;
+        }
+        // descriptors attached to any other command are not used
+        local_transport_close_fds(passed);
         if (strcmp(command, "ufile") == ZERO)
         {
             manage_upload_file_to_server(channel_for_client, arg1, arg2, buffer);
@@ -173,6 +332,39 @@ empty_return_function manage_client_interaction(number channel_for_client)
         {
             manage_display_list_document_names_in_folder(channel_for_client, arg1);
         }
+        // smain asks for the membership filter of this server
+        else if (strcmp(command, "bloom") == ZERO)
+        {
+            manage_membership_filter_request(channel_for_client);
+        }
+        // smain's rebalancer lists, copies out and copies in files which belong to another server now
+        else if (strcmp(command, "list") == ZERO)
+        {
+            manage_list_request(channel_for_client);
+        }
+        // smain asks for one sorted page of a folder
+        else if (strcmp(command, "page") == ZERO)
+        {
+            manage_page_request(channel_for_client, arg1, arg2);
+        }
+        else if (strcmp(command, "fetch") == ZERO)
+        {
+            manage_fetch_request(channel_for_client, arg1);
+        }
+        else if (strcmp(command, "store") == ZERO)
+        {
+            manage_store_request(channel_for_client, arg1, arg2);
+        }
+        // smain asks whether a client's cached copy of a file is still current
+        else if (strcmp(command, FILE_VERSION_COMMAND) == ZERO)
+        {
+            manage_version_request(channel_for_client, arg1);
+        }
+        // smain asks for size, time, hash and tier of many files at once
+        else if (strcmp(command, FILE_STAT_INDEX) == ZERO)
+        {
+            manage_index_request(channel_for_client, arg1, arg2);
+        }
         else
         {
             character *msg = "Invalid command\n";
@@ -180,83 +372,74 @@ empty_return_function manage_client_interaction(number channel_for_client)
         }
     }
 }
+// this function serves a dfile or ufile whose client connection smain handed over as handed_over
+// the file goes straight between the disk and the client, smain is told on channel_for_client when the connection is its own again
+empty_return_function manage_handoff(number channel_for_client, number handed_over, character *buffer)
+{
+    character command[BUFFER_SIZE], arg1[BUFFER_SIZE], arg2[BUFFER_SIZE];
+    // the command of the client follows the word handoff
+    number fields = handed_over >= ZERO ? sscanf(buffer, "%*s %1023s %1023s %1023s", command, arg1, arg2) : ZERO;
+    if (fields >= 2 && strcmp(command, "dfile") == ZERO)
+    {
+        manage_download_file_to_server(handed_over, arg1);
+    }
+    else if (fields == 3 && strcmp(command, "ufile") == ZERO)
+    {
+        manage_upload_file_to_server(handed_over, arg1, arg2, buffer);
+    }
+    else
+    {
+        if (handed_over >= ZERO)
+        {
+            close(handed_over);
+        }
+        send(channel_for_client, LOCAL_TRANSPORT_HANDOFF_REFUSED, strlen(LOCAL_TRANSPORT_HANDOFF_REFUSED), ZERO);
+        return;
+    }
+    close(handed_over);
+    send(channel_for_client, LOCAL_TRANSPORT_HANDOFF_DONE, strlen(LOCAL_TRANSPORT_HANDOFF_DONE), ZERO);
+}
 // handles the display commmand
 empty_return_function manage_display_list_document_names_in_folder(number channel_for_client, character *pathname)
 {
     character buffer[BUFFER_SIZE];
+    character line[BUFFER_SIZE];
     character command[BUFFER_SIZE];
     FILE *pipe;
     size_t file_size;
     // Construct the full path
-    snprintf(command, sizeof(command), "%s/spdf/%s", return_home_value(), pathname);
+    size_t prefix = snprintf(command, sizeof(command), "%s/%s/%s", return_home_value(), store_folder, pathname);
     // Check if the directory exists
     object stat st;
     if (stat(command, &st) != ZERO || !S_ISDIR(st.st_mode))
     {
         // If the directory does not exist or is not a directory, return an empty response
-        snprintf(buffer, sizeof(buffer), "DIRECTORY_NOT_FOUND\n"); // Send an empty string
+        snprintf(buffer, sizeof(buffer), "DIRECTORY_NOT_FOUND\n%s", END_OF_LIST); // Send an empty string
         send(channel_for_client, buffer, strlen(buffer), ZERO);
         return;
     }
-    // Construct the command to find .pdf files in the specified directory
-    snprintf(command, sizeof(command), "find %s/spdf/%s -type f -name '*.pdf'", return_home_value(), pathname);
+    // Construct the command to find the files of this server's extension in the specified directory
+    snprintf(command, sizeof(command), "find %s/%s/%s -type f -name '*%s'", return_home_value(), store_folder, pathname, store_extension);
     pipe = popen(command, "r"); // craete and open pipe
     if (!pipe)
     {
         perror("popen failed");
+        send(channel_for_client, END_OF_LIST, strlen(END_OF_LIST), ZERO);
         return;
     }
-    // Read the list of .pdf files and send it to the client
-    while (fgets(buffer, sizeof(buffer), pipe) != NULL)
+    // Read the list of files and send it to the client
+    // every file goes out with its path below pathname, smain tells the same name in two folders apart by it
+    while (fgets(line, sizeof(line), pipe) != NULL)
     {
-        buffer[strcspn(buffer, "\n")] = ZERO;                   // Remove newline character
-        character *filename = basename(buffer);                 // Extract the file name
-        snprintf(buffer, sizeof(buffer), "%s\n", filename);     // Format the output with just the filename
-        send(channel_for_client, buffer, strlen(buffer), ZERO); // Send the filename to the client
+        line[strcspn(line, "\n")] = ZERO; // Remove newline character
+        character *filename = strlen(line) > prefix ? line + prefix : line;
+        filename += strspn(filename, "/");
+        snprintf(buffer, sizeof(buffer), "%s\n", filename);
+        send(channel_for_client, buffer, strlen(buffer), ZERO);
     }
     pclose(pipe);
-}
-// this function is a common fucntion to create a recursive directory if it's not there in the system
-number create_directory_recursive(constant character *path)
-{
-    // iinitializing string for temporary name of file
-    character temp[256];
-    // a null pointer initialization
-    character *p = NULL;
-    size_t len;
-    // snprintf is to scan values and then add it to a single string
-    // it works like concatenation of string
-    // here file_name_temporary will be assigned with value of:  directory_to_be_created_path
-    snprintf(temp, sizeof(temp), "%s", path);
-    // get file_name_temporary length and store it to file_name_length
-    len = strlen(temp);
-    // set last character as null of file_name_temporary
-    if (temp[len - 1] == '/')
-    {
-        temp[len - 1] = '\0';
-    }
-    // loop to create all non existed folder
-    for (p = temp + 1; *p; p++)
-    {
-        if (*p == '/')
-        {
-            *p = '\0';
-            if (mkdir(temp, 0755) != ZERO && errno != EEXIST)
-            {
-                perror("mkdir");
-                // on error return -1
-                return -1;
-            }
-            *p = '/';
-        }
-    }
-    // make last folder as well through this
-    if (mkdir(temp, 0755) != ZERO && errno != EEXIST)
-    {
-        perror("mkdir");
-        return -1;
-    }
-    return ZERO; // on success return ZERO
+    // smain reads the names as they come and stops at END_OF_LIST
+    send(channel_for_client, END_OF_LIST, strlen(END_OF_LIST), ZERO);
 }
 // function manage_upload_file_to_server is to perform ufile
 empty_return_function manage_upload_file_to_server(number channel_for_client, character *filename, character *dest_path, character *buffer)
@@ -266,37 +449,55 @@ empty_return_function manage_upload_file_to_server(number channel_for_client, ch
     FILE *file;
     size_t file_size;
     character response[BUFFER_SIZE];
-    character destination_path[BUFFER_SIZE];
     character file_buffer[BUFFER_SIZE];
     number bytes_received;
+    // the command gives the size of the file, the byte which ends a file on a short chunk is not stored
+    long long size = dfs_protocol_upload_size(buffer, BUFFER_SIZE);
+    long long received = ZERO;
     // folder_name tis to store all folders string
     character folder_name[1024];
     // base_filena is to store the end file name
     character base_filename[1024];
-    // construct the folder path- directory_to_be_created_path -  on the server
-    snprintf(destination_path, sizeof(destination_path), "%s/spdf/%s", return_home_value(), dest_path);
-    // Create the destination directory if it doesn't exist
-    // if error then return
-    if (create_directory_recursive(destination_path) != ZERO)
-    {
-        return;
-    }
     // only fetch file name and ignore any directory path
     split_path(filename, folder_name, base_filename);
-    // we are using return_home_value() function here to get HOME variable value to keep it dynamic
-    // scan multiple strings to build document_location
-    snprintf(file_path, sizeof(file_path), "%s/spdf/%s/%s", return_home_value(), dest_path, base_filename);
-    object stat st = {ZERO};
-    // Open the file at document_location for writig
-    file = fopen(file_path, "wb");
+    // file_path is only used for messages now
+    snprintf(file_path, sizeof(file_path), "%s/%s/%s/%s", return_home_value(), store_folder, dest_path, base_filename);
+    // the destination folder is opened relative to ~/spdf and created if it doesn't exist
+    // try to create a new file first, only a path which was not stored before is added to the membership filter
+    character *key = stored_path_key(dest_path, base_filename);
+    number file_fd = path_resolver_open_file(&store_dirs, dest_path, base_filename, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (file_fd >= ZERO)
+    {
+        if (key != NULL && stored_paths != NULL)
+        {
+            membership_filter_add(stored_paths, key);
+        }
+    }
+    else if (errno == EEXIST)
+    {
+        file_fd = path_resolver_open_file(&store_dirs, dest_path, base_filename, O_WRONLY | O_TRUNC, 0644);
+        // the new content replaces a stub as well, its cold copy is not needed anymore
+        if (file_fd >= ZERO && key != NULL)
+        {
+            tiering_forget(&tiers, key);
+        }
+    }
+    file = file_fd >= ZERO ? fdopen(file_fd, "wb") : NULL;
     // if no document found then
     if (file == NULL)
     {
         // return this message to client using send()
         snprintf(response, sizeof(response), "Failed to open file %s for writing\n", file_path);
         send(channel_for_client, response, strlen(response), ZERO);
+        free(key);
         return;
     }
+    // in the erasure coded layout the bytes go to the shards and the file itself becomes the stub
+    // when the shards cannot be set up the file is stored as it is, downloads handle both
+    object erasure_writer writer;
+    number coded = erasure_data > ZERO && key != NULL && open_shard_writer(&writer, dest_path, base_filename) == ZERO;
+    // the content of a coded file is not kept in one piece, so its hash (file_stat.h) is taken on the way to the shards
+    uint64_t content_hash = DELTA_HASH_START;
     // Receive file data from the client
     show_on_cmd("Receiving file: %s\n", file_path);
     // start reading this file from client and then wait for recieving this data
@@ -306,8 +507,18 @@ empty_return_function manage_upload_file_to_server(number channel_for_client, ch
     {
         // this will print the message on server that how many bytes will be written at the targetfile location
         show_on_cmd("Received %d bytes\n", bytes_received);
+        size_t part = dfs_protocol_file_part(size, received, bytes_received);
+        received += bytes_received;
         // fwrite to wrrite the content in new file name - file_string_storage
-        fwrite(file_buffer, 1, bytes_received, file);
+        if (coded)
+        {
+            erasure_writer_write(&writer, file_buffer, part);
+            content_hash = delta_hash(content_hash, (unsigned char *)file_buffer, part);
+        }
+        else
+        {
+            fwrite(file_buffer, 1, part, file);
+        }
         // if file ahs been read completely then break out of loop
         if (bytes_received < sizeof(file_buffer))
         {
@@ -315,54 +526,102 @@ empty_return_function manage_upload_file_to_server(number channel_for_client, ch
             break; // End of file
         }
     }
+    if (coded)
+    {
+        number written = erasure_writer_close(&writer);
+        if (written < erasure_data)
+        {
+            // fewer than k shards cannot give the file back, nothing of it is kept
+            fclose(file);
+            remove(file_path);
+            remove_shard_files(key);
+            if (stored_paths != NULL)
+            {
+                membership_filter_remove(stored_paths, key);
+            }
+            snprintf(response, sizeof(response), "File %s upload failed, only %d of %d shards were written\n", filename, written, shard_count);
+            send(channel_for_client, response, strlen(response), ZERO);
+            free(key);
+            return;
+        }
+        if (written < shard_count)
+        {
+            show_on_cmd("%s was written to %d of %d shards only\n", file_path, written, shard_count);
+        }
+        fprintf(file, ERASURE_STUB_FORMAT, writer.size);
+        fflush(file);
+        keep_coded_hash(fileno(file), writer.size, content_hash);
+    }
+    fclose(file);
+    free(key);
     // on success scan this response and send it to client to state that new file at destinated location has been created and content has been added
     snprintf(response, sizeof(response), "File %s uploaded successfully\n", filename);
     send(channel_for_client, response, strlen(response), ZERO);
-    fclose(file);
 }
 // function manage_download_file_to_serverfor dfile comamd
 empty_return_function manage_download_file_to_server(number channel_for_client, character *filename)
 {
     // initializing all required variables
-    // this is a buffer string to add content into it from any file
-    character buffer[BUFFER_SIZE];
     character file_path[BUFFER_SIZE];
     number file;
-    number file_size;
     character response[BUFFER_SIZE];
+    // a path the membership filter has never seen is not stored here, no need to touch the disk
+    character *key = stored_path_key("", filename);
+    if (key == NULL || (stored_paths != NULL && !membership_filter_may_contain(stored_paths, key)))
+    {
+        free(key);
+        send_file_not_found(channel_for_client, filename);
+        return;
+    }
     //// construct the folder path- document_location -  on the server
-    snprintf(file_path, sizeof(file_path), "%s/spdf/%s", return_home_value(), filename);
+    snprintf(file_path, sizeof(file_path), "%s/%s/%s", return_home_value(), store_folder, filename);
     show_on_cmd("File to be uploaded from: %s\n", file_path);
-    // open file with only read access
-    file = open(file_path, O_RDONLY);
-    // open file with only read access
+    // open file with only read access, a file in the cold tier is brought back first
+    file = tiering_open(&tiers, key);
     if (file < ZERO)
     {
         perror("Failed to open file");
+        send_file_not_found(channel_for_client, filename);
+        free(key);
         return;
     }
-    // read file in chunks and then send the to client
-    while ((file_size = read(file, buffer, sizeof(buffer))) >= ZERO)
+    object stat info = {ZERO};
+    object erasure_reader reader;
+    number sent;
+    long long coded_size = erasure_stub_size(file);
+    if (coded_size >= ZERO)
     {
-        if (file_size == ZERO)
-        {
-            // send it to client whoo is waiting to recieve this signal
-            send(channel_for_client, buffer, 1, ZERO);
-        }
-        else
+        // an erasure coded file is put together from its data shards, parity is only read for a damaged stripe
+        if (open_shard_reader(&reader, key) != ZERO)
         {
-            // send it to client whoo is waiting to recieve this signal
-            send(channel_for_client, buffer, file_size, ZERO);
-        }
-        if (file_size < sizeof(buffer))
-        {
-            break; // End of file
+            close(file);
+            send_file_not_found(channel_for_client, filename);
+            free(key);
+            return;
         }
+        info.st_size = coded_size;
+        sent = erasure_reader_copy(&reader, channel_for_client);
+        erasure_reader_close(&reader);
+    }
+    else
+    {
+        // the read engine picks pread(), mmap() or O_DIRECT depending on the size of the file and on the page cache
+        sent = fstat(file, &info) == ZERO ? read_engine_send_file(file, info.st_size, channel_for_client) : -1;
+    }
+    free(key);
+    if (sent != ZERO)
+    {
+        perror("send file");
+    }
+    // the receiver waits for a chunk shorter than its buffer, so a file ending on a full chunk gets one more byte
+    else if (info.st_size % BUFFER_SIZE == ZERO)
+    {
+        send(channel_for_client, "", 1, ZERO);
     }
     close(file);
     sleep(5);
-    // build the string to send success message
-    snprintf(response, sizeof(response), "File %s uploaded successfully\n", filename);
+    // build the string to send success message, the size tells the client whether the last byte was padding
+    snprintf(response, sizeof(response), "File %s uploaded successfully" DFS_PROTOCOL_FILE_SIZE "\n", filename, (long long)info.st_size);
     // send the response to the client
     send(channel_for_client, response, strlen(response), ZERO);
 }
@@ -373,8 +632,11 @@ empty_return_function manage_remove_file_from_server(number channel_for_client,
     character file_path[BUFFER_SIZE];
     character response[BUFFER_SIZE];
     // build document_location out of HOME, docuemnt_name given by client
-    snprintf(file_path, sizeof(file_path), "%s/spdf/%s", return_home_value(), filename);
-    if (remove(file_path) < 0) // run remove() operation on it
+    snprintf(file_path, sizeof(file_path), "%s/%s/%s", return_home_value(), store_folder, filename);
+    // a path the membership filter has never seen is answered as not found without touching the disk
+    character *key = stored_path_key("", filename);
+    number known = key != NULL && (stored_paths == NULL || membership_filter_may_contain(stored_paths, key));
+    if (!known || remove(file_path) < 0) // run remove() operation on it
     {
         // send() successfull message to client
         snprintf(response, sizeof(response), "File %s not found.\n", filename);
@@ -385,7 +647,19 @@ empty_return_function manage_remove_file_from_server(number channel_for_client,
         // send() successfull message to client
         snprintf(response, sizeof(response), "File %s deleted successfully.\n", filename);
         send(channel_for_client, response, strlen(response), ZERO);
+        // the path is not stored anymore
+        if (stored_paths != NULL)
+        {
+            membership_filter_remove(stored_paths, key);
+        }
+        // and neither are its shards when it was erasure coded, or its cold copy
+        if (erasure_data > ZERO)
+        {
+            remove_shard_files(key);
+        }
+        tiering_forget(&tiers, key);
     }
+    free(key);
 }
 // this function handles the dtar command of the project
 // this takes in the socket desc of the client and the type of file we want to tar
@@ -396,10 +670,34 @@ empty_return_function manage_add_tar_for_file_types_local(number channel_for_cli
     character buffer[BUFFER_SIZE];
     FILE *tar_file;
     size_t file_size;
-    // this compares the agruement we have put to pdf and  if it is true then we enter the if statement
-    if (strcmp(filetype, ".pdf") == ZERO)
+    // tar reads the files itself, so the cold ones are brought back first
+    if (strcmp(filetype, store_extension) == ZERO)
+    {
+        tiering_promote_all(&tiers, page_match, NULL);
+    }
+    // this compares the agruement we have put to the extension of this server and  if it is true then we enter the if statement
+    if (strcmp(filetype, store_extension) == ZERO && erasure_data > ZERO)
     {
-        snprintf(tar_command, sizeof(tar_command), "find ~/spdf -name '*.pdf' | tar -cvf pdffiles.tar -T -");
+        // the stubs of erasure coded files are no use in a tar, the files are put together in a staging folder first
+        character staging[BUFFER_SIZE / 4];
+        object path_resolver staging_dirs;
+        snprintf(staging, sizeof(staging), "%s/.%s-dtar", return_home_value(), store_folder);
+        mkdir(staging, 0755);
+        number staging_fd = open(staging, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (staging_fd >= ZERO)
+        {
+            path_resolver_init(&staging_dirs, staging_fd);
+            path_resolver_walk(&store_dirs, visit_staged_file, &staging_dirs);
+            path_resolver_forget(&staging_dirs);
+            close(staging_fd);
+        }
+        snprintf(tar_command, sizeof(tar_command), "find %s -name '*%s' | tar -cvf pdffiles.tar -T -; rm -rf %s", staging, store_extension, staging);
+        system(tar_command);
+        tar_file = fopen("pdffiles.tar", "rb");
+    }
+    else if (strcmp(filetype, store_extension) == ZERO)
+    {
+        snprintf(tar_command, sizeof(tar_command), "find ~/%s -name '*%s' | tar -cvf pdffiles.tar -T -", store_folder, store_extension);
         system(tar_command);
         tar_file = fopen("pdffiles.tar", "rb");
     }
@@ -417,6 +715,639 @@ empty_return_function manage_add_tar_for_file_types_local(number channel_for_cli
     }
     fclose(tar_file); // close tar file
 }
+// makes sure ~/spdf exists and opens it for the path resolver
+empty_return_function setup_store()
+{
+    character store_path[BUFFER_SIZE];
+    snprintf(store_path, sizeof(store_path), "%s/%s", return_home_value(), store_folder);
+    if (mkdir(store_path, 0755) != ZERO && errno != EEXIST)
+    {
+        perror("mkdir storage folder");
+    }
+    store_fd = open(store_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (store_fd < ZERO)
+    {
+        perror("Failed to open storage folder");
+    }
+    path_resolver_init(&store_dirs, store_fd);
+    // the membership filter starts with every file already stored, later uploads and removals keep it up to date
+    stored_paths = membership_filter_create();
+    if (stored_paths == NULL)
+    {
+        perror("Membership filter disabled, mmap failed");
+    }
+    else if (store_fd >= ZERO)
+    {
+        membership_filter_load_tree(stored_paths, store_fd);
+    }
+    if (erasure_data > ZERO)
+    {
+        setup_shards();
+    }
+}
+// opens the cold folder and starts the process which moves files there
+empty_return_function setup_tiers()
+{
+    character cold_path[BUFFER_SIZE];
+    if (cold_folder != NULL)
+    {
+        snprintf(cold_path, sizeof(cold_path), "%s", cold_folder);
+    }
+    else
+    {
+        snprintf(cold_path, sizeof(cold_path), "%s/%s-cold", return_home_value(), store_folder);
+    }
+    if (tiering_setup(&tiers, store_fd, cold_path, cold_seconds) != ZERO)
+    {
+        perror("Tiering disabled, cold folder cannot be used");
+        return;
+    }
+    if (tiers.table != NULL)
+    {
+        show_on_cmd("Files not read for %lld seconds move to %s\n", cold_seconds, cold_path);
+        tiering_start(&tiers);
+    }
+}
+// opens one folder per shard, a folder which cannot be opened counts as a lost disk and its shards as missing
+empty_return_function setup_shards()
+{
+    character shard_path[BUFFER_SIZE];
+    character *list = shard_folder_list != NULL ? strdup(shard_folder_list) : NULL;
+    character *next = list;
+    for (shard_count = ZERO; shard_count < erasure_data + erasure_parity; shard_count++)
+    {
+        character *name = next != NULL ? strsep(&next, ",") : NULL;
+        if (shard_folder_list != NULL && (name == NULL || *name == '\0'))
+        {
+            break;
+        }
+        if (name == NULL)
+        {
+            snprintf(shard_path, sizeof(shard_path), "%s/%s-shard%d", return_home_value(), store_folder, shard_count);
+        }
+        else if (name[ZERO] == '/')
+        {
+            snprintf(shard_path, sizeof(shard_path), "%s", name);
+        }
+        else
+        {
+            snprintf(shard_path, sizeof(shard_path), "%s/%s", return_home_value(), name);
+        }
+        if (mkdir(shard_path, 0755) != ZERO && errno != EEXIST)
+        {
+            perror("mkdir shard folder");
+        }
+        shard_fds[shard_count] = open(shard_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (shard_fds[shard_count] < ZERO)
+        {
+            perror("Failed to open shard folder");
+        }
+        path_resolver_init(&shard_dirs[shard_count], shard_fds[shard_count]);
+    }
+    if (shard_count != erasure_data + erasure_parity || next != NULL)
+    {
+        fprintf(stderr, "-s needs %d shard folders, one for each of the %d data and %d parity shards\n", erasure_data + erasure_parity, erasure_data, erasure_parity);
+        exit(EXIT_FAILURE);
+    }
+    free(list);
+}
+// opens the shard of name in folder in every shard folder with flags, fds gets -1 for a shard which cannot be opened
+empty_return_function open_shard_files(constant character *folder, constant character *name, number flags, number *fds)
+{
+    for (number i = ZERO; i < shard_count; i++)
+    {
+        fds[i] = path_resolver_open_file(&shard_dirs[i], folder, name, flags, 0644);
+    }
+}
+// starts writing the shards of name in folder, returns 0 or -1
+number open_shard_writer(object erasure_writer *writer, constant character *folder, constant character *name)
+{
+    number fds[ERASURE_MAX_SHARDS];
+    open_shard_files(folder, name, O_WRONLY | O_CREAT | O_TRUNC, fds);
+    if (erasure_writer_open(writer, erasure_data, erasure_parity, fds) == ZERO)
+    {
+        return ZERO;
+    }
+    for (number i = ZERO; i < shard_count; i++)
+    {
+        if (fds[i] >= ZERO)
+        {
+            close(fds[i]);
+        }
+    }
+    return -1;
+}
+// opens the shards of the stored file key for reading, returns 0 or -1 when fewer than k of them can be read
+number open_shard_reader(object erasure_reader *reader, constant character *key)
+{
+    number fds[ERASURE_MAX_SHARDS];
+    open_shard_files("", key, O_RDONLY, fds);
+    if (erasure_reader_open(reader, fds, shard_count) == ZERO)
+    {
+        return ZERO;
+    }
+    show_on_cmd("Too few shards of %s can be read\n", key);
+    erasure_reader_close(reader);
+    return -1;
+}
+// removes the shards of the stored file key from every shard folder
+empty_return_function remove_shard_files(constant character *key)
+{
+    for (number i = ZERO; i < shard_count; i++)
+    {
+        if (shard_fds[i] >= ZERO)
+        {
+            unlinkat(shard_fds[i], key, ZERO);
+        }
+    }
+}
+// cuts the content of the open file into the shards of name in folder and then replaces that content with the stub
+// returns 0, or -1 when fewer than k shards could be written
+number store_as_shards(number file, constant character *folder, constant character *name)
+{
+    object erasure_writer writer;
+    character buffer[BUFFER_SIZE * 64];
+    ssize_t got = -1;
+    if (open_shard_writer(&writer, folder, name) != ZERO)
+    {
+        return -1;
+    }
+    uint64_t content_hash = DELTA_HASH_START;
+    for (off_t offset = ZERO; (got = pread(file, buffer, sizeof(buffer), offset)) > ZERO; offset += got)
+    {
+        erasure_writer_write(&writer, buffer, got);
+        content_hash = delta_hash(content_hash, (unsigned char *)buffer, got);
+    }
+    number written = erasure_writer_close(&writer);
+    if (got == ZERO && written >= erasure_data)
+    {
+        character stub[ERASURE_STUB_MAXIMUM];
+        number length = snprintf(stub, sizeof(stub), ERASURE_STUB_FORMAT, writer.size);
+        if (ftruncate(file, ZERO) == ZERO && pwrite(file, stub, length, ZERO) == length)
+        {
+            keep_coded_hash(file, writer.size, content_hash);
+            return ZERO;
+        }
+    }
+    character *key = stored_path_key(folder, name);
+    if (key != NULL)
+    {
+        remove_shard_files(key);
+    }
+    free(key);
+    return -1;
+}
+// returns the size of the erasure coded file the open stub stands for, or -1 when file is a plain file
+long long erasure_stub_size(number file)
+{
+    character stub[ERASURE_STUB_MAXIMUM + 1];
+    unsigned long long size;
+    object stat info;
+    if (erasure_data == ZERO || fstat(file, &info) != ZERO || info.st_size > ERASURE_STUB_MAXIMUM)
+    {
+        return -1;
+    }
+    ssize_t got = pread(file, stub, info.st_size, ZERO);
+    if (got <= ZERO)
+    {
+        return -1;
+    }
+    stub[got] = '\0';
+    return sscanf(stub, ERASURE_STUB_FORMAT, &size) == 1 ? (long long)size : -1;
+}
+// called by dtar for every stored file, writes the whole file below the staging folder given as argument
+empty_return_function visit_staged_file(constant character *path, empty_return_function *argument)
+{
+    character folder[BUFFER_SIZE], name[BUFFER_SIZE], buffer[BUFFER_SIZE * 64];
+    object erasure_reader reader;
+    if (strlen(path) >= BUFFER_SIZE)
+    {
+        return;
+    }
+    split_path(path, folder, name);
+    number source = path_resolver_open_file(&store_dirs, "", path, O_RDONLY, ZERO);
+    // a file which cannot be put together any more is left out of the tar
+    number coded = source >= ZERO && erasure_stub_size(source) >= ZERO;
+    number readable = source >= ZERO && (!coded || open_shard_reader(&reader, path) == ZERO);
+    number target = readable ? path_resolver_open_file((object path_resolver *)argument, folder, name, O_WRONLY | O_CREAT | O_TRUNC, 0644) : -1;
+    if (coded && readable)
+    {
+        if (target >= ZERO && erasure_reader_copy(&reader, target) != ZERO)
+        {
+            number owned;
+            number dir_fd = path_resolver_open_dir((object path_resolver *)argument, folder, &owned);
+            show_on_cmd("%s could not be put together for the tar\n", path);
+            unlinkat(dir_fd, name, ZERO);
+            if (owned)
+            {
+                close(dir_fd);
+            }
+        }
+        erasure_reader_close(&reader);
+    }
+    else if (target >= ZERO)
+    {
+        ssize_t got;
+        while ((got = read(source, buffer, sizeof(buffer))) > ZERO && erasure_write_all(target, (unsigned char *)buffer, got) == ZERO)
+        {
+        }
+    }
+    if (target >= ZERO)
+    {
+        close(target);
+    }
+    if (source >= ZERO)
+    {
+        close(source);
+    }
+}
+// builds the key of a stored file: folder and name joined and cleaned like the path resolver does
+// returns an allocated string, or NULL for a path outside the storage folder
+character *stored_path_key(constant character *folder, constant character *name)
+{
+    character joined[BUFFER_SIZE * 2];
+    snprintf(joined, sizeof(joined), "%s/%s", folder, name);
+    return path_resolver_clean(joined);
+}
+// tells smain that filename is not stored here, in one message so it can be recognised and passed on as it is
+empty_return_function send_file_not_found(number channel_for_client, character *filename)
+{
+    character response[BUFFER_SIZE];
+    snprintf(response, sizeof(response), "%sFile %s not found.\n", FILE_NOT_FOUND_MARKER, filename);
+    send(channel_for_client, response, strlen(response), ZERO);
+}
+// sends "VERSION <version>\n" of filename (file_version.h), or the not found message
+// an erasure coded file has the version of its stub, which is written again with every upload of the file
+empty_return_function manage_version_request(number channel_for_client, character *filename)
+{
+    character version[FILE_VERSION_SIZE];
+    character reply[FILE_VERSION_SIZE * 2];
+    character *key = stored_path_key("", filename);
+    if (key == NULL || (stored_paths != NULL && !membership_filter_may_contain(stored_paths, key)) || file_version_of(store_fd, key, version, sizeof(version)) != ZERO)
+    {
+        free(key);
+        send_file_not_found(channel_for_client, filename);
+        return;
+    }
+    free(key);
+    snprintf(reply, sizeof(reply), "%s %s\n", FILE_VERSION_REPLY, version);
+    send(channel_for_client, reply, strlen(reply), ZERO);
+}
+// answers an index request for count keys in length bytes with one line per key (file_stat.h)
+// an erasure coded file is reported with its own size and the hash taken when it was written
+empty_return_function manage_index_request(number channel_for_client, character *count_text, character *length_text)
+{
+    character **keys;
+    long long count = atoll(count_text);
+    character *body = file_stat_read_keys(channel_for_client, count, atoll(length_text), &keys);
+    number index_channel = body != NULL ? dup(channel_for_client) : -1;
+    FILE *out = index_channel >= ZERO ? fdopen(index_channel, "w") : NULL;
+    if (out == NULL)
+    {
+        if (index_channel >= ZERO)
+        {
+            close(index_channel);
+        }
+        if (body != NULL)
+        {
+            perror("index");
+            send(channel_for_client, END_OF_LIST, strlen(END_OF_LIST), ZERO);
+        }
+        free(body);
+        free(keys);
+        return;
+    }
+    for (long long i = ZERO; i < count; i++)
+    {
+        object file_stat stat;
+        character *key = stored_path_key("", keys[i]);
+        // the membership filter answers for most keys which are not here without a look at the disk
+        number file = key != NULL && (stored_paths == NULL || membership_filter_may_contain(stored_paths, key)) ? file_stat_open(store_fd, key, &stat) : -1;
+        long long coded_size = file >= ZERO ? erasure_stub_size(file) : -1;
+        if (coded_size >= ZERO)
+        {
+            stat.size = coded_size;
+            stat.tier = FILE_STAT_CODED;
+        }
+        if (file >= ZERO)
+        {
+            file_stat_hash(file, &stat);
+            close(file);
+        }
+        file_stat_write(out, file >= ZERO ? &stat : NULL);
+        free(key);
+    }
+    fputs(END_OF_LIST, out);
+    fclose(out);
+    free(body);
+    free(keys);
+}
+// keeps hash with the stub of an erasure coded file of size bytes, the stub has to be written completely already
+empty_return_function keep_coded_hash(number stub, unsigned long long size, uint64_t hash)
+{
+    object stat info;
+    object file_stat stat;
+    if (fstat(stub, &info) != ZERO)
+    {
+        return;
+    }
+    stat.size = size;
+    stat.mtime = info.st_mtim;
+    file_stat_keep_hash(stub, &stat, hash);
+}
+// sends the membership filter to smain as "BLOOM <bytes>\n" followed by the bits
+empty_return_function manage_membership_filter_request(number channel_for_client)
+{
+    character header[BUFFER_SIZE];
+    unsigned char *bits = malloc(MEMBERSHIP_FILTER_BYTES);
+    // without a filter smain gets an empty answer and keeps asking us about every file
+    if (stored_paths == NULL || bits == NULL)
+    {
+        send(channel_for_client, "BLOOM 0\n", strlen("BLOOM 0\n"), ZERO);
+        free(bits);
+        return;
+    }
+    membership_filter_export(stored_paths, bits);
+    snprintf(header, sizeof(header), "BLOOM %lu\n", (unsigned long)MEMBERSHIP_FILTER_BYTES);
+    send(channel_for_client, header, strlen(header), ZERO);
+    for (size_t sent = ZERO; sent < MEMBERSHIP_FILTER_BYTES;)
+    {
+        ssize_t written = send(channel_for_client, bits + sent, MEMBERSHIP_FILTER_BYTES - sent, ZERO);
+        if (written <= ZERO)
+        {
+            perror("send membership filter");
+            break;
+        }
+        sent += written;
+    }
+    free(bits);
+}
+// sends the path of every stored file, one per line, and END_OF_LIST at the end
+empty_return_function manage_list_request(number channel_for_client)
+{
+    // the names are written through a stdio stream so that they leave in big packets
+    number list_channel = dup(channel_for_client);
+    FILE *out = list_channel >= ZERO ? fdopen(list_channel, "w") : NULL;
+    if (out == NULL)
+    {
+        perror("list");
+        if (list_channel >= ZERO)
+        {
+            close(list_channel);
+        }
+        send(channel_for_client, END_OF_LIST, strlen(END_OF_LIST), ZERO);
+        return;
+    }
+    path_resolver_walk(&store_dirs, visit_listed_file, out);
+    fputs(END_OF_LIST, out);
+    fclose(out);
+}
+// called for every stored file by manage_list_request, half written copies of the rebalancer are left out
+empty_return_function visit_listed_file(constant character *path, empty_return_function *argument)
+{
+    constant character *last_slash = strrchr(path, '/');
+    constant character *name = last_slash != NULL ? last_slash + 1 : path;
+    if (strncmp(name, REBALANCE_TEMP_PREFIX, strlen(REBALANCE_TEMP_PREFIX)) != ZERO && strncmp(name, TIERING_TEMP_PREFIX, strlen(TIERING_TEMP_PREFIX)) != ZERO)
+    {
+        fprintf((FILE *)argument, "%s\n", path);
+    }
+}
+// sends the files of folder after cursor, one "path size mtime" line each, MORE when another page follows and END_OF_LIST
+empty_return_function manage_page_request(number channel_for_client, character *folder, character *cursor)
+{
+    character after[BUFFER_SIZE];
+    object listing_page page;
+    number page_channel = dup(channel_for_client);
+    FILE *out = page_channel >= ZERO ? fdopen(page_channel, "w") : NULL;
+    if (out == NULL)
+    {
+        perror("page");
+        if (page_channel >= ZERO)
+        {
+            close(page_channel);
+        }
+        send(channel_for_client, END_OF_LIST, strlen(END_OF_LIST), ZERO);
+        return;
+    }
+    // a folder which is not here has an empty page
+    number folder_fd = listing_cursor_decode(cursor, after, sizeof(after)) == ZERO ? listing_page_open_folder(store_fd, folder) : -1;
+    if (folder_fd >= ZERO)
+    {
+        listing_page_collect(&page, folder_fd, after, page_match, NULL);
+        // an erasure coded file or a file in the cold tier is listed with its own size and not with the size of its stub
+        for (number i = ZERO; i < page.count; i++)
+        {
+            number file = page.entries[i].size <= ERASURE_STUB_MAXIMUM || page.entries[i].size <= TIERING_STUB_MAXIMUM ? openat(folder_fd, page.entries[i].path, O_RDONLY | O_CLOEXEC) : -1;
+            long long real_size = file >= ZERO ? tiering_stub_size(file, &page.entries[i].mtime) : -1;
+            if (real_size < ZERO && file >= ZERO && erasure_data > ZERO)
+            {
+                real_size = erasure_stub_size(file);
+            }
+            if (real_size >= ZERO)
+            {
+                page.entries[i].size = real_size;
+            }
+            if (file >= ZERO)
+            {
+                close(file);
+            }
+        }
+        listing_page_write(&page, out);
+        if (page.more)
+        {
+            fputs(LISTING_MORE, out);
+        }
+        listing_page_free(&page);
+        close(folder_fd);
+    }
+    fputs(END_OF_LIST, out);
+    fclose(out);
+}
+// files of this server's extension are listed, like display does
+number page_match(constant character *name, empty_return_function *argument)
+{
+    (empty_return_function)argument;
+    size_t length = strlen(name);
+    size_t extension_length = strlen(store_extension);
+    return length >= extension_length && strcmp(name + length - extension_length, store_extension) == ZERO;
+}
+// sends "SIZE <bytes>\n" and the content of filename, or the not found message
+empty_return_function manage_fetch_request(number channel_for_client, character *filename)
+{
+    character header[BUFFER_SIZE];
+    object stat info;
+    character *key = stored_path_key("", filename);
+    if (key == NULL || (stored_paths != NULL && !membership_filter_may_contain(stored_paths, key)))
+    {
+        free(key);
+        send_file_not_found(channel_for_client, filename);
+        return;
+    }
+    number file = tiering_open(&tiers, key);
+    // the rebalancer gets the whole file, an erasure coded one is put together from its shards
+    object erasure_reader reader;
+    long long coded_size = file >= ZERO ? erasure_stub_size(file) : -1;
+    if (file < ZERO || fstat(file, &info) != ZERO || (coded_size >= ZERO && open_shard_reader(&reader, key) != ZERO))
+    {
+        if (file >= ZERO)
+        {
+            close(file);
+        }
+        free(key);
+        send_file_not_found(channel_for_client, filename);
+        return;
+    }
+    free(key);
+    snprintf(header, sizeof(header), "SIZE %lld\n", coded_size >= ZERO ? coded_size : (long long)info.st_size);
+    send(channel_for_client, header, strlen(header), ZERO);
+    number sent;
+    if (coded_size >= ZERO)
+    {
+        sent = erasure_reader_copy(&reader, channel_for_client);
+        erasure_reader_close(&reader);
+    }
+    else
+    {
+        sent = read_engine_send_file(file, info.st_size, channel_for_client);
+    }
+    if (sent != ZERO)
+    {
+        perror("fetch");
+    }
+    close(file);
+}
+// "ring fetch <file>" from smain on this host, passed holds the memfd and the two eventfds of a shared memory ring
+// answers like fetch but reads the file into the ring instead of sending it over channel_for_client
+// an erasure coded file is refused, it is put together stripe by stripe and smain fetches it over the socket
+empty_return_function manage_ring_request(number channel_for_client, number *passed, character *buffer)
+{
+    character command[BUFFER_SIZE], filename[BUFFER_SIZE], header[BUFFER_SIZE];
+    object stat info;
+    object shm_ring ring;
+    if (passed[2] < ZERO || sscanf(buffer, "%*s %1023s %1023s", command, filename) != 2 || strcmp(command, "fetch") != ZERO)
+    {
+        local_transport_close_fds(passed);
+        send(channel_for_client, SHM_RING_REFUSED, strlen(SHM_RING_REFUSED), ZERO);
+        return;
+    }
+    // the ring owns the descriptors from here on, even when it cannot be mapped
+    if (shm_ring_attach(&ring, passed[ZERO], passed[1], passed[2]) != ZERO)
+    {
+        send(channel_for_client, SHM_RING_REFUSED, strlen(SHM_RING_REFUSED), ZERO);
+        return;
+    }
+    character *key = stored_path_key("", filename);
+    number file = key != NULL && (stored_paths == NULL || membership_filter_may_contain(stored_paths, key)) ? tiering_open(&tiers, key) : -1;
+    free(key);
+    if (file < ZERO || fstat(file, &info) != ZERO)
+    {
+        if (file >= ZERO)
+        {
+            close(file);
+        }
+        shm_ring_destroy(&ring);
+        send_file_not_found(channel_for_client, filename);
+        return;
+    }
+    if (erasure_stub_size(file) >= ZERO)
+    {
+        close(file);
+        shm_ring_destroy(&ring);
+        send(channel_for_client, SHM_RING_REFUSED, strlen(SHM_RING_REFUSED), ZERO);
+        return;
+    }
+    snprintf(header, sizeof(header), "SIZE %lld\n", (long long)info.st_size);
+    send(channel_for_client, header, strlen(header), ZERO);
+    // smain stops reading when the size was not reached, closing the ring early is enough to tell it
+    if (shm_ring_fill_from_file(&ring, file, info.st_size, SHM_RING_TIMEOUT_MS) != ZERO)
+    {
+        perror("ring");
+    }
+    shm_ring_close(&ring);
+    shm_ring_destroy(&ring);
+    close(file);
+}
+// stores size_text bytes under filename but never replaces a file which is already there
+// answers EXISTS right away, or READY and then STORED or FAILED once the bytes have arrived
+empty_return_function manage_store_request(number channel_for_client, character *filename, character *size_text)
+{
+    character buffer[BUFFER_SIZE];
+    character temp_name[64];
+    long long size = atoll(size_text);
+    number owned = ZERO;
+    number stored = ZERO;
+    character *key = stored_path_key("", filename);
+    // split the key into its folder and its name
+    character *last_slash = key != NULL ? strrchr(key, '/') : NULL;
+    character *name = last_slash != NULL ? last_slash + 1 : key;
+    if (last_slash != NULL)
+    {
+        *last_slash = '\0';
+    }
+    number dir_fd = key != NULL && size >= ZERO ? path_resolver_open_dir(&store_dirs, last_slash != NULL ? key : "", &owned) : -1;
+    if (dir_fd < ZERO)
+    {
+        send(channel_for_client, "FAILED\n", strlen("FAILED\n"), ZERO);
+        free(key);
+        return;
+    }
+    // a file uploaded by a client in the meantime is newer than the copy of the rebalancer
+    if (faccessat(dir_fd, name, F_OK, AT_SYMLINK_NOFOLLOW) == ZERO)
+    {
+        send(channel_for_client, "EXISTS\n", strlen("EXISTS\n"), ZERO);
+    }
+    else
+    {
+        snprintf(temp_name, sizeof(temp_name), "%s%d.tmp", REBALANCE_TEMP_PREFIX, getpid());
+        number file = openat(dir_fd, temp_name, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        constant character *reply = file >= ZERO ? "READY\n" : "FAILED\n";
+        send(channel_for_client, reply, strlen(reply), ZERO);
+        long long received = ZERO;
+        while (file >= ZERO && received < size)
+        {
+            ssize_t got = recv(channel_for_client, buffer, size - received < (long long)sizeof(buffer) ? size - received : (long long)sizeof(buffer), ZERO);
+            if (got <= ZERO || write(file, buffer, got) != got)
+            {
+                break;
+            }
+            received += got;
+        }
+        if (file >= ZERO)
+        {
+            number exists = ZERO;
+            // in the erasure coded layout the copy is cut into shards and the temporary file becomes its stub
+            number coded = received == size && erasure_data > ZERO;
+            if (coded && store_as_shards(file, last_slash != NULL ? key : "", name) != ZERO)
+            {
+                received = -1;
+            }
+            close(file);
+            // linkat() fails with EEXIST when a client created the file meanwhile, that one is kept
+            if (received == size)
+            {
+                stored = linkat(dir_fd, temp_name, dir_fd, name, ZERO) == ZERO;
+                exists = !stored && errno == EEXIST;
+            }
+            unlinkat(dir_fd, temp_name, ZERO);
+            reply = stored ? "STORED\n" : (exists ? "EXISTS\n" : "FAILED\n");
+            send(channel_for_client, reply, strlen(reply), ZERO);
+        }
+    }
+    if (stored && stored_paths != NULL)
+    {
+        // the key is joined again for the filter
+        if (last_slash != NULL)
+        {
+            *last_slash = '/';
+        }
+        membership_filter_add(stored_paths, key);
+    }
+    if (owned)
+    {
+        close(dir_fd);
+    }
+    free(key);
+}
 // return the home path
 constant character *return_home_value()
 {
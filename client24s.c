@@ -8,6 +8,15 @@
 #include <sys/stat.h>
 #include <errno.h>
 #include <limits.h>
+#include <time.h>
+#include <glob.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include "delta_transfer.h"
+#include "file_version.h"
+#include "file_stat.h"
+#include "dfs_client.h"
 
 // if PATH_MAX is not found then self declare it
 #ifndef PATH_MAX
@@ -16,9 +25,37 @@
 // defining all necessary self defined macros which will be used through out the code
 // this is the port where client will be running
 #define PORT 8053
-// this is the macros for buffer_size
-#define BUFFER_SIZE 1024
+// this is the macros for buffer_size, the chunk smain sends and reads files in (dfs_protocol.h)
+#define BUFFER_SIZE DFS_PROTOCOL_CHUNK
 #define IP_ADDRESS "127.0.0.1"
+// first line of smain's answer to a dfile for a file which is not stored
+#define FILE_NOT_FOUND_MARKER DFS_CLIENT_NOT_FOUND
+// last line of smain's answer to display
+#define END_OF_LIST "END_OF_LIST\n"
+// display with this option lists the folder a page at a time with size and modification time
+#define LONG_LISTING_OPTION "-l"
+// cursor of the first page, smain ends every page with more files after it with "NEXT <cursor>"
+#define FIRST_PAGE_CURSOR "-"
+#define NEXT_PAGE_PREFIX "NEXT "
+// ufile and dfile take several files at once: more paths, globs (ufile only) or @file for a list of paths, one per line
+// the files are moved by this many processes with a connection to smain each, -j on the command line or jobs changes it
+#define BATCH_DEFAULT_JOBS 4
+#define BATCH_MAX_JOBS 64
+// words of one command line
+#define BATCH_MAX_WORDS 64
+#define BATCH_LIST_PREFIX '@'
+// how often the progress line is written while a batch runs
+#define BATCH_PROGRESS_USEC 500000
+// what the workers of a batch do with each file
+#define BATCH_DOWNLOAD 0
+#define BATCH_UPLOAD 1
+#define BATCH_REMOVE 2
+// sync with this option also removes the files on smain which are not in the local folder
+#define SYNC_DELETE_OPTION "-d"
+// folder below $HOME where downloaded files are kept with their version, dfile then asks smain whether they changed
+#define CACHE_FOLDER ".client24s-cache"
+// room for the name of an entry behind the cache folder, "/" with the 16 digits of its hash and ".data" or ".meta"
+#define CACHE_ENTRY_NAME_SIZE 32
 
 // redefining already defined data types in system
 #define character char
@@ -36,17 +73,78 @@ const char *DOWNLOAD_FILE = "dfile";
 const char *REMOVE_FILE = "rmfile";
 const char *GENERATE_TAR = "dtar";
 const char *DISPLAY_LIST = "display";
+const char *SYNC_FOLDER = "sync";
+// counters of a running batch, in shared memory so that every worker process updates the same ones
+object batch_progress
+{
+    // index of the next file a worker takes
+    volatile number next;
+    volatile number done;
+    volatile number failed;
+    volatile long long bytes;
+};
+// processes moving the files of a batch
+number batch_jobs = BATCH_DEFAULT_JOBS;
+// set in the batch workers, the lines printed for every single file are left out there
+number quiet_transfers = ZERO;
+// bytes sent by deliver_file_to_server() or received by get_file_from_server() last
+long long last_transfer_bytes = ZERO;
+// file get_file_from_server() wrote last, empty when it wrote none
+character last_received_file[BUFFER_SIZE] = "";
+// path on smain and version of the file get_file_with_cache() received last, it goes into the cache once its download ended
+character pending_cache_name[BUFFER_SIZE] = "";
+character pending_cache_version[FILE_VERSION_SIZE] = "";
+// folder of the download cache, empty when there is none
+character cache_folder[PATH_MAX] = "";
+number connect_to_smain();
+number batch_requested(constant character *instruction_from_user, character **words, number word_count);
+number batch_add_path(character ***paths, number *count, number *capacity, constant character *path);
+number batch_collect(constant character *word, number upload, character ***paths, number *count, number *capacity);
+empty_return_function batch_target_for(constant character *path, constant character *target, character *folder, size_t folder_size);
+number batch_transfer(number channel_for_client, number mode, constant character *path, constant character *target);
+empty_return_function batch_worker(number mode, character **paths, number count, constant character *target, object batch_progress *progress);
+empty_return_function run_batch(constant character *instruction_from_user, character **words, number word_count);
+empty_return_function run_batch_files(constant character *instruction_from_user, number mode, character **paths, number count, constant character *target);
+empty_return_function free_batch_paths(character **paths, number count);
+number upload_changes(number channel_for_client, constant character *document_name, constant character *target);
+number sync_walk(constant character *folder, constant character *relative, FILE *manifest, number *files);
+empty_return_function run_sync(number channel_for_client, constant character *local_folder, constant character *target, number remove_extra);
+empty_return_function open_download_cache();
+number cache_entry_path(constant character *document_name, constant character *suffix, character *path, size_t path_size);
+number cache_lookup(constant character *document_name, character *version, size_t version_size);
+number copy_file_contents(number from, number to);
+empty_return_function cache_store(constant character *document_name, constant character *version, constant character *received);
+number get_file_with_cache(number channel_for_client, constant character *document_name);
+empty_return_function finish_received_file(constant character *reply_from_server);
+empty_return_function run_stat(number channel_for_client, character **words, number word_count);
+number stat_paths(number channel_for_client, character **paths, number count);
 
 // function deliver_command_to_server to send command to smain
 empty_return_function deliver_command_to_server(number channel_for_client, constant character *instruction_from_user, constant character *parameter_1, constant character *parameter_2)
 {
     // a buffer string for storing the values
     character string_storage[BUFFER_SIZE];
+    // the file of a ufile (and the manifest of a sync, the paths of a stat) follows right after the command, so the command is padded with zero bytes
+    // to the size smain reads a command for in one read, that keeps the start of the file out of it when both arrive together
+    number followed = strcmp(instruction_from_user, UPLOAD_FILE) == ZERO || strcmp(instruction_from_user, SYNC_FOLDER) == ZERO ||
+                      strcmp(instruction_from_user, FILE_STAT_COMMAND) == ZERO;
     // build string_storage string by concatinating instruction_from_user i.e. command, parameter_1 i.e arguemnt 1, parameter_2 i.e argueemnt 2
-    snprintf(string_storage, sizeof(string_storage), "%s %s %s", instruction_from_user, parameter_1, parameter_2);
+    // in the same way as the client library does for the programs which use it
+    size_t length = dfs_client_format_command(string_storage, instruction_from_user, parameter_1, parameter_2, followed, NULL);
+    // smain keeps as many bytes of the file as the command says, the byte which may end it on a short chunk is not stored
+    object stat info;
+    if (strcmp(instruction_from_user, UPLOAD_FILE) == ZERO && stat(parameter_1, &info) == ZERO)
+    {
+        dfs_protocol_set_upload_size(string_storage, info.st_size);
+    }
+    // a download asks smain for the size of the file first, a cached file then comes without the pause before the end message
+    if (strcmp(instruction_from_user, DOWNLOAD_FILE) == ZERO || strcmp(instruction_from_user, FILE_VERSION_CONDITIONAL) == ZERO)
+    {
+        length = dfs_protocol_set_sized(string_storage);
+    }
 
     // send this to server and if there is any error wehile sending thenn print error message
-    if (send(channel_for_client, string_storage, strlen(string_storage), ZERO) == -1)
+    if (send(channel_for_client, string_storage, length, ZERO) == -1)
     {
         perror("deliver_command_to_server failed");
     }
@@ -69,11 +167,15 @@ empty_return_function deliver_file_to_server(number channel_for_client, constant
     off_t file_size = lseek(document_a4, ZERO, SEEK_END);
     // Rewind to the start of the file
     lseek(document_a4, ZERO, SEEK_SET);
+    last_transfer_bytes = file_size;
 
     // if file has no content then state this message but still send it to smain
     if (file_size == ZERO)
     {
-        show_on_cmd("File is empty: %s\n", document_name);
+        if (!quiet_transfers)
+        {
+            show_on_cmd("File is empty: %s\n", document_name);
+        }
         // sending to smain
         send(channel_for_client, "", 1, ZERO);
     }
@@ -93,6 +195,11 @@ empty_return_function deliver_file_to_server(number channel_for_client, constant
                 break;
             }
         }
+        // smain waits for a chunk shorter than its buffer, so a file ending on a full chunk gets one more byte like downloads do
+        if (dfs_protocol_needs_padding(file_size))
+        {
+            send(channel_for_client, "", 1, ZERO);
+        }
     }
 
     close(document_a4);
@@ -174,40 +281,10 @@ empty_return_function get_unique_filename(constant character *folder_path, chara
     }
 }
 
-// this is to create the folders recursively
-number create_directory_recursive(constant character *path)
-{
-    character temp[256];
-    character *p = NULL;
-    size_t len;
-
-    snprintf(temp, sizeof(temp), "%s", path);
-    len = strlen(temp);
-
-    if (temp[len - 1] == '/')
-    {
-        temp[len - 1] = '\0';
-    }
-
-    for (p = temp + 1; *p; p++)
-    {
-        if (*p == '/')
-        {
-            *p = '\0';
-            if (mkdir(temp, 0755) != ZERO && errno != EEXIST)
-            {
-                perror("mkdir");
-                return -1;
-            }
-            *p = '/';
-        }
-    }
-
-    return ZERO;
-}
-
 // function get_file_from_server is to get file content from smain
-empty_return_function get_file_from_server(number channel_for_client, constant character *document_name)
+// returns ZERO when the file was received and -1 when smain answered that it is not stored, in that case smain's
+// whole answer has been printed already and there is no end message to wait for
+number get_file_from_server(number channel_for_client, constant character *document_name)
 {
     // to store the buffer string here in this variable
     character string_storage[BUFFER_SIZE];
@@ -221,31 +298,74 @@ empty_return_function get_file_from_server(number channel_for_client, constant c
     character folder_name[1024];
     character base_filename[1024];
 
+    long long size = -1;
+
+    last_transfer_bytes = ZERO;
+    last_received_file[ZERO] = '\0';
+    // the download was sized, smain says first how many bytes follow, -1 when the file comes in chunks like for any dfile
+    if (delta_recv_line(channel_for_client, string_storage, sizeof(string_storage)) != ZERO || sscanf(string_storage, DFS_PROTOCOL_SIZE_LINE, &size) != 1)
+    {
+        show_on_cmd("Server disconnected.\n");
+        return -1;
+    }
+    // the first chunk tells whether the file exists, so nothing is created in the pwd before it arrived
+    bytes_received = size >= ZERO ? ZERO : recv(channel_for_client, string_storage, sizeof(string_storage), ZERO);
+    if (size < ZERO && bytes_received >= ZERO && dfs_client_not_found(string_storage, bytes_received))
+    {
+        if (quiet_transfers)
+        {
+            show_on_cmd("%.*s", (number)(bytes_received - strlen(FILE_NOT_FOUND_MARKER)), string_storage + strlen(FILE_NOT_FOUND_MARKER));
+            return -1;
+        }
+        show_on_cmd("Server reply_from_server: %.*s", (number)(bytes_received - strlen(FILE_NOT_FOUND_MARKER)), string_storage + strlen(FILE_NOT_FOUND_MARKER));
+        return -1;
+    }
+
     split_path(document_name, folder_name, base_filename);
     snprintf(file_path, sizeof(file_path), "%s/%s", cwd, base_filename);
 
     // if there is already same name filename exists in the pwd then rename it and make it unique
-    get_unique_filename(file_path, unique_filename);
-
-    // open the file with write access
-    document_a4 = fopen(unique_filename, "wb");
+    // the file is only opened when it is new, so batch workers fetching files of the same name never share one
+    do
+    {
+        get_unique_filename(file_path, unique_filename);
+        document_a4 = fopen(unique_filename, "wbx");
+    } while (document_a4 == NULL && errno == EEXIST);
     // if it doesnt open it then through error message
     if (document_a4 == NULL)
     {
         perror("Failed to open file for writing");
-        return;
+        return ZERO;
     }
 
+    snprintf(last_received_file, sizeof(last_received_file), "%s", unique_filename);
     // message on terminal that file is being recieved
-    show_on_cmd("Receiving file: %s\n", unique_filename);
-    // Receive the file data in chunks from smain and wait untill client gets it
-    while ((bytes_received = recv(channel_for_client, string_storage, sizeof(string_storage), ZERO)) >= ZERO)
+    if (!quiet_transfers)
+    {
+        show_on_cmd("Receiving file: %s\n", unique_filename);
+    }
+    // a file of known size is read up to its last byte, the end message follows it right away
+    while (size >= ZERO && last_transfer_bytes < size)
+    {
+        bytes_received = recv(channel_for_client, string_storage, size - last_transfer_bytes < (long long)sizeof(string_storage) ? (size_t)(size - last_transfer_bytes) : sizeof(string_storage), ZERO);
+        if (bytes_received <= ZERO)
+        {
+            bytes_received = -1;
+            break;
+        }
+        fwrite(string_storage, 1, bytes_received, document_a4);
+        last_transfer_bytes += bytes_received;
+    }
+    // Receive the file data in chunks from smain and wait untill client gets it, starting with the chunk received above
+    while (size < ZERO && bytes_received >= ZERO)
     {
         fwrite(string_storage, 1, bytes_received, document_a4);
+        last_transfer_bytes += bytes_received;
         if (bytes_received < sizeof(string_storage))
         {
             break; // End of file
         }
+        bytes_received = recv(channel_for_client, string_storage, sizeof(string_storage), ZERO);
     }
 
     // if none bytes recieved from the file then through error message
@@ -255,7 +375,120 @@ empty_return_function get_file_from_server(number channel_for_client, constant c
     }
     // close the file
     fclose(document_a4);
-    return;
+    return ZERO;
+}
+
+// prints the names smain sends for display as they arrive, up to END_OF_LIST
+// smain gathers them from all servers at once, so the list has no size limit and may come in several parts
+empty_return_function receive_listing(number channel_for_client)
+{
+    character *line = NULL;
+    size_t line_size = ZERO;
+    // a stdio stream on a copy of the socket reads whole lines, nothing follows END_OF_LIST so nothing is lost by buffering
+    number listing_channel = dup(channel_for_client);
+    FILE *listing = listing_channel >= ZERO ? fdopen(listing_channel, "r") : NULL;
+    if (listing == NULL)
+    {
+        perror("display");
+        if (listing_channel >= ZERO)
+        {
+            close(listing_channel);
+        }
+        return;
+    }
+    show_on_cmd("Server reply_from_server:\n");
+    while (getline(&line, &line_size, listing) > ZERO && strcmp(line, END_OF_LIST) != ZERO)
+    {
+        show_on_cmd("%s", line);
+        fflush(stdout);
+    }
+    free(line);
+    fclose(listing);
+}
+
+// prints the files of pathname a page at a time, "path size date" each, and asks before fetching the next page
+// the pages come sorted from smain and only one of them is held at a time, so the folder can be of any size
+empty_return_function receive_pages(number channel_for_client, constant character *pathname)
+{
+    character cursor[BUFFER_SIZE] = FIRST_PAGE_CURSOR;
+    character *line = NULL;
+    size_t line_size = ZERO;
+    ssize_t length;
+    unsigned long files = ZERO;
+    // smain sends nothing after a page until it is asked for the next one, so one stream can read all pages
+    number listing_channel = dup(channel_for_client);
+    FILE *listing = listing_channel >= ZERO ? fdopen(listing_channel, "r") : NULL;
+    if (listing == NULL)
+    {
+        perror("display");
+        if (listing_channel >= ZERO)
+        {
+            close(listing_channel);
+        }
+        return;
+    }
+    while (cursor[ZERO] != '\0')
+    {
+        deliver_command_to_server(channel_for_client, "page", pathname, cursor);
+        cursor[ZERO] = '\0';
+        number ended = ZERO;
+        while ((length = getline(&line, &line_size, listing)) > ZERO)
+        {
+            if (strcmp(line, END_OF_LIST) == ZERO)
+            {
+                ended = 1;
+                break;
+            }
+            line[length - 1] = '\0';
+            if (strncmp(line, NEXT_PAGE_PREFIX, strlen(NEXT_PAGE_PREFIX)) == ZERO)
+            {
+                snprintf(cursor, sizeof(cursor), "%s", line + strlen(NEXT_PAGE_PREFIX));
+                continue;
+            }
+            // the path may hold spaces, size and time are the last two words
+            character *mtime_text = strrchr(line, ' ');
+            character *size_text = NULL;
+            if (mtime_text != NULL)
+            {
+                *mtime_text++ = '\0';
+                size_text = strrchr(line, ' ');
+            }
+            if (size_text == NULL)
+            {
+                continue;
+            }
+            *size_text++ = '\0';
+            time_t modified = (time_t)atoll(mtime_text);
+            character date[32];
+            strftime(date, sizeof(date), "%Y-%m-%d %H:%M", localtime(&modified));
+            show_on_cmd("%12s  %s  %s\n", size_text, date, line);
+            files++;
+        }
+        fflush(stdout);
+        if (!ended)
+        {
+            show_on_cmd("Server disconnected.\n");
+            break;
+        }
+        if (cursor[ZERO] == '\0')
+        {
+            break;
+        }
+        // the rest of the folder is only fetched when it is wanted
+        character answer[BUFFER_SIZE];
+        show_on_cmd("-- %lu files so far, enter for more or q to stop: ", files);
+        fflush(stdout);
+        if (fgets(answer, sizeof(answer), stdin) == NULL || answer[ZERO] == 'q')
+        {
+            break;
+        }
+    }
+    if (files == ZERO)
+    {
+        show_on_cmd("Display command: No files were found.\n");
+    }
+    free(line);
+    fclose(listing);
 }
 
 // function manage_command_execution checks which command has been given by client
@@ -277,13 +510,20 @@ number manage_command_execution(number channel_for_client, constant character *i
         // function to deliver file content to smain
         deliver_file_to_server(channel_for_client, parameter_1);
     }
+    // if delta, only the changes against the stored copy are sent, or the whole file when there is none to compare with
+    else if (strcmp(instruction_from_user, DELTA_COMMAND) == ZERO)
+    {
+        return upload_changes(channel_for_client, parameter_1, parameter_2);
+    }
     // if dfile
     else if (strcmp(instruction_from_user, "dfile") == ZERO)
     {
-        // go to deliver_command_to_server and send this command to smain to execute and take appropriate actions
-        deliver_command_to_server(channel_for_client, instruction_from_user, parameter_1, parameter_2);
-        // function to receive file content from smain
-        get_file_from_server(channel_for_client, parameter_1);
+        // the file is asked for with the version of the copy in the cache, a copy which did not change is not sent again,
+        // that and a file which is not stored have no end message to wait for
+        if (get_file_with_cache(channel_for_client, parameter_1) != ZERO)
+        {
+            return -1;
+        }
     }
     // if rmfile
     else if (strcmp(instruction_from_user, "rmfile") == ZERO)
@@ -291,12 +531,24 @@ number manage_command_execution(number channel_for_client, constant character *i
         // go to deliver_command_to_server and send this command to smain to execute and take appropriate actions
         deliver_command_to_server(channel_for_client, instruction_from_user, parameter_1, parameter_2);
     }
-    // if dtar or display
-    else if (strcmp(instruction_from_user, "dtar") == ZERO || strcmp(instruction_from_user, "display") == ZERO)
+    // if dtar
+    else if (strcmp(instruction_from_user, "dtar") == ZERO)
     {
         // go to deliver_command_to_server and send this command to smain to execute and take appropriate actions
         deliver_command_to_server(channel_for_client, instruction_from_user, parameter_1, parameter_2);
     }
+    // if display, its whole answer is printed here and there is no end message to wait for
+    else if (strcmp(instruction_from_user, "display") == ZERO && strcmp(parameter_2, LONG_LISTING_OPTION) == ZERO)
+    {
+        receive_pages(channel_for_client, parameter_1);
+        return -1;
+    }
+    else if (strcmp(instruction_from_user, "display") == ZERO)
+    {
+        deliver_command_to_server(channel_for_client, instruction_from_user, parameter_1, parameter_2);
+        receive_listing(channel_for_client);
+        return -1;
+    }
     // if not valid command
     else
     {
@@ -304,107 +556,1024 @@ number manage_command_execution(number channel_for_client, constant character *i
         show_on_cmd("Unknown instruction_from_user: %s\n", instruction_from_user);
         return -1;
     }
+    // the end message of smain is still to come
+    return ZERO;
 }
 
-// entry point of code
-number main()
+// function upload_changes uploads a new version of a file which is stored already, smain sends the checksums of the blocks
+// of its copy and only the bytes which are not in one of those blocks go back (delta_transfer.h)
+// a file smain has no copy of, or keeps in a way which cannot take changes, is sent whole like with ufile
+// returns ZERO when the end message of smain is still to come, and -1 when the command ended here
+number upload_changes(number channel_for_client, constant character *document_name, constant character *target)
 {
-    // this is the socket initialization for client channel
-    number channel_for_client;
-    // socket addresses for server
-    object sockaddr_in server_channel_address;
-    // instruction_from_user is command or operation asked from client to perform
-    // parameter_1 is arguement 1 of command if there is any
-    // parameter_2 is arguement 2 of command if there is any
-    character instruction_from_user[BUFFER_SIZE], parameter_1[BUFFER_SIZE], parameter_2[BUFFER_SIZE];
-    // a temporary variable to store command and its parameters one by one
-    character *temp_storage_for_command;
-    // to store the inputed string from client in cmd
-    character user_entered_command[BUFFER_SIZE];
-    // make client socket here - TCP/IP socket
-    //  AF_INET stands for "Address family internet". Here we are taking it from IPv4 addresses
-    //  SOCK_STREAM is basically for providing reliable, two-way, connection-based byte streams. We use SOCKK_STREAM in TCP connection and SOCK_DGRAM for UDP
-    //  ZERO is to choose protocol by default as per AF_INET and SOCK_STREAM
-    //  here by default protocol would be TCP
-    //  this "if" condition checks if there is any error while creating socket
-    if ((channel_for_client = socket(AF_INET, SOCK_STREAM, ZERO)) < ZERO)
+    character reply_from_server[BUFFER_SIZE];
+    object delta_signature signature;
+    object stat info;
+    long long sent = ZERO;
+    number document_a4 = open(document_name, O_RDONLY);
+    if (document_a4 < ZERO || fstat(document_a4, &info) != ZERO)
     {
-        // if there is then print this message with error statement
-        perror("Failure of client socket due to: ");
-        // then exit from code
-        exit(EXIT_FAILURE);
+        perror("open file");
+        if (document_a4 >= ZERO)
+        {
+            close(document_a4);
+        }
+        return -1;
     }
-    // this is used to specify what IP address family would be used for server socket
-    server_channel_address.sin_family = AF_INET;
-    // this is for assigning port to server
-    // htons is used to convert - a host's byte order of 16-bit number (short) - from the to the network's byte order.
-    server_channel_address.sin_port = htons(PORT);
-    // inet_pton is used here to convert string IP address to binary form
-    if (inet_pton(AF_INET, IP_ADDRESS, &server_channel_address.sin_addr) <= ZERO)
+    // the whole file is looked at for blocks at every offset, it is mapped instead of read
+    constant unsigned char *content = info.st_size > ZERO ? mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, document_a4, ZERO) : NULL;
+    close(document_a4);
+    if (content == MAP_FAILED)
     {
-        // if unsuccesfull to change then print error
-        perror("Invalid address");
-        // exit with failure coode
-        exit(EXIT_FAILURE);
+        perror("mmap");
+        return -1;
     }
-    // Connect to server
-    if (connect(channel_for_client, (object sockaddr *)&server_channel_address, sizeof(server_channel_address)) < ZERO)
+    deliver_command_to_server(channel_for_client, DELTA_COMMAND, document_name, target);
+    if (delta_recv_line(channel_for_client, reply_from_server, sizeof(reply_from_server)) != ZERO)
     {
-        // if not connected then print error and exit with failure
-        perror("Failure of bind due to");
-        exit(EXIT_FAILURE);
+        show_on_cmd("Server disconnected.\n");
+        if (content != NULL)
+        {
+            munmap((empty_return_function *)content, info.st_size);
+        }
+        return -1;
     }
-    // infite loop to take command from client to perform through smain
-    while (1)
+    number result = ZERO;
+    if (strcmp(reply_from_server, DELTA_NONE) == ZERO || strcmp(reply_from_server, DELTA_REFUSED) == ZERO)
     {
-        // Get instruction_from_user from user
-        show_on_cmd("Please give command: ");
-        // if n o user_entered_command has been detected from client then print error message
-        // and then continue from top of the loop using continue;
-        if (fgets(user_entered_command, sizeof(user_entered_command), stdin) == NULL)
+        show_on_cmd("%s", strcmp(reply_from_server, DELTA_NONE) == ZERO ? "Smain has no copy of the file yet, " : "Smain cannot take changes of this file, ");
+        show_on_cmd("the whole file is sent.\n");
+        deliver_command_to_server(channel_for_client, UPLOAD_FILE, document_name, target);
+        deliver_file_to_server(channel_for_client, document_name);
+    }
+    else if (strncmp(reply_from_server, DELTA_SIGNATURE, strlen(DELTA_SIGNATURE)) != ZERO)
+    {
+        // any other answer (an unsupported file type) is all smain sends
+        show_on_cmd("Server reply_from_server: %s", reply_from_server);
+        result = -1;
+    }
+    else if (delta_read_signature(channel_for_client, reply_from_server, &signature) != ZERO ||
+             delta_send_changes(channel_for_client, content, info.st_size, &signature, &sent) != ZERO)
+    {
+        show_on_cmd("The changes of %s could not be sent.\n", document_name);
+        delta_free_signature(&signature);
+        result = -1;
+    }
+    else
+    {
+        show_on_cmd("Sent %lld bytes for %lld bytes of %s.\n", sent, (long long)info.st_size, document_name);
+        delta_free_signature(&signature);
+    }
+    if (content != NULL)
+    {
+        munmap((empty_return_function *)content, info.st_size);
+    }
+    return result;
+}
+
+// returns 1 when the ufile or dfile in words is a batch: more files than one, a list of files or (for ufile) a glob
+// ufile takes the folder on smain as its last word like before, dfile only files
+number batch_requested(constant character *instruction_from_user, character **words, number word_count)
+{
+    number upload = strcmp(instruction_from_user, UPLOAD_FILE) == ZERO;
+    if ((!upload && strcmp(instruction_from_user, DOWNLOAD_FILE) != ZERO) || word_count == ZERO)
+    {
+        return ZERO;
+    }
+    if (word_count > (upload ? 2 : 1))
+    {
+        return 1;
+    }
+    return words[ZERO][ZERO] == BATCH_LIST_PREFIX || (upload && strpbrk(words[ZERO], "*?[") != NULL);
+}
+
+// this function appends a copy of path to the list of files of a batch, it returns ZERO or -1 when memory ran out
+number batch_add_path(character ***paths, number *count, number *capacity, constant character *path)
+{
+    if (*count == *capacity)
+    {
+        number grown = *capacity > ZERO ? *capacity * 2 : 64;
+        character **bigger = realloc(*paths, grown * sizeof(character *));
+        if (bigger == NULL)
         {
-            perror("fgets failed");
-            continue;
+            return -1;
         }
-        // Remove newline character
-        user_entered_command[strcspn(user_entered_command, "\n")] = ZERO;
-        // Tokenize the user_entered_command means break it on basis of space and use command and parameter separately
-        temp_storage_for_command = strtok(user_entered_command, " ");
-        // if there is no command then pint error message to client
-        if (temp_storage_for_command == NULL)
+        *paths = bigger;
+        *capacity = grown;
+    }
+    if (((*paths)[*count] = strdup(path)) == NULL)
+    {
+        return -1;
+    }
+    (*count)++;
+    return ZERO;
+}
+
+// this function adds the files word stands for to a batch: the lines of the list @file, the matches of a glob
+// for an upload, or word itself, it returns ZERO or -1 when a list cannot be read or nothing matches a glob
+number batch_collect(constant character *word, number upload, character ***paths, number *count, number *capacity)
+{
+    if (word[ZERO] == BATCH_LIST_PREFIX)
+    {
+        FILE *list = fopen(word + 1, "r");
+        character *line = NULL;
+        size_t line_size = ZERO;
+        ssize_t length;
+        number failed = ZERO;
+        if (list == NULL)
         {
-            show_on_cmd("No command has been entered by you.\n");
-            // then continue form top
-            continue;
+            perror(word + 1);
+            return -1;
         }
-        // keep building final command and store it into instruction_from_user
-        strncpy(instruction_from_user, temp_storage_for_command, sizeof(instruction_from_user));
-        // this will take parameter_1 or arguement 1
-        temp_storage_for_command = strtok(NULL, " ");
-        // if there is arguement 1 then
-        if (temp_storage_for_command != NULL)
-        {
-            // add that arguement 1 to parameter_1
-            strncpy(parameter_1, temp_storage_for_command, sizeof(parameter_1));
-            // check for arguement 2
-            temp_storage_for_command = strtok(NULL, " ");
-            // if there is arguement 2
-            if (temp_storage_for_command != NULL)
-            {
-                // store it to parameter_2
-                strncpy(parameter_2, temp_storage_for_command, sizeof(parameter_2));
-            }
-            // otherwise keep it null
-            else
-            {
-                parameter_2[ZERO] = '\0';
-            }
+        // one path per line, it may hold spaces, empty lines are skipped
+        while (!failed && (length = getline(&line, &line_size, list)) > ZERO)
+        {
+            line[strcspn(line, "\r\n")] = '\0';
+            failed = line[ZERO] != '\0' && batch_add_path(paths, count, capacity, line) != ZERO;
         }
-        // otherwise keep them null
-        else
+        free(line);
+        fclose(list);
+        return failed ? -1 : ZERO;
+    }
+    // files on smain cannot be globbed here, a dfile word is always one file
+    if (upload && strpbrk(word, "*?[") != NULL)
+    {
+        glob_t matches;
+        if (glob(word, ZERO, NULL, &matches) != ZERO)
+        {
+            show_on_cmd("No file matches %s\n", word);
+            return -1;
+        }
+        number failed = ZERO;
+        for (size_t i = ZERO; i < matches.gl_pathc && !failed; i++)
+        {
+            failed = batch_add_path(paths, count, capacity, matches.gl_pathv[i]) != ZERO;
+        }
+        globfree(&matches);
+        return failed ? -1 : ZERO;
+    }
+    return batch_add_path(paths, count, capacity, word);
+}
+
+// this function writes the folder on smain which the file path of a batch upload goes to
+// a relative path keeps its folders below target, so a list made with find uploads a whole tree as it is
+empty_return_function batch_target_for(constant character *path, constant character *target, character *folder, size_t folder_size)
+{
+    constant character *last_slash = strrchr(path, '/');
+    if (last_slash == NULL || path[ZERO] == '/' || strstr(path, "..") != NULL)
+    {
+        snprintf(folder, folder_size, "%s", target);
+        return;
+    }
+    // "./a/b.txt" goes to target/a like "a/b.txt"
+    while (strncmp(path, "./", 2) == ZERO)
+    {
+        path += 2;
+    }
+    if (last_slash < path)
+    {
+        snprintf(folder, folder_size, "%s", target);
+        return;
+    }
+    snprintf(folder, folder_size, "%s/%.*s", target, (number)(last_slash - path), path);
+}
+
+// this function moves (or removes) one file of a batch over channel_for_client, like a ufile, dfile or rmfile typed at the prompt
+// it returns ZERO when smain confirmed the file and -1 when it did not, -2 when the connection is gone
+number batch_transfer(number channel_for_client, number mode, constant character *path, constant character *target)
+{
+    character folder[BUFFER_SIZE];
+    character reply_from_server[BUFFER_SIZE];
+    last_transfer_bytes = ZERO;
+    if (mode == BATCH_REMOVE)
+    {
+        deliver_command_to_server(channel_for_client, REMOVE_FILE, path, "");
+    }
+    else if (mode == BATCH_UPLOAD)
+    {
+        // a file which cannot be read is not announced to smain at all
+        if (access(path, R_OK) != ZERO)
+        {
+            perror(path);
+            return -1;
+        }
+        batch_target_for(path, target, folder, sizeof(folder));
+        deliver_command_to_server(channel_for_client, UPLOAD_FILE, path, folder);
+        deliver_file_to_server(channel_for_client, path);
+    }
+    else
+    {
+        // a file which is not stored has its whole answer printed already and no end message,
+        // neither has one which was taken from the cache
+        number cached = get_file_with_cache(channel_for_client, path);
+        if (cached != ZERO)
+        {
+            return cached > ZERO ? ZERO : -1;
+        }
+    }
+    number len = recv(channel_for_client, reply_from_server, sizeof(reply_from_server) - 1, ZERO);
+    if (len <= ZERO)
+    {
+        show_on_cmd("%s: server disconnected\n", path);
+        return -2;
+    }
+    reply_from_server[len] = '\0';
+    finish_received_file(reply_from_server);
+    if (strstr(reply_from_server, "successfully") == NULL)
+    {
+        show_on_cmd("%s: %s", path, reply_from_server);
+        return -1;
+    }
+    return ZERO;
+}
+
+// this function is one worker process of a batch, it takes the next file until none is left
+// every worker has a connection of its own, so smain serves the files of a batch in as many processes
+empty_return_function batch_worker(number mode, character **paths, number count, constant character *target, object batch_progress *progress)
+{
+    number channel_for_client = connect_to_smain();
+    quiet_transfers = 1;
+    number taken;
+    while ((taken = __sync_fetch_and_add(&progress->next, 1)) < count)
+    {
+        number result = channel_for_client >= ZERO ? batch_transfer(channel_for_client, mode, paths[taken], target) : -2;
+        // a worker whose connection broke gets a new one for the next file
+        if (result == -2 && channel_for_client >= ZERO)
         {
-            parameter_1[ZERO] = '\0';
-            parameter_2[ZERO] = '\0';
+            close(channel_for_client);
+            channel_for_client = connect_to_smain();
+        }
+        __sync_fetch_and_add(&progress->bytes, last_transfer_bytes);
+        __sync_fetch_and_add(&progress->failed, result != ZERO);
+        __sync_fetch_and_add(&progress->done, 1);
+    }
+    if (channel_for_client >= ZERO)
+    {
+        close(channel_for_client);
+    }
+}
+
+// this function collects the files of a batch ufile or dfile given in words and moves them with run_batch_files()
+empty_return_function run_batch(constant character *instruction_from_user, character **words, number word_count)
+{
+    number upload = strcmp(instruction_from_user, UPLOAD_FILE) == ZERO;
+    // an upload ends with the folder on smain
+    number file_words = upload ? word_count - 1 : word_count;
+    constant character *target = upload ? words[word_count - 1] : "";
+    character **paths = NULL;
+    number count = ZERO, capacity = ZERO;
+    number unusable = ZERO;
+    if (file_words < 1)
+    {
+        show_on_cmd("Usage: ufile <file, glob or @list>... <folder on smain> or dfile <file or @list>...\n");
+        return;
+    }
+    for (number i = ZERO; i < file_words; i++)
+    {
+        if (batch_collect(words[i], upload, &paths, &count, &capacity) != ZERO)
+        {
+            unusable = 1;
+            break;
+        }
+    }
+    if (!unusable && count == ZERO)
+    {
+        show_on_cmd("No files were given.\n");
+    }
+    else if (!unusable)
+    {
+        run_batch_files(instruction_from_user, upload ? BATCH_UPLOAD : BATCH_DOWNLOAD, paths, count, target);
+    }
+    free_batch_paths(paths, count);
+}
+
+// this function moves the count files of paths with batch_jobs worker processes, mode tells what is done with each
+// and writes one progress line for all of them until every file was moved or failed
+empty_return_function run_batch_files(constant character *instruction_from_user, number mode, character **paths, number count, constant character *target)
+{
+    object batch_progress *progress = count > ZERO ? mmap(NULL, sizeof(*progress), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, ZERO) : MAP_FAILED;
+    if (progress == MAP_FAILED)
+    {
+        if (count > ZERO)
+        {
+            perror("batch");
+        }
+        return;
+    }
+    number jobs = batch_jobs < count ? batch_jobs : count;
+    number running = ZERO;
+    object timespec started, now;
+    memset(progress, ZERO, sizeof(*progress));
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    // stdout is empty before forking so the workers do not print what the prompt printed before
+    fflush(stdout);
+    for (number i = ZERO; i < jobs; i++)
+    {
+        pid_t worker = fork();
+        if (worker == ZERO)
+        {
+            batch_worker(mode, paths, count, target, progress);
+            fflush(stdout);
+            _exit(ZERO);
+        }
+        running += worker > ZERO;
+    }
+    // the workers are waited for and the counters shown until the last one is done
+    while (running > ZERO)
+    {
+        while (running > ZERO && waitpid(-1, NULL, WNOHANG) > ZERO)
+        {
+            running--;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double seconds = (now.tv_sec - started.tv_sec) + (now.tv_nsec - started.tv_nsec) / 1e9;
+        show_on_cmd("\r%s: %d of %d files, %d failed, %.1f MB, %.1f MB/s   ", instruction_from_user, progress->done, count, progress->failed,
+                    progress->bytes / 1048576.0, seconds > ZERO ? progress->bytes / 1048576.0 / seconds : 0.0);
+        fflush(stdout);
+        if (running > ZERO)
+        {
+            usleep(BATCH_PROGRESS_USEC);
+        }
+    }
+    show_on_cmd("\n");
+    // workers which could not be started leave files behind, those count as failed
+    if (progress->done < count)
+    {
+        show_on_cmd("%d files were not moved.\n", count - progress->done);
+    }
+    munmap(progress, sizeof(*progress));
+}
+
+// this function frees the list of files of a batch
+empty_return_function free_batch_paths(character **paths, number count)
+{
+    for (number i = ZERO; i < count; i++)
+    {
+        free(paths[i]);
+    }
+    free(paths);
+}
+
+// this function writes a "path size mtime" line to manifest for every file below folder, path relative to the synced folder
+// relative is the path of folder itself below it ("" for the synced folder), it returns ZERO or -1 when a folder cannot be read
+number sync_walk(constant character *folder, constant character *relative, FILE *manifest, number *files)
+{
+    DIR *listing = opendir(folder);
+    object dirent *entry;
+    number failed = ZERO;
+    if (listing == NULL)
+    {
+        perror(folder);
+        return -1;
+    }
+    while ((entry = readdir(listing)) != NULL && !failed)
+    {
+        character path[PATH_MAX];
+        character relative_path[PATH_MAX];
+        object stat info;
+        // a name with a line break cannot go into the manifest, links are not followed out of the folder
+        if (strcmp(entry->d_name, ".") == ZERO || strcmp(entry->d_name, "..") == ZERO || strchr(entry->d_name, '\n') != NULL)
+        {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", folder, entry->d_name);
+        snprintf(relative_path, sizeof(relative_path), "%s%s%s", relative, relative[ZERO] != '\0' ? "/" : "", entry->d_name);
+        if (lstat(path, &info) != ZERO)
+        {
+            continue;
+        }
+        if (S_ISDIR(info.st_mode))
+        {
+            failed = sync_walk(path, relative_path, manifest, files) != ZERO;
+        }
+        else if (S_ISREG(info.st_mode))
+        {
+            fprintf(manifest, "%s %lld %lld\n", relative_path, (long long)info.st_size, (long long)info.st_mtime);
+            (*files)++;
+        }
+    }
+    closedir(listing);
+    return failed ? -1 : ZERO;
+}
+
+// this function makes the folder target on smain the same as local_folder: smain compares a manifest of the local files
+// with its own in one pass and only the files it names are uploaded, by batch workers like a batch ufile
+// files which are only on smain are removed when remove_extra is set and listed otherwise
+empty_return_function run_sync(number channel_for_client, constant character *local_folder, constant character *target, number remove_extra)
+{
+    character *manifest = NULL;
+    size_t manifest_size = ZERO;
+    character manifest_length[32];
+    character **uploads = NULL, **extras = NULL;
+    number upload_count = ZERO, upload_capacity = ZERO, extra_count = ZERO, extra_capacity = ZERO, skipped = ZERO, files = ZERO;
+    number ended = ZERO;
+    FILE *manifest_stream = open_memstream(&manifest, &manifest_size);
+    if (manifest_stream == NULL)
+    {
+        perror("sync");
+        return;
+    }
+    number walked = sync_walk(local_folder, "", manifest_stream, &files);
+    fclose(manifest_stream);
+    if (walked != ZERO)
+    {
+        free(manifest);
+        return;
+    }
+    // smain reads the manifest right after the command and answers with the files which differ
+    snprintf(manifest_length, sizeof(manifest_length), "%zu", manifest_size);
+    deliver_command_to_server(channel_for_client, SYNC_FOLDER, target, manifest_length);
+    for (size_t offset = ZERO; offset < manifest_size;)
+    {
+        ssize_t written = send(channel_for_client, manifest + offset, manifest_size - offset, ZERO);
+        if (written <= ZERO)
+        {
+            perror("sync");
+            break;
+        }
+        offset += written;
+    }
+    free(manifest);
+    number reply_channel = dup(channel_for_client);
+    FILE *reply = reply_channel >= ZERO ? fdopen(reply_channel, "r") : NULL;
+    if (reply == NULL)
+    {
+        perror("sync");
+        if (reply_channel >= ZERO)
+        {
+            close(reply_channel);
+        }
+        return;
+    }
+    character *line = NULL;
+    size_t line_size = ZERO;
+    ssize_t length;
+    while ((length = getline(&line, &line_size, reply)) > ZERO)
+    {
+        if (strcmp(line, END_OF_LIST) == ZERO)
+        {
+            ended = 1;
+            break;
+        }
+        line[strcspn(line, "\n")] = '\0';
+        if (strncmp(line, "SEND ", 5) == ZERO)
+        {
+            batch_add_path(&uploads, &upload_count, &upload_capacity, line + 5);
+        }
+        // removals name the file on smain, below target
+        else if (strncmp(line, "EXTRA ", 6) == ZERO)
+        {
+            character stored[BUFFER_SIZE];
+            snprintf(stored, sizeof(stored), "%s/%s", target, line + 6);
+            batch_add_path(&extras, &extra_count, &extra_capacity, stored);
+        }
+        else if (strncmp(line, "SKIP ", 5) == ZERO)
+        {
+            skipped++;
+        }
+        else
+        {
+            show_on_cmd("Server reply_from_server: %s\n", line);
+        }
+    }
+    free(line);
+    fclose(reply);
+    if (!ended)
+    {
+        show_on_cmd("Server disconnected.\n");
+    }
+    else
+    {
+        show_on_cmd("sync: %d files, %d to upload, %d only on smain, %d not supported\n", files, upload_count, extra_count, skipped);
+        // the paths are relative to the local folder and keep their folders below target, like a batch ufile run from inside it
+        number home = open(".", O_RDONLY | O_DIRECTORY);
+        if (upload_count > ZERO && home >= ZERO && chdir(local_folder) == ZERO)
+        {
+            run_batch_files(UPLOAD_FILE, BATCH_UPLOAD, uploads, upload_count, target);
+            if (fchdir(home) != ZERO)
+            {
+                perror("sync");
+            }
+        }
+        if (home >= ZERO)
+        {
+            close(home);
+        }
+        if (extra_count > ZERO && remove_extra)
+        {
+            run_batch_files(REMOVE_FILE, BATCH_REMOVE, extras, extra_count, "");
+        }
+        else if (extra_count > ZERO)
+        {
+            show_on_cmd("sync with %s removes the files which are only on smain.\n", SYNC_DELETE_OPTION);
+        }
+    }
+    free_batch_paths(uploads, upload_count);
+    free_batch_paths(extras, extra_count);
+}
+
+// this function prints size, time, content hash and tier of the files on smain words name, a word may be a list @file
+// smain looks all of them up at once, a long list goes in several requests of at most FILE_STAT_PATHS files
+empty_return_function run_stat(number channel_for_client, character **words, number word_count)
+{
+    character **paths = NULL;
+    number count = ZERO, capacity = ZERO;
+    for (number i = ZERO; i < word_count; i++)
+    {
+        if (batch_collect(words[i], ZERO, &paths, &count, &capacity) != ZERO)
+        {
+            free_batch_paths(paths, count);
+            return;
+        }
+    }
+    show_on_cmd("%12s  %-16s  %-16s  %-7s  %s\n", "size", "modified", "hash", "tier", "file");
+    for (number first = ZERO; first < count;)
+    {
+        number taken = stat_paths(channel_for_client, paths + first, count - first);
+        if (taken <= ZERO)
+        {
+            break;
+        }
+        first += taken;
+    }
+    fflush(stdout);
+    free_batch_paths(paths, count);
+}
+
+// this function sends one stat request for the first of count paths and prints the answer
+// it returns how many paths the request had, or -1 when smain did not answer
+number stat_paths(number channel_for_client, character **paths, number count)
+{
+    character count_text[32], length_text[32];
+    size_t length = ZERO;
+    number taken = ZERO;
+    // a path cannot hold a line break, it would end the path for smain
+    while (taken < count && taken < FILE_STAT_PATHS && length + strlen(paths[taken]) + 1 <= FILE_STAT_MAXIMUM)
+    {
+        length += strlen(paths[taken++]) + 1;
+    }
+    if (taken == ZERO)
+    {
+        show_on_cmd("%s: path too long\n", paths[ZERO]);
+        return -1;
+    }
+    character *body = malloc(length);
+    if (body == NULL)
+    {
+        perror("stat");
+        return -1;
+    }
+    for (size_t used = ZERO, i = ZERO; i < (size_t)taken; i++)
+    {
+        size_t path_length = strlen(paths[i]);
+        memcpy(body + used, paths[i], path_length);
+        body[used + path_length] = '\n';
+        used += path_length + 1;
+    }
+    snprintf(count_text, sizeof(count_text), "%d", taken);
+    snprintf(length_text, sizeof(length_text), "%zu", length);
+    deliver_command_to_server(channel_for_client, FILE_STAT_COMMAND, count_text, length_text);
+    number sent = delta_send_all(channel_for_client, body, length);
+    free(body);
+    // nothing follows END_OF_LIST, so a stdio stream can read the answer
+    number reply_channel = sent == ZERO ? dup(channel_for_client) : -1;
+    FILE *reply = reply_channel >= ZERO ? fdopen(reply_channel, "r") : NULL;
+    if (reply == NULL)
+    {
+        perror("stat");
+        if (reply_channel >= ZERO)
+        {
+            close(reply_channel);
+        }
+        return -1;
+    }
+    character *line = NULL;
+    size_t line_size = ZERO;
+    number ended = ZERO;
+    while (getline(&line, &line_size, reply) > ZERO)
+    {
+        if (strcmp(line, END_OF_LIST) == ZERO)
+        {
+            ended = 1;
+            break;
+        }
+        line[strcspn(line, "\n")] = '\0';
+        character size_text[32], mtime_text[32], hash[FILE_STAT_HASH_SIZE], tier[16];
+        number used = ZERO;
+        if (sscanf(line, "%31s %31s %16s %15s %n", size_text, mtime_text, hash, tier, &used) != 4 || used == ZERO)
+        {
+            show_on_cmd("Server reply_from_server: %s\n", line);
+            continue;
+        }
+        if (strcmp(size_text, FILE_STAT_UNKNOWN) == ZERO)
+        {
+            show_on_cmd("%12s  %-16s  %-16s  %-7s  %s\n", "-", "not stored", "-", "-", line + used);
+            continue;
+        }
+        time_t modified = (time_t)atoll(mtime_text);
+        character date[32];
+        strftime(date, sizeof(date), "%Y-%m-%d %H:%M", localtime(&modified));
+        show_on_cmd("%12s  %-16s  %-16s  %-7s  %s\n", size_text, date, hash, tier, line + used);
+    }
+    free(line);
+    fclose(reply);
+    if (!ended)
+    {
+        show_on_cmd("Server disconnected.\n");
+        return -1;
+    }
+    return taken;
+}
+
+// this function creates the folder of the download cache in $HOME, without one every dfile downloads the whole file
+empty_return_function open_download_cache()
+{
+    constant character *home = getenv("HOME");
+    character folder[PATH_MAX];
+    // the folder has to leave room for the names of its entries, a longer one means there is no cache
+    if (home == NULL || snprintf(folder, sizeof(folder), "%s/%s", home, CACHE_FOLDER) >= (number)sizeof(folder) - CACHE_ENTRY_NAME_SIZE)
+    {
+        return;
+    }
+    if (mkdir(folder, 0700) != ZERO && errno != EEXIST)
+    {
+        perror("download cache");
+        return;
+    }
+    snprintf(cache_folder, sizeof(cache_folder), "%s", folder);
+}
+
+// this function writes the path of the cache entry of document_name into path, suffix is ".data" or ".meta"
+// entries are named after a hash of the path on smain, the meta file holds the version and the path itself
+// returns ZERO, or -1 when the path does not fit into path_size bytes
+number cache_entry_path(constant character *document_name, constant character *suffix, character *path, size_t path_size)
+{
+    unsigned long long hash = delta_hash(DELTA_HASH_START, (constant unsigned char *)document_name, strlen(document_name));
+    number length = snprintf(path, path_size, "%s/%016llx%s", cache_folder, hash, suffix);
+    return length >= ZERO && (size_t)length < path_size ? ZERO : -1;
+}
+
+// this function reads the version of the cached copy of document_name into version
+// returns ZERO, or -1 when there is no copy, version is FILE_VERSION_UNKNOWN then
+number cache_lookup(constant character *document_name, character *version, size_t version_size)
+{
+    character meta_path[PATH_MAX];
+    character data_path[PATH_MAX];
+    character stored_name[BUFFER_SIZE];
+    snprintf(version, version_size, "%s", FILE_VERSION_UNKNOWN);
+    if (cache_folder[ZERO] == '\0' || cache_entry_path(document_name, ".meta", meta_path, sizeof(meta_path)) != ZERO ||
+        cache_entry_path(document_name, ".data", data_path, sizeof(data_path)) != ZERO)
+    {
+        return -1;
+    }
+    FILE *meta = fopen(meta_path, "r");
+    if (meta == NULL)
+    {
+        return -1;
+    }
+    character line[FILE_VERSION_SIZE];
+    number found = fgets(line, sizeof(line), meta) != NULL && fgets(stored_name, sizeof(stored_name), meta) != NULL;
+    fclose(meta);
+    if (!found)
+    {
+        return -1;
+    }
+    line[strcspn(line, "\n")] = '\0';
+    stored_name[strcspn(stored_name, "\n")] = '\0';
+    // two paths with the same hash share the entry, the copy of the other one is not used
+    if (strcmp(stored_name, document_name) != ZERO || access(data_path, R_OK) != ZERO)
+    {
+        return -1;
+    }
+    snprintf(version, version_size, "%s", line);
+    return ZERO;
+}
+
+// this function copies the rest of the file from into the file to, it returns ZERO or -1
+number copy_file_contents(number from, number to)
+{
+    character string_storage[BUFFER_SIZE * 64];
+    ssize_t got;
+    while ((got = read(from, string_storage, sizeof(string_storage))) > ZERO)
+    {
+        if (write(to, string_storage, got) != got)
+        {
+            return -1;
+        }
+    }
+    return got < ZERO ? -1 : ZERO;
+}
+
+// this function keeps a copy of the file received in the cache as document_name with version
+// the data is renamed into place before the meta file, a copy is never found with the version of another one
+empty_return_function cache_store(constant character *document_name, constant character *version, constant character *received)
+{
+    character data_path[PATH_MAX];
+    character meta_path[PATH_MAX];
+    character temporary[PATH_MAX + 16];
+    if (cache_folder[ZERO] == '\0' || strcmp(version, FILE_VERSION_UNKNOWN) == ZERO ||
+        cache_entry_path(document_name, ".data", data_path, sizeof(data_path)) != ZERO ||
+        cache_entry_path(document_name, ".meta", meta_path, sizeof(meta_path)) != ZERO)
+    {
+        return;
+    }
+    // the old meta file goes first, a copy which is being replaced is not used by another client meanwhile
+    unlink(meta_path);
+    // batch workers may store the same path at the same time, each one writes a file of its own
+    snprintf(temporary, sizeof(temporary), "%s.%d", data_path, (number)getpid());
+    number from = open(received, O_RDONLY);
+    number to = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    number copied = from >= ZERO && to >= ZERO && copy_file_contents(from, to) == ZERO;
+    if (from >= ZERO)
+    {
+        close(from);
+    }
+    if (to >= ZERO)
+    {
+        close(to);
+    }
+    if (!copied || rename(temporary, data_path) != ZERO)
+    {
+        unlink(temporary);
+        return;
+    }
+    snprintf(temporary, sizeof(temporary), "%s.%d", meta_path, (number)getpid());
+    FILE *meta = fopen(temporary, "w");
+    if (meta == NULL)
+    {
+        return;
+    }
+    fprintf(meta, "%s\n%s\n", version, document_name);
+    if (fclose(meta) != ZERO || rename(temporary, meta_path) != ZERO)
+    {
+        unlink(temporary);
+    }
+}
+
+// function get_file_with_cache downloads a file like get_file_from_server, but sends cdfile with the version of the
+// cached copy, smain then answers with FILE_VERSION_NOT_MODIFIED alone when the copy is still current and it is taken from the cache
+// returns ZERO when the file was received and the end message is still to come, 1 when the cached copy was used,
+// and -1 when the file is not stored or smain did not answer, the command ended then in both cases
+number get_file_with_cache(number channel_for_client, constant character *document_name)
+{
+    character version[FILE_VERSION_SIZE];
+    character reply_from_server[BUFFER_SIZE];
+    character data_path[PATH_MAX];
+    character file_path[BUFFER_SIZE];
+    character unique_filename[BUFFER_SIZE];
+    character folder_name[1024];
+    character base_filename[1024];
+    character cwd[PATH_MAX];
+    pending_cache_name[ZERO] = '\0';
+    cache_lookup(document_name, version, sizeof(version));
+    deliver_command_to_server(channel_for_client, FILE_VERSION_CONDITIONAL, document_name, version);
+    if (delta_recv_line(channel_for_client, reply_from_server, sizeof(reply_from_server)) != ZERO)
+    {
+        show_on_cmd("Server disconnected.\n");
+        return -1;
+    }
+    if (strncmp(reply_from_server, FILE_VERSION_REPLY " ", strlen(FILE_VERSION_REPLY " ")) == ZERO)
+    {
+        constant character *given = reply_from_server + strlen(FILE_VERSION_REPLY " ");
+        number given_length = strcspn(given, "\n");
+        // a version longer than any smain gives out is not trusted, the file is downloaded but not kept in the cache
+        if (given_length >= (number)sizeof(version))
+        {
+            given = FILE_VERSION_UNKNOWN;
+            given_length = strlen(FILE_VERSION_UNKNOWN);
+        }
+        memcpy(version, given, given_length);
+        version[given_length] = '\0';
+        if (get_file_from_server(channel_for_client, document_name) != ZERO)
+        {
+            return -1;
+        }
+        // the copy goes into the cache once the end message gave its size
+        if (last_received_file[ZERO] != '\0')
+        {
+            snprintf(pending_cache_name, sizeof(pending_cache_name), "%s", document_name);
+            snprintf(pending_cache_version, sizeof(pending_cache_version), "%s", version);
+        }
+        return ZERO;
+    }
+    // any other answer is the whole answer of smain, like the one for a file type it does not store
+    if (strcmp(reply_from_server, FILE_VERSION_NOT_MODIFIED) != ZERO)
+    {
+        show_on_cmd("Server reply_from_server: %s", reply_from_server);
+        return -1;
+    }
+    // the copy in the cache is current, it is written into the pwd in the same way a download is
+    number from = cache_entry_path(document_name, ".data", data_path, sizeof(data_path)) == ZERO ? open(data_path, O_RDONLY) : -1;
+    if (from < ZERO)
+    {
+        perror("download cache");
+        return -1;
+    }
+    getcwd(cwd, sizeof(cwd));
+    split_path(document_name, folder_name, base_filename);
+    if (snprintf(file_path, sizeof(file_path), "%s/%s", cwd, base_filename) >= (number)sizeof(file_path))
+    {
+        show_on_cmd("Path of %s is too long.\n", base_filename);
+        close(from);
+        return -1;
+    }
+    number to;
+    do
+    {
+        get_unique_filename(file_path, unique_filename);
+        to = open(unique_filename, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    } while (to < ZERO && errno == EEXIST);
+    if (to < ZERO)
+    {
+        perror("Failed to open file for writing");
+        close(from);
+        return -1;
+    }
+    number copied = copy_file_contents(from, to);
+    close(from);
+    close(to);
+    if (copied != ZERO)
+    {
+        perror("download cache");
+        return -1;
+    }
+    if (!quiet_transfers)
+    {
+        show_on_cmd("File %s has not changed, taken from the cache: %s\n", document_name, unique_filename);
+    }
+    return 1;
+}
+
+// this function ends the download of the file received last once smain's end message reply_from_server came
+// a file ending on a full chunk arrived with one more byte, which the size in the end message leaves out,
+// and a file asked for with cdfile goes into the cache when smain says it was sent completely
+empty_return_function finish_received_file(constant character *reply_from_server)
+{
+    long long size = dfs_protocol_reply_size(reply_from_server);
+    if (last_received_file[ZERO] == '\0')
+    {
+        return;
+    }
+    if (size >= ZERO && last_transfer_bytes == size + 1 && dfs_protocol_needs_padding(size) && truncate(last_received_file, size) == ZERO)
+    {
+        last_transfer_bytes = size;
+    }
+    if (pending_cache_name[ZERO] != '\0' && strstr(reply_from_server, DFS_CLIENT_SUCCESS) != NULL)
+    {
+        cache_store(pending_cache_name, pending_cache_version, last_received_file);
+    }
+    pending_cache_name[ZERO] = '\0';
+    last_received_file[ZERO] = '\0';
+}
+
+// this function connects a new socket to smain, it returns the socket or -1 when smain cannot be reached
+number connect_to_smain()
+{
+    // this is the socket initialization for client channel
+    number channel_for_client;
+    // socket addresses for server
+    object sockaddr_in server_channel_address;
+    // make client socket here - TCP/IP socket
+    //  AF_INET stands for "Address family internet". Here we are taking it from IPv4 addresses
+    //  SOCK_STREAM is basically for providing reliable, two-way, connection-based byte streams. We use SOCKK_STREAM in TCP connection and SOCK_DGRAM for UDP
+    //  ZERO is to choose protocol by default as per AF_INET and SOCK_STREAM
+    //  here by default protocol would be TCP
+    //  this "if" condition checks if there is any error while creating socket
+    if ((channel_for_client = socket(AF_INET, SOCK_STREAM, ZERO)) < ZERO)
+    {
+        // if there is then print this message with error statement
+        perror("Failure of client socket due to: ");
+        return -1;
+    }
+    // this is used to specify what IP address family would be used for server socket
+    server_channel_address.sin_family = AF_INET;
+    // this is for assigning port to server
+    // htons is used to convert - a host's byte order of 16-bit number (short) - from the to the network's byte order.
+    server_channel_address.sin_port = htons(PORT);
+    // inet_pton is used here to convert string IP address to binary form
+    if (inet_pton(AF_INET, IP_ADDRESS, &server_channel_address.sin_addr) <= ZERO)
+    {
+        // if unsuccesfull to change then print error
+        perror("Invalid address");
+        close(channel_for_client);
+        return -1;
+    }
+    // Connect to server
+    if (connect(channel_for_client, (object sockaddr *)&server_channel_address, sizeof(server_channel_address)) < ZERO)
+    {
+        // if not connected then print error
+        perror("Failure of bind due to");
+        close(channel_for_client);
+        return -1;
+    }
+    return channel_for_client;
+}
+
+// entry point of code
+number main(number argc, character *argv[])
+{
+    // this is the socket initialization for client channel
+    number channel_for_client;
+    // instruction_from_user is command or operation asked from client to perform
+    // parameter_1 is arguement 1 of command if there is any
+    // parameter_2 is arguement 2 of command if there is any
+    character instruction_from_user[BUFFER_SIZE], parameter_1[BUFFER_SIZE], parameter_2[BUFFER_SIZE];
+    // a temporary variable to store command and its parameters one by one
+    character *temp_storage_for_command;
+    // every word of the command line, ufile and dfile can be given many files
+    character *words[BATCH_MAX_WORDS];
+    number word_count;
+    // to store the inputed string from client in cmd
+    character user_entered_command[BUFFER_SIZE];
+    number option;
+    // -j sets how many files a batch ufile or dfile moves at the same time
+    while ((option = getopt(argc, argv, "j:")) != -1)
+    {
+        if (option != 'j' || atoi(optarg) < 1 || atoi(optarg) > BATCH_MAX_JOBS)
+        {
+            fprintf(stderr, "usage: %s [-j 1-%d parallel transfers]\n", argv[ZERO], BATCH_MAX_JOBS);
+            exit(EXIT_FAILURE);
+        }
+        batch_jobs = atoi(optarg);
+    }
+    open_download_cache();
+    // if the client could not connect then exit with failure
+    if ((channel_for_client = connect_to_smain()) < ZERO)
+    {
+        exit(EXIT_FAILURE);
+    }
+    // infite loop to take command from client to perform through smain
+    while (1)
+    {
+        // Get instruction_from_user from user
+        show_on_cmd("Please give command: ");
+        // if n o user_entered_command has been detected from client then print error message
+        // and then continue from top of the loop using continue;
+        if (fgets(user_entered_command, sizeof(user_entered_command), stdin) == NULL)
+        {
+            perror("fgets failed");
+            continue;
+        }
+        // Remove newline character
+        user_entered_command[strcspn(user_entered_command, "\n")] = ZERO;
+        // Tokenize the user_entered_command means break it on basis of space and use command and parameter separately
+        word_count = ZERO;
+        for (temp_storage_for_command = strtok(user_entered_command, " "); temp_storage_for_command != NULL && word_count < BATCH_MAX_WORDS; temp_storage_for_command = strtok(NULL, " "))
+        {
+            words[word_count++] = temp_storage_for_command;
+        }
+        // if there is no command then pint error message to client
+        if (word_count == ZERO)
+        {
+            show_on_cmd("No command has been entered by you.\n");
+            // then continue form top
+            continue;
+        }
+        // keep building final command and store it into instruction_from_user, with arguement 1 and 2 or null when not given
+        snprintf(instruction_from_user, sizeof(instruction_from_user), "%s", words[ZERO]);
+        snprintf(parameter_1, sizeof(parameter_1), "%s", word_count > 1 ? words[1] : "");
+        snprintf(parameter_2, sizeof(parameter_2), "%s", word_count > 2 ? words[2] : "");
+        // jobs changes the number of parallel transfers of the next batches
+        if (strcmp(instruction_from_user, "jobs") == ZERO)
+        {
+            if (atoi(parameter_1) >= 1 && atoi(parameter_1) <= BATCH_MAX_JOBS)
+            {
+                batch_jobs = atoi(parameter_1);
+            }
+            show_on_cmd("Batches move %d files at a time.\n", batch_jobs);
+            continue;
+        }
+        // sync uploads the files of a local folder smain does not have in the same way, and removes the others with -d
+        if (strcmp(instruction_from_user, SYNC_FOLDER) == ZERO)
+        {
+            if (word_count < 3)
+            {
+                show_on_cmd("Usage: sync <local folder> <folder on smain> [%s]\n", SYNC_DELETE_OPTION);
+            }
+            else
+            {
+                run_sync(channel_for_client, parameter_1, parameter_2, word_count > 3 && strcmp(words[3], SYNC_DELETE_OPTION) == ZERO);
+            }
+            continue;
+        }
+        // stat prints size, time, content hash and tier of files on smain without downloading them
+        if (strcmp(instruction_from_user, FILE_STAT_COMMAND) == ZERO)
+        {
+            if (word_count < 2)
+            {
+                show_on_cmd("Usage: stat <file on smain>... or stat @<list of files>\n");
+            }
+            else
+            {
+                run_stat(channel_for_client, words + 1, word_count - 1);
+            }
+            continue;
+        }
+        // several files, a glob or a list of files go through their own connections and only print their progress
+        if (batch_requested(instruction_from_user, words + 1, word_count - 1))
+        {
+            run_batch(instruction_from_user, words + 1, word_count - 1);
+            continue;
         }
         // Send the instruction_from_user to manage_command_execution in order to check which function to be implemented based on command
         int ret = manage_command_execution(channel_for_client, instruction_from_user, parameter_1, parameter_2);
@@ -421,6 +1590,7 @@ number main()
         if (len > ZERO)
         {
             reply_from_server[len] = '\0'; // Null-terminate the received data
+            finish_received_file(reply_from_server);
             show_on_cmd("Server reply_from_server: %s\n", reply_from_server);
         }
         // state if server has been disconnected
@@ -0,0 +1,541 @@
+// delta uploads of files which are stored already, shared by the client, smain, stext and the storage engine
+// the server cuts its copy into blocks and sends a weak rolling checksum and a strong checksum of every block,
+// the client looks for those blocks at every offset of its new version and only sends the bytes it did not find
+// together with references to the blocks it found, the server builds the new version next to the old one from both
+// and renames it over the old one once the checksum of the whole file matched, a reader sees the old or the new file
+// and never a mix of them, like rsync does it
+// the weak checksum can be moved on by one byte in constant time, so the client checks every offset of a big file
+// and only computes the strong one for the few offsets whose weak one is in the signature
+#ifndef DELTA_TRANSFER_H
+#define DELTA_TRANSFER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+// "delta <file> <folder>" asks for the signature of the stored copy of folder/<name of file>
+#define DELTA_COMMAND "delta"
+// the answer is "SIGNATURE <size> <block size> <blocks>\n" followed by the records of the blocks,
+// or one of these two, the client then sends the whole file with ufile
+#define DELTA_SIGNATURE "SIGNATURE"
+// nothing is stored under that name yet
+#define DELTA_NONE "DELTA_NONE\n"
+// the file is kept in a way delta uploads cannot change (several copies, a journal, erasure coding)
+#define DELTA_REFUSED "DELTA_REFUSED\n"
+// blocks are about the square root of the file in size, within these bounds
+#define DELTA_BLOCK_MINIMUM 1024
+#define DELTA_BLOCK_MAXIMUM (128 * 1024)
+// a block record is the weak checksum (4 bytes) and the strong one (8 bytes), most significant byte first
+#define DELTA_RECORD_BYTES 12
+// the delta the client sends is a list of operations, each starting with its letter:
+//   L <length, 4 bytes> <bytes>              literal bytes, at most DELTA_LITERAL_MAXIMUM at a time
+//   C <first block, 4 bytes> <count, 4 bytes> blocks of the stored copy which follow each other
+//   E <size, 8 bytes> <checksum, 8 bytes>    end, size and strong checksum of the whole new version
+#define DELTA_LITERAL 'L'
+#define DELTA_COPY 'C'
+#define DELTA_END 'E'
+#define DELTA_LITERAL_MAXIMUM (64 * 1024)
+// the new version is written under this name next to the stored copy
+#define DELTA_TEMP_PREFIX ".delta."
+// start value of the strong checksum
+#define DELTA_HASH_START 14695981039346656037ULL
+
+// signature of a stored copy as the client holds it
+struct delta_signature
+{
+    long long size;
+    int block;
+    long long blocks;
+    uint32_t *weak;
+    uint64_t *strong;
+};
+
+// this function returns the block size for a stored copy of size bytes
+static inline int delta_block_size(long long size)
+{
+    long long block = DELTA_BLOCK_MINIMUM;
+    while (block < DELTA_BLOCK_MAXIMUM && block * block < size)
+    {
+        block *= 2;
+    }
+    return (int)block;
+}
+
+// this function returns the weak checksum of length bytes, two 16 bit sums like rsync's
+static inline uint32_t delta_weak(const unsigned char *data, size_t length)
+{
+    uint32_t a = 0, b = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        a += data[i];
+        b += (uint32_t)(length - i) * data[i];
+    }
+    return (a & 0xffff) | (b << 16);
+}
+
+// this function moves the weak checksum of a window of length bytes on by one byte, out leaves it and in joins it
+static inline uint32_t delta_roll(uint32_t weak, size_t length, unsigned char out, unsigned char in)
+{
+    uint32_t a = (weak & 0xffff) - out + in;
+    uint32_t b = (weak >> 16) - (uint32_t)length * out + a;
+    return (a & 0xffff) | (b << 16);
+}
+
+// this function continues the strong checksum hash (64 bit FNV-1a) over length bytes, it can be fed a file in any pieces
+static inline uint64_t delta_hash(uint64_t hash, const unsigned char *data, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ data[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+static inline void delta_put(unsigned char *out, uint64_t value, int bytes)
+{
+    for (int i = bytes - 1; i >= 0; i--)
+    {
+        out[i] = value & 0xff;
+        value >>= 8;
+    }
+}
+
+static inline uint64_t delta_get(const unsigned char *in, int bytes)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++)
+    {
+        value = (value << 8) | in[i];
+    }
+    return value;
+}
+
+// this function sends length bytes, it returns 0 or -1 when the connection broke
+static inline int delta_send_all(int sock, const void *data, size_t length)
+{
+    for (size_t sent = 0; sent < length;)
+    {
+        ssize_t written = send(sock, (const char *)data + sent, length - sent, MSG_NOSIGNAL);
+        if (written <= 0)
+        {
+            return -1;
+        }
+        sent += written;
+    }
+    return 0;
+}
+
+// this function receives exactly length bytes, it returns 0 or -1 when the connection ended before
+static inline int delta_recv_all(int sock, void *data, size_t length)
+{
+    for (size_t received = 0; received < length;)
+    {
+        ssize_t got = recv(sock, (char *)data + received, length - received, 0);
+        if (got <= 0)
+        {
+            return -1;
+        }
+        received += got;
+    }
+    return 0;
+}
+
+// this function receives one line one byte at a time, so the records after a signature line stay in the socket
+// the '\n' is kept, it returns 0 or -1 when the connection ended or the line does not fit
+static inline int delta_recv_line(int sock, char *line, size_t size)
+{
+    for (size_t used = 0; used + 1 < size; used++)
+    {
+        if (recv(sock, line + used, 1, 0) != 1)
+        {
+            return -1;
+        }
+        if (line[used] == '\n')
+        {
+            line[used + 1] = '\0';
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// server: this function sends the signature line and the records of the size bytes of old_file, it returns 0 or -1
+// only whole blocks are in the signature, the bytes after the last one are sent as literal bytes if they are still there
+static inline int delta_send_signature(int sock, int old_file, long long size)
+{
+    int block = delta_block_size(size);
+    long long blocks = size / block;
+    char header[128];
+    unsigned char *data = malloc(block);
+    unsigned char records[DELTA_RECORD_BYTES * 256];
+    size_t used = 0;
+    snprintf(header, sizeof(header), "%s %lld %d %lld\n", DELTA_SIGNATURE, size, block, blocks);
+    if (data == NULL || delta_send_all(sock, header, strlen(header)) != 0)
+    {
+        free(data);
+        return -1;
+    }
+    for (long long i = 0; i < blocks; i++)
+    {
+        if (pread(old_file, data, block, i * block) != block)
+        {
+            // the client waits for every record, a block which cannot be read gets one of zeros,
+            // a copy of it fails in delta_apply() and the upload with it
+            memset(data, 0, block);
+        }
+        delta_put(records + used, delta_weak(data, block), 4);
+        delta_put(records + used + 4, delta_hash(DELTA_HASH_START, data, block), 8);
+        used += DELTA_RECORD_BYTES;
+        if (used == sizeof(records) || i == blocks - 1)
+        {
+            if (delta_send_all(sock, records, used) != 0)
+            {
+                free(data);
+                return -1;
+            }
+            used = 0;
+        }
+    }
+    free(data);
+    return 0;
+}
+
+// server: this function writes the new version into new_file from the operations the client sends on sock
+// copied blocks are read from old_file, it returns 0 when the size and checksum the client sent at the end match
+static inline int delta_apply(int sock, int old_file, long long old_size, int new_file)
+{
+    int block = delta_block_size(old_size);
+    long long blocks = old_size / block;
+    unsigned char *data = malloc(DELTA_LITERAL_MAXIMUM > block ? DELTA_LITERAL_MAXIMUM : block);
+    unsigned char operation[17];
+    uint64_t hash = DELTA_HASH_START;
+    long long written = 0;
+    int result = -1;
+    while (data != NULL && delta_recv_all(sock, operation, 1) == 0)
+    {
+        if (operation[0] == DELTA_LITERAL)
+        {
+            if (delta_recv_all(sock, operation + 1, 4) != 0)
+            {
+                break;
+            }
+            uint32_t length = delta_get(operation + 1, 4);
+            if (length > DELTA_LITERAL_MAXIMUM || delta_recv_all(sock, data, length) != 0 || write(new_file, data, length) != (ssize_t)length)
+            {
+                break;
+            }
+            hash = delta_hash(hash, data, length);
+            written += length;
+        }
+        else if (operation[0] == DELTA_COPY)
+        {
+            if (delta_recv_all(sock, operation + 1, 8) != 0)
+            {
+                break;
+            }
+            long long first = delta_get(operation + 1, 4);
+            long long count = delta_get(operation + 5, 4);
+            if (first + count > blocks)
+            {
+                break;
+            }
+            long long i;
+            for (i = first; i < first + count; i++)
+            {
+                if (pread(old_file, data, block, i * block) != block || write(new_file, data, block) != block)
+                {
+                    break;
+                }
+                hash = delta_hash(hash, data, block);
+                written += block;
+            }
+            if (i < first + count)
+            {
+                break;
+            }
+        }
+        else if (operation[0] == DELTA_END)
+        {
+            if (delta_recv_all(sock, operation + 1, 16) == 0)
+            {
+                result = (long long)delta_get(operation + 1, 8) == written && delta_get(operation + 9, 8) == hash ? 0 : -1;
+            }
+            break;
+        }
+        else
+        {
+            break;
+        }
+    }
+    free(data);
+    return result;
+}
+
+// server: this function runs a whole delta upload over sock against old_file, the stored copy name in the folder dir_fd
+// the new version is written to a temporary file next to it and renamed over name when it arrived complete
+// it returns 0 when name is the new version now, and -1 when it is still the old one
+static inline int delta_receive(int sock, int dir_fd, const char *name, int old_file)
+{
+    char temp_name[64];
+    struct stat info;
+    if (fstat(old_file, &info) != 0)
+    {
+        return -1;
+    }
+    snprintf(temp_name, sizeof(temp_name), "%s%d.tmp", DELTA_TEMP_PREFIX, getpid());
+    int new_file = openat(dir_fd, temp_name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, info.st_mode & 0777);
+    if (new_file < 0)
+    {
+        // the client is waiting for a signature, one of nothing makes it send the whole file as literal bytes
+        // which are read off the connection and dropped
+        char header[128];
+        snprintf(header, sizeof(header), "%s 0 %d 0\n", DELTA_SIGNATURE, DELTA_BLOCK_MINIMUM);
+        delta_send_all(sock, header, strlen(header));
+        new_file = open("/dev/null", O_WRONLY | O_CLOEXEC);
+        if (new_file >= 0)
+        {
+            delta_apply(sock, -1, 0, new_file);
+            close(new_file);
+        }
+        return -1;
+    }
+    int result = delta_send_signature(sock, old_file, info.st_size) == 0 && delta_apply(sock, old_file, info.st_size, new_file) == 0 ? 0 : -1;
+    // the new version is on disk before it takes the place of the old one
+    if (result == 0 && fsync(new_file) != 0)
+    {
+        result = -1;
+    }
+    close(new_file);
+    if (result == 0 && renameat(dir_fd, temp_name, dir_fd, name) != 0)
+    {
+        result = -1;
+    }
+    if (result != 0)
+    {
+        unlinkat(dir_fd, temp_name, 0);
+    }
+    return result;
+}
+
+// client: this function reads the records of the signature whose line is header, it returns 0 or -1
+static inline int delta_read_signature(int sock, const char *header, struct delta_signature *signature)
+{
+    unsigned char records[DELTA_RECORD_BYTES * 256];
+    memset(signature, 0, sizeof(*signature));
+    if (sscanf(header, DELTA_SIGNATURE " %lld %d %lld", &signature->size, &signature->block, &signature->blocks) != 3 ||
+        signature->block < DELTA_BLOCK_MINIMUM || signature->block > DELTA_BLOCK_MAXIMUM || signature->blocks < 0 ||
+        signature->blocks > signature->size / signature->block)
+    {
+        return -1;
+    }
+    signature->weak = malloc((signature->blocks + 1) * sizeof(uint32_t));
+    signature->strong = malloc((signature->blocks + 1) * sizeof(uint64_t));
+    if (signature->weak == NULL || signature->strong == NULL)
+    {
+        return -1;
+    }
+    for (long long i = 0; i < signature->blocks;)
+    {
+        long long count = signature->blocks - i < 256 ? signature->blocks - i : 256;
+        if (delta_recv_all(sock, records, count * DELTA_RECORD_BYTES) != 0)
+        {
+            return -1;
+        }
+        for (long long j = 0; j < count; j++, i++)
+        {
+            signature->weak[i] = delta_get(records + j * DELTA_RECORD_BYTES, 4);
+            signature->strong[i] = delta_get(records + j * DELTA_RECORD_BYTES + 4, 8);
+        }
+    }
+    return 0;
+}
+
+static inline void delta_free_signature(struct delta_signature *signature)
+{
+    free(signature->weak);
+    free(signature->strong);
+    signature->weak = NULL;
+    signature->strong = NULL;
+}
+
+// operations waiting to be sent by the client, sent in pieces of the buffer's size
+struct delta_output
+{
+    int sock;
+    unsigned char buffer[DELTA_LITERAL_MAXIMUM + 32];
+    size_t used;
+    int failed;
+    // bytes of the delta, the operations included
+    long long sent;
+    // a run of copied blocks is only written when the next operation does not continue it
+    long long copy_first;
+    long long copy_count;
+};
+
+static inline void delta_output_bytes(struct delta_output *output, const void *data, size_t length)
+{
+    if (output->used + length > sizeof(output->buffer))
+    {
+        output->failed |= delta_send_all(output->sock, output->buffer, output->used) != 0;
+        output->used = 0;
+    }
+    if (length > sizeof(output->buffer))
+    {
+        output->failed |= delta_send_all(output->sock, data, length) != 0;
+    }
+    else
+    {
+        memcpy(output->buffer + output->used, data, length);
+        output->used += length;
+    }
+    output->sent += length;
+}
+
+static inline void delta_output_copies(struct delta_output *output)
+{
+    unsigned char operation[9] = {DELTA_COPY};
+    if (output->copy_count == 0)
+    {
+        return;
+    }
+    delta_put(operation + 1, output->copy_first, 4);
+    delta_put(operation + 5, output->copy_count, 4);
+    delta_output_bytes(output, operation, sizeof(operation));
+    output->copy_count = 0;
+}
+
+static inline void delta_output_literal(struct delta_output *output, const unsigned char *data, size_t length)
+{
+    if (length == 0)
+    {
+        return;
+    }
+    delta_output_copies(output);
+    while (length > 0)
+    {
+        unsigned char operation[5] = {DELTA_LITERAL};
+        size_t piece = length < DELTA_LITERAL_MAXIMUM ? length : DELTA_LITERAL_MAXIMUM;
+        delta_put(operation + 1, piece, 4);
+        delta_output_bytes(output, operation, sizeof(operation));
+        delta_output_bytes(output, data, piece);
+        data += piece;
+        length -= piece;
+    }
+}
+
+static inline void delta_output_copy(struct delta_output *output, long long block)
+{
+    if (output->copy_count > 0 && output->copy_first + output->copy_count == block && output->copy_count < 0xffffffffLL)
+    {
+        output->copy_count++;
+        return;
+    }
+    delta_output_copies(output);
+    output->copy_first = block;
+    output->copy_count = 1;
+}
+
+// client: this function sends the delta of the size bytes at data against signature, it returns 0 or -1
+// *sent is set to the bytes of the delta, the part of the upload which depends on how much changed
+static inline int delta_send_changes(int sock, const unsigned char *data, long long size, const struct delta_signature *signature, long long *sent)
+{
+    long long table_size = 1;
+    long long block = signature->block;
+    // blocks by their weak checksum, a chain of the blocks with the same bucket in next
+    while (table_size < signature->blocks * 2)
+    {
+        table_size *= 2;
+    }
+    long long *heads = malloc(table_size * sizeof(long long));
+    long long *next = malloc((signature->blocks + 1) * sizeof(long long));
+    struct delta_output *output = malloc(sizeof(struct delta_output));
+    if (heads == NULL || next == NULL || output == NULL)
+    {
+        free(heads);
+        free(next);
+        free(output);
+        return -1;
+    }
+    memset(heads, 0xff, table_size * sizeof(long long));
+    // chained from the last block down, so the first of equal blocks is tried first
+    for (long long i = signature->blocks - 1; i >= 0; i--)
+    {
+        long long bucket = signature->weak[i] & (table_size - 1);
+        next[i] = heads[bucket];
+        heads[bucket] = i;
+    }
+    memset(output, 0, sizeof(*output));
+    output->sock = sock;
+    long long literal_start = 0;
+    long long position = 0;
+    int rolling = 0;
+    uint32_t weak = 0;
+    while (signature->blocks > 0 && position + block <= size && !output->failed)
+    {
+        weak = rolling ? delta_roll(weak, block, data[position - 1], data[position + block - 1]) : delta_weak(data + position, block);
+        rolling = 1;
+        long long found = -1;
+        int strong_known = 0;
+        uint64_t strong = 0;
+        for (long long i = heads[weak & (table_size - 1)]; i >= 0 && found < 0; i = next[i])
+        {
+            if (signature->weak[i] != weak)
+            {
+                continue;
+            }
+            if (!strong_known)
+            {
+                strong = delta_hash(DELTA_HASH_START, data + position, block);
+                strong_known = 1;
+            }
+            if (signature->strong[i] == strong)
+            {
+                found = i;
+            }
+        }
+        if (found >= 0)
+        {
+            delta_output_literal(output, data + literal_start, position - literal_start);
+            delta_output_copy(output, found);
+            position += block;
+            literal_start = position;
+            rolling = 0;
+            continue;
+        }
+        position++;
+        // long runs of new bytes go out while the search goes on, so the client never holds more than one piece
+        if (position - literal_start >= DELTA_LITERAL_MAXIMUM)
+        {
+            delta_output_literal(output, data + literal_start, position - literal_start);
+            literal_start = position;
+        }
+    }
+    delta_output_literal(output, data + literal_start, size - literal_start);
+    delta_output_copies(output);
+    unsigned char end[17] = {DELTA_END};
+    delta_put(end + 1, size, 8);
+    delta_put(end + 9, delta_hash(DELTA_HASH_START, data, size), 8);
+    delta_output_bytes(output, end, sizeof(end));
+    if (!output->failed && delta_send_all(sock, output->buffer, output->used) != 0)
+    {
+        output->failed = 1;
+    }
+    int result = output->failed ? -1 : 0;
+    if (sent != NULL)
+    {
+        *sent = output->sent;
+    }
+    free(heads);
+    free(next);
+    free(output);
+    return result;
+}
+
+#endif
@@ -0,0 +1,912 @@
+// client library of smain, for programs which move files from their own process instead of running client24s
+// a struct dfs_client keeps a pool of connections to smain and runs any number of uploads, downloads and removals at the
+// same time, each one is an operation which dfs_client_poll() moves on whenever its socket is ready, so the program
+// never blocks on a single file, it is told about the end of an operation by its callback or waits for it with
+// dfs_client_wait() like for a future
+// smain serves one command at a time on a connection, so an operation has a connection to itself until it is done,
+// the connection then goes back to the pool for the next one and operations beyond the size of the pool wait their turn
+// an upload can be written piece by piece (dfs_client_open_write) and a download read as it arrives (dfs_client_open_read)
+// the framing is the one of client24s, which uses the same functions for the commands it sends, files move as
+// dfs_protocol.h describes, a download is sized and a file of unknown size starts with DFS_CLIENT_NOT_FOUND when it is
+// not stored
+//
+//   struct dfs_client client;
+//   dfs_client_init(&client, "127.0.0.1", 8053, DFS_CLIENT_CONNECTIONS);
+//   dfs_client_upload(&client, "notes.txt", "docs", uploaded, NULL);   // uploaded() is called with the result
+//   while (dfs_client_poll(&client, -1) > 0)
+//       ;
+//   dfs_client_destroy(&client);
+#ifndef DFS_CLIENT_H
+#define DFS_CLIENT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "dfs_protocol.h"
+
+// first line of smain's answer to a dfile for a file which is not stored, the reason follows on the same chunk
+#define DFS_CLIENT_NOT_FOUND "FILE_NOT_FOUND\n"
+// every answer of smain to a command which worked has this word in it
+#define DFS_CLIENT_SUCCESS "successfully"
+// what smain answers for a file type none of its pools stores, there is nothing after it
+#define DFS_CLIENT_NOT_SUPPORTED "File %s not supported for this process.\n"
+// default size of the connection pool, smain forks a process for every connection
+#define DFS_CLIENT_CONNECTIONS 64
+// most bytes of a file read ahead of the socket for an upload
+#define DFS_CLIENT_READ_AHEAD (64 * DFS_PROTOCOL_CHUNK)
+// size of a download while the line of smain which gives it has not been read
+#define DFS_CLIENT_SIZE_PENDING -2
+
+// what an operation does
+#define DFS_CLIENT_UPLOAD 0
+#define DFS_CLIENT_DOWNLOAD 1
+#define DFS_CLIENT_REMOVE 2
+// where an operation is
+#define DFS_CLIENT_QUEUED 0
+#define DFS_CLIENT_CONNECTING 1
+#define DFS_CLIENT_SENDING 2
+#define DFS_CLIENT_RECEIVING 3
+#define DFS_CLIENT_ANSWER 4
+#define DFS_CLIENT_FINISHED 5
+// result of an operation, the answer of smain is in its reply for all but the last two
+#define DFS_CLIENT_RUNNING 1
+#define DFS_CLIENT_DONE 0
+#define DFS_CLIENT_REFUSED -1
+#define DFS_CLIENT_NOT_STORED -2
+#define DFS_CLIENT_DISCONNECTED -3
+#define DFS_CLIENT_LOCAL_ERROR -4
+
+struct dfs_client;
+struct dfs_client_operation;
+// called once when an operation finished, its result and reply are set then
+typedef void (*dfs_client_done)(struct dfs_client_operation *operation, void *argument);
+// called with every piece of a download read with dfs_client_open_read(), in order
+typedef void (*dfs_client_data)(struct dfs_client_operation *operation, const char *data, size_t length, void *argument);
+
+struct dfs_client_operation
+{
+    struct dfs_client *client;
+    int kind;
+    int state;
+    int result;
+    // connection of the pool while the operation has one, -1 otherwise
+    int sock;
+    // the command as it goes to smain
+    char command[DFS_PROTOCOL_CHUNK];
+    size_t command_length;
+    size_t command_sent;
+    // body of an upload, read from source (-1 for a write handle) or given to dfs_client_write()
+    // the bytes before body_offset are sent, closed is set once nothing is added anymore
+    int source;
+    char *body;
+    size_t body_length;
+    size_t body_offset;
+    size_t body_capacity;
+    long long body_total;
+    long long body_sent;
+    int closed;
+    // a download goes to the file sink_path (opened with the first data) or to on_data
+    char *sink_path;
+    int sink;
+    dfs_client_data on_data;
+    // size of an upload given in its command, -1 while a write handle does not know it yet
+    long long size;
+    // bytes of the file moved so far, without the padding
+    long long bytes;
+    // set when the last byte of a download may be the padding, it is kept back until the line of smain tells
+    int held_back;
+    // size of a download given before it (DFS_PROTOCOL_SIZE_LINE), -1 when it comes in chunks, and the line while it is read
+    long long expected;
+    char size_line[64];
+    size_t size_line_length;
+    // answer of smain, or the reason of the failure
+    char reply[DFS_PROTOCOL_CHUNK];
+    dfs_client_done on_done;
+    void *argument;
+    // set by dfs_client_release(), the operation is freed once it finished and was reported
+    int released;
+    int reported;
+    struct dfs_client_operation *next;
+};
+
+struct dfs_client
+{
+    struct sockaddr_in address;
+    // most connections open at the same time, open counts the ones in use and the idle ones
+    int connections;
+    int open;
+    int *idle;
+    int idle_count;
+    // operations which did not finish, in the order they were started
+    struct dfs_client_operation *first;
+    struct dfs_client_operation *last;
+    int running;
+    // what the last dfs_client_poll() waited for
+    struct pollfd *waiting;
+    struct dfs_client_operation **polled;
+};
+
+// this function writes the command for smain into buffer (of DFS_PROTOCOL_CHUNK bytes) and returns how many bytes of it to send
+// a command followed by a body is padded with zero bytes, that keeps the start of the body out of the read of the command
+// a command longer than smain reads is cut, fits is set to 0 then when it is not NULL
+static inline size_t dfs_client_format_command(char *buffer, const char *command, const char *parameter_1, const char *parameter_2, int followed, int *fits)
+{
+    memset(buffer, 0, DFS_PROTOCOL_CHUNK);
+    int length = snprintf(buffer, DFS_PROTOCOL_COMMAND_SIZE + 1, "%s %s %s", command, parameter_1, parameter_2);
+    if (fits != NULL)
+    {
+        *fits = length >= 0 && length <= DFS_PROTOCOL_COMMAND_SIZE;
+    }
+    return followed ? DFS_PROTOCOL_COMMAND_SIZE : strlen(buffer);
+}
+
+// returns 1 when the first chunk of the answer to a dfile says that the file is not stored
+static inline int dfs_client_not_found(const char *chunk, size_t length)
+{
+    return length >= strlen(DFS_CLIENT_NOT_FOUND) && strncmp(chunk, DFS_CLIENT_NOT_FOUND, strlen(DFS_CLIENT_NOT_FOUND)) == 0;
+}
+
+// this function sets up client for smain at ip and port with at most connections connections
+// returns 0, or -1 when ip is not an address or there is no memory
+static inline int dfs_client_init(struct dfs_client *client, const char *ip, int port, int connections)
+{
+    memset(client, 0, sizeof(*client));
+    client->address.sin_family = AF_INET;
+    client->address.sin_port = htons(port);
+    client->connections = connections > 0 ? connections : DFS_CLIENT_CONNECTIONS;
+    if (inet_pton(AF_INET, ip, &client->address.sin_addr) != 1)
+    {
+        return -1;
+    }
+    client->idle = calloc(client->connections, sizeof(int));
+    client->waiting = calloc(client->connections, sizeof(struct pollfd));
+    client->polled = calloc(client->connections, sizeof(struct dfs_client_operation *));
+    if (client->idle == NULL || client->waiting == NULL || client->polled == NULL)
+    {
+        free(client->idle);
+        free(client->waiting);
+        free(client->polled);
+        return -1;
+    }
+    return 0;
+}
+
+// this function frees an operation and everything it still holds, its connection is closed
+static inline void dfs_client_free_operation(struct dfs_client_operation *operation)
+{
+    if (operation->sock >= 0)
+    {
+        close(operation->sock);
+        operation->client->open--;
+    }
+    if (operation->source >= 0)
+    {
+        close(operation->source);
+    }
+    if (operation->sink >= 0)
+    {
+        close(operation->sink);
+    }
+    free(operation->body);
+    free(operation->sink_path);
+    free(operation);
+}
+
+// this function closes every connection of client and frees the operations which did not finish, without calling them back
+static inline void dfs_client_destroy(struct dfs_client *client)
+{
+    while (client->first != NULL)
+    {
+        struct dfs_client_operation *operation = client->first;
+        client->first = operation->next;
+        dfs_client_free_operation(operation);
+    }
+    for (int i = 0; i < client->idle_count; i++)
+    {
+        close(client->idle[i]);
+    }
+    free(client->idle);
+    free(client->waiting);
+    free(client->polled);
+    memset(client, 0, sizeof(*client));
+}
+
+// this function gives a connection to smain, an idle one of the pool or a new one while the pool has room
+// connected is set to 0 for a new connection which is still being made
+// returns the socket, -2 when every connection is in use and -1 when smain cannot be reached
+static inline int dfs_client_take_connection(struct dfs_client *client, int *connected)
+{
+    while (client->idle_count > 0)
+    {
+        int sock = client->idle[--client->idle_count];
+        // smain never sends anything on its own, so an idle connection which can be read from was closed
+        struct pollfd check = {sock, POLLIN, 0};
+        if (poll(&check, 1, 0) == 0)
+        {
+            *connected = 1;
+            return sock;
+        }
+        close(sock);
+        client->open--;
+    }
+    if (client->open >= client->connections)
+    {
+        return -2;
+    }
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+    {
+        return -1;
+    }
+    *connected = connect(sock, (struct sockaddr *)&client->address, sizeof(client->address)) == 0;
+    if (!*connected && errno != EINPROGRESS)
+    {
+        close(sock);
+        return -1;
+    }
+    client->open++;
+    return sock;
+}
+
+// this function ends operation with result, its connection goes back to the pool when smain has nothing more to send
+// or read on it and is closed otherwise, the callback is called by dfs_client_poll() once the round is over
+static inline void dfs_client_finish(struct dfs_client_operation *operation, int result, int reusable)
+{
+    struct dfs_client *client = operation->client;
+    if (operation->sock >= 0 && reusable && client->idle_count < client->connections)
+    {
+        client->idle[client->idle_count++] = operation->sock;
+    }
+    else if (operation->sock >= 0)
+    {
+        close(operation->sock);
+        client->open--;
+    }
+    operation->sock = -1;
+    if (operation->source >= 0)
+    {
+        close(operation->source);
+        operation->source = -1;
+    }
+    if (operation->sink >= 0)
+    {
+        close(operation->sink);
+        operation->sink = -1;
+    }
+    operation->result = result;
+    operation->state = DFS_CLIENT_FINISHED;
+    client->running--;
+}
+
+// this function adds an operation of kind for command to client, it is started by the next dfs_client_poll()
+// returns the operation or NULL when there is no memory
+static inline struct dfs_client_operation *dfs_client_add(struct dfs_client *client, int kind, const char *command, const char *parameter_1,
+                                                          const char *parameter_2, dfs_client_done on_done, void *argument)
+{
+    struct dfs_client_operation *operation = calloc(1, sizeof(*operation));
+    if (operation == NULL)
+    {
+        return NULL;
+    }
+    operation->client = client;
+    operation->kind = kind;
+    operation->state = DFS_CLIENT_QUEUED;
+    operation->result = DFS_CLIENT_RUNNING;
+    operation->sock = -1;
+    operation->source = -1;
+    operation->sink = -1;
+    operation->size = -1;
+    operation->expected = DFS_CLIENT_SIZE_PENDING;
+    int fits;
+    operation->command_length = dfs_client_format_command(operation->command, command, parameter_1, parameter_2, kind == DFS_CLIENT_UPLOAD, &fits);
+    // a download of known size needs neither the padding nor smain's pause before its line
+    if (kind == DFS_CLIENT_DOWNLOAD)
+    {
+        operation->command_length = dfs_protocol_set_sized(operation->command);
+    }
+    if (!fits)
+    {
+        snprintf(operation->reply, sizeof(operation->reply), "The names of %s are too long for smain.\n", command);
+        operation->result = DFS_CLIENT_LOCAL_ERROR;
+    }
+    operation->on_done = on_done;
+    operation->argument = argument;
+    if (client->last != NULL)
+    {
+        client->last->next = operation;
+    }
+    else
+    {
+        client->first = operation;
+    }
+    client->last = operation;
+    client->running++;
+    return operation;
+}
+
+// this function adds length bytes of data to the body of an upload, it returns 0 or -1 when there is no memory
+static inline int dfs_client_append(struct dfs_client_operation *operation, const void *data, size_t length)
+{
+    // the part which was sent already is dropped before the buffer grows
+    if (operation->body_offset > 0)
+    {
+        memmove(operation->body, operation->body + operation->body_offset, operation->body_length - operation->body_offset);
+        operation->body_length -= operation->body_offset;
+        operation->body_offset = 0;
+    }
+    if (operation->body_length + length > operation->body_capacity)
+    {
+        size_t capacity = operation->body_capacity > 0 ? operation->body_capacity : DFS_CLIENT_READ_AHEAD;
+        while (capacity < operation->body_length + length)
+        {
+            capacity *= 2;
+        }
+        char *body = realloc(operation->body, capacity);
+        if (body == NULL)
+        {
+            return -1;
+        }
+        operation->body = body;
+        operation->body_capacity = capacity;
+    }
+    memcpy(operation->body + operation->body_length, data, length);
+    operation->body_length += length;
+    operation->body_total += length;
+    return 0;
+}
+
+// this function ends the body of an upload, with the byte which makes its last chunk a short one when it needs it
+static inline int dfs_client_end_body(struct dfs_client_operation *operation)
+{
+    operation->closed = 1;
+    return dfs_protocol_needs_padding(operation->body_total) ? dfs_client_append(operation, "", 1) : 0;
+}
+
+// this function starts an upload of the file path into folder on smain, smain stores it under the name of the file
+// a file which cannot be read finishes with DFS_CLIENT_LOCAL_ERROR in the next dfs_client_poll()
+static inline struct dfs_client_operation *dfs_client_upload(struct dfs_client *client, const char *path, const char *folder, dfs_client_done on_done, void *argument)
+{
+    struct dfs_client_operation *operation = dfs_client_add(client, DFS_CLIENT_UPLOAD, "ufile", path, folder, on_done, argument);
+    if (operation == NULL)
+    {
+        return NULL;
+    }
+    operation->source = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat info;
+    if (operation->source < 0 || fstat(operation->source, &info) != 0)
+    {
+        snprintf(operation->reply, sizeof(operation->reply), "%.512s: %s\n", path, strerror(errno));
+        operation->result = DFS_CLIENT_LOCAL_ERROR;
+    }
+    else if (dfs_protocol_set_upload_size(operation->command, info.st_size) == 0)
+    {
+        operation->size = info.st_size;
+    }
+    return operation;
+}
+
+// this function starts an upload of a file called name into folder on smain whose content is given with dfs_client_write()
+// and ended with dfs_client_close_write(), smain does not answer before that
+// size is the size of the file, its bytes go out while they are written, or -1 when it is not known yet, then nothing is sent
+// (and the whole file is kept in memory) until the handle is closed, smain has to know the size before the first byte
+static inline struct dfs_client_operation *dfs_client_open_write(struct dfs_client *client, const char *name, const char *folder, long long size,
+                                                                 dfs_client_done on_done, void *argument)
+{
+    struct dfs_client_operation *operation = dfs_client_add(client, DFS_CLIENT_UPLOAD, "ufile", name, folder, on_done, argument);
+    if (operation != NULL && size >= 0 && dfs_protocol_set_upload_size(operation->command, size) == 0)
+    {
+        operation->size = size;
+    }
+    return operation;
+}
+
+// this function adds length bytes to the file of a write handle, it never waits, the bytes are kept until the socket takes them
+// whole chunks go out as soon as the connection is ready, the rest once the handle is closed
+// returns 0, or -1 when the handle is closed or finished already, the bytes go beyond the size given or there is no memory
+static inline int dfs_client_write(struct dfs_client_operation *operation, const void *data, size_t length)
+{
+    if (operation->kind != DFS_CLIENT_UPLOAD || operation->source >= 0 || operation->closed || operation->state == DFS_CLIENT_FINISHED ||
+        (operation->size >= 0 && operation->bytes + (long long)length > operation->size))
+    {
+        return -1;
+    }
+    if (dfs_client_append(operation, data, length) != 0)
+    {
+        return -1;
+    }
+    operation->bytes += length;
+    return 0;
+}
+
+// this function ends the file of a write handle, smain stores it and answers once the rest was sent
+// a file shorter than the size given is stored as it is
+static inline int dfs_client_close_write(struct dfs_client_operation *operation)
+{
+    if (operation->kind != DFS_CLIENT_UPLOAD || operation->source >= 0 || operation->closed || operation->state == DFS_CLIENT_FINISHED)
+    {
+        return -1;
+    }
+    // nothing was sent yet when the size was not known, the command gets it now
+    if (operation->size < 0 && dfs_protocol_set_upload_size(operation->command, operation->body_total) == 0)
+    {
+        operation->size = operation->body_total;
+    }
+    return dfs_client_end_body(operation);
+}
+
+// returns 1 while a write handle which was opened without a size cannot send anything
+static inline int dfs_client_waits_for_size(const struct dfs_client_operation *operation)
+{
+    return operation->kind == DFS_CLIENT_UPLOAD && operation->source < 0 && operation->size < 0 && !operation->closed;
+}
+
+// this function starts a download of the file name on smain into the local file path, which is only created (or emptied)
+// once smain sends the file, a file which is not stored finishes with DFS_CLIENT_NOT_STORED and leaves path alone
+static inline struct dfs_client_operation *dfs_client_download(struct dfs_client *client, const char *name, const char *path, dfs_client_done on_done, void *argument)
+{
+    struct dfs_client_operation *operation = dfs_client_add(client, DFS_CLIENT_DOWNLOAD, "dfile", name, "", on_done, argument);
+    if (operation == NULL)
+    {
+        return NULL;
+    }
+    operation->sink_path = strdup(path);
+    if (operation->sink_path == NULL)
+    {
+        snprintf(operation->reply, sizeof(operation->reply), "%.512s: %s\n", path, strerror(errno));
+        operation->result = DFS_CLIENT_LOCAL_ERROR;
+    }
+    return operation;
+}
+
+// this function starts a download of the file name on smain whose content is passed to on_data as it arrives
+static inline struct dfs_client_operation *dfs_client_open_read(struct dfs_client *client, const char *name, dfs_client_data on_data, dfs_client_done on_done, void *argument)
+{
+    struct dfs_client_operation *operation = dfs_client_add(client, DFS_CLIENT_DOWNLOAD, "dfile", name, "", on_done, argument);
+    if (operation != NULL)
+    {
+        operation->on_data = on_data;
+    }
+    return operation;
+}
+
+// this function starts the removal of the file name on smain
+static inline struct dfs_client_operation *dfs_client_remove(struct dfs_client *client, const char *name, dfs_client_done on_done, void *argument)
+{
+    return dfs_client_add(client, DFS_CLIENT_REMOVE, "rmfile", name, "", on_done, argument);
+}
+
+// this function returns the bytes of the body of an upload which may go out now
+// before the body is closed that is whole chunks only, so smain never reads a short chunk in the middle of the file
+static inline size_t dfs_client_sendable(const struct dfs_client_operation *operation)
+{
+    long long allowed = operation->closed ? operation->body_total : operation->body_total - operation->body_total % DFS_PROTOCOL_CHUNK;
+    return allowed > operation->body_sent ? (size_t)(allowed - operation->body_sent) : 0;
+}
+
+// this function returns the events the socket of operation is waited for with
+static inline short dfs_client_events(const struct dfs_client_operation *operation)
+{
+    if (operation->state == DFS_CLIENT_CONNECTING)
+    {
+        return POLLOUT;
+    }
+    if (operation->state == DFS_CLIENT_SENDING)
+    {
+        // a write handle with nothing to send (or no size) waits for the program, not for the socket
+        int more = operation->command_sent < operation->command_length || dfs_client_sendable(operation) > 0 ||
+                   (operation->source >= 0 && !operation->closed);
+        if (dfs_client_waits_for_size(operation))
+        {
+            return 0;
+        }
+        return more ? POLLOUT : 0;
+    }
+    return POLLIN;
+}
+
+// this function sends what operation has for smain, it returns 0, or -1 when the operation finished
+static inline int dfs_client_send(struct dfs_client_operation *operation)
+{
+    if (dfs_client_waits_for_size(operation))
+    {
+        return 0;
+    }
+    while (operation->command_sent < operation->command_length)
+    {
+        ssize_t sent = send(operation->sock, operation->command + operation->command_sent, operation->command_length - operation->command_sent, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            {
+                return 0;
+            }
+            snprintf(operation->reply, sizeof(operation->reply), "send: %s\n", strerror(errno));
+            dfs_client_finish(operation, DFS_CLIENT_DISCONNECTED, 0);
+            return -1;
+        }
+        operation->command_sent += sent;
+    }
+    if (operation->kind != DFS_CLIENT_UPLOAD)
+    {
+        operation->state = operation->kind == DFS_CLIENT_DOWNLOAD ? DFS_CLIENT_RECEIVING : DFS_CLIENT_ANSWER;
+        return 0;
+    }
+    for (;;)
+    {
+        // a file is read ahead of the socket, never more than DFS_CLIENT_READ_AHEAD bytes
+        if (operation->source >= 0 && !operation->closed && operation->body_length - operation->body_offset < DFS_CLIENT_READ_AHEAD)
+        {
+            char chunk[DFS_CLIENT_READ_AHEAD];
+            ssize_t got = read(operation->source, chunk, DFS_CLIENT_READ_AHEAD - (operation->body_length - operation->body_offset));
+            if (got < 0 || dfs_client_append(operation, chunk, got > 0 ? got : 0) != 0 || (got == 0 && dfs_client_end_body(operation) != 0))
+            {
+                snprintf(operation->reply, sizeof(operation->reply), "read: %s\n", strerror(errno));
+                dfs_client_finish(operation, DFS_CLIENT_LOCAL_ERROR, 0);
+                return -1;
+            }
+            operation->bytes += got;
+        }
+        size_t sendable = dfs_client_sendable(operation);
+        // less than a chunk read so far, the file is read on until there is one or it ended
+        if (sendable == 0 && operation->source >= 0 && !operation->closed)
+        {
+            continue;
+        }
+        if (sendable == 0)
+        {
+            break;
+        }
+        // one chunk goes out per send(), half a chunk left queued would be read by smain as the short last one once it caught up,
+        // so a chunk the socket took only a part of is finished right away, waiting for this socket alone
+        size_t chunk_left = DFS_PROTOCOL_CHUNK - operation->body_sent % DFS_PROTOCOL_CHUNK;
+        ssize_t sent = send(operation->sock, operation->body + operation->body_offset, sendable < chunk_left ? sendable : chunk_left, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            struct pollfd writable = {operation->sock, POLLOUT, 0};
+            if ((errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) && chunk_left < DFS_PROTOCOL_CHUNK)
+            {
+                poll(&writable, 1, -1);
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            {
+                return 0;
+            }
+            snprintf(operation->reply, sizeof(operation->reply), "send: %s\n", strerror(errno));
+            dfs_client_finish(operation, DFS_CLIENT_DISCONNECTED, 0);
+            return -1;
+        }
+        operation->body_offset += sent;
+        operation->body_sent += sent;
+    }
+    // everything is sent once the body is closed and nothing is left, smain answers then
+    if (operation->closed && operation->body_sent == operation->body_total)
+    {
+        operation->state = DFS_CLIENT_ANSWER;
+    }
+    return 0;
+}
+
+// this function passes length bytes of a download to on_data and into the sink, it returns 0, or -1 when the operation finished
+static inline int dfs_client_deliver(struct dfs_client_operation *operation, const char *data, size_t length)
+{
+    if (operation->on_data != NULL && length > 0)
+    {
+        operation->on_data(operation, data, length, operation->argument);
+    }
+    for (size_t written = 0; operation->sink >= 0 && written < length;)
+    {
+        ssize_t part = write(operation->sink, data + written, length - written);
+        if (part < 0 && errno != EINTR)
+        {
+            snprintf(operation->reply, sizeof(operation->reply), "%.512s: %s\n", operation->sink_path, strerror(errno));
+            dfs_client_finish(operation, DFS_CLIENT_LOCAL_ERROR, 0);
+            return -1;
+        }
+        written += part > 0 ? part : 0;
+    }
+    operation->bytes += length;
+    return 0;
+}
+
+// this function opens the file a download goes to, it returns 0, or -1 when the operation finished
+static inline int dfs_client_open_sink(struct dfs_client_operation *operation)
+{
+    if (operation->sink_path == NULL)
+    {
+        return 0;
+    }
+    operation->sink = open(operation->sink_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (operation->sink < 0)
+    {
+        snprintf(operation->reply, sizeof(operation->reply), "%.512s: %s\n", operation->sink_path, strerror(errno));
+        dfs_client_finish(operation, DFS_CLIENT_LOCAL_ERROR, 0);
+        return -1;
+    }
+    return 0;
+}
+
+// this function reads the line which gives the size of a download, a byte at a time so nothing of the file is taken with it
+// it returns 0, or -1 when the operation finished
+static inline int dfs_client_receive_size(struct dfs_client_operation *operation)
+{
+    char *line = operation->size_line;
+    ssize_t got = recv(operation->sock, line + operation->size_line_length, 1, 0);
+    if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    {
+        return 0;
+    }
+    if (got <= 0 || (line[operation->size_line_length] != '\n' && operation->size_line_length + 2 >= sizeof(operation->size_line)))
+    {
+        snprintf(operation->reply, sizeof(operation->reply), "Server disconnected.\n");
+        dfs_client_finish(operation, DFS_CLIENT_DISCONNECTED, 0);
+        return -1;
+    }
+    if (line[operation->size_line_length++] != '\n')
+    {
+        return 0;
+    }
+    line[operation->size_line_length] = '\0';
+    if (sscanf(line, DFS_PROTOCOL_SIZE_LINE, &operation->expected) != 1 || operation->expected < -1)
+    {
+        snprintf(operation->reply, sizeof(operation->reply), "%s", line);
+        dfs_client_finish(operation, DFS_CLIENT_DISCONNECTED, 0);
+        return -1;
+    }
+    // an empty file is complete already, the line of smain comes next
+    if (operation->expected >= 0 && dfs_client_open_sink(operation) == 0 && operation->expected == 0)
+    {
+        operation->state = DFS_CLIENT_ANSWER;
+    }
+    return operation->state == DFS_CLIENT_FINISHED ? -1 : 0;
+}
+
+// this function takes the next chunk of a download, it returns 0, or -1 when the operation finished
+// smain gives the size first, a file of known size is read up to its last byte, any other one chunk by chunk like
+// client24s does, a short chunk is the end of the file then
+static inline int dfs_client_receive(struct dfs_client_operation *operation)
+{
+    char chunk[DFS_PROTOCOL_CHUNK];
+    if (operation->expected == DFS_CLIENT_SIZE_PENDING)
+    {
+        return dfs_client_receive_size(operation);
+    }
+    size_t wanted = operation->expected >= 0 && operation->expected - operation->bytes < (long long)sizeof(chunk) ? (size_t)(operation->expected - operation->bytes) : sizeof(chunk);
+    ssize_t got = recv(operation->sock, chunk, wanted, 0);
+    if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    {
+        return 0;
+    }
+    if (got <= 0)
+    {
+        snprintf(operation->reply, sizeof(operation->reply), "Server disconnected.\n");
+        dfs_client_finish(operation, DFS_CLIENT_DISCONNECTED, 0);
+        return -1;
+    }
+    if (operation->expected >= 0)
+    {
+        if (operation->bytes + got == operation->expected)
+        {
+            operation->state = DFS_CLIENT_ANSWER;
+        }
+        return dfs_client_deliver(operation, chunk, got);
+    }
+    // the first chunk tells whether there is a file at all, nothing is created before it arrived
+    if (operation->bytes == 0 && operation->sink < 0)
+    {
+        char name[DFS_PROTOCOL_CHUNK] = "";
+        char not_supported[DFS_PROTOCOL_CHUNK + 64];
+        // the command is "dfile <name> ", smain names the file in its answer
+        sscanf(operation->command, "%*s %1023s", name);
+        snprintf(not_supported, sizeof(not_supported), DFS_CLIENT_NOT_SUPPORTED, name);
+        int unsupported = (size_t)got == strlen(not_supported) && memcmp(chunk, not_supported, got) == 0;
+        if (dfs_client_not_found(chunk, got) || unsupported)
+        {
+            size_t skip = unsupported ? 0 : strlen(DFS_CLIENT_NOT_FOUND);
+            snprintf(operation->reply, sizeof(operation->reply), "%.*s", (int)(got - skip), chunk + skip);
+            dfs_client_finish(operation, unsupported ? DFS_CLIENT_REFUSED : DFS_CLIENT_NOT_STORED, 1);
+            return -1;
+        }
+        if (dfs_client_open_sink(operation) != 0)
+        {
+            return -1;
+        }
+    }
+    // a zero byte which makes the file one byte longer than a multiple of a chunk may be the padding, smain's line tells
+    if (got < DFS_PROTOCOL_CHUNK)
+    {
+        operation->held_back = chunk[got - 1] == 0 && dfs_protocol_needs_padding(operation->bytes + got - 1);
+        got -= operation->held_back;
+        operation->state = DFS_CLIENT_ANSWER;
+    }
+    return dfs_client_deliver(operation, chunk, got);
+}
+
+// this function reads the line smain ends a command with and finishes operation with it
+static inline void dfs_client_answer(struct dfs_client_operation *operation)
+{
+    ssize_t got = recv(operation->sock, operation->reply, sizeof(operation->reply) - 1, 0);
+    if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    {
+        return;
+    }
+    if (got <= 0)
+    {
+        snprintf(operation->reply, sizeof(operation->reply), "Server disconnected.\n");
+        dfs_client_finish(operation, DFS_CLIENT_DISCONNECTED, 0);
+        return;
+    }
+    operation->reply[got] = '\0';
+    // the byte kept back is part of the file unless smain says the file ends before it
+    if (operation->held_back && dfs_protocol_reply_size(operation->reply) != operation->bytes)
+    {
+        operation->held_back = 0;
+        if (dfs_client_deliver(operation, "", 1) != 0)
+        {
+            return;
+        }
+    }
+    int done = strstr(operation->reply, DFS_CLIENT_SUCCESS) != NULL;
+    // smain may have refused an upload without reading its body, that connection cannot take another command
+    dfs_client_finish(operation, done ? DFS_CLIENT_DONE : DFS_CLIENT_REFUSED, done || operation->kind != DFS_CLIENT_UPLOAD);
+}
+
+// this function moves operation on after its socket reported revents
+static inline void dfs_client_step(struct dfs_client_operation *operation, short revents)
+{
+    if (operation->state == DFS_CLIENT_CONNECTING)
+    {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if (getsockopt(operation->sock, SOL_SOCKET, SO_ERROR, &error, &length) != 0 || error != 0)
+        {
+            snprintf(operation->reply, sizeof(operation->reply), "connect: %s\n", strerror(error != 0 ? error : errno));
+            dfs_client_finish(operation, DFS_CLIENT_DISCONNECTED, 0);
+            return;
+        }
+        operation->state = DFS_CLIENT_SENDING;
+    }
+    if (operation->state == DFS_CLIENT_SENDING)
+    {
+        // smain closed a connection the operation still has to send on
+        if (revents & (POLLHUP | POLLERR))
+        {
+            snprintf(operation->reply, sizeof(operation->reply), "Server disconnected.\n");
+            dfs_client_finish(operation, DFS_CLIENT_DISCONNECTED, 0);
+            return;
+        }
+        dfs_client_send(operation);
+        return;
+    }
+    // an operation which just got to reading is waited for with POLLIN in the next round,
+    // so a download reads its last chunk and smain's line (which comes a while later) in different rounds
+    if (operation->state == DFS_CLIENT_RECEIVING)
+    {
+        dfs_client_receive(operation);
+    }
+    else if (operation->state == DFS_CLIENT_ANSWER)
+    {
+        dfs_client_answer(operation);
+    }
+}
+
+// this function starts the operations which wait while the pool has connections for them, waits up to timeout milliseconds
+// (-1 for as long as it takes) for one of the running ones to be ready and moves it on
+// the callbacks of the operations which finished are called at the end, they may start new operations
+// returns how many operations did not finish yet, or -1 when poll() failed
+static inline int dfs_client_poll(struct dfs_client *client, int timeout)
+{
+    int count = 0, busy = 0;
+    for (struct dfs_client_operation *operation = client->first; operation != NULL; operation = operation->next)
+    {
+        // an operation which failed while it was added finishes without a connection
+        if (operation->state == DFS_CLIENT_QUEUED && operation->result != DFS_CLIENT_RUNNING)
+        {
+            dfs_client_finish(operation, operation->result, 0);
+        }
+        else if (operation->state == DFS_CLIENT_QUEUED && !busy)
+        {
+            int connected = 0;
+            int sock = dfs_client_take_connection(client, &connected);
+            busy = sock == -2;
+            if (sock == -1)
+            {
+                snprintf(operation->reply, sizeof(operation->reply), "connect: %s\n", strerror(errno));
+                dfs_client_finish(operation, DFS_CLIENT_DISCONNECTED, 0);
+            }
+            else if (sock >= 0)
+            {
+                operation->sock = sock;
+                operation->state = connected ? DFS_CLIENT_SENDING : DFS_CLIENT_CONNECTING;
+            }
+        }
+        if (operation->sock >= 0 && count < client->connections)
+        {
+            client->waiting[count].fd = operation->sock;
+            client->waiting[count].events = dfs_client_events(operation);
+            client->waiting[count].revents = 0;
+            client->polled[count++] = operation;
+        }
+    }
+    int ready = count > 0 ? poll(client->waiting, count, timeout) : 0;
+    if (ready < 0 && errno != EINTR)
+    {
+        return -1;
+    }
+    for (int i = 0; ready > 0 && i < count; i++)
+    {
+        if (client->waiting[i].revents != 0)
+        {
+            dfs_client_step(client->polled[i], client->waiting[i].revents);
+        }
+    }
+    // the finished operations leave the list before any callback runs, so a callback can add and release operations
+    struct dfs_client_operation *finished = NULL, **finished_last = &finished;
+    struct dfs_client_operation **link = &client->first;
+    client->last = NULL;
+    while (*link != NULL)
+    {
+        struct dfs_client_operation *operation = *link;
+        if (operation->state != DFS_CLIENT_FINISHED)
+        {
+            client->last = operation;
+            link = &operation->next;
+            continue;
+        }
+        *link = operation->next;
+        operation->next = NULL;
+        *finished_last = operation;
+        finished_last = &operation->next;
+    }
+    while (finished != NULL)
+    {
+        struct dfs_client_operation *operation = finished;
+        finished = operation->next;
+        operation->next = NULL;
+        if (operation->on_done != NULL)
+        {
+            operation->on_done(operation, operation->argument);
+        }
+        operation->reported = 1;
+        if (operation->released)
+        {
+            dfs_client_free_operation(operation);
+        }
+    }
+    return client->running;
+}
+
+// this function waits until operation finished, moving every other operation of its client on meanwhile
+// it must not be called from a callback, the operation stays until dfs_client_release()
+// returns the result of the operation
+static inline int dfs_client_wait(struct dfs_client_operation *operation)
+{
+    while (!operation->reported)
+    {
+        if (dfs_client_poll(operation->client, -1) < 0)
+        {
+            return DFS_CLIENT_DISCONNECTED;
+        }
+    }
+    return operation->result;
+}
+
+// this function lets go of operation, a finished one is freed right away and any other one once it finished and was called back
+static inline void dfs_client_release(struct dfs_client_operation *operation)
+{
+    operation->released = 1;
+    if (operation->reported)
+    {
+        dfs_client_free_operation(operation);
+    }
+}
+
+#endif
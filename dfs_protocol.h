@@ -0,0 +1,110 @@
+// framing of files between smain, its clients and its servers, shared by smain, stext, spdf, client24s and dfs_client.h
+// a command followed by a file (or by the body of sync and stat) is padded to DFS_PROTOCOL_COMMAND_SIZE bytes, so the
+// start of the file stays out of the one read of the command
+// a file is sent in chunks of DFS_PROTOCOL_CHUNK bytes and ends with a shorter one, a file ending on a full chunk (or an
+// empty one) gets one more zero byte, that byte is not part of the file:
+//   an upload gives the size of its file in the command (DFS_PROTOCOL_UPLOAD_SIZE) and only that many bytes are stored,
+//   the line which follows a download gives it there (DFS_PROTOCOL_FILE_SIZE) and the client drops the byte after them
+// the line comes a pause after the file so that it is not read with its last chunk, a client which marks its download
+// with DFS_PROTOCOL_SIZED is told the size first instead (DFS_PROTOCOL_SIZE_LINE) whenever smain knows it, the file then
+// has no padding and the line follows it right away
+#ifndef DFS_PROTOCOL_H
+#define DFS_PROTOCOL_H
+
+#include <stdio.h>
+#include <string.h>
+
+// files are sent and read in chunks of this size, a shorter one is the last of a file
+#define DFS_PROTOCOL_CHUNK 1024
+// size of a command which is followed by a body, smain and the servers read that many bytes for a command in one read
+#define DFS_PROTOCOL_COMMAND_SIZE (DFS_PROTOCOL_CHUNK - 1)
+// size of the file which follows an upload command, it is written behind the zero byte which ends the words of the command,
+// so "%s %s %s" does not see it and a server which gets the command passed on gets it too, nothing more than that is stored
+#define DFS_PROTOCOL_UPLOAD_SIZE "size %lld"
+// size of a downloaded file at the end of the line which follows it
+#define DFS_PROTOCOL_FILE_SIZE " (%lld bytes)"
+// written behind the zero byte which ends the words of a dfile or cdfile, like the size of an upload, the client reads the
+// first line of the answer as DFS_PROTOCOL_SIZE_LINE then
+#define DFS_PROTOCOL_SIZED "sized"
+// first line of the answer to a sized download, with -1 the answer goes on as for any dfile (chunks, padding, pause, line),
+// otherwise exactly that many bytes of the file follow and then the line
+#define DFS_PROTOCOL_SIZE_LINE "SIZE %lld\n"
+
+// this function adds size, the size of the file which follows, to a command of DFS_PROTOCOL_COMMAND_SIZE bytes in buffer
+// returns 0, or -1 when the words leave no room for it, every byte sent is stored then
+static inline int dfs_protocol_set_upload_size(char *buffer, long long size)
+{
+    size_t used = strlen(buffer) + 1;
+    int length = used < DFS_PROTOCOL_COMMAND_SIZE ? snprintf(buffer + used, DFS_PROTOCOL_COMMAND_SIZE - used, DFS_PROTOCOL_UPLOAD_SIZE, size) : -1;
+    if (length >= 0 && (size_t)length < DFS_PROTOCOL_COMMAND_SIZE - used)
+    {
+        return 0;
+    }
+    if (used < DFS_PROTOCOL_COMMAND_SIZE)
+    {
+        memset(buffer + used, 0, DFS_PROTOCOL_COMMAND_SIZE - used);
+    }
+    return -1;
+}
+
+// this function returns the size of the file which follows the upload command (length bytes as they were read),
+// or -1 when the command does not give one
+static inline long long dfs_protocol_upload_size(const char *command, size_t length)
+{
+    size_t words = strnlen(command, length);
+    long long size;
+    if (words + 1 >= length || memchr(command + words + 1, 0, length - words - 1) == NULL ||
+        sscanf(command + words + 1, DFS_PROTOCOL_UPLOAD_SIZE, &size) != 1 || size < 0)
+    {
+        return -1;
+    }
+    return size;
+}
+
+// this function marks the download command in buffer (of DFS_PROTOCOL_CHUNK bytes, zero behind its words) as sized
+// it returns how many bytes of buffer to send, a command which leaves no room for the mark goes without it
+static inline size_t dfs_protocol_set_sized(char *buffer)
+{
+    size_t used = strlen(buffer) + 1;
+    if (used + strlen(DFS_PROTOCOL_SIZED) >= DFS_PROTOCOL_COMMAND_SIZE)
+    {
+        return used - 1;
+    }
+    memcpy(buffer + used, DFS_PROTOCOL_SIZED, strlen(DFS_PROTOCOL_SIZED));
+    return used + strlen(DFS_PROTOCOL_SIZED);
+}
+
+// this function returns 1 when the download command (length bytes as they were read, zero behind them) is marked as sized
+static inline int dfs_protocol_sized(const char *command, size_t length)
+{
+    size_t words = strnlen(command, length);
+    return words + 1 < length && strnlen(command + words + 1, length - words - 1) == strlen(DFS_PROTOCOL_SIZED) &&
+           memcmp(command + words + 1, DFS_PROTOCOL_SIZED, strlen(DFS_PROTOCOL_SIZED)) == 0;
+}
+
+// this function returns how many of the length bytes which follow the first received bytes of a file belong to it
+// size is the size given for the file, or -1 when there is none and every byte is kept
+static inline size_t dfs_protocol_file_part(long long size, long long received, size_t length)
+{
+    if (size < 0 || size - received >= (long long)length)
+    {
+        return length;
+    }
+    return received < size ? (size_t)(size - received) : 0;
+}
+
+// this function returns the size of a downloaded file given in the line which ended the download, -1 when there is none
+static inline long long dfs_protocol_reply_size(const char *reply)
+{
+    const char *note = strrchr(reply, '(');
+    long long size;
+    return note != NULL && sscanf(note, "(%lld bytes)", &size) == 1 && size >= 0 ? size : -1;
+}
+
+// returns 1 when a file of size bytes needs one more byte to end on a chunk shorter than DFS_PROTOCOL_CHUNK
+static inline int dfs_protocol_needs_padding(long long size)
+{
+    return size % DFS_PROTOCOL_CHUNK == 0;
+}
+
+#endif
@@ -0,0 +1,735 @@
+// erasure coding used by spdf to keep big files safe without storing full copies of them
+// a file is cut into stripes and every stripe into k data chunks, m parity chunks are computed from those
+// with a Reed-Solomon code over GF(2^8), any k of the k + m chunks of a stripe are enough to get the stripe back
+// chunk i of every stripe goes to shard file i and every shard file lives in its own folder, one per disk
+// the parity rows of the code are a Cauchy matrix, every k rows of [identity; cauchy] can be inverted,
+// so any m of the shard files may be lost or damaged
+// multiplying a chunk by a constant uses pshufb on split nibble tables where the cpu has AVX2 or SSSE3
+// (checked at run time, no compiler flag needed) and a table lookup per byte everywhere else
+//
+// a shard file is a header of ERASURE_HEADER_SIZE bytes, one chunk per stripe and a checksum per chunk at the end
+// reading a file reads the k data shards only, parity is read and the stripe rebuilt only when a data chunk
+// is missing or does not match its checksum
+#ifndef ERASURE_CODE_H
+#define ERASURE_CODE_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ERASURE_CODE_X86 1
+#else
+#define ERASURE_CODE_X86 0
+#endif
+
+// most shard files one file can be spread over, data and parity together
+#define ERASURE_MAX_SHARDS 32
+// bytes of one chunk, a full stripe holds k of them, the last stripe of a file is cut to what is left
+#define ERASURE_CHUNK_SIZE (64 * 1024)
+// bytes before the first chunk of a shard file
+#define ERASURE_HEADER_SIZE 64
+// first bytes of every shard file
+#define ERASURE_MAGIC "DFSEC1\n"
+
+// header of a shard file, written once all chunks are there so a shard cut short has no valid header
+struct erasure_header
+{
+    char magic[8];
+    // size of the whole file, not of the shard
+    unsigned long long size;
+    unsigned int chunk_size;
+    unsigned char data;
+    unsigned char parity;
+    // which shard of the file this is, the first data ones come first
+    unsigned char index;
+    char unused[ERASURE_HEADER_SIZE - 8 - 8 - 4 - 3];
+};
+
+// exp table is doubled so that exp[log a + log b] needs no modulo
+static unsigned char erasure_gf_exp[512];
+static unsigned char erasure_gf_log[256];
+// 0 until the tables are built, then 1 for plain c, 2 for SSSE3 and 3 for AVX2
+static int erasure_region_kind;
+
+// this function builds the tables of GF(2^8) with the polynomial 0x11d and picks the vector code once
+static inline void erasure_gf_init(void)
+{
+    if (erasure_region_kind != 0)
+    {
+        return;
+    }
+    unsigned int value = 1;
+    for (int i = 0; i < 255; i++)
+    {
+        erasure_gf_exp[i] = erasure_gf_exp[i + 255] = (unsigned char)value;
+        erasure_gf_log[value] = (unsigned char)i;
+        value <<= 1;
+        if (value & 0x100)
+        {
+            value ^= 0x11d;
+        }
+    }
+    int kind = 1;
+#if ERASURE_CODE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        kind = 3;
+    }
+    else if (__builtin_cpu_supports("ssse3"))
+    {
+        kind = 2;
+    }
+#endif
+    erasure_region_kind = kind;
+}
+
+static inline unsigned char erasure_gf_mul(unsigned char a, unsigned char b)
+{
+    if (a == 0 || b == 0)
+    {
+        return 0;
+    }
+    return erasure_gf_exp[erasure_gf_log[a] + erasure_gf_log[b]];
+}
+
+// a must not be 0
+static inline unsigned char erasure_gf_inverse(unsigned char a)
+{
+    return erasure_gf_exp[255 - erasure_gf_log[a]];
+}
+
+// these functions do dst ^= c * src over length bytes, one per kind of cpu
+static inline void erasure_region_plain(unsigned char *dst, const unsigned char *src, unsigned char c, size_t length)
+{
+    unsigned char row[256];
+    for (int x = 0; x < 256; x++)
+    {
+        row[x] = erasure_gf_mul(c, (unsigned char)x);
+    }
+    for (size_t i = 0; i < length; i++)
+    {
+        dst[i] ^= row[src[i]];
+    }
+}
+
+#if ERASURE_CODE_X86
+// c * x is c * (low nibble of x) ^ c * (high nibble of x), both come out of a 16 byte table with one pshufb
+static inline void erasure_nibble_tables(unsigned char c, unsigned char *low, unsigned char *high)
+{
+    for (int x = 0; x < 16; x++)
+    {
+        low[x] = erasure_gf_mul(c, (unsigned char)x);
+        high[x] = erasure_gf_mul(c, (unsigned char)(x << 4));
+    }
+}
+
+__attribute__((target("ssse3"))) static inline void erasure_region_ssse3(unsigned char *dst, const unsigned char *src, unsigned char c, size_t length)
+{
+    unsigned char low[16], high[16];
+    erasure_nibble_tables(c, low, high);
+    __m128i low_table = _mm_loadu_si128((const __m128i *)low);
+    __m128i high_table = _mm_loadu_si128((const __m128i *)high);
+    __m128i mask = _mm_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i in = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i product = _mm_xor_si128(_mm_shuffle_epi8(low_table, _mm_and_si128(in, mask)),
+                                        _mm_shuffle_epi8(high_table, _mm_and_si128(_mm_srli_epi64(in, 4), mask)));
+        __m128i out = _mm_loadu_si128((const __m128i *)(dst + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(out, product));
+    }
+    for (; i < length; i++)
+    {
+        dst[i] ^= erasure_gf_mul(c, src[i]);
+    }
+}
+
+__attribute__((target("avx2"))) static inline void erasure_region_avx2(unsigned char *dst, const unsigned char *src, unsigned char c, size_t length)
+{
+    unsigned char low[16], high[16];
+    erasure_nibble_tables(c, low, high);
+    // pshufb on 256 bits looks up each 128 bit half on its own, so both halves get the same table
+    __m256i low_table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)low));
+    __m256i high_table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)high));
+    __m256i mask = _mm256_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32)
+    {
+        __m256i in = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i product = _mm256_xor_si256(_mm256_shuffle_epi8(low_table, _mm256_and_si256(in, mask)),
+                                           _mm256_shuffle_epi8(high_table, _mm256_and_si256(_mm256_srli_epi64(in, 4), mask)));
+        __m256i out = _mm256_loadu_si256((const __m256i *)(dst + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(out, product));
+    }
+    for (; i < length; i++)
+    {
+        dst[i] ^= erasure_gf_mul(c, src[i]);
+    }
+}
+#endif
+
+// this function does dst ^= c * src, erasure_gf_init() must have been called
+static inline void erasure_region_mul_add(unsigned char *dst, const unsigned char *src, unsigned char c, size_t length)
+{
+    if (c == 0)
+    {
+        return;
+    }
+#if ERASURE_CODE_X86
+    if (erasure_region_kind == 3)
+    {
+        erasure_region_avx2(dst, src, c, length);
+        return;
+    }
+    if (erasure_region_kind == 2)
+    {
+        erasure_region_ssse3(dst, src, c, length);
+        return;
+    }
+#endif
+    erasure_region_plain(dst, src, c, length);
+}
+
+// the code of one file, shard r is row r of matrix times the k data chunks
+struct erasure_code
+{
+    int data;
+    int parity;
+    // the first data rows are the identity, the data chunks are stored as they are
+    unsigned char matrix[ERASURE_MAX_SHARDS][ERASURE_MAX_SHARDS];
+};
+
+// this function sets up the code for data + parity shards, returns -1 with errno EINVAL for counts which do not fit
+static inline int erasure_code_init(struct erasure_code *code, int data, int parity)
+{
+    if (data < 1 || parity < 0 || data + parity > ERASURE_MAX_SHARDS)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    erasure_gf_init();
+    code->data = data;
+    code->parity = parity;
+    memset(code->matrix, 0, sizeof(code->matrix));
+    for (int r = 0; r < data; r++)
+    {
+        code->matrix[r][r] = 1;
+    }
+    // cauchy entry 1 / (x_r + y_j) with x_r = r and y_j = j, r >= data > j so r ^ j is never 0
+    for (int r = data; r < data + parity; r++)
+    {
+        for (int j = 0; j < data; j++)
+        {
+            code->matrix[r][j] = erasure_gf_inverse((unsigned char)(r ^ j));
+        }
+    }
+    return 0;
+}
+
+// this function computes the parity chunks of one stripe
+// chunks[0 .. data - 1] hold the data and chunks[data .. data + parity - 1] get the parity, all of length bytes
+static inline void erasure_code_encode(const struct erasure_code *code, unsigned char **chunks, size_t length)
+{
+    for (int r = code->data; r < code->data + code->parity; r++)
+    {
+        memset(chunks[r], 0, length);
+        for (int j = 0; j < code->data; j++)
+        {
+            erasure_region_mul_add(chunks[r], chunks[j], code->matrix[r][j], length);
+        }
+    }
+}
+
+// this function rebuilds every data chunk whose present entry is 0 out of k chunks which are present
+// returns 0, or -1 when fewer than k chunks of the stripe are present
+static inline int erasure_code_reconstruct(const struct erasure_code *code, unsigned char **chunks, const int *present, size_t length)
+{
+    int k = code->data;
+    int rows[ERASURE_MAX_SHARDS];
+    int used = 0;
+    for (int r = 0; r < k + code->parity && used < k; r++)
+    {
+        if (present[r])
+        {
+            rows[used++] = r;
+        }
+    }
+    if (used < k)
+    {
+        return -1;
+    }
+    // invert the k x k matrix made of those rows with Gauss-Jordan elimination
+    unsigned char left[ERASURE_MAX_SHARDS][ERASURE_MAX_SHARDS];
+    unsigned char right[ERASURE_MAX_SHARDS][ERASURE_MAX_SHARDS];
+    for (int i = 0; i < k; i++)
+    {
+        memcpy(left[i], code->matrix[rows[i]], k);
+        memset(right[i], 0, k);
+        right[i][i] = 1;
+    }
+    for (int column = 0; column < k; column++)
+    {
+        int pivot = column;
+        while (pivot < k && left[pivot][column] == 0)
+        {
+            pivot++;
+        }
+        if (pivot == k)
+        {
+            return -1;
+        }
+        if (pivot != column)
+        {
+            unsigned char swap[ERASURE_MAX_SHARDS];
+            memcpy(swap, left[pivot], k);
+            memcpy(left[pivot], left[column], k);
+            memcpy(left[column], swap, k);
+            memcpy(swap, right[pivot], k);
+            memcpy(right[pivot], right[column], k);
+            memcpy(right[column], swap, k);
+        }
+        unsigned char scale = erasure_gf_inverse(left[column][column]);
+        for (int j = 0; j < k; j++)
+        {
+            left[column][j] = erasure_gf_mul(left[column][j], scale);
+            right[column][j] = erasure_gf_mul(right[column][j], scale);
+        }
+        for (int i = 0; i < k; i++)
+        {
+            unsigned char factor = left[i][column];
+            if (i == column || factor == 0)
+            {
+                continue;
+            }
+            for (int j = 0; j < k; j++)
+            {
+                left[i][j] ^= erasure_gf_mul(factor, left[column][j]);
+                right[i][j] ^= erasure_gf_mul(factor, right[column][j]);
+            }
+        }
+    }
+    // data chunk j is row j of the inverse times the chunks which were read
+    for (int j = 0; j < k; j++)
+    {
+        if (present[j])
+        {
+            continue;
+        }
+        memset(chunks[j], 0, length);
+        for (int i = 0; i < k; i++)
+        {
+            erasure_region_mul_add(chunks[j], chunks[rows[i]], right[j][i], length);
+        }
+    }
+    return 0;
+}
+
+// checksum of a chunk, 64 bit FNV-1a taken a word at a time with the high bits folded back in
+static inline unsigned long long erasure_checksum(const unsigned char *data, size_t length)
+{
+    unsigned long long hash = 14695981039346656037ULL ^ length;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * 1099511628211ULL;
+        hash ^= hash >> 29;
+    }
+    for (; i < length; i++)
+    {
+        hash = (hash ^ data[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// number of stripes of a file of size bytes cut into data chunks per stripe
+static inline unsigned long long erasure_stripe_count(unsigned long long size, int data)
+{
+    unsigned long long stripe = (unsigned long long)data * ERASURE_CHUNK_SIZE;
+    return (size + stripe - 1) / stripe;
+}
+
+// length of every chunk of stripe number stripe, only the last stripe of a file is shorter
+static inline size_t erasure_chunk_length(unsigned long long size, int data, unsigned long long stripe)
+{
+    unsigned long long stripe_bytes = (unsigned long long)data * ERASURE_CHUNK_SIZE;
+    unsigned long long left = size - stripe * stripe_bytes;
+    return left >= stripe_bytes ? ERASURE_CHUNK_SIZE : (size_t)((left + data - 1) / data);
+}
+
+// offset of the checksum table in a shard file, right after the last chunk
+static inline off_t erasure_table_offset(unsigned long long size, int data)
+{
+    unsigned long long stripes = erasure_stripe_count(size, data);
+    if (stripes == 0)
+    {
+        return ERASURE_HEADER_SIZE;
+    }
+    return ERASURE_HEADER_SIZE + (off_t)(stripes - 1) * ERASURE_CHUNK_SIZE + erasure_chunk_length(size, data, stripes - 1);
+}
+
+// this function writes length bytes to fd, a socket or a file, and returns 0 or -1
+static inline int erasure_write_all(int fd, const unsigned char *data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t written = write(fd, data, length);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written <= 0)
+        {
+            return -1;
+        }
+        data += written;
+        length -= written;
+    }
+    return 0;
+}
+
+// one file being written into its shard files, bytes are gathered until a stripe is full
+struct erasure_writer
+{
+    struct erasure_code code;
+    int fds[ERASURE_MAX_SHARDS];
+    // a shard whose write failed is not finished, it gets no header and readers skip it
+    int broken[ERASURE_MAX_SHARDS];
+    // one stripe, chunk i starts at stripe + i * ERASURE_CHUNK_SIZE
+    unsigned char *stripe;
+    size_t filled;
+    unsigned long long size;
+    unsigned long long stripes;
+    // checksums of the stripes written so far, shards entries per stripe
+    unsigned long long *checksums;
+    unsigned long long capacity;
+};
+
+// this function starts a file of data + parity shards written to fds, which the writer closes in the end
+// returns 0, or -1 when the counts do not fit or memory is short (the descriptors stay with the caller then)
+static inline int erasure_writer_open(struct erasure_writer *writer, int data, int parity, const int *fds)
+{
+    if (erasure_code_init(&writer->code, data, parity) != 0)
+    {
+        return -1;
+    }
+    writer->stripe = malloc((size_t)(data + parity) * ERASURE_CHUNK_SIZE);
+    if (writer->stripe == NULL)
+    {
+        return -1;
+    }
+    for (int i = 0; i < data + parity; i++)
+    {
+        writer->fds[i] = fds[i];
+        writer->broken[i] = fds[i] < 0;
+    }
+    writer->filled = 0;
+    writer->size = 0;
+    writer->stripes = 0;
+    writer->checksums = NULL;
+    writer->capacity = 0;
+    return 0;
+}
+
+// this function encodes the gathered stripe and writes one chunk of length bytes to every shard
+static inline void erasure_writer_flush(struct erasure_writer *writer, size_t length)
+{
+    int k = writer->code.data;
+    int shards = k + writer->code.parity;
+    unsigned char *chunks[ERASURE_MAX_SHARDS];
+    for (int i = 0; i < shards; i++)
+    {
+        chunks[i] = writer->stripe + (size_t)i * ERASURE_CHUNK_SIZE;
+    }
+    // the bytes of a short last stripe are spread over its shorter chunks, the highest chunk is moved first
+    if (length < ERASURE_CHUNK_SIZE)
+    {
+        for (int j = k - 1; j >= 0; j--)
+        {
+            size_t start = (size_t)j * length;
+            size_t bytes = writer->filled > start ? writer->filled - start : 0;
+            bytes = bytes < length ? bytes : length;
+            memmove(chunks[j], writer->stripe + start, bytes);
+            memset(chunks[j] + bytes, 0, length - bytes);
+        }
+    }
+    erasure_code_encode(&writer->code, chunks, length);
+    if (writer->stripes == writer->capacity)
+    {
+        unsigned long long bigger = writer->capacity == 0 ? 16 : writer->capacity * 2;
+        unsigned long long *grown = realloc(writer->checksums, bigger * shards * sizeof(*grown));
+        if (grown == NULL)
+        {
+            for (int i = 0; i < shards; i++)
+            {
+                writer->broken[i] = 1;
+            }
+            writer->filled = 0;
+            return;
+        }
+        writer->checksums = grown;
+        writer->capacity = bigger;
+    }
+    off_t offset = ERASURE_HEADER_SIZE + (off_t)writer->stripes * ERASURE_CHUNK_SIZE;
+    for (int i = 0; i < shards; i++)
+    {
+        writer->checksums[writer->stripes * shards + i] = erasure_checksum(chunks[i], length);
+        if (!writer->broken[i] && pwrite(writer->fds[i], chunks[i], length, offset) != (ssize_t)length)
+        {
+            writer->broken[i] = 1;
+        }
+    }
+    writer->stripes++;
+    writer->filled = 0;
+}
+
+// this function adds length bytes to the end of the file
+static inline void erasure_writer_write(struct erasure_writer *writer, const void *data, size_t length)
+{
+    size_t stripe_bytes = (size_t)writer->code.data * ERASURE_CHUNK_SIZE;
+    const unsigned char *bytes = data;
+    writer->size += length;
+    while (length > 0)
+    {
+        size_t room = stripe_bytes - writer->filled;
+        size_t taken = length < room ? length : room;
+        memcpy(writer->stripe + writer->filled, bytes, taken);
+        writer->filled += taken;
+        bytes += taken;
+        length -= taken;
+        if (writer->filled == stripe_bytes)
+        {
+            erasure_writer_flush(writer, ERASURE_CHUNK_SIZE);
+        }
+    }
+}
+
+// this function writes the last stripe, the checksums and the headers and closes the shard files
+// returns the number of shards which were written completely, the file can be read when that is at least data
+static inline int erasure_writer_close(struct erasure_writer *writer)
+{
+    int k = writer->code.data;
+    int shards = k + writer->code.parity;
+    int written = 0;
+    if (writer->filled > 0)
+    {
+        erasure_writer_flush(writer, (writer->filled + k - 1) / k);
+    }
+    unsigned long long *table = malloc((writer->stripes > 0 ? writer->stripes : 1) * sizeof(*table));
+    off_t table_offset = erasure_table_offset(writer->size, k);
+    for (int i = 0; i < shards; i++)
+    {
+        if (writer->fds[i] < 0)
+        {
+            continue;
+        }
+        if (!writer->broken[i] && table != NULL)
+        {
+            struct erasure_header header;
+            memset(&header, 0, sizeof(header));
+            memcpy(header.magic, ERASURE_MAGIC, sizeof(header.magic));
+            header.size = writer->size;
+            header.chunk_size = ERASURE_CHUNK_SIZE;
+            header.data = (unsigned char)k;
+            header.parity = (unsigned char)writer->code.parity;
+            header.index = (unsigned char)i;
+            for (unsigned long long s = 0; s < writer->stripes; s++)
+            {
+                table[s] = writer->checksums[s * shards + i];
+            }
+            size_t table_bytes = writer->stripes * sizeof(*table);
+            // the header goes last, a shard is only valid once everything before it is on disk
+            if (pwrite(writer->fds[i], table, table_bytes, table_offset) == (ssize_t)table_bytes &&
+                ftruncate(writer->fds[i], table_offset + table_bytes) == 0 &&
+                pwrite(writer->fds[i], &header, sizeof(header), 0) == (ssize_t)sizeof(header))
+            {
+                written++;
+            }
+            else
+            {
+                writer->broken[i] = 1;
+            }
+        }
+        // an unfinished shard is emptied so that an older version of the file is not mixed with this one
+        if (writer->broken[i])
+        {
+            ftruncate(writer->fds[i], 0);
+        }
+        close(writer->fds[i]);
+    }
+    free(table);
+    free(writer->checksums);
+    free(writer->stripe);
+    return written;
+}
+
+// one file being read back from its shard files
+struct erasure_reader
+{
+    struct erasure_code code;
+    int fds[ERASURE_MAX_SHARDS];
+    // 1 for every shard with a valid header and checksum table
+    int usable[ERASURE_MAX_SHARDS];
+    unsigned long long size;
+    unsigned long long stripes;
+    unsigned long long *checksums[ERASURE_MAX_SHARDS];
+    unsigned char *stripe;
+};
+
+// this function reads the headers and checksum tables of the shard files fds[0 .. shards - 1], -1 for a missing one
+// the reader takes the descriptors over, erasure_reader_close() closes them even when this fails
+// returns 0 when at least k shards can be read, -1 otherwise
+static inline int erasure_reader_open(struct erasure_reader *reader, const int *fds, int shards)
+{
+    struct erasure_header first = {0};
+    int have_first = 0;
+    int usable = 0;
+    reader->stripe = NULL;
+    for (int i = 0; i < ERASURE_MAX_SHARDS; i++)
+    {
+        reader->fds[i] = i < shards ? fds[i] : -1;
+        reader->usable[i] = 0;
+        reader->checksums[i] = NULL;
+    }
+    for (int i = 0; i < shards; i++)
+    {
+        struct erasure_header header;
+        if (reader->fds[i] < 0 || pread(reader->fds[i], &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+            memcmp(header.magic, ERASURE_MAGIC, sizeof(header.magic)) != 0 || header.index != i ||
+            header.chunk_size != ERASURE_CHUNK_SIZE || header.data < 1 || header.data + header.parity > shards)
+        {
+            continue;
+        }
+        // every shard has to describe the same file as the first good one
+        if (!have_first)
+        {
+            first = header;
+            have_first = 1;
+            if (erasure_code_init(&reader->code, header.data, header.parity) != 0)
+            {
+                return -1;
+            }
+            reader->size = header.size;
+            reader->stripes = erasure_stripe_count(header.size, header.data);
+        }
+        else if (header.size != first.size || header.data != first.data || header.parity != first.parity)
+        {
+            continue;
+        }
+        size_t table_bytes = reader->stripes * sizeof(unsigned long long);
+        reader->checksums[i] = malloc(table_bytes > 0 ? table_bytes : 1);
+        if (reader->checksums[i] == NULL ||
+            pread(reader->fds[i], reader->checksums[i], table_bytes, erasure_table_offset(reader->size, header.data)) != (ssize_t)table_bytes)
+        {
+            continue;
+        }
+        reader->usable[i] = 1;
+        usable++;
+    }
+    if (!have_first)
+    {
+        errno = ENOENT;
+        return -1;
+    }
+    if (usable < reader->code.data)
+    {
+        errno = EIO;
+        return -1;
+    }
+    reader->stripe = malloc((size_t)(reader->code.data + reader->code.parity) * ERASURE_CHUNK_SIZE);
+    return reader->stripe != NULL ? 0 : -1;
+}
+
+// this function reads chunk stripe of shard i into chunk and returns 1 when it arrived whole and matches its checksum
+static inline int erasure_reader_chunk(struct erasure_reader *reader, int i, unsigned long long stripe, unsigned char *chunk, size_t length)
+{
+    off_t offset = ERASURE_HEADER_SIZE + (off_t)stripe * ERASURE_CHUNK_SIZE;
+    return reader->usable[i] && pread(reader->fds[i], chunk, length, offset) == (ssize_t)length &&
+           erasure_checksum(chunk, length) == reader->checksums[i][stripe];
+}
+
+// this function writes the whole file to out, a socket or a file
+// returns 0, or -1 when a stripe has fewer than k good chunks or out failed
+static inline int erasure_reader_copy(struct erasure_reader *reader, int out)
+{
+    int k = reader->code.data;
+    int shards = k + reader->code.parity;
+    unsigned char *chunks[ERASURE_MAX_SHARDS];
+    for (int i = 0; i < shards; i++)
+    {
+        chunks[i] = reader->stripe + (size_t)i * ERASURE_CHUNK_SIZE;
+    }
+    // the data shards are on different disks, readahead is asked on all of them at once so they are read in parallel
+    for (int j = 0; j < k; j++)
+    {
+        if (reader->usable[j])
+        {
+            posix_fadvise(reader->fds[j], ERASURE_HEADER_SIZE, 2 * ERASURE_CHUNK_SIZE, POSIX_FADV_WILLNEED);
+        }
+    }
+    unsigned long long left = reader->size;
+    for (unsigned long long s = 0; s < reader->stripes; s++)
+    {
+        size_t length = erasure_chunk_length(reader->size, k, s);
+        int present[ERASURE_MAX_SHARDS];
+        int missing = 0;
+        for (int j = 0; j < k; j++)
+        {
+            // the stripe after the next one is asked for while this one is read and sent
+            if (reader->usable[j])
+            {
+                posix_fadvise(reader->fds[j], ERASURE_HEADER_SIZE + (off_t)(s + 2) * ERASURE_CHUNK_SIZE, ERASURE_CHUNK_SIZE, POSIX_FADV_WILLNEED);
+            }
+            present[j] = erasure_reader_chunk(reader, j, s, chunks[j], length);
+            missing += !present[j];
+        }
+        // parity is only touched for a stripe which lost data chunks, and only as much of it as is needed
+        for (int i = k; i < shards; i++)
+        {
+            present[i] = missing > 0 && erasure_reader_chunk(reader, i, s, chunks[i], length);
+            missing -= present[i];
+        }
+        if (missing > 0 || erasure_code_reconstruct(&reader->code, chunks, present, length) != 0)
+        {
+            return -1;
+        }
+        // the stripe leaves in one write, the receivers of this protocol take a short read for the end of the file
+        // full chunks already lie back to back, the shorter ones of the last stripe are moved together first
+        for (int j = 1; j < k && length < ERASURE_CHUNK_SIZE; j++)
+        {
+            memmove(reader->stripe + (size_t)j * length, chunks[j], length);
+        }
+        size_t bytes = left < (unsigned long long)k * length ? (size_t)left : (size_t)k * length;
+        if (erasure_write_all(out, reader->stripe, bytes) != 0)
+        {
+            return -1;
+        }
+        left -= bytes;
+    }
+    return 0;
+}
+
+// this function closes the shard files and frees what the reader holds
+static inline void erasure_reader_close(struct erasure_reader *reader)
+{
+    for (int i = 0; i < ERASURE_MAX_SHARDS; i++)
+    {
+        if (reader->fds[i] >= 0)
+        {
+            close(reader->fds[i]);
+        }
+        free(reader->checksums[i]);
+    }
+    free(reader->stripe);
+}
+
+#endif
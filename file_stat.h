@@ -0,0 +1,235 @@
+// metadata of stored files, shared by smain, stext, spdf and the client
+// stat gives the size, the modification time, a hash of the content and the tier of many files in one request
+// and moves none of them, smain answers for its own files and asks every server for its files with one index request
+// the hash is the 64 bit FNV-1a of the whole content (the same one delta_transfer.h checks a rebuilt file with),
+// a server works it out the first time it is asked for and keeps it in an extended attribute of the file,
+// next to the size and time of the content it belongs to, so a file written again never shows the hash of its old content
+// a cold file (tiering.h) keeps the attribute on its stub and an erasure coded file gets it while it is written,
+// only a file whose hash was never taken before it went cold has none ("-") until it is read again
+#ifndef FILE_STAT_H
+#define FILE_STAT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include "delta_transfer.h"
+#include "tiering.h"
+
+// "stat <count> <bytes>" from the client is followed by that many bytes of paths, one per line, smain answers
+// one FILE_STAT_LINE per path in the same order and END_OF_LIST
+#define FILE_STAT_COMMAND "stat"
+// "index <count> <bytes>" from smain to a server, the server answers FILE_STAT_READY, or FILE_STAT_REFUSED when it does not
+// take that many, then reads the keys, one per line, and answers one "<size> <mtime> <hash> <tier>" line per key
+// (FILE_STAT_MISSING for a key it does not store) and END_OF_LIST
+#define FILE_STAT_INDEX "index"
+#define FILE_STAT_READY "READY\n"
+#define FILE_STAT_REFUSED "REFUSED\n"
+#define FILE_STAT_MISSING "-\n"
+// most paths and bytes of paths in one request, to smain and to a server, the client splits longer lists
+#define FILE_STAT_PATHS 65536
+#define FILE_STAT_MAXIMUM (8 * 1024 * 1024)
+// a line of the answer to the client, the path goes last because it may hold spaces
+#define FILE_STAT_LINE "%lld %lld %s %s %s\n"
+// the line for a path which is not stored
+#define FILE_STAT_NOT_STORED "- - - - %s\n"
+// extended attribute with "<size> <seconds>.<nanoseconds> <hash>" of the content it was taken from
+#define FILE_STAT_ATTRIBUTE "user.dfs.hash"
+// 16 hex digits and the end of the string, a hash which is not known is "-"
+#define FILE_STAT_HASH_SIZE 17
+#define FILE_STAT_UNKNOWN "-"
+// tiers a file is reported in
+#define FILE_STAT_HOT "hot"
+#define FILE_STAT_COLD "cold"
+#define FILE_STAT_CODED "coded"
+#define FILE_STAT_JOURNAL "journal"
+
+struct file_stat
+{
+    // size and modification time of the content, not of a stub standing for it
+    long long size;
+    struct timespec mtime;
+    char hash[FILE_STAT_HASH_SIZE];
+    const char *tier;
+};
+
+// this function reads the hash kept with the open file fd into stat, when it was taken from content of stat's size and time
+// returns 0, or -1 when there is none for this content and the hash stays FILE_STAT_UNKNOWN
+static inline int file_stat_kept_hash(int fd, struct file_stat *stat)
+{
+    char value[128];
+    long long size, seconds;
+    long nanoseconds;
+    char hash[FILE_STAT_HASH_SIZE];
+    ssize_t length = fgetxattr(fd, FILE_STAT_ATTRIBUTE, value, sizeof(value) - 1);
+    snprintf(stat->hash, sizeof(stat->hash), "%s", FILE_STAT_UNKNOWN);
+    if (length <= 0)
+    {
+        return -1;
+    }
+    value[length] = '\0';
+    if (sscanf(value, "%lld %lld.%ld %16s", &size, &seconds, &nanoseconds, hash) != 4 || size != stat->size ||
+        seconds != (long long)stat->mtime.tv_sec || nanoseconds != stat->mtime.tv_nsec)
+    {
+        return -1;
+    }
+    snprintf(stat->hash, sizeof(stat->hash), "%s", hash);
+    return 0;
+}
+
+// this function keeps hash with the open file fd for content of stat's size and time
+// a file system without extended attributes only has the hash worked out again on the next stat
+static inline void file_stat_keep_hash(int fd, const struct file_stat *stat, uint64_t hash)
+{
+    char value[128];
+    int length = snprintf(value, sizeof(value), "%lld %lld.%09ld %016llx", stat->size, (long long)stat->mtime.tv_sec, stat->mtime.tv_nsec, (unsigned long long)hash);
+    fsetxattr(fd, FILE_STAT_ATTRIBUTE, value, length, 0);
+}
+
+// this function works out the hash of the whole open file fd, it returns 0 or -1 when the file could not be read
+static inline int file_stat_hash_file(int fd, uint64_t *hash)
+{
+    size_t size = 1024 * 1024;
+    unsigned char *buffer = malloc(size);
+    ssize_t got = -1;
+    *hash = DELTA_HASH_START;
+    if (buffer == NULL)
+    {
+        return -1;
+    }
+    for (off_t offset = 0; (got = pread(fd, buffer, size, offset)) > 0; offset += got)
+    {
+        *hash = delta_hash(*hash, buffer, got);
+    }
+    free(buffer);
+    return got == 0 ? 0 : -1;
+}
+
+// this function opens the file key below root_fd and fills stat with its size, time and tier, the hash is not looked at yet
+// a stub of the cold tier is reported with the size of the cold file, the caller checks for stubs of its own
+// returns the open file, or -1 when nothing is stored under key
+static inline int file_stat_open(int root_fd, const char *key, struct file_stat *stat)
+{
+    struct stat info;
+    int fd = openat(root_fd, key, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode))
+    {
+        close(fd);
+        return -1;
+    }
+    stat->size = info.st_size;
+    stat->mtime = info.st_mtim;
+    stat->tier = FILE_STAT_HOT;
+    snprintf(stat->hash, sizeof(stat->hash), "%s", FILE_STAT_UNKNOWN);
+    long long cold_size = info.st_size <= TIERING_STUB_MAXIMUM ? tiering_stub_size(fd, NULL) : -1;
+    if (cold_size >= 0)
+    {
+        stat->size = cold_size;
+        stat->tier = FILE_STAT_COLD;
+    }
+    return fd;
+}
+
+// this function fills the hash of stat for the open file fd, a file in the fast tier has it worked out when none is kept
+static inline void file_stat_hash(int fd, struct file_stat *stat)
+{
+    uint64_t hash;
+    if (file_stat_kept_hash(fd, stat) == 0 || strcmp(stat->tier, FILE_STAT_HOT) != 0 || file_stat_hash_file(fd, &hash) != 0)
+    {
+        return;
+    }
+    snprintf(stat->hash, sizeof(stat->hash), "%016llx", (unsigned long long)hash);
+    file_stat_keep_hash(fd, stat, hash);
+}
+
+// this function fills stat for the file key below root_fd, it returns 0 or -1 when nothing is stored under key
+static inline int file_stat_of(int root_fd, const char *key, struct file_stat *stat)
+{
+    int fd = file_stat_open(root_fd, key, stat);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    file_stat_hash(fd, stat);
+    close(fd);
+    return 0;
+}
+
+// this function writes the line of the index answer for stat, or FILE_STAT_MISSING when stat is NULL
+static inline void file_stat_write(FILE *out, const struct file_stat *stat)
+{
+    if (stat == NULL)
+    {
+        fputs(FILE_STAT_MISSING, out);
+        return;
+    }
+    fprintf(out, "%lld %lld %s %s\n", stat->size, (long long)stat->mtime.tv_sec, stat->hash, stat->tier);
+}
+
+// this function reads a line of the index answer into stat, the tier is one of the FILE_STAT tiers
+// returns 0, or -1 for FILE_STAT_MISSING and a line which cannot be read
+static inline int file_stat_read(const char *line, struct file_stat *stat)
+{
+    static const char *tiers[] = {FILE_STAT_HOT, FILE_STAT_COLD, FILE_STAT_CODED, FILE_STAT_JOURNAL};
+    char tier[16];
+    long long mtime;
+    if (sscanf(line, "%lld %lld %16s %15s", &stat->size, &mtime, stat->hash, tier) != 4)
+    {
+        return -1;
+    }
+    stat->mtime.tv_sec = mtime;
+    stat->mtime.tv_nsec = 0;
+    stat->tier = FILE_STAT_UNKNOWN;
+    for (size_t i = 0; i < sizeof(tiers) / sizeof(tiers[0]); i++)
+    {
+        if (strcmp(tier, tiers[i]) == 0)
+        {
+            stat->tier = tiers[i];
+        }
+    }
+    return 0;
+}
+
+// this function reads the body of an index request, count keys in length bytes, after answering FILE_STAT_READY on sock
+// returns the keys cut into lines in an allocated buffer (keys points into it), or NULL when the request was refused
+static inline char *file_stat_read_keys(int sock, long long count, long long length, char ***keys)
+{
+    char *body = count > 0 && count <= FILE_STAT_PATHS && length > 0 && length <= FILE_STAT_MAXIMUM && count <= length ? malloc(length + 1) : NULL;
+    *keys = body != NULL ? calloc(count, sizeof(char *)) : NULL;
+    if (*keys == NULL)
+    {
+        free(body);
+        send(sock, FILE_STAT_REFUSED, strlen(FILE_STAT_REFUSED), 0);
+        return NULL;
+    }
+    if (delta_send_all(sock, FILE_STAT_READY, strlen(FILE_STAT_READY)) != 0 || delta_recv_all(sock, body, length) != 0)
+    {
+        free(body);
+        free(*keys);
+        *keys = NULL;
+        return NULL;
+    }
+    body[length] = '\0';
+    long long found = 0;
+    for (char *line = body, *end; found < count && (end = strchr(line, '\n')) != NULL; line = end + 1)
+    {
+        *end = '\0';
+        (*keys)[found++] = line;
+    }
+    // a key which was not sent is answered as missing
+    for (; found < count; found++)
+    {
+        (*keys)[found] = "";
+    }
+    return body;
+}
+
+#endif
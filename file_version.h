@@ -0,0 +1,40 @@
+// versions of stored files, shared by smain, stext, spdf and the client
+// a version is the size and modification time of what is stored under a path, written as one word, it changes with every
+// upload or removal of the path and the client only compares it, so it keeps the version with its cached copy of a file
+// and asks with cdfile for the file only in case the version is not the same anymore
+// the stub of a file in the cold tier or of an erasure coded file has a version of its own, moving a file between tiers
+// costs the client one more download and nothing else
+#ifndef FILE_VERSION_H
+#define FILE_VERSION_H
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+// "version <file>" asks a server for the version of one of its files, it answers "VERSION <version>\n" or the not found marker
+#define FILE_VERSION_COMMAND "version"
+#define FILE_VERSION_REPLY "VERSION"
+// "cdfile <file> <version>" is a dfile which smain answers with FILE_VERSION_NOT_MODIFIED alone when the file still has
+// that version, and otherwise with "VERSION <version>\n" followed by the answer to a dfile
+#define FILE_VERSION_CONDITIONAL "cdfile"
+#define FILE_VERSION_NOT_MODIFIED "NOT_MODIFIED\n"
+// version of a file which is not known, it never matches
+#define FILE_VERSION_UNKNOWN "-"
+// longest version, with the line it is sent in
+#define FILE_VERSION_SIZE 64
+
+// this function writes the version of the file key below the folder root_fd into version
+// returns 0, or -1 when nothing is stored under key
+static inline int file_version_of(int root_fd, const char *key, char *version, size_t version_size)
+{
+    struct stat info;
+    if (fstatat(root_fd, key, &info, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(info.st_mode))
+    {
+        return -1;
+    }
+    snprintf(version, version_size, "%lld-%lld.%09ld", (long long)info.st_size, (long long)info.st_mtim.tv_sec, (long)info.st_mtim.tv_nsec);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,266 @@
+// sorted pages of a folder listing, shared by smain, stext and spdf
+// a page is the first LISTING_PAGE_SIZE files after a cursor, in byte order of their path below the listed folder
+// the folder is walked once per page and only the smallest paths after the cursor are kept in a max heap,
+// so a page of a folder with millions of files costs one page of memory and no sort of the whole folder
+// the cursor is the last path of the previous page written in hex, that keeps it one word without spaces
+// and clients only hand it back without looking into it
+#ifndef LISTING_PAGE_H
+#define LISTING_PAGE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "path_resolver.h"
+
+// files per page, smain asks every server for this many and passes on this many as well
+#define LISTING_PAGE_SIZE 256
+// the cursor of the first page
+#define LISTING_FIRST_CURSOR "-"
+// line a server sends after its page when more files follow it
+#define LISTING_MORE "MORE\n"
+
+// one file of a page, path is relative to the listed folder
+struct listing_entry
+{
+    char *path;
+    long long size;
+    long long mtime;
+};
+
+// called for every file name found, returns 1 when the file belongs into the listing
+typedef int (*listing_page_match)(const char *name, void *argument);
+
+// a page being collected, entries is a max heap on path until listing_page_collect() sorts it
+struct listing_page
+{
+    struct listing_entry entries[LISTING_PAGE_SIZE];
+    int count;
+    // files with a path up to this one were on earlier pages
+    const char *after;
+    int folder_fd;
+    listing_page_match match;
+    void *argument;
+    // 1 when files were left out because the page was full, so there is another page after this one
+    int more;
+};
+
+static inline void listing_page_swap(struct listing_entry *a, struct listing_entry *b)
+{
+    struct listing_entry saved = *a;
+    *a = *b;
+    *b = saved;
+}
+
+// this function moves entry i of the heap down until both children are smaller
+static inline void listing_page_sift_down(struct listing_page *page, int i)
+{
+    for (;;)
+    {
+        int largest = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+        if (left < page->count && strcmp(page->entries[left].path, page->entries[largest].path) > 0)
+        {
+            largest = left;
+        }
+        if (right < page->count && strcmp(page->entries[right].path, page->entries[largest].path) > 0)
+        {
+            largest = right;
+        }
+        if (largest == i)
+        {
+            return;
+        }
+        listing_page_swap(&page->entries[i], &page->entries[largest]);
+        i = largest;
+    }
+}
+
+// called by path_resolver_walk_folder() for every file below the listed folder
+static inline void listing_page_visit(const char *path, void *argument)
+{
+    struct listing_page *page = argument;
+    const char *last_slash = strrchr(path, '/');
+    if (!page->match(last_slash != NULL ? last_slash + 1 : path, page->argument) || strcmp(path, page->after) <= 0)
+    {
+        return;
+    }
+    // a full page only takes a path which is smaller than its biggest one, that one drops out
+    if (page->count == LISTING_PAGE_SIZE)
+    {
+        page->more = 1;
+        if (strcmp(path, page->entries[0].path) >= 0)
+        {
+            return;
+        }
+    }
+    struct stat info;
+    char *copy = strdup(path);
+    if (copy == NULL || fstatat(page->folder_fd, path, &info, AT_SYMLINK_NOFOLLOW) != 0)
+    {
+        free(copy);
+        return;
+    }
+    if (page->count == LISTING_PAGE_SIZE)
+    {
+        free(page->entries[0].path);
+        page->entries[0].path = copy;
+        page->entries[0].size = info.st_size;
+        page->entries[0].mtime = info.st_mtime;
+        listing_page_sift_down(page, 0);
+        return;
+    }
+    int i = page->count++;
+    page->entries[i].path = copy;
+    page->entries[i].size = info.st_size;
+    page->entries[i].mtime = info.st_mtime;
+    while (i > 0 && strcmp(page->entries[(i - 1) / 2].path, page->entries[i].path) < 0)
+    {
+        listing_page_swap(&page->entries[(i - 1) / 2], &page->entries[i]);
+        i = (i - 1) / 2;
+    }
+}
+
+static inline int listing_entry_compare(const void *a, const void *b)
+{
+    return strcmp(((const struct listing_entry *)a)->path, ((const struct listing_entry *)b)->path);
+}
+
+// this function fills page with the first files after the path after below the open folder folder_fd, in path order
+// match picks the files which are listed, a folder which cannot be read gives an empty page
+static inline void listing_page_collect(struct listing_page *page, int folder_fd, const char *after, listing_page_match match, void *argument)
+{
+    size_t capacity = 256;
+    char *path = malloc(capacity);
+    page->count = 0;
+    page->after = after;
+    page->folder_fd = folder_fd;
+    page->match = match;
+    page->argument = argument;
+    page->more = 0;
+    if (path == NULL)
+    {
+        return;
+    }
+    path[0] = '\0';
+    path_resolver_walk_folder(folder_fd, &path, &capacity, 0, listing_page_visit, page);
+    free(path);
+    qsort(page->entries, page->count, sizeof(page->entries[0]), listing_entry_compare);
+}
+
+// this function sorts the count entries of pages from several servers and drops the paths which came more than once
+// (a file of a replicated pool is on several servers), the paths of dropped entries are freed, returns how many are left
+static inline int listing_page_merge(struct listing_entry *entries, int count)
+{
+    int unique = 0;
+    qsort(entries, count, sizeof(entries[0]), listing_entry_compare);
+    for (int i = 0; i < count; i++)
+    {
+        if (unique > 0 && strcmp(entries[unique - 1].path, entries[i].path) == 0)
+        {
+            free(entries[i].path);
+            continue;
+        }
+        entries[unique++] = entries[i];
+    }
+    return unique;
+}
+
+// this function frees the paths of the page
+static inline void listing_page_free(struct listing_page *page)
+{
+    for (int i = 0; i < page->count; i++)
+    {
+        free(page->entries[i].path);
+    }
+    page->count = 0;
+}
+
+// this function opens folder below the storage folder root_fd for listing, without creating it like the path resolver would
+// returns the descriptor or -1 when the folder does not exist or leaves the storage folder
+static inline int listing_page_open_folder(int root_fd, const char *folder)
+{
+    char *clean = path_resolver_clean(folder);
+    if (clean == NULL)
+    {
+        return -1;
+    }
+    int fd = openat(root_fd, clean[0] != '\0' ? clean : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    free(clean);
+    return fd;
+}
+
+// this function writes path as a cursor into cursor, returns 0 or -1 when cursor_size is too small
+static inline int listing_cursor_encode(const char *path, char *cursor, size_t cursor_size)
+{
+    static const char digits[] = "0123456789abcdef";
+    size_t length = strlen(path);
+    if (length == 0)
+    {
+        snprintf(cursor, cursor_size, "%s", LISTING_FIRST_CURSOR);
+        return cursor_size > strlen(LISTING_FIRST_CURSOR) ? 0 : -1;
+    }
+    if (length * 2 + 1 > cursor_size)
+    {
+        return -1;
+    }
+    for (size_t i = 0; i < length; i++)
+    {
+        cursor[2 * i] = digits[(unsigned char)path[i] >> 4];
+        cursor[2 * i + 1] = digits[(unsigned char)path[i] & 15];
+    }
+    cursor[2 * length] = '\0';
+    return 0;
+}
+
+// this function turns a cursor back into the path it stands for, the first cursor (or an empty one) gives ""
+// returns 0, or -1 for a cursor which was not made by listing_cursor_encode()
+static inline int listing_cursor_decode(const char *cursor, char *path, size_t path_size)
+{
+    size_t length = strlen(cursor);
+    if (length == 0 || strcmp(cursor, LISTING_FIRST_CURSOR) == 0)
+    {
+        path[0] = '\0';
+        return 0;
+    }
+    if (length % 2 != 0 || length / 2 + 1 > path_size)
+    {
+        return -1;
+    }
+    for (size_t i = 0; i < length / 2; i++)
+    {
+        int value = 0;
+        for (int half = 0; half < 2; half++)
+        {
+            char digit = cursor[2 * i + half];
+            int nibble = digit >= '0' && digit <= '9' ? digit - '0' : (digit >= 'a' && digit <= 'f' ? digit - 'a' + 10 : -1);
+            if (nibble < 0)
+            {
+                return -1;
+            }
+            value = value * 16 + nibble;
+        }
+        // a zero byte would end the path early
+        if (value == 0)
+        {
+            return -1;
+        }
+        path[i] = (char)value;
+    }
+    path[length / 2] = '\0';
+    return 0;
+}
+
+// this function writes the entries of the page to out as "path size mtime" lines
+static inline void listing_page_write(const struct listing_page *page, FILE *out)
+{
+    for (int i = 0; i < page->count; i++)
+    {
+        fprintf(out, "%s %lld %lld\n", page->entries[i].path, page->entries[i].size, page->entries[i].mtime);
+    }
+}
+
+#endif
@@ -0,0 +1,201 @@
+// unix domain sockets between smain and the stext and spdf servers running on the same host
+// every server listens on a unix socket as well as on its TCP port, the socket is named after the address and port
+// the server is bound to, so only a server on this host can own the name of a backend in smain.conf
+// smain tries that socket first and only goes through the TCP loopback stack when nobody listens on it
+// the names live in the abstract namespace of linux, there is no file to create, clean up or protect
+// over the unix socket smain can also hand the connection of its client to the server for a dfile or ufile,
+// the server then moves the file straight between its disk and the client and gives the connection back when done
+// or smain passes a shared memory ring (shm_ring.h) which the server fills with the file instead of the socket
+#ifndef LOCAL_TRANSPORT_H
+#define LOCAL_TRANSPORT_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// start of every socket name, the rest is "<ip>:<port>"
+#define LOCAL_TRANSPORT_PREFIX "dfs-backend-"
+// "handoff <command of the client>" comes with the client connection attached
+#define LOCAL_TRANSPORT_HANDOFF "handoff"
+// answers of the server, after the first one the connection is smain's again
+#define LOCAL_TRANSPORT_HANDOFF_DONE "HANDOFF_DONE\n"
+// the command cannot be handed off, the client connection was not touched and smain relays the command itself
+#define LOCAL_TRANSPORT_HANDOFF_REFUSED "HANDOFF_REFUSED\n"
+// most descriptors one message carries, a shared memory ring (shm_ring.h) comes with three
+#define LOCAL_TRANSPORT_MAX_FDS 3
+
+// this function fills address with the socket name of the server at ip and port and returns its length
+// the leading zero byte puts the name into the abstract namespace
+static inline socklen_t local_transport_address(const char *ip, int port, struct sockaddr_un *address)
+{
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    int length = snprintf(address->sun_path + 1, sizeof(address->sun_path) - 1, "%s%s:%d", LOCAL_TRANSPORT_PREFIX, ip, port);
+    if (length < 0 || (size_t)length >= sizeof(address->sun_path) - 1)
+    {
+        length = sizeof(address->sun_path) - 2;
+    }
+    return offsetof(struct sockaddr_un, sun_path) + 1 + length;
+}
+
+// this function opens the unix socket of the server bound to ip and port, with the same backlog as its TCP port
+// returns the listening socket or -1, the server keeps working over TCP alone then
+static inline int local_transport_listen(const char *ip, int port, int backlog)
+{
+    struct sockaddr_un address;
+    socklen_t length = local_transport_address(ip, port, &address);
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+    {
+        return -1;
+    }
+    if (bind(sock, (struct sockaddr *)&address, length) != 0 || listen(sock, backlog) != 0)
+    {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// this function connects to the unix socket of the server at ip and port
+// it never waits, a server which is not on this host (or is so busy that its backlog is full) gives -1
+// and the caller goes through TCP instead, the socket returned is blocking like a TCP one
+static inline int local_transport_connect(const char *ip, int port)
+{
+    struct sockaddr_un address;
+    socklen_t length = local_transport_address(ip, port, &address);
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+    {
+        return -1;
+    }
+    if (connect(sock, (struct sockaddr *)&address, length) != 0)
+    {
+        close(sock);
+        return -1;
+    }
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) & ~O_NONBLOCK);
+    return sock;
+}
+
+// this function waits for the next connection on the TCP socket or on the unix socket (-1 when there is none)
+// returns the accepted connection, or -1 when accepting failed
+static inline int local_transport_accept(int tcp_sock, int local_sock)
+{
+    struct pollfd waiting[2] = {{tcp_sock, POLLIN, 0}, {local_sock, POLLIN, 0}};
+    for (;;)
+    {
+        if (poll(waiting, local_sock >= 0 ? 2 : 1, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        for (int i = 0; i < 2; i++)
+        {
+            if (waiting[i].fd >= 0 && (waiting[i].revents & POLLIN))
+            {
+                return accept(waiting[i].fd, NULL, NULL);
+            }
+        }
+    }
+}
+
+// this function sends length bytes of data over the unix socket sock with count descriptors of fds attached (SCM_RIGHTS)
+// returns 0, or -1 when the message could not be sent
+static inline int local_transport_send_fds(int sock, const char *data, size_t length, const int *fds, int count)
+{
+    struct iovec part = {(void *)data, length};
+    union
+    {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(sizeof(int) * LOCAL_TRANSPORT_MAX_FDS)];
+    } control;
+    struct msghdr message;
+    if (count < 1 || count > LOCAL_TRANSPORT_MAX_FDS)
+    {
+        return -1;
+    }
+    memset(&message, 0, sizeof(message));
+    memset(&control, 0, sizeof(control));
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+    message.msg_control = control.space;
+    message.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+    struct cmsghdr *attached = CMSG_FIRSTHDR(&message);
+    attached->cmsg_level = SOL_SOCKET;
+    attached->cmsg_type = SCM_RIGHTS;
+    attached->cmsg_len = CMSG_LEN(sizeof(int) * count);
+    memcpy(CMSG_DATA(attached), fds, sizeof(int) * count);
+    return sendmsg(sock, &message, MSG_NOSIGNAL) == (ssize_t)length ? 0 : -1;
+}
+
+// this function receives like recv() and also takes the descriptors sent along with local_transport_send_fds()
+// fds is filled with them in the order they were sent and -1 for the rest,
+// it works on TCP sockets too where there never are any
+static inline ssize_t local_transport_recv(int sock, char *buffer, size_t size, int fds[LOCAL_TRANSPORT_MAX_FDS])
+{
+    struct iovec part = {buffer, size};
+    union
+    {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(sizeof(int) * LOCAL_TRANSPORT_MAX_FDS)];
+    } control;
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+    message.msg_control = control.space;
+    message.msg_controllen = sizeof(control.space);
+    for (int i = 0; i < LOCAL_TRANSPORT_MAX_FDS; i++)
+    {
+        fds[i] = -1;
+    }
+    ssize_t received = recvmsg(sock, &message, MSG_CMSG_CLOEXEC);
+    int count = 0;
+    for (struct cmsghdr *attached = received >= 0 ? CMSG_FIRSTHDR(&message) : NULL; attached != NULL; attached = CMSG_NXTHDR(&message, attached))
+    {
+        if (attached->cmsg_level != SOL_SOCKET || attached->cmsg_type != SCM_RIGHTS)
+        {
+            continue;
+        }
+        for (size_t i = 0; i < (attached->cmsg_len - CMSG_LEN(0)) / sizeof(int); i++)
+        {
+            int fd;
+            memcpy(&fd, CMSG_DATA(attached) + i * sizeof(int), sizeof(int));
+            // the kernel never passes more than fit into control, this only keeps fds in bounds
+            if (count < LOCAL_TRANSPORT_MAX_FDS)
+            {
+                fds[count++] = fd;
+            }
+            else
+            {
+                close(fd);
+            }
+        }
+    }
+    return received;
+}
+
+// this function closes the descriptors received with local_transport_recv() which were not used
+static inline void local_transport_close_fds(int fds[LOCAL_TRANSPORT_MAX_FDS])
+{
+    for (int i = 0; i < LOCAL_TRANSPORT_MAX_FDS; i++)
+    {
+        if (fds[i] >= 0)
+        {
+            close(fds[i]);
+            fds[i] = -1;
+        }
+    }
+}
+
+#endif
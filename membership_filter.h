@@ -0,0 +1,235 @@
+// membership filter shared by smain, stext and spdf
+// every storage folder keeps a counting bloom filter of the paths stored in it
+// when the filter says a path is not there then it is really not there, so a dfile or rmfile
+// for a missing file can be answered without looking at the disk or asking another server
+// the counters are kept in shared memory so that changes made by forked children are seen by the parent
+// smain keeps a plain bit copy of the stext and spdf filters, fetched with the "bloom" command
+#ifndef MEMBERSHIP_FILTER_H
+#define MEMBERSHIP_FILTER_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// number of counters (and of bits in the exported copy), 4 hashes keep false positives around 1% for 400000 files
+#define MEMBERSHIP_FILTER_BITS (1UL << 22)
+#define MEMBERSHIP_FILTER_HASHES 4
+// size of the exported bit copy sent to smain
+#define MEMBERSHIP_FILTER_BYTES (MEMBERSHIP_FILTER_BITS / 8)
+// a counter which reaches this value is never decremented again, the filter stays correct but that bit stays set
+#define MEMBERSHIP_FILTER_STUCK 255
+
+// counting filter, one byte per bit position
+struct membership_filter
+{
+    unsigned char counters[MEMBERSHIP_FILTER_BITS];
+};
+
+// FNV-1a of the key split in two halves, the bit positions are h1 + i * h2
+static inline void membership_filter_hash(const char *key, unsigned int *h1, unsigned int *h2)
+{
+    unsigned long long hash = 14695981039346656037ULL;
+    while (*key)
+    {
+        hash ^= (unsigned char)*key++;
+        hash *= 1099511628211ULL;
+    }
+    *h1 = (unsigned int)hash;
+    // h2 is kept odd so that the positions never collapse onto each other
+    *h2 = (unsigned int)(hash >> 32) | 1;
+}
+
+static inline unsigned long membership_filter_position(unsigned int h1, unsigned int h2, int i)
+{
+    return (h1 + (unsigned long)i * h2) % MEMBERSHIP_FILTER_BITS;
+}
+
+// this function maps an empty filter in shared memory, NULL when that is not possible
+static inline struct membership_filter *membership_filter_create(void)
+{
+    struct membership_filter *filter = mmap(NULL, sizeof(*filter), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    return filter == MAP_FAILED ? NULL : filter;
+}
+
+// this function records that key is stored now, it must be called once per newly created file
+static inline void membership_filter_add(struct membership_filter *filter, const char *key)
+{
+    unsigned int h1, h2;
+    membership_filter_hash(key, &h1, &h2);
+    for (int i = 0; i < MEMBERSHIP_FILTER_HASHES; i++)
+    {
+        unsigned char *counter = &filter->counters[membership_filter_position(h1, h2, i)];
+        unsigned char old;
+        do
+        {
+            old = *counter;
+            if (old == MEMBERSHIP_FILTER_STUCK)
+            {
+                break;
+            }
+        } while (!__sync_bool_compare_and_swap(counter, old, old + 1));
+    }
+}
+
+// this function records that key has been removed, it must only be called for a key which was added
+static inline void membership_filter_remove(struct membership_filter *filter, const char *key)
+{
+    unsigned int h1, h2;
+    membership_filter_hash(key, &h1, &h2);
+    for (int i = 0; i < MEMBERSHIP_FILTER_HASHES; i++)
+    {
+        unsigned char *counter = &filter->counters[membership_filter_position(h1, h2, i)];
+        unsigned char old;
+        do
+        {
+            old = *counter;
+            if (old == 0 || old == MEMBERSHIP_FILTER_STUCK)
+            {
+                break;
+            }
+        } while (!__sync_bool_compare_and_swap(counter, old, old - 1));
+    }
+}
+
+// returns 0 when key is certainly not stored and 1 when it may be
+static inline int membership_filter_may_contain(const struct membership_filter *filter, const char *key)
+{
+    unsigned int h1, h2;
+    membership_filter_hash(key, &h1, &h2);
+    for (int i = 0; i < MEMBERSHIP_FILTER_HASHES; i++)
+    {
+        if (filter->counters[membership_filter_position(h1, h2, i)] == 0)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// this function writes the filter as MEMBERSHIP_FILTER_BYTES bytes, one bit per counter which is not zero
+static inline void membership_filter_export(const struct membership_filter *filter, unsigned char *bits)
+{
+    memset(bits, 0, MEMBERSHIP_FILTER_BYTES);
+    for (unsigned long position = 0; position < MEMBERSHIP_FILTER_BITS; position++)
+    {
+        if (filter->counters[position] != 0)
+        {
+            bits[position / 8] |= (unsigned char)(1 << (position % 8));
+        }
+    }
+}
+
+// these two work on an exported bit copy, setting uses atomic or because several processes share the copy
+static inline void membership_bits_set(unsigned char *bits, unsigned int h1, unsigned int h2)
+{
+    for (int i = 0; i < MEMBERSHIP_FILTER_HASHES; i++)
+    {
+        unsigned long position = membership_filter_position(h1, h2, i);
+        __sync_fetch_and_or(&bits[position / 8], (unsigned char)(1 << (position % 8)));
+    }
+}
+
+static inline int membership_bits_may_contain(const unsigned char *bits, const char *key)
+{
+    unsigned int h1, h2;
+    membership_filter_hash(key, &h1, &h2);
+    for (int i = 0; i < MEMBERSHIP_FILTER_HASHES; i++)
+    {
+        unsigned long position = membership_filter_position(h1, h2, i);
+        if (!(bits[position / 8] & (1 << (position % 8))))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// this function adds every file below the open folder dir_fd, path holds the key of that folder ("" for the storage folder)
+// path grows as needed so deep trees are fine, it is allocated by the caller with malloc
+static inline void membership_filter_load_folder(struct membership_filter *filter, int dir_fd, char **path, size_t *capacity, size_t length)
+{
+    // a new open of the folder and not dup(), a dup would share its read position with dir_fd and with every later walk
+    int list_fd = openat(dir_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *folder = list_fd >= 0 ? fdopendir(list_fd) : NULL;
+    if (folder == NULL)
+    {
+        if (list_fd >= 0)
+        {
+            close(list_fd);
+        }
+        return;
+    }
+    struct dirent *item;
+    while ((item = readdir(folder)) != NULL)
+    {
+        if (strcmp(item->d_name, ".") == 0 || strcmp(item->d_name, "..") == 0)
+        {
+            continue;
+        }
+        size_t name_length = strlen(item->d_name);
+        // room for the '/' and the terminating zero
+        if (length + name_length + 2 > *capacity)
+        {
+            size_t bigger = (length + name_length + 2) * 2;
+            char *grown = realloc(*path, bigger);
+            if (grown == NULL)
+            {
+                continue;
+            }
+            *path = grown;
+            *capacity = bigger;
+        }
+        size_t child_length = length;
+        if (length > 0)
+        {
+            (*path)[child_length++] = '/';
+        }
+        memcpy(*path + child_length, item->d_name, name_length + 1);
+        child_length += name_length;
+        unsigned char type = item->d_type;
+        if (type == DT_UNKNOWN)
+        {
+            struct stat info;
+            if (fstatat(dir_fd, item->d_name, &info, AT_SYMLINK_NOFOLLOW) != 0)
+            {
+                continue;
+            }
+            type = S_ISDIR(info.st_mode) ? DT_DIR : (S_ISREG(info.st_mode) ? DT_REG : DT_UNKNOWN);
+        }
+        if (type == DT_REG)
+        {
+            membership_filter_add(filter, *path);
+        }
+        else if (type == DT_DIR)
+        {
+            int child_fd = openat(dir_fd, item->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (child_fd >= 0)
+            {
+                membership_filter_load_folder(filter, child_fd, path, capacity, child_length);
+                close(child_fd);
+            }
+        }
+        (*path)[length] = '\0';
+    }
+    closedir(folder);
+}
+
+// this function fills filter with every file stored below the storage folder root_fd
+static inline void membership_filter_load_tree(struct membership_filter *filter, int root_fd)
+{
+    size_t capacity = 256;
+    char *path = malloc(capacity);
+    if (path == NULL)
+    {
+        return;
+    }
+    path[0] = '\0';
+    membership_filter_load_folder(filter, root_fd, &path, &capacity, 0);
+    free(path);
+}
+
+#endif
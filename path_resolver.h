@@ -0,0 +1,366 @@
+// path resolution shared by smain, stext and spdf
+// every server keeps its files below one storage folder (~/smain, ~/stext, ~/spdf) and uploads name a folder inside it
+// instead of running mkdir() for every part of that folder on every upload, the folders which are known to exist
+// are kept open as directory descriptors and files are created relative to them with openat()
+// missing folders are created one level at a time with mkdirat(), so there is no limit on how long a path can be
+// path_resolver_walk() visits every stored file, the rebalancer of smain uses it to list what a server holds
+#ifndef PATH_RESOLVER_H
+#define PATH_RESOLVER_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+// number of folders kept open by one process
+#define PATH_RESOLVER_SLOTS 64
+
+// one open folder, path is relative to the storage folder and has no leading or trailing '/'
+struct path_resolver_entry
+{
+    // open directory descriptor, -1 when the entry is free
+    int fd;
+    // tick of the last use for the LRU eviction
+    unsigned long last_used;
+    // allocated with the exact length of the path so deep trees are fine
+    char *path;
+};
+
+// cache of open folders below one storage folder
+struct path_resolver
+{
+    // descriptor of the storage folder itself, owned by the caller
+    int root_fd;
+    unsigned long tick;
+    struct path_resolver_entry entries[PATH_RESOLVER_SLOTS];
+};
+
+// this function prepares an empty cache for the storage folder open at root_fd
+static inline void path_resolver_init(struct path_resolver *resolver, int root_fd)
+{
+    resolver->root_fd = root_fd;
+    resolver->tick = 0;
+    for (int i = 0; i < PATH_RESOLVER_SLOTS; i++)
+    {
+        resolver->entries[i].fd = -1;
+        resolver->entries[i].path = NULL;
+    }
+}
+
+// this function closes every cached folder, for example after a folder was removed behind our back
+static inline void path_resolver_forget(struct path_resolver *resolver)
+{
+    for (int i = 0; i < PATH_RESOLVER_SLOTS; i++)
+    {
+        if (resolver->entries[i].fd >= 0)
+        {
+            close(resolver->entries[i].fd);
+            free(resolver->entries[i].path);
+            resolver->entries[i].fd = -1;
+            resolver->entries[i].path = NULL;
+        }
+    }
+}
+
+// this function returns the cached descriptor of the first length bytes of path, or -1
+static inline int path_resolver_lookup(struct path_resolver *resolver, const char *path, size_t length)
+{
+    for (int i = 0; i < PATH_RESOLVER_SLOTS; i++)
+    {
+        struct path_resolver_entry *entry = &resolver->entries[i];
+        if (entry->fd >= 0 && strlen(entry->path) == length && strncmp(entry->path, path, length) == 0)
+        {
+            entry->last_used = resolver->tick;
+            return entry->fd;
+        }
+    }
+    return -1;
+}
+
+// this function keeps fd as the descriptor of the first length bytes of path
+// entries used by the current lookup are never evicted because the caller may still be walking from them
+// returns 0 when the cache took the descriptor over and -1 when the caller still owns it
+static inline int path_resolver_remember(struct path_resolver *resolver, const char *path, size_t length, int fd)
+{
+    struct path_resolver_entry *victim = NULL;
+    for (int i = 0; i < PATH_RESOLVER_SLOTS; i++)
+    {
+        struct path_resolver_entry *entry = &resolver->entries[i];
+        if (entry->fd < 0)
+        {
+            victim = entry;
+            break;
+        }
+        if (entry->last_used != resolver->tick && (victim == NULL || entry->last_used < victim->last_used))
+        {
+            victim = entry;
+        }
+    }
+    char *copy = victim != NULL ? malloc(length + 1) : NULL;
+    if (copy == NULL)
+    {
+        return -1;
+    }
+    memcpy(copy, path, length);
+    copy[length] = '\0';
+    if (victim->fd >= 0)
+    {
+        close(victim->fd);
+        free(victim->path);
+    }
+    victim->fd = fd;
+    victim->path = copy;
+    victim->last_used = resolver->tick;
+    return 0;
+}
+
+// this function turns a folder given by a client like "./f1//f2/" into "f1/f2"
+// ".." is refused so that nobody can write outside the storage folder
+// returns an allocated string which the caller frees, or NULL with errno set
+static inline char *path_resolver_clean(const char *folder)
+{
+    size_t used = 0;
+    char *clean = malloc(strlen(folder) + 1);
+    if (clean == NULL)
+    {
+        return NULL;
+    }
+    for (const char *part = folder; *part;)
+    {
+        size_t part_length = strcspn(part, "/");
+        if (part_length == 2 && strncmp(part, "..", 2) == 0)
+        {
+            free(clean);
+            errno = EACCES;
+            return NULL;
+        }
+        // empty parts come from repeated slashes and "." is the folder itself, both are skipped
+        if (part_length > 0 && !(part_length == 1 && part[0] == '.'))
+        {
+            if (used > 0)
+            {
+                clean[used++] = '/';
+            }
+            memcpy(clean + used, part, part_length);
+            used += part_length;
+        }
+        part += part_length;
+        part += (*part == '/');
+    }
+    clean[used] = '\0';
+    return clean;
+}
+
+// this function returns an open descriptor for folder below the storage folder, creating the missing levels
+// the descriptor belongs to the cache and must not be closed by the caller
+// *owned is set to 1 when the cache had no room for it and the caller has to close it
+static inline int path_resolver_open_dir(struct path_resolver *resolver, const char *folder, int *owned)
+{
+    *owned = 0;
+    char *path = path_resolver_clean(folder);
+    if (path == NULL)
+    {
+        return -1;
+    }
+    size_t length = strlen(path);
+    if (length == 0)
+    {
+        free(path);
+        return resolver->root_fd;
+    }
+    resolver->tick++;
+    // hot case: the folder has been used before and costs no syscall at all
+    int fd = path_resolver_lookup(resolver, path, length);
+    if (fd >= 0)
+    {
+        free(path);
+        return fd;
+    }
+    // find the deepest parent which is already open, the walk below starts from there
+    size_t known = length;
+    int parent_fd = resolver->root_fd;
+    while (known > 0)
+    {
+        while (known > 0 && path[known - 1] != '/')
+        {
+            known--;
+        }
+        if (known == 0)
+        {
+            break;
+        }
+        int cached = path_resolver_lookup(resolver, path, known - 1);
+        if (cached >= 0)
+        {
+            parent_fd = cached;
+            break;
+        }
+        known--;
+    }
+    // usually the folder exists already and a single openat() of the rest of the path is enough
+    fd = openat(parent_fd, path + known, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0)
+    {
+        if (path_resolver_remember(resolver, path, length, fd) != 0)
+        {
+            *owned = 1;
+        }
+        free(path);
+        return fd;
+    }
+    if (errno != ENOENT && errno != ENAMETOOLONG)
+    {
+        free(path);
+        return -1;
+    }
+    // otherwise walk the rest one level at a time, creating what is missing
+    int parent_owned = 0;
+    while (known < length)
+    {
+        size_t end = known + strcspn(path + known, "/");
+        char saved = path[end];
+        path[end] = '\0';
+        fd = openat(parent_fd, path + known, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0 && errno == ENOENT && (mkdirat(parent_fd, path + known, 0755) == 0 || errno == EEXIST))
+        {
+            fd = openat(parent_fd, path + known, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        }
+        path[end] = saved;
+        if (parent_owned)
+        {
+            close(parent_fd);
+        }
+        if (fd < 0)
+        {
+            free(path);
+            return -1;
+        }
+        parent_owned = path_resolver_remember(resolver, path, end, fd) != 0;
+        parent_fd = fd;
+        known = end + (saved == '/');
+    }
+    *owned = parent_owned;
+    free(path);
+    return parent_fd;
+}
+
+// this function creates or opens the file name inside folder below the storage folder, like openat() with flags and mode
+// a cached folder may have been removed by someone else in the meantime, in that case the cache is dropped and the lookup is done once more
+static inline int path_resolver_open_file(struct path_resolver *resolver, const char *folder, const char *name, int flags, mode_t mode)
+{
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        int owned;
+        int dir_fd = path_resolver_open_dir(resolver, folder, &owned);
+        if (dir_fd < 0)
+        {
+            return -1;
+        }
+        int fd = openat(dir_fd, name, flags | O_CLOEXEC, mode);
+        int saved_errno = errno;
+        if (owned)
+        {
+            close(dir_fd);
+        }
+        if (fd >= 0 || saved_errno != ENOENT)
+        {
+            errno = saved_errno;
+            return fd;
+        }
+        path_resolver_forget(resolver);
+        errno = saved_errno;
+    }
+    return -1;
+}
+
+// called by path_resolver_walk() for every file, path is relative to the storage folder
+typedef void (*path_resolver_visit)(const char *path, void *argument);
+
+// this function calls visit for every regular file below the open folder dir_fd, path holds the path of that folder
+// path grows as needed so deep trees are fine, it is allocated by the caller with malloc
+static inline void path_resolver_walk_folder(int dir_fd, char **path, size_t *capacity, size_t length, path_resolver_visit visit, void *argument)
+{
+    // a new open of the folder and not dup(), a dup would share its read position with dir_fd and with every later walk
+    int list_fd = openat(dir_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *folder = list_fd >= 0 ? fdopendir(list_fd) : NULL;
+    if (folder == NULL)
+    {
+        if (list_fd >= 0)
+        {
+            close(list_fd);
+        }
+        return;
+    }
+    struct dirent *item;
+    while ((item = readdir(folder)) != NULL)
+    {
+        if (strcmp(item->d_name, ".") == 0 || strcmp(item->d_name, "..") == 0)
+        {
+            continue;
+        }
+        size_t name_length = strlen(item->d_name);
+        // room for the '/' and the terminating zero
+        if (length + name_length + 2 > *capacity)
+        {
+            size_t bigger = (length + name_length + 2) * 2;
+            char *grown = realloc(*path, bigger);
+            if (grown == NULL)
+            {
+                continue;
+            }
+            *path = grown;
+            *capacity = bigger;
+        }
+        size_t child_length = length;
+        if (length > 0)
+        {
+            (*path)[child_length++] = '/';
+        }
+        memcpy(*path + child_length, item->d_name, name_length + 1);
+        child_length += name_length;
+        unsigned char type = item->d_type;
+        if (type == DT_UNKNOWN)
+        {
+            struct stat info;
+            if (fstatat(dir_fd, item->d_name, &info, AT_SYMLINK_NOFOLLOW) != 0)
+            {
+                continue;
+            }
+            type = S_ISDIR(info.st_mode) ? DT_DIR : (S_ISREG(info.st_mode) ? DT_REG : DT_UNKNOWN);
+        }
+        if (type == DT_REG)
+        {
+            visit(*path, argument);
+        }
+        else if (type == DT_DIR)
+        {
+            int child_fd = openat(dir_fd, item->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (child_fd >= 0)
+            {
+                path_resolver_walk_folder(child_fd, path, capacity, child_length, visit, argument);
+                close(child_fd);
+            }
+        }
+        (*path)[length] = '\0';
+    }
+    closedir(folder);
+}
+
+// this function calls visit for every file stored below the storage folder of resolver
+static inline void path_resolver_walk(struct path_resolver *resolver, path_resolver_visit visit, void *argument)
+{
+    size_t capacity = 256;
+    char *path = malloc(capacity);
+    if (path == NULL)
+    {
+        return;
+    }
+    path[0] = '\0';
+    path_resolver_walk_folder(resolver->root_fd, &path, &capacity, 0, visit, argument);
+    free(path);
+}
+
+#endif
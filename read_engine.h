@@ -0,0 +1,203 @@
+// read engine shared by smain, stext and spdf to send a stored file to a socket
+// the way a file is read depends on its size and on whether it is already in the page cache
+//   small files are read with one pread(), they are the hot working set and stay in the page cache
+//   bigger files are mapped with mmap() and MADV_SEQUENTIAL so the kernel reads ahead in big steps
+//   files too big for the page cache which are not cached yet are streamed with O_DIRECT in big aligned reads
+//   so they do not push the small hot files out of memory, where O_DIRECT is not supported posix_fadvise()
+//   asks for readahead and the pages already sent are dropped again
+#ifndef READ_ENGINE_H
+#define READ_ENGINE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+// O_DIRECT is only declared with _GNU_SOURCE, without it the engine never uses the O_DIRECT path
+#ifndef O_DIRECT
+#define O_DIRECT 0
+#endif
+
+// files up to this size are read with a single pread()
+#define READ_ENGINE_SMALL_FILE (64 * 1024)
+// files bigger than physical memory divided by this are too big for the page cache
+#define READ_ENGINE_CACHE_SHARE 4
+// but never stream files smaller than this with O_DIRECT
+#define READ_ENGINE_DIRECT_MINIMUM (64L * 1024 * 1024)
+// size of one O_DIRECT or readahead read
+#define READ_ENGINE_STREAM_CHUNK (2 * 1024 * 1024)
+// alignment O_DIRECT needs for the buffer, the offset and the length
+#define READ_ENGINE_DIRECT_ALIGN 4096
+// how many pages of a big file are checked with mincore() to see whether it is already cached
+#define READ_ENGINE_RESIDENCY_SAMPLES 64
+
+// this function sends length bytes from data and returns 0, or -1 when the socket failed
+static inline int read_engine_send_all(int sock, const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t written = send(sock, data, length, 0);
+        if (written <= 0)
+        {
+            return -1;
+        }
+        data += written;
+        length -= written;
+    }
+    return 0;
+}
+
+// this function returns the size above which a file counts as too big for the page cache
+static inline off_t read_engine_direct_threshold(void)
+{
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long page_size = sysconf(_SC_PAGESIZE);
+    off_t threshold = pages > 0 && page_size > 0 ? (off_t)pages * page_size / READ_ENGINE_CACHE_SHARE : 0;
+    return threshold > READ_ENGINE_DIRECT_MINIMUM ? threshold : READ_ENGINE_DIRECT_MINIMUM;
+}
+
+// this function checks some pages spread over the mapped file and returns 1 when at least half of them are in memory
+static inline int read_engine_mostly_cached(char *map, off_t size)
+{
+    long page_size = sysconf(_SC_PAGESIZE);
+    off_t pages = (size + page_size - 1) / page_size;
+    int resident = 0;
+    for (int i = 0; i < READ_ENGINE_RESIDENCY_SAMPLES; i++)
+    {
+        unsigned char state = 0;
+        off_t page = pages * i / READ_ENGINE_RESIDENCY_SAMPLES;
+        if (mincore(map + page * page_size, page_size, &state) == 0 && (state & 1))
+        {
+            resident++;
+        }
+    }
+    return resident * 2 >= READ_ENGINE_RESIDENCY_SAMPLES;
+}
+
+// this function streams the file through the page cache with readahead and drops what has been sent
+// it is used for big cold files where O_DIRECT is not possible and when a file cannot be mapped
+static inline int read_engine_send_streamed(int fd, off_t size, int sock, int drop_behind)
+{
+    char *buffer = malloc(READ_ENGINE_STREAM_CHUNK);
+    int result = 0;
+    if (buffer == NULL)
+    {
+        return -1;
+    }
+    posix_fadvise(fd, 0, size, POSIX_FADV_SEQUENTIAL);
+    for (off_t offset = 0; offset < size && result == 0;)
+    {
+        // ask for the next chunk while this one is being sent
+        posix_fadvise(fd, offset + READ_ENGINE_STREAM_CHUNK, READ_ENGINE_STREAM_CHUNK, POSIX_FADV_WILLNEED);
+        ssize_t got = pread(fd, buffer, READ_ENGINE_STREAM_CHUNK, offset);
+        if (got <= 0)
+        {
+            result = -1;
+            break;
+        }
+        result = read_engine_send_all(sock, buffer, got);
+        if (drop_behind)
+        {
+            posix_fadvise(fd, offset, got, POSIX_FADV_DONTNEED);
+        }
+        offset += got;
+    }
+    free(buffer);
+    return result;
+}
+
+// this function reads the file with O_DIRECT through a second descriptor, returns 1 when O_DIRECT is not possible here
+static inline int read_engine_send_direct(int fd, off_t size, int sock)
+{
+    char proc_path[64];
+    void *buffer = NULL;
+    int result = 0;
+    if (O_DIRECT == 0)
+    {
+        return 1;
+    }
+    // the descriptor may be shared with other requests, so O_DIRECT is set on a new one to the same file
+    snprintf(proc_path, sizeof(proc_path), "/proc/self/fd/%d", fd);
+    int direct_fd = open(proc_path, O_RDONLY | O_DIRECT | O_CLOEXEC);
+    if (direct_fd < 0)
+    {
+        return 1;
+    }
+    if (posix_memalign(&buffer, READ_ENGINE_DIRECT_ALIGN, READ_ENGINE_STREAM_CHUNK) != 0)
+    {
+        close(direct_fd);
+        return 1;
+    }
+    for (off_t offset = 0; offset < size;)
+    {
+        ssize_t got = pread(direct_fd, buffer, READ_ENGINE_STREAM_CHUNK, offset);
+        // some file systems accept O_DIRECT on open() and refuse it on read()
+        if (got < 0 && errno == EINVAL && offset == 0)
+        {
+            result = 1;
+            break;
+        }
+        if (got <= 0)
+        {
+            result = -1;
+            break;
+        }
+        // the last read may go past the end of the file, only the real bytes are sent
+        if (offset + got > size)
+        {
+            got = size - offset;
+        }
+        if (read_engine_send_all(sock, buffer, got) != 0)
+        {
+            result = -1;
+            break;
+        }
+        offset += got;
+    }
+    free(buffer);
+    close(direct_fd);
+    return result;
+}
+
+// this function sends the first size bytes of the open file fd to sock
+// it returns 0 when everything was sent and -1 when reading or sending failed
+static inline int read_engine_send_file(int fd, off_t size, int sock)
+{
+    if (size <= 0)
+    {
+        return 0;
+    }
+    // small files: one read, one send
+    if (size <= READ_ENGINE_SMALL_FILE)
+    {
+        char buffer[READ_ENGINE_SMALL_FILE];
+        ssize_t got = pread(fd, buffer, size, 0);
+        return got == size ? read_engine_send_all(sock, buffer, got) : -1;
+    }
+    char *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        return read_engine_send_streamed(fd, size, sock, 0);
+    }
+    // a big file which is not in memory yet would evict the hot files, read it around the page cache
+    if (size > read_engine_direct_threshold() && !read_engine_mostly_cached(map, size))
+    {
+        munmap(map, size);
+        int direct = read_engine_send_direct(fd, size, sock);
+        return direct == 1 ? read_engine_send_streamed(fd, size, sock, 1) : direct;
+    }
+    // everything else is sent straight from the mapping, the kernel reads ahead because of MADV_SEQUENTIAL
+    // send() copies from the mapping inside the kernel, a file truncated meanwhile makes it fail with EFAULT instead of a signal
+    madvise(map, size, MADV_SEQUENTIAL);
+    madvise(map, size < READ_ENGINE_STREAM_CHUNK ? size : READ_ENGINE_STREAM_CHUNK, MADV_WILLNEED);
+    int result = read_engine_send_all(sock, map, size);
+    munmap(map, size);
+    return result;
+}
+
+#endif
@@ -0,0 +1,105 @@
+// consistent hash ring which smain places the copies of a file on, one ring per pool of servers
+// every server gets ROUTE_VIRTUAL_NODES points on the ring and a key belongs to the server of the first point at or
+// after its hash, so adding a server to a pool only moves the keys which land on its points and nothing else
+// a point is named after the address of its server and not its position, so the order of the backend lines does not matter
+#ifndef ROUTE_RING_H
+#define ROUTE_RING_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// points every server of a pool gets on the pool's hash ring, more points spread the keys more evenly
+#define ROUTE_VIRTUAL_NODES 128
+
+// one virtual node of a server on the hash ring of its pool
+struct route_ring_point
+{
+    unsigned int hash;
+    int backend;
+};
+
+// FNV-1a hash used for the ring, it spreads similar paths like f1/a1.txt and f1/a2.txt far apart
+static inline unsigned int route_hash(const char *text)
+{
+    unsigned int hash = 2166136261u;
+    while (*text)
+    {
+        hash ^= (unsigned char)*text++;
+        hash *= 16777619u;
+    }
+    // final mixing so the last characters of the path move the high bits too
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    return hash;
+}
+
+// orders ring points by hash, ties by server so that qsort always gives the same ring
+static inline int route_ring_compare(const void *left, const void *right)
+{
+    const struct route_ring_point *a = left, *b = right;
+    if (a->hash != b->hash)
+    {
+        return a->hash < b->hash ? -1 : 1;
+    }
+    return a->backend - b->backend;
+}
+
+// this function adds the ROUTE_VIRTUAL_NODES points of server backend at ip and port to the ring of *ring_size points
+// the ring needs room for them and is sorted with route_ring_sort() once every server was added
+static inline void route_ring_add(struct route_ring_point *ring, int *ring_size, const char *ip, int port, int backend)
+{
+    char point_name[128];
+    for (int point = 0; point < ROUTE_VIRTUAL_NODES; point++)
+    {
+        snprintf(point_name, sizeof(point_name), "%s:%d#%d", ip, port, point);
+        ring[*ring_size].hash = route_hash(point_name);
+        ring[*ring_size].backend = backend;
+        (*ring_size)++;
+    }
+}
+
+static inline void route_ring_sort(struct route_ring_point *ring, int ring_size)
+{
+    qsort(ring, ring_size, sizeof(ring[0]), route_ring_compare);
+}
+
+// this function fills order with the servers of the ring in the order they follow key and returns how many there are,
+// backend_count at most, the first ones keep the copies of the key, the next ones are where the key lived before
+// servers were added in front of it
+static inline int route_ring_order(const struct route_ring_point *ring, int ring_size, int backend_count, const char *key, int *order)
+{
+    unsigned int hash = route_hash(key);
+    int count = 0;
+    // binary search for the first point at or after the hash
+    int low = 0, high = ring_size;
+    while (low < high)
+    {
+        int middle = (low + high) / 2;
+        if (ring[middle].hash < hash)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    // walk on around the ring, wrapping at the end, and note every server the first time it shows up
+    for (int step = 0; step < ring_size && count < backend_count; step++)
+    {
+        int backend = ring[(low + step) % ring_size].backend;
+        int seen = 0;
+        for (int i = 0; i < count && !seen; i++)
+        {
+            seen = order[i] == backend;
+        }
+        if (!seen)
+        {
+            order[count++] = backend;
+        }
+    }
+    return count;
+}
+
+#endif
@@ -0,0 +1,284 @@
+// shared memory ring between smain and a stext or spdf server on the same host
+// smain creates the ring in a memfd and passes it over the unix socket together with two eventfds,
+// the server then reads the file straight into the ring and smain sends it to the client straight out of it,
+// so the bytes are never copied through a socket between the two processes
+// there is exactly one producer (the server) and one consumer (smain): each side only moves its own counter
+// and the eventfds are only written when the other side went to sleep waiting for them
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/eventfd.h>
+
+// bytes a ring holds, a power of two
+#define SHM_RING_BYTES (4 * 1024 * 1024)
+// the counters are kept on their own page in front of the data
+#define SHM_RING_CONTROL_BYTES 4096
+// a side which waits this long for the other one gives up, like a socket with BACKEND_IO_TIMEOUT_SECONDS
+#define SHM_RING_TIMEOUT_MS 15000
+// "ring fetch <file>" comes with the memfd and the two eventfds attached, the server answers on the socket
+// with "SIZE <bytes>" before it fills the ring, with the not found marker, or with SHM_RING_REFUSED
+#define SHM_RING_COMMAND "ring"
+#define SHM_RING_REFUSED "RING_REFUSED\n"
+
+// first page of the memfd
+struct shm_ring_control
+{
+    // bytes ever written and ever read, head is only moved by the producer and tail only by the consumer
+    uint64_t head;
+    uint64_t tail;
+    uint64_t capacity;
+    // set by the producer after the last byte
+    uint32_t closed;
+    // set by a side before it sleeps on its eventfd, the other side then knows it has to write it
+    uint32_t consumer_waiting;
+    uint32_t producer_waiting;
+};
+
+struct shm_ring
+{
+    struct shm_ring_control *control;
+    unsigned char *data;
+    int memfd;
+    // written by the producer when there is data, and by the consumer when there is room
+    int data_event;
+    int space_event;
+};
+
+// this function maps the memfd of a ring, it returns 0 or -1
+static inline int shm_ring_map(struct shm_ring *ring)
+{
+    struct stat info;
+    if (fstat(ring->memfd, &info) != 0 || info.st_size <= SHM_RING_CONTROL_BYTES)
+    {
+        return -1;
+    }
+    void *mapped = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->memfd, 0);
+    if (mapped == MAP_FAILED)
+    {
+        return -1;
+    }
+    ring->control = mapped;
+    ring->data = (unsigned char *)mapped + SHM_RING_CONTROL_BYTES;
+    // a capacity which does not match the mapping would let the other side write past it
+    if (ring->control->capacity != (uint64_t)info.st_size - SHM_RING_CONTROL_BYTES || (ring->control->capacity & (ring->control->capacity - 1)) != 0)
+    {
+        munmap(mapped, info.st_size);
+        ring->control = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+// this function unmaps the ring and closes its descriptors, the memory goes away once the other side did the same
+static inline void shm_ring_destroy(struct shm_ring *ring)
+{
+    if (ring->control != NULL)
+    {
+        munmap(ring->control, SHM_RING_CONTROL_BYTES + ring->control->capacity);
+        ring->control = NULL;
+    }
+    int *fds[3] = {&ring->memfd, &ring->data_event, &ring->space_event};
+    for (int i = 0; i < 3; i++)
+    {
+        if (*fds[i] >= 0)
+        {
+            close(*fds[i]);
+            *fds[i] = -1;
+        }
+    }
+}
+
+// this function creates an empty ring of capacity bytes (a power of two), it returns 0 or -1
+static inline int shm_ring_create(struct shm_ring *ring, size_t capacity)
+{
+    ring->control = NULL;
+    ring->memfd = memfd_create("dfs-ring", MFD_CLOEXEC);
+    ring->data_event = eventfd(0, EFD_CLOEXEC);
+    ring->space_event = eventfd(0, EFD_CLOEXEC);
+    if (ring->memfd < 0 || ring->data_event < 0 || ring->space_event < 0 || ftruncate(ring->memfd, SHM_RING_CONTROL_BYTES + capacity) != 0)
+    {
+        shm_ring_destroy(ring);
+        return -1;
+    }
+    // the control page is written through a mapping of its own before the whole ring is mapped and checked
+    struct shm_ring_control *control = mmap(NULL, SHM_RING_CONTROL_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, ring->memfd, 0);
+    if (control == MAP_FAILED)
+    {
+        shm_ring_destroy(ring);
+        return -1;
+    }
+    control->capacity = capacity;
+    munmap(control, SHM_RING_CONTROL_BYTES);
+    if (shm_ring_map(ring) != 0)
+    {
+        shm_ring_destroy(ring);
+        return -1;
+    }
+    return 0;
+}
+
+// this function maps a ring received from the other side, the three descriptors belong to the ring from now on
+static inline int shm_ring_attach(struct shm_ring *ring, int memfd, int data_event, int space_event)
+{
+    ring->control = NULL;
+    ring->memfd = memfd;
+    ring->data_event = data_event;
+    ring->space_event = space_event;
+    if (shm_ring_map(ring) != 0)
+    {
+        shm_ring_destroy(ring);
+        return -1;
+    }
+    return 0;
+}
+
+// this function wakes the other side when it is asleep on event
+static inline void shm_ring_wake(uint32_t *waiting, int event)
+{
+    if (__atomic_exchange_n(waiting, 0, __ATOMIC_SEQ_CST))
+    {
+        uint64_t one = 1;
+        ssize_t ignored = write(event, &one, sizeof(one));
+        (void)ignored;
+    }
+}
+
+// this function sleeps on event until the other side writes it or timeout_ms passed, it returns 0 or -1 on timeout
+static inline int shm_ring_sleep(int event, int timeout_ms)
+{
+    struct pollfd waiting = {event, POLLIN, 0};
+    int ready;
+    while ((ready = poll(&waiting, 1, timeout_ms)) < 0 && errno == EINTR)
+    {
+    }
+    if (ready != 1)
+    {
+        return -1;
+    }
+    uint64_t count;
+    ssize_t ignored = read(event, &count, sizeof(count));
+    (void)ignored;
+    return 0;
+}
+
+// producer: this function waits for room and points *space at the free bytes which follow each other in memory
+// it returns how many there are, or 0 when the consumer made no room for timeout_ms
+static inline size_t shm_ring_reserve(struct shm_ring *ring, unsigned char **space, int timeout_ms)
+{
+    struct shm_ring_control *control = ring->control;
+    uint64_t head = control->head;
+    for (;;)
+    {
+        uint64_t tail = __atomic_load_n(&control->tail, __ATOMIC_ACQUIRE);
+        if (head - tail < control->capacity)
+        {
+            size_t offset = head & (control->capacity - 1);
+            size_t free_bytes = control->capacity - (head - tail);
+            *space = ring->data + offset;
+            return free_bytes < control->capacity - offset ? free_bytes : control->capacity - offset;
+        }
+        // the flag is set before looking again, so a consumer which makes room right now sees it and wakes us
+        __atomic_store_n(&control->producer_waiting, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&control->tail, __ATOMIC_SEQ_CST) != tail)
+        {
+            __atomic_store_n(&control->producer_waiting, 0, __ATOMIC_SEQ_CST);
+            continue;
+        }
+        if (shm_ring_sleep(ring->space_event, timeout_ms) != 0)
+        {
+            return 0;
+        }
+    }
+}
+
+// producer: this function publishes length bytes written into the space given by shm_ring_reserve()
+static inline void shm_ring_commit(struct shm_ring *ring, size_t length)
+{
+    __atomic_store_n(&ring->control->head, ring->control->head + length, __ATOMIC_SEQ_CST);
+    shm_ring_wake(&ring->control->consumer_waiting, ring->data_event);
+}
+
+// producer: this function tells the consumer that no more bytes follow
+static inline void shm_ring_close(struct shm_ring *ring)
+{
+    __atomic_store_n(&ring->control->closed, 1, __ATOMIC_SEQ_CST);
+    shm_ring_wake(&ring->control->consumer_waiting, ring->data_event);
+}
+
+// producer: this function reads size bytes of the file fd straight into the ring, it returns 0 or -1
+static inline int shm_ring_fill_from_file(struct shm_ring *ring, int fd, off_t size, int timeout_ms)
+{
+    for (off_t offset = 0; offset < size;)
+    {
+        unsigned char *space;
+        size_t room = shm_ring_reserve(ring, &space, timeout_ms);
+        if (room == 0)
+        {
+            return -1;
+        }
+        if ((off_t)room > size - offset)
+        {
+            room = size - offset;
+        }
+        ssize_t got = pread(fd, space, room, offset);
+        if (got <= 0)
+        {
+            return -1;
+        }
+        shm_ring_commit(ring, got);
+        offset += got;
+    }
+    return 0;
+}
+
+// consumer: this function waits for bytes and points *data at the ones which follow each other in memory
+// it returns how many there are, 0 once the producer closed the ring and everything was read, or -1 after timeout_ms
+static inline ssize_t shm_ring_peek(struct shm_ring *ring, const unsigned char **data, int timeout_ms)
+{
+    struct shm_ring_control *control = ring->control;
+    uint64_t tail = control->tail;
+    for (;;)
+    {
+        // closed is read before head, bytes published before the close are then seen as well
+        uint32_t closed = __atomic_load_n(&control->closed, __ATOMIC_ACQUIRE);
+        uint64_t head = __atomic_load_n(&control->head, __ATOMIC_ACQUIRE);
+        if (head != tail)
+        {
+            size_t offset = tail & (control->capacity - 1);
+            size_t ready = head - tail;
+            *data = ring->data + offset;
+            return ready < control->capacity - offset ? ready : control->capacity - offset;
+        }
+        if (closed)
+        {
+            return 0;
+        }
+        __atomic_store_n(&control->consumer_waiting, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&control->head, __ATOMIC_SEQ_CST) != head || __atomic_load_n(&control->closed, __ATOMIC_SEQ_CST))
+        {
+            __atomic_store_n(&control->consumer_waiting, 0, __ATOMIC_SEQ_CST);
+            continue;
+        }
+        if (shm_ring_sleep(ring->data_event, timeout_ms) != 0)
+        {
+            return -1;
+        }
+    }
+}
+
+// consumer: this function gives length bytes seen with shm_ring_peek() back to the producer
+static inline void shm_ring_consume(struct shm_ring *ring, size_t length)
+{
+    __atomic_store_n(&ring->control->tail, ring->control->tail + length, __ATOMIC_SEQ_CST);
+    shm_ring_wake(&ring->control->producer_waiting, ring->space_event);
+}
+
+#endif
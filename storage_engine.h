@@ -0,0 +1,1010 @@
+// storage engine of the text and pdf tiers, one tier is a storage folder below the home folder and the extension of its files
+// the standalone stext server is this engine behind a TCP port and a unix socket (local_transport.h),
+// and smain can run the same engine for a server of smain.conf itself (see "embed" there), it then serves
+// the dfile and ufile commands of its clients for that server in its own process without any hop to another server
+// the including file defines _GNU_SOURCE before its first include, the read engine needs it for O_DIRECT
+#ifndef STORAGE_ENGINE_H
+#define STORAGE_ENGINE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <arpa/inet.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "path_resolver.h"
+#include "membership_filter.h"
+#include "read_engine.h"
+#include "listing_page.h"
+#include "tiering.h"
+#include "local_transport.h"
+#include "shm_ring.h"
+#include "delta_transfer.h"
+#include "file_version.h"
+#include "file_stat.h"
+#include "dfs_protocol.h"
+
+// size of a command and of the chunks a file is sent and received in
+#define STORAGE_ENGINE_BUFFER_SIZE 1024
+// first line of the reply to a dfile for a file which is not stored here
+#define STORAGE_ENGINE_NOT_FOUND "FILE_NOT_FOUND\n"
+// files copied in by smain's rebalancer are written under this name first and linked to their real name at the end
+#define STORAGE_ENGINE_TEMP_PREFIX ".rebalance."
+// last line of the answer to list, display and page
+#define STORAGE_ENGINE_END_OF_LIST "END_OF_LIST\n"
+
+struct storage_engine
+{
+    // shown in the log of the server
+    const char *name;
+    // address and port of the server, its unix socket is named after them as well
+    const char *address;
+    int port;
+    // name of the storage folder inside the home folder
+    const char *folder;
+    // extension of the files listed by display and packed by dtar
+    const char *extension;
+    // descriptor of the storage folder, files are created relative to it
+    int store_fd;
+    // folders of the storage folder which are open already
+    struct path_resolver store_dirs;
+    // counting filter of every path stored, shared with the forked children
+    struct membership_filter *stored_paths;
+    // files which are not read for cold_seconds move to the cold folder (~/<folder>-cold unless cold_folder says otherwise), 0 turns that off
+    const char *cold_folder;
+    long long cold_seconds;
+    struct tiering_store tiers;
+    // listening sockets, -1 until storage_engine_listen()
+    int tcp_sock;
+    int local_sock;
+};
+
+static inline void storage_engine_split_path(const char *full_path, char *folder_name, char *target_file_name);
+static inline void storage_engine_serve(struct storage_engine *engine, int main_sock);
+static inline int storage_engine_client(struct storage_engine *engine, int client_sock, char *command_line, size_t length);
+static inline void storage_engine_handoff(struct storage_engine *engine, int main_sock, int client_sock, char *buffer);
+static inline void storage_engine_ufile(struct storage_engine *engine, int main_sock, char *filename, char *dest_path, long long size);
+static inline void storage_engine_dfile(struct storage_engine *engine, int main_sock, char *filename);
+static inline void storage_engine_rmfile(struct storage_engine *engine, int main_sock, char *filename);
+static inline void storage_engine_dtar(struct storage_engine *engine, int main_sock, char *filetype);
+static inline void storage_engine_display(struct storage_engine *engine, int main_sock, char *pathname);
+static inline void storage_engine_setup_store(struct storage_engine *engine);
+static inline void storage_engine_setup_tiers(struct storage_engine *engine);
+static inline char *storage_engine_key(const char *folder, const char *name);
+static inline void storage_engine_not_found(int main_sock, char *filename);
+static inline void storage_engine_bloom(struct storage_engine *engine, int main_sock);
+static inline const char *storage_engine_home();
+static inline void storage_engine_list(struct storage_engine *engine, int main_sock);
+static inline void storage_engine_list_visit(const char *path, void *argument);
+static inline void storage_engine_page(struct storage_engine *engine, int main_sock, char *folder, char *cursor);
+static inline int storage_engine_match(const char *name, void *argument);
+static inline int storage_engine_open(struct storage_engine *engine, char *filename, struct stat *info);
+static inline void storage_engine_fetch(struct storage_engine *engine, int main_sock, char *filename);
+static inline void storage_engine_ring(struct storage_engine *engine, int main_sock, int *passed, char *buffer);
+static inline void storage_engine_store(struct storage_engine *engine, int main_sock, char *filename, char *size_text);
+static inline void storage_engine_delta(struct storage_engine *engine, int main_sock, char *filename, char *dest_path);
+static inline void storage_engine_version(struct storage_engine *engine, int main_sock, char *filename);
+static inline void storage_engine_index(struct storage_engine *engine, int main_sock, char *count_text, char *length_text);
+
+// this function fills engine for the tier of extension in ~/folder, served at address and port
+static inline void storage_engine_init(struct storage_engine *engine, const char *name, const char *address, int port, const char *folder, const char *extension)
+{
+    memset(engine, 0, sizeof(*engine));
+    engine->name = name;
+    engine->address = address;
+    engine->port = port;
+    engine->folder = folder;
+    engine->extension = extension;
+    engine->store_fd = -1;
+    engine->cold_seconds = TIERING_DEFAULT_COLD_SECONDS;
+    engine->tcp_sock = -1;
+    engine->local_sock = -1;
+}
+// this function opens the storage folder, builds its membership filter and starts moving cold files away
+// it is called once before any connection is served, so every forked child shares the filter and the tiers
+static inline void storage_engine_setup(struct storage_engine *engine)
+{
+    storage_engine_setup_store(engine);
+    storage_engine_setup_tiers(engine);
+}
+// this function binds the TCP port of the server and opens its unix socket, returns 0 or -1 when the port cannot be used
+// a unix socket which cannot be opened only leaves smain on this host going through TCP
+static inline int storage_engine_listen(struct storage_engine *engine)
+{
+    // structure for server address
+    struct sockaddr_in server_addr;
+    // make socket connection
+    if ((engine->tcp_sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+    {
+        perror("Socket failed");
+        return -1;
+    }
+    // set up server address
+    // ipv4 address family
+    server_addr.sin_family = AF_INET;
+    // this converts the port number from host byte order to network byte order
+    server_addr.sin_port = htons(engine->port);
+    // this function converts the IP address from text to binary form and stores it in sin_addr structure
+    if (inet_pton(AF_INET, engine->address, &server_addr.sin_addr) <= 0)
+    {
+        perror("The given IP address is invalid");
+        close(engine->tcp_sock);
+        engine->tcp_sock = -1;
+        return -1;
+    }
+    // bind the server socket and listen for the incoming commands, smain connects once for every client it serves at the same time
+    if (bind(engine->tcp_sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0 || listen(engine->tcp_sock, SOMAXCONN) < 0)
+    {
+        perror("Failure of bind due to");
+        close(engine->tcp_sock);
+        engine->tcp_sock = -1;
+        return -1;
+    }
+    engine->local_sock = local_transport_listen(engine->address, engine->port, SOMAXCONN);
+    if (engine->local_sock < 0)
+    {
+        perror("Unix socket not opened, only TCP is served");
+    }
+    return 0;
+}
+// this function accepts connections on the sockets of storage_engine_listen() and serves each of them in a forked child,
+// the connections are served at the same time like the clients of smain, it only returns when accepting failed
+static inline void storage_engine_run(struct storage_engine *engine)
+{
+    int main_sock;
+    // go into infinite loop of accept to accept commands from client
+    while ((main_sock = local_transport_accept(engine->tcp_sock, engine->local_sock)) >= 0)
+    {
+        printf("New client connected to %s\n", engine->name);
+        // fork to handle the client commands
+        if (fork() == 0)
+        {
+            close(engine->tcp_sock);
+            if (engine->local_sock >= 0)
+            {
+                close(engine->local_sock);
+            }
+            storage_engine_serve(engine, main_sock); // using handle client do the needful actions
+            close(main_sock);
+            exit(0);
+        }
+        else
+        {
+            close(main_sock);
+            // one after the other a download would wait for every download before it, only the children which are done are collected here
+            while (waitpid(-1, NULL, WNOHANG) > 0)
+                ;
+        }
+    }
+    perror("Accept failed");
+}
+// function storage_engine_split_path is to get filename from the path passeed to this function
+// ignore all folders which are given in path and just save filename to target_file_name
+static inline void storage_engine_split_path(const char *full_path, char *folder_name, char *target_file_name)
+{
+    // Find the last occurrence of the '/' char
+    const char *last_slash = strrchr(full_path, '/');
+    // If a slash was found, separate the folder and file names
+    if (last_slash != NULL)
+    {
+        // Copy the folder name (including the slash)
+        size_t folder_len = last_slash - full_path + 1;
+        strncpy(folder_name, full_path, folder_len);
+        folder_name[folder_len] = '\0';
+        // Copy the file name
+        strcpy(target_file_name, last_slash + 1);
+    }
+    else
+    {
+        // If no slash is found, treat the entire path as a file name
+        strcpy(folder_name, "");
+        strcpy(target_file_name, full_path);
+    }
+}
+// this function handles the client commands
+static inline void storage_engine_serve(struct storage_engine *engine, int main_sock)
+{
+    char buffer[STORAGE_ENGINE_BUFFER_SIZE];
+    // to store incoming data from client
+    // buffers to store command and arguements from the user
+    char command[STORAGE_ENGINE_BUFFER_SIZE];
+    char arg1[STORAGE_ENGINE_BUFFER_SIZE], arg2[STORAGE_ENGINE_BUFFER_SIZE];
+    // connection of a client which smain handed over with the command, or the descriptors of a shared memory ring
+    int passed[LOCAL_TRANSPORT_MAX_FDS];
+    while (1)
+    {
+        // memset is used to clear the contents of buffer, command, arg1, and arg2
+        // to ensure they are empty before each new read operation
+        memset(buffer, 0, STORAGE_ENGINE_BUFFER_SIZE);
+        memset(command, 0, STORAGE_ENGINE_BUFFER_SIZE);
+        memset(arg1, 0, STORAGE_ENGINE_BUFFER_SIZE);
+        memset(arg2, 0, STORAGE_ENGINE_BUFFER_SIZE);
+        // Receive from client, smain may attach the connection of its own client over the unix socket
+        // a command is one byte shorter than the buffer, so the zero which ends it always fits behind it
+        int recv_len = local_transport_recv(main_sock, buffer, STORAGE_ENGINE_BUFFER_SIZE - 1, passed);
+        if (recv_len <= 0)
+        {
+            perror("recv failed"); // if failed print this
+            break;
+        }
+        // Null-terminate the buffer
+        buffer[recv_len] = '\0';
+        sscanf(buffer, "%s %s %s", command, arg1, arg2);
+        // compare the command and accordingly invoke the functions
+        if (strcmp(command, LOCAL_TRANSPORT_HANDOFF) == 0)
+        {
+            // only the first descriptor is a client connection
+            int client_sock = passed[0];
+            passed[0] = -1;
+            local_transport_close_fds(passed);
+            storage_engine_handoff(engine, main_sock, client_sock, buffer);
+            continue;
+        }
+        if (strcmp(command, SHM_RING_COMMAND) == 0)
+        {
+            storage_engine_ring(engine, main_sock, passed, buffer);
+            continue;
+        }
+        // descriptors attached to any other command are not used
+        local_transport_close_fds(passed);
+        if (strcmp(command, "ufile") == 0)
+        {
+            storage_engine_ufile(engine, main_sock, arg1, arg2, dfs_protocol_upload_size(buffer, sizeof(buffer)));
+        }
+        else if (strcmp(command, "dfile") == 0)
+        {
+            storage_engine_dfile(engine, main_sock, arg1);
+        }
+        else if (strcmp(command, "rmfile") == 0)
+        {
+            storage_engine_rmfile(engine, main_sock, arg1);
+        }
+        else if (strcmp(command, "dtar") == 0)
+        {
+            storage_engine_dtar(engine, main_sock, arg1);
+        }
+        else if (strcmp(command, "display") == 0)
+        {
+            storage_engine_display(engine, main_sock, arg1);
+        }
+        // smain asks for the membership filter of this server
+        else if (strcmp(command, "bloom") == 0)
+        {
+            storage_engine_bloom(engine, main_sock);
+        }
+        // smain's rebalancer lists, copies out and copies in files which belong to another server now
+        else if (strcmp(command, "list") == 0)
+        {
+            storage_engine_list(engine, main_sock);
+        }
+        // smain asks for one sorted page of a folder
+        else if (strcmp(command, "page") == 0)
+        {
+            storage_engine_page(engine, main_sock, arg1, arg2);
+        }
+        else if (strcmp(command, "fetch") == 0)
+        {
+            storage_engine_fetch(engine, main_sock, arg1);
+        }
+        else if (strcmp(command, "store") == 0)
+        {
+            storage_engine_store(engine, main_sock, arg1, arg2);
+        }
+        // smain asks whether a client's cached copy of a file is still current
+        else if (strcmp(command, FILE_VERSION_COMMAND) == 0)
+        {
+            storage_engine_version(engine, main_sock, arg1);
+        }
+        // smain asks for size, time, hash and tier of many files at once
+        else if (strcmp(command, FILE_STAT_INDEX) == 0)
+        {
+            storage_engine_index(engine, main_sock, arg1, arg2);
+        }
+        // a changed file whose old version is stored here, only the changes come in
+        else if (strcmp(command, DELTA_COMMAND) == 0)
+        {
+            storage_engine_delta(engine, main_sock, arg1, arg2);
+        }
+        else
+        {
+            char *msg = "Invalid command\n";
+            send(main_sock, msg, strlen(msg), 0);
+        }
+    }
+}
+// this function serves the dfile or ufile in command_line of a client straight on client_sock and leaves it open
+// smain calls it for an engine it runs itself, a standalone server for a connection handed over by smain
+// command_line is length bytes long, an upload command gives the size of its file behind its words
+// returns 0, or -1 for any other command, client_sock was not touched then
+static inline int storage_engine_client(struct storage_engine *engine, int client_sock, char *command_line, size_t length)
+{
+    char command[STORAGE_ENGINE_BUFFER_SIZE], arg1[STORAGE_ENGINE_BUFFER_SIZE], arg2[STORAGE_ENGINE_BUFFER_SIZE];
+    int fields = sscanf(command_line, "%1023s %1023s %1023s", command, arg1, arg2);
+    if (fields >= 2 && strcmp(command, "dfile") == 0)
+    {
+        storage_engine_dfile(engine, client_sock, arg1);
+    }
+    else if (fields == 3 && strcmp(command, "ufile") == 0)
+    {
+        storage_engine_ufile(engine, client_sock, arg1, arg2, dfs_protocol_upload_size(command_line, length));
+    }
+    else
+    {
+        return -1;
+    }
+    return 0;
+}
+// this function serves a dfile or ufile whose client connection smain handed over as client_sock
+// the file goes straight between the disk and the client, smain is told on main_sock when the connection is its own again
+static inline void storage_engine_handoff(struct storage_engine *engine, int main_sock, int client_sock, char *buffer)
+{
+    // the command of the client follows the word handoff
+    size_t skipped = strcspn(buffer, " ");
+    if (client_sock < 0 || storage_engine_client(engine, client_sock, buffer + skipped, STORAGE_ENGINE_BUFFER_SIZE - skipped) != 0)
+    {
+        if (client_sock >= 0)
+        {
+            close(client_sock);
+        }
+        send(main_sock, LOCAL_TRANSPORT_HANDOFF_REFUSED, strlen(LOCAL_TRANSPORT_HANDOFF_REFUSED), 0);
+        return;
+    }
+    close(client_sock);
+    send(main_sock, LOCAL_TRANSPORT_HANDOFF_DONE, strlen(LOCAL_TRANSPORT_HANDOFF_DONE), 0);
+}
+// function manage_upload_file_to_server is to perform ufile
+// size is the size of the file given in the command, the byte which ends a file on a short chunk is not stored, -1 keeps every byte
+static inline void storage_engine_ufile(struct storage_engine *engine, int main_sock, char *filename, char *dest_path, long long size)
+{
+    // initializing all required variables
+    // the messages hold the whole path, which is longer than one command
+    char file_path[STORAGE_ENGINE_BUFFER_SIZE * 4];
+    FILE *file;
+    char response[STORAGE_ENGINE_BUFFER_SIZE * 5];
+    char file_buffer[STORAGE_ENGINE_BUFFER_SIZE];
+    int bytes_received;
+    long long received = 0;
+    // folder_name tis to store all folders string
+    char folder_name[1024];
+    // base_filena is to store the end file name
+    char base_filename[1024];
+    // only fetch file name and ignore any directory path
+    storage_engine_split_path(filename, folder_name, base_filename);
+    // file_path is only used for messages now
+    snprintf(file_path, sizeof(file_path), "%s/%s/%s/%s", storage_engine_home(), engine->folder, dest_path, base_filename);
+    // the destination folder is opened relative to the storage folder and created if it doesn't exist
+    // try to create a new file first, only a path which was not stored before is added to the membership filter
+    int file_fd = path_resolver_open_file(&engine->store_dirs, dest_path, base_filename, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (file_fd >= 0)
+    {
+        char *key = storage_engine_key(dest_path, base_filename);
+        if (key != NULL && engine->stored_paths != NULL)
+        {
+            membership_filter_add(engine->stored_paths, key);
+        }
+        free(key);
+    }
+    else if (errno == EEXIST)
+    {
+        file_fd = path_resolver_open_file(&engine->store_dirs, dest_path, base_filename, O_WRONLY | O_TRUNC, 0644);
+        // the new content replaces a stub as well, its cold copy is not needed anymore
+        char *key = file_fd >= 0 ? storage_engine_key(dest_path, base_filename) : NULL;
+        if (key != NULL)
+        {
+            tiering_forget(&engine->tiers, key);
+        }
+        free(key);
+    }
+    file = file_fd >= 0 ? fdopen(file_fd, "wb") : NULL;
+    // if no document found then
+    if (file == NULL)
+    {
+        // return this message to client using send()
+        snprintf(response, sizeof(response), "Failed to open file %s for writing\n", file_path);
+        send(main_sock, response, strlen(response), 0);
+        return;
+    }
+    // Receive file data from the client
+    printf("Receiving file: %s\n", file_path);
+    // start reading this file from client and then wait for recieving this data
+    // file will be read in chunks
+    // recv() will ensure to wait for the send() call from client
+    while ((bytes_received = recv(main_sock, file_buffer, sizeof(file_buffer), 0)) > 0)
+    {
+        printf("Received %d bytes\n", bytes_received);
+        // fwrite to wrrite the content in new file name - file_string_storage
+        fwrite(file_buffer, 1, dfs_protocol_file_part(size, received, bytes_received), file);
+        received += bytes_received;
+        if (bytes_received < sizeof(file_buffer))
+        {
+            printf("End of file detected\n");
+            break; // End of file
+        }
+    }
+    // on success scan this response and send it to client to state that new file at destinated location has been created and content has been added
+    snprintf(response, sizeof(response), "File %s uploaded successfully\n", filename);
+    send(main_sock, response, strlen(response), 0);
+    fclose(file);
+}
+// function manage_download_file_to_serverfor dfile comamd
+static inline void storage_engine_dfile(struct storage_engine *engine, int main_sock, char *filename)
+{
+    // initializing all required variables
+    char file_path[STORAGE_ENGINE_BUFFER_SIZE];
+    int file;
+    char response[STORAGE_ENGINE_BUFFER_SIZE];
+    // a path the membership filter has never seen is not stored here, no need to touch the disk
+    char *key = storage_engine_key("", filename);
+    if (key == NULL || (engine->stored_paths != NULL && !membership_filter_may_contain(engine->stored_paths, key)))
+    {
+        free(key);
+        storage_engine_not_found(main_sock, filename);
+        return;
+    }
+    //// construct the folder path- document_location -  on the server
+    snprintf(file_path, sizeof(file_path), "%s/%s/%s", storage_engine_home(), engine->folder, filename);
+    printf("File to be uploaded from: %s\n", file_path);
+    // open file with only read access, a file in the cold tier is brought back first
+    file = tiering_open(&engine->tiers, key);
+    free(key);
+    if (file < 0)
+    {
+        perror("Failed to open file");
+        storage_engine_not_found(main_sock, filename);
+        return;
+    }
+    // the read engine picks pread(), mmap() or O_DIRECT depending on the size of the file and on the page cache
+    struct stat info = {0};
+    if (fstat(file, &info) != 0 || read_engine_send_file(file, info.st_size, main_sock) != 0)
+    {
+        perror("send file");
+    }
+    // the receiver waits for a chunk shorter than its buffer, so a file ending on a full chunk gets one more byte
+    else if (info.st_size % STORAGE_ENGINE_BUFFER_SIZE == 0)
+    {
+        send(main_sock, "", 1, 0);
+    }
+    close(file);
+    sleep(5);
+    // the size tells the client whether the last byte was padding
+    snprintf(response, sizeof(response), "File %s uploaded successfully" DFS_PROTOCOL_FILE_SIZE "\n", filename, (long long)info.st_size);
+    send(main_sock, response, strlen(response), 0); // send the response to the client
+}
+// function manage_remove_file_from_server for rmfile comamd
+static inline void storage_engine_rmfile(struct storage_engine *engine, int main_sock, char *filename)
+{
+    char response[STORAGE_ENGINE_BUFFER_SIZE];
+    char file_path[STORAGE_ENGINE_BUFFER_SIZE];
+    // build document_location out of HOME, docuemnt_name given by client
+    snprintf(file_path, sizeof(file_path), "%s/%s/%s", storage_engine_home(), engine->folder, filename);
+    // a path the membership filter has never seen is answered as not found without touching the disk
+    char *key = storage_engine_key("", filename);
+    int known = key != NULL && (engine->stored_paths == NULL || membership_filter_may_contain(engine->stored_paths, key));
+    if (!known || remove(file_path) < 0) // run remove() operation on it
+    {
+        // send() successfull message to client
+        snprintf(response, sizeof(response), "File %s not found..\n", filename);
+        send(main_sock, response, strlen(response), 0);
+    }
+    else
+    {
+        // send() successfull message to client
+        snprintf(response, sizeof(response), "File %s deleted successfully.\n", filename);
+        send(main_sock, response, strlen(response), 0);
+        // the path is not stored anymore
+        if (engine->stored_paths != NULL)
+        {
+            membership_filter_remove(engine->stored_paths, key);
+        }
+        tiering_forget(&engine->tiers, key);
+    }
+    free(key);
+}
+// this function handles the dtar command of the project
+// this takes in the socket desc of the client and the type of file we want to tar
+static inline void storage_engine_dtar(struct storage_engine *engine, int main_sock, char *filetype)
+{
+    // this is a buffer string to add content into it from any file
+    char tar_command[STORAGE_ENGINE_BUFFER_SIZE];
+    FILE *tar_file;
+    // this compares the agruement we have put to the extension of this server and  if it is true then we enter the if statement
+    if (strcmp(filetype, engine->extension) == 0)
+    {
+        // tar reads the files itself, so the cold ones are brought back first
+        tiering_promote_all(&engine->tiers, storage_engine_match, engine);
+        snprintf(tar_command, sizeof(tar_command), "find ~/%s -name '*%s' | tar -cvf textfiles.tar -T -", engine->folder, engine->extension);
+        system(tar_command);
+        tar_file = fopen("textfiles.tar", "rb");
+    }
+    else
+    {
+        char *msg = "Unsupported file type\n";
+        send(main_sock, msg, strlen(msg), 0);
+        return;
+    }
+    // open tar file
+    if (!tar_file)
+    {
+        perror("Failed to open tar file");
+        return;
+    }
+    fclose(tar_file);
+}
+// handles the display commmand
+static inline void storage_engine_display(struct storage_engine *engine, int main_sock, char *pathname)
+{
+    char buffer[STORAGE_ENGINE_BUFFER_SIZE];
+    char line[STORAGE_ENGINE_BUFFER_SIZE];
+    char command[STORAGE_ENGINE_BUFFER_SIZE];
+    FILE *pipe;
+    // Construct the full path
+    size_t prefix = snprintf(command, sizeof(command), "%s/%s/%s", storage_engine_home(), engine->folder, pathname);
+    // Check if the directory exists
+    struct stat st;
+    if (stat(command, &st) != 0 || !S_ISDIR(st.st_mode))
+    {
+        // If the directory does not exist or is not a directory, return an empty response
+        snprintf(buffer, sizeof(buffer), "DIRECTORY_NOT_FOUND\n%s", STORAGE_ENGINE_END_OF_LIST); // Send an empty string
+        send(main_sock, buffer, strlen(buffer), 0);
+        return;
+    }
+    // Construct the command to find the files of this server's extension in the specified directory
+    snprintf(command, sizeof(command), "find %s/%s/%s -type f -name '*%s'", storage_engine_home(), engine->folder, pathname, engine->extension);
+    pipe = popen(command, "r"); // craete and open pipe
+    if (!pipe)
+    {
+        perror("popen failed");
+        send(main_sock, STORAGE_ENGINE_END_OF_LIST, strlen(STORAGE_ENGINE_END_OF_LIST), 0);
+        return;
+    }
+    // Read the list of files and send it to the client
+    // every file goes out with its path below pathname, smain tells the same name in two folders apart by it
+    while (fgets(line, sizeof(line), pipe) != NULL)
+    {
+        line[strcspn(line, "\n")] = 0; // Remove newline char
+        char *filename = strlen(line) > prefix ? line + prefix : line;
+        filename += strspn(filename, "/");
+        snprintf(buffer, sizeof(buffer), "%s\n", filename);
+        send(main_sock, buffer, strlen(buffer), 0);
+    }
+    pclose(pipe);
+    // smain reads the names as they come and stops at STORAGE_ENGINE_END_OF_LIST
+    send(main_sock, STORAGE_ENGINE_END_OF_LIST, strlen(STORAGE_ENGINE_END_OF_LIST), 0);
+}
+// makes sure the storage folder exists and opens it for the path resolver
+static inline void storage_engine_setup_store(struct storage_engine *engine)
+{
+    char store_path[STORAGE_ENGINE_BUFFER_SIZE];
+    snprintf(store_path, sizeof(store_path), "%s/%s", storage_engine_home(), engine->folder);
+    if (mkdir(store_path, 0755) != 0 && errno != EEXIST)
+    {
+        perror("mkdir storage folder");
+    }
+    engine->store_fd = open(store_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (engine->store_fd < 0)
+    {
+        perror("Failed to open storage folder");
+    }
+    path_resolver_init(&engine->store_dirs, engine->store_fd);
+    // the membership filter starts with every file already stored, later uploads and removals keep it up to date
+    engine->stored_paths = membership_filter_create();
+    if (engine->stored_paths == NULL)
+    {
+        perror("Membership filter disabled, mmap failed");
+    }
+    else if (engine->store_fd >= 0)
+    {
+        membership_filter_load_tree(engine->stored_paths, engine->store_fd);
+    }
+}
+// opens the cold folder and starts the process which moves files there
+static inline void storage_engine_setup_tiers(struct storage_engine *engine)
+{
+    char cold_path[STORAGE_ENGINE_BUFFER_SIZE];
+    if (engine->cold_folder != NULL)
+    {
+        snprintf(cold_path, sizeof(cold_path), "%s", engine->cold_folder);
+    }
+    else
+    {
+        snprintf(cold_path, sizeof(cold_path), "%s/%s-cold", storage_engine_home(), engine->folder);
+    }
+    if (tiering_setup(&engine->tiers, engine->store_fd, cold_path, engine->cold_seconds) != 0)
+    {
+        perror("Tiering disabled, cold folder cannot be used");
+        return;
+    }
+    if (engine->tiers.table != NULL)
+    {
+        printf("Files not read for %lld seconds move to %s\n", engine->cold_seconds, cold_path);
+        tiering_start(&engine->tiers);
+    }
+}
+// builds the key of a stored file: folder and name joined and cleaned like the path resolver does
+// returns an allocated string, or NULL for a path outside the storage folder
+static inline char *storage_engine_key(const char *folder, const char *name)
+{
+    char joined[STORAGE_ENGINE_BUFFER_SIZE * 2];
+    snprintf(joined, sizeof(joined), "%s/%s", folder, name);
+    return path_resolver_clean(joined);
+}
+// tells smain that filename is not stored here, in one message so it can be recognised and passed on as it is
+static inline void storage_engine_not_found(int main_sock, char *filename)
+{
+    char response[STORAGE_ENGINE_BUFFER_SIZE];
+    snprintf(response, sizeof(response), "%sFile %s not found.\n", STORAGE_ENGINE_NOT_FOUND, filename);
+    send(main_sock, response, strlen(response), 0);
+}
+// sends the membership filter to smain as "BLOOM <bytes>\n" followed by the bits
+static inline void storage_engine_bloom(struct storage_engine *engine, int main_sock)
+{
+    char header[STORAGE_ENGINE_BUFFER_SIZE];
+    unsigned char *bits = malloc(MEMBERSHIP_FILTER_BYTES);
+    // without a filter smain gets an empty answer and keeps asking us about every file
+    if (engine->stored_paths == NULL || bits == NULL)
+    {
+        send(main_sock, "BLOOM 0\n", strlen("BLOOM 0\n"), 0);
+        free(bits);
+        return;
+    }
+    membership_filter_export(engine->stored_paths, bits);
+    snprintf(header, sizeof(header), "BLOOM %lu\n", (unsigned long)MEMBERSHIP_FILTER_BYTES);
+    send(main_sock, header, strlen(header), 0);
+    for (size_t sent = 0; sent < MEMBERSHIP_FILTER_BYTES;)
+    {
+        ssize_t written = send(main_sock, bits + sent, MEMBERSHIP_FILTER_BYTES - sent, 0);
+        if (written <= 0)
+        {
+            perror("send membership filter");
+            break;
+        }
+        sent += written;
+    }
+    free(bits);
+}
+// returns the path
+static inline const char *storage_engine_home()
+{
+    return getenv("HOME");
+}
+// sends the path of every stored file, one per line, and STORAGE_ENGINE_END_OF_LIST at the end
+static inline void storage_engine_list(struct storage_engine *engine, int main_sock)
+{
+    // the names are written through a stdio stream so that they leave in big packets
+    int list_sock = dup(main_sock);
+    FILE *out = list_sock >= 0 ? fdopen(list_sock, "w") : NULL;
+    if (out == NULL)
+    {
+        perror("list");
+        if (list_sock >= 0)
+        {
+            close(list_sock);
+        }
+        send(main_sock, STORAGE_ENGINE_END_OF_LIST, strlen(STORAGE_ENGINE_END_OF_LIST), 0);
+        return;
+    }
+    path_resolver_walk(&engine->store_dirs, storage_engine_list_visit, out);
+    fputs(STORAGE_ENGINE_END_OF_LIST, out);
+    fclose(out);
+}
+// called for every stored file by storage_engine_list, half written copies of the rebalancer are left out
+static inline void storage_engine_list_visit(const char *path, void *argument)
+{
+    const char *last_slash = strrchr(path, '/');
+    const char *name = last_slash != NULL ? last_slash + 1 : path;
+    if (strncmp(name, STORAGE_ENGINE_TEMP_PREFIX, strlen(STORAGE_ENGINE_TEMP_PREFIX)) != 0 && strncmp(name, TIERING_TEMP_PREFIX, strlen(TIERING_TEMP_PREFIX)) != 0)
+    {
+        fprintf((FILE *)argument, "%s\n", path);
+    }
+}
+// sends the files of folder after cursor, one "path size mtime" line each, MORE when another page follows and STORAGE_ENGINE_END_OF_LIST
+static inline void storage_engine_page(struct storage_engine *engine, int main_sock, char *folder, char *cursor)
+{
+    char after[STORAGE_ENGINE_BUFFER_SIZE];
+    struct listing_page page;
+    int page_sock = dup(main_sock);
+    FILE *out = page_sock >= 0 ? fdopen(page_sock, "w") : NULL;
+    if (out == NULL)
+    {
+        perror("page");
+        if (page_sock >= 0)
+        {
+            close(page_sock);
+        }
+        send(main_sock, STORAGE_ENGINE_END_OF_LIST, strlen(STORAGE_ENGINE_END_OF_LIST), 0);
+        return;
+    }
+    // a folder which is not here has an empty page
+    int folder_fd = listing_cursor_decode(cursor, after, sizeof(after)) == 0 ? listing_page_open_folder(engine->store_fd, folder) : -1;
+    if (folder_fd >= 0)
+    {
+        listing_page_collect(&page, folder_fd, after, storage_engine_match, engine);
+        // a file in the cold tier is listed with its own size and time and not with those of its stub
+        for (int i = 0; i < page.count; i++)
+        {
+            int file = page.entries[i].size <= TIERING_STUB_MAXIMUM ? openat(folder_fd, page.entries[i].path, O_RDONLY | O_CLOEXEC) : -1;
+            long long size = file >= 0 ? tiering_stub_size(file, &page.entries[i].mtime) : -1;
+            if (size >= 0)
+            {
+                page.entries[i].size = size;
+            }
+            if (file >= 0)
+            {
+                close(file);
+            }
+        }
+        listing_page_write(&page, out);
+        if (page.more)
+        {
+            fputs(LISTING_MORE, out);
+        }
+        listing_page_free(&page);
+        close(folder_fd);
+    }
+    fputs(STORAGE_ENGINE_END_OF_LIST, out);
+    fclose(out);
+}
+// files of this server's extension are listed, like display does
+static inline int storage_engine_match(const char *name, void *argument)
+{
+    struct storage_engine *engine = argument;
+    size_t length = strlen(name);
+    size_t extension_length = strlen(engine->extension);
+    return length >= extension_length && strcmp(name + length - extension_length, engine->extension) == 0;
+}
+// opens the stored file filename for reading and fills info, returns the descriptor or -1 when it is not stored
+static inline int storage_engine_open(struct storage_engine *engine, char *filename, struct stat *info)
+{
+    char *key = storage_engine_key("", filename);
+    if (key == NULL || (engine->stored_paths != NULL && !membership_filter_may_contain(engine->stored_paths, key)))
+    {
+        free(key);
+        return -1;
+    }
+    int file = tiering_open(&engine->tiers, key);
+    free(key);
+    if (file >= 0 && fstat(file, info) != 0)
+    {
+        close(file);
+        return -1;
+    }
+    return file;
+}
+// sends "SIZE <bytes>\n" and the content of filename, or the not found message
+static inline void storage_engine_fetch(struct storage_engine *engine, int main_sock, char *filename)
+{
+    char header[STORAGE_ENGINE_BUFFER_SIZE];
+    struct stat info;
+    int file = storage_engine_open(engine, filename, &info);
+    if (file < 0)
+    {
+        storage_engine_not_found(main_sock, filename);
+        return;
+    }
+    snprintf(header, sizeof(header), "SIZE %lld\n", (long long)info.st_size);
+    send(main_sock, header, strlen(header), 0);
+    if (read_engine_send_file(file, info.st_size, main_sock) != 0)
+    {
+        perror("fetch");
+    }
+    close(file);
+}
+// "ring fetch <file>" from smain on this host, passed holds the memfd and the two eventfds of a shared memory ring
+// answers like fetch but reads the file into the ring instead of sending it over main_sock
+static inline void storage_engine_ring(struct storage_engine *engine, int main_sock, int *passed, char *buffer)
+{
+    char command[STORAGE_ENGINE_BUFFER_SIZE], filename[STORAGE_ENGINE_BUFFER_SIZE], header[STORAGE_ENGINE_BUFFER_SIZE];
+    struct stat info;
+    struct shm_ring ring;
+    if (passed[2] < 0 || sscanf(buffer, "%*s %1023s %1023s", command, filename) != 2 || strcmp(command, "fetch") != 0)
+    {
+        local_transport_close_fds(passed);
+        send(main_sock, SHM_RING_REFUSED, strlen(SHM_RING_REFUSED), 0);
+        return;
+    }
+    // the ring owns the descriptors from here on, even when it cannot be mapped
+    if (shm_ring_attach(&ring, passed[0], passed[1], passed[2]) != 0)
+    {
+        send(main_sock, SHM_RING_REFUSED, strlen(SHM_RING_REFUSED), 0);
+        return;
+    }
+    int file = storage_engine_open(engine, filename, &info);
+    if (file < 0)
+    {
+        shm_ring_destroy(&ring);
+        storage_engine_not_found(main_sock, filename);
+        return;
+    }
+    snprintf(header, sizeof(header), "SIZE %lld\n", (long long)info.st_size);
+    send(main_sock, header, strlen(header), 0);
+    // smain stops reading when the size was not reached, closing the ring early is enough to tell it
+    if (shm_ring_fill_from_file(&ring, file, info.st_size, SHM_RING_TIMEOUT_MS) != 0)
+    {
+        perror("ring");
+    }
+    shm_ring_close(&ring);
+    shm_ring_destroy(&ring);
+    close(file);
+}
+// stores size_text bytes under filename but never replaces a file which is already there
+// answers EXISTS right away, or READY and then STORED or FAILED once the bytes have arrived
+static inline void storage_engine_store(struct storage_engine *engine, int main_sock, char *filename, char *size_text)
+{
+    char buffer[STORAGE_ENGINE_BUFFER_SIZE];
+    char temp_name[64];
+    long long size = atoll(size_text);
+    int owned = 0;
+    int stored = 0;
+    char *key = storage_engine_key("", filename);
+    // split the key into its folder and its name
+    char *last_slash = key != NULL ? strrchr(key, '/') : NULL;
+    char *name = last_slash != NULL ? last_slash + 1 : key;
+    if (last_slash != NULL)
+    {
+        *last_slash = '\0';
+    }
+    int dir_fd = key != NULL && size >= 0 ? path_resolver_open_dir(&engine->store_dirs, last_slash != NULL ? key : "", &owned) : -1;
+    if (dir_fd < 0)
+    {
+        send(main_sock, "FAILED\n", strlen("FAILED\n"), 0);
+        free(key);
+        return;
+    }
+    // a file uploaded by a client in the meantime is newer than the copy of the rebalancer
+    if (faccessat(dir_fd, name, F_OK, AT_SYMLINK_NOFOLLOW) == 0)
+    {
+        send(main_sock, "EXISTS\n", strlen("EXISTS\n"), 0);
+    }
+    else
+    {
+        snprintf(temp_name, sizeof(temp_name), "%s%d.tmp", STORAGE_ENGINE_TEMP_PREFIX, getpid());
+        int file = openat(dir_fd, temp_name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        const char *reply = file >= 0 ? "READY\n" : "FAILED\n";
+        send(main_sock, reply, strlen(reply), 0);
+        long long received = 0;
+        while (file >= 0 && received < size)
+        {
+            ssize_t got = recv(main_sock, buffer, size - received < (long long)sizeof(buffer) ? size - received : (long long)sizeof(buffer), 0);
+            if (got <= 0 || write(file, buffer, got) != got)
+            {
+                break;
+            }
+            received += got;
+        }
+        if (file >= 0)
+        {
+            int exists = 0;
+            close(file);
+            // linkat() fails with EEXIST when a client created the file meanwhile, that one is kept
+            if (received == size)
+            {
+                stored = linkat(dir_fd, temp_name, dir_fd, name, 0) == 0;
+                exists = !stored && errno == EEXIST;
+            }
+            unlinkat(dir_fd, temp_name, 0);
+            reply = stored ? "STORED\n" : (exists ? "EXISTS\n" : "FAILED\n");
+            send(main_sock, reply, strlen(reply), 0);
+        }
+    }
+    if (stored && engine->stored_paths != NULL)
+    {
+        // the key is joined again for the filter
+        if (last_slash != NULL)
+        {
+            *last_slash = '/';
+        }
+        membership_filter_add(engine->stored_paths, key);
+    }
+    if (owned)
+    {
+        close(dir_fd);
+    }
+    free(key);
+}
+
+// "delta <file> <folder>": the stored copy of folder/<name of file> is replaced by its new version, built from the blocks
+// of the copy and the changed bytes the client sends (delta_transfer.h), files which are not stored get DELTA_NONE
+static inline void storage_engine_delta(struct storage_engine *engine, int main_sock, char *filename, char *dest_path)
+{
+    char response[STORAGE_ENGINE_BUFFER_SIZE * 2];
+    char folder_name[STORAGE_ENGINE_BUFFER_SIZE];
+    char base_filename[STORAGE_ENGINE_BUFFER_SIZE];
+    int owned = 0;
+    storage_engine_split_path(filename, folder_name, base_filename);
+    char *key = storage_engine_key(dest_path, base_filename);
+    // a file in the cold tier is brought back, the new version is built from the blocks of the whole file
+    int old_file = key != NULL && (engine->stored_paths == NULL || membership_filter_may_contain(engine->stored_paths, key)) ? tiering_open(&engine->tiers, key) : -1;
+    int dir_fd = old_file >= 0 ? path_resolver_open_dir(&engine->store_dirs, dest_path, &owned) : -1;
+    if (dir_fd < 0)
+    {
+        if (old_file >= 0)
+        {
+            close(old_file);
+        }
+        free(key);
+        send(main_sock, DELTA_NONE, strlen(DELTA_NONE), 0);
+        return;
+    }
+    printf("Receiving changes of: %s\n", key);
+    if (delta_receive(main_sock, dir_fd, base_filename, old_file) == 0)
+    {
+        // the new version replaced a file which may have had a cold copy, that one is old now
+        tiering_forget(&engine->tiers, key);
+        snprintf(response, sizeof(response), "File %s uploaded successfully\n", filename);
+    }
+    else
+    {
+        snprintf(response, sizeof(response), "Changes of %s could not be applied, the stored file is unchanged\n", filename);
+    }
+    send(main_sock, response, strlen(response), 0);
+    close(old_file);
+    if (owned)
+    {
+        close(dir_fd);
+    }
+    free(key);
+}
+
+// sends "VERSION <version>\n" of filename (file_version.h), or the not found message, the file itself is not read
+static inline void storage_engine_version(struct storage_engine *engine, int main_sock, char *filename)
+{
+    char version[FILE_VERSION_SIZE];
+    char reply[FILE_VERSION_SIZE * 2];
+    char *key = storage_engine_key("", filename);
+    if (key == NULL || (engine->stored_paths != NULL && !membership_filter_may_contain(engine->stored_paths, key)) ||
+        file_version_of(engine->store_fd, key, version, sizeof(version)) != 0)
+    {
+        free(key);
+        storage_engine_not_found(main_sock, filename);
+        return;
+    }
+    free(key);
+    snprintf(reply, sizeof(reply), "%s %s\n", FILE_VERSION_REPLY, version);
+    send(main_sock, reply, strlen(reply), 0);
+}
+// this function answers an index request for count keys in length bytes with one line per key (file_stat.h)
+// the membership filter answers for most keys which are not here without a look at the disk
+static inline void storage_engine_index(struct storage_engine *engine, int main_sock, char *count_text, char *length_text)
+{
+    char **keys;
+    long long count = atoll(count_text);
+    char *body = file_stat_read_keys(main_sock, count, atoll(length_text), &keys);
+    int index_sock = body != NULL ? dup(main_sock) : -1;
+    FILE *out = index_sock >= 0 ? fdopen(index_sock, "w") : NULL;
+    if (out == NULL)
+    {
+        if (index_sock >= 0)
+        {
+            close(index_sock);
+        }
+        if (body != NULL)
+        {
+            perror("index");
+            send(main_sock, STORAGE_ENGINE_END_OF_LIST, strlen(STORAGE_ENGINE_END_OF_LIST), 0);
+        }
+        free(body);
+        free(keys);
+        return;
+    }
+    for (long long i = 0; i < count; i++)
+    {
+        struct file_stat stat;
+        char *key = storage_engine_key("", keys[i]);
+        int found = key != NULL && (engine->stored_paths == NULL || membership_filter_may_contain(engine->stored_paths, key)) &&
+                    file_stat_of(engine->store_fd, key, &stat) == 0;
+        file_stat_write(out, found ? &stat : NULL);
+        free(key);
+    }
+    fputs(STORAGE_ENGINE_END_OF_LIST, out);
+    fclose(out);
+    free(body);
+    free(keys);
+}
+
+#endif
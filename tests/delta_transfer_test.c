@@ -0,0 +1,107 @@
+// delta_transfer.h: the rolling weak checksum matches the one computed from scratch, and a delta upload over a
+// socket pair turns the stored copy into the new version while only the changed bytes travel as literals
+#include "test_check.h"
+#include <sys/wait.h>
+#include "delta_transfer.h"
+
+// this function checks that rolling the weak checksum one byte on gives the checksum of the moved window
+static void test_rolling(void)
+{
+    unsigned char data[8192];
+    size_t block = DELTA_BLOCK_MINIMUM;
+    test_random_bytes(data, sizeof(data));
+    uint32_t weak = delta_weak(data, block);
+    for (size_t position = 1; position + block <= sizeof(data); position++)
+    {
+        weak = delta_roll(weak, block, data[position - 1], data[position + block - 1]);
+        if (weak != delta_weak(data + position, block))
+        {
+            TEST_CHECK(0, "rolled checksum differs at %zu", position);
+            return;
+        }
+    }
+}
+
+// client side of the upload, run in a child: reads the signature and sends the delta of the new version
+// it exits with 0 when the delta was sent and was smaller than limit bytes
+static int test_client(int sock, const unsigned char *data, long long size, long long limit)
+{
+    char line[256];
+    struct delta_signature signature;
+    long long sent = 0;
+    if (delta_recv_line(sock, line, sizeof(line)) != 0 || delta_read_signature(sock, line, &signature) != 0 ||
+        delta_send_changes(sock, data, size, &signature, &sent) != 0)
+    {
+        return 2;
+    }
+    delta_free_signature(&signature);
+    return sent < limit ? 0 : 1;
+}
+
+// this function stores old as the copy on the server and sends new_data as a delta against it
+// limit is the most bytes the delta may take, the stored copy has to be new_data afterwards
+static void test_round_trip(const char *label, const unsigned char *old, long long old_size, const unsigned char *new_data, long long new_size, long long limit)
+{
+    char folder[256], path[512];
+    int socks[2];
+    TEST_CHECK(test_make_folder(folder, sizeof(folder), "delta_transfer_test") == 0, "no folder for %s", label);
+    snprintf(path, sizeof(path), "%s/stored", folder);
+    int old_file = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    TEST_CHECK(old_file >= 0 && write(old_file, old, old_size) == old_size, "%s: stored copy not written", label);
+    int dir_fd = open(folder, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    TEST_CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, socks) == 0, "%s: no socket pair", label);
+    pid_t client = fork();
+    if (client == 0)
+    {
+        close(socks[0]);
+        _exit(test_client(socks[1], new_data, new_size, limit));
+    }
+    close(socks[1]);
+    int result = delta_receive(socks[0], dir_fd, "stored", old_file);
+    int status = -1;
+    waitpid(client, &status, 0);
+    close(socks[0]);
+    close(old_file);
+    TEST_CHECK(result == 0, "%s: the new version was not taken", label);
+    TEST_CHECK(WIFEXITED(status) && WEXITSTATUS(status) != 2, "%s: the client failed", label);
+    TEST_CHECK(WIFEXITED(status) && WEXITSTATUS(status) != 1, "%s: the delta was not smaller than %lld bytes", label, limit);
+    // the stored copy is the new version now, and nothing was left next to it
+    unsigned char *back = malloc(new_size + 1);
+    int stored = open(path, O_RDONLY | O_CLOEXEC);
+    TEST_CHECK(back != NULL && stored >= 0 && pread(stored, back, new_size + 1, 0) == new_size && memcmp(back, new_data, new_size) == 0,
+               "%s: the stored copy is not the new version", label);
+    free(back);
+    close(stored);
+    snprintf(path, sizeof(path), "%s/%s%d.tmp", folder, DELTA_TEMP_PREFIX, getpid());
+    TEST_CHECK(access(path, F_OK) != 0, "%s: the temporary file was left behind", label);
+    close(dir_fd);
+    test_remove_folder(folder);
+}
+
+int main(void)
+{
+    long long size = 1000000;
+    unsigned char *old = malloc(size);
+    unsigned char *changed = malloc(size + 100);
+    test_rolling();
+    test_random_bytes(old, size);
+    // the same file again costs the copies of its blocks and the bytes after the last whole block
+    test_round_trip("unchanged", old, size, old, size, 4096);
+    // a few bytes changed in the middle and some inserted near the start cost about one block each
+    memcpy(changed, old, 5000);
+    memcpy(changed + 5000, "inserted bytes", 14);
+    memcpy(changed + 5014, old + 5000, size - 5000);
+    memset(changed + 600000, 0, 10);
+    test_round_trip("edited", old, size, changed, size + 14, 16 * 1024);
+    // a file cut short keeps its front
+    test_round_trip("truncated", old, size, old, size / 2, 4096);
+    // nothing in common, every byte goes as a literal
+    test_random_bytes(changed, 50000);
+    test_round_trip("replaced", old, size, changed, 50000, 50000 + 1024);
+    // an empty stored copy has no blocks at all
+    test_round_trip("from empty", old, 0, changed, 50000, 50000 + 1024);
+    test_round_trip("to empty", old, size, changed, 0, 64);
+    free(old);
+    free(changed);
+    return test_finish("delta_transfer");
+}
@@ -0,0 +1,186 @@
+// erasure_code.h: the vector code multiplies like the plain one, every loss of up to m chunks of a stripe is rebuilt,
+// and a file written into shard files is read back whole with up to m of them gone or damaged
+#include "test_check.h"
+#include <fcntl.h>
+#include "erasure_code.h"
+
+#define TEST_LENGTH 1000
+
+// this function checks erasure_region_mul_add() and the vector code the cpu has against the plain table lookup
+static void test_regions(void)
+{
+    unsigned char src[TEST_LENGTH + 64], start[TEST_LENGTH + 64], plain[TEST_LENGTH + 64], other[TEST_LENGTH + 64];
+    erasure_gf_init();
+    for (int c = 0; c < 256; c++)
+    {
+        // lengths which are not a multiple of the vector width, so the tail loops are used too
+        size_t length = TEST_LENGTH + c % 37;
+        test_random_bytes(src, length);
+        test_random_bytes(start, length);
+        memcpy(plain, start, length);
+        erasure_region_plain(plain, src, (unsigned char)c, length);
+        memcpy(other, start, length);
+        erasure_region_mul_add(other, src, (unsigned char)c, length);
+        TEST_CHECK(memcmp(plain, other, length) == 0, "region kind %d differs for c %d", erasure_region_kind, c);
+#if ERASURE_CODE_X86
+        if (__builtin_cpu_supports("ssse3"))
+        {
+            memcpy(other, start, length);
+            erasure_region_ssse3(other, src, (unsigned char)c, length);
+            TEST_CHECK(memcmp(plain, other, length) == 0, "ssse3 differs for c %d", c);
+        }
+        if (__builtin_cpu_supports("avx2"))
+        {
+            memcpy(other, start, length);
+            erasure_region_avx2(other, src, (unsigned char)c, length);
+            TEST_CHECK(memcmp(plain, other, length) == 0, "avx2 differs for c %d", c);
+        }
+#endif
+    }
+}
+
+// this function encodes one stripe of data + parity chunks and rebuilds it for every set of at most parity lost chunks
+static void test_stripe(int data, int parity)
+{
+    int shards = data + parity;
+    static unsigned char stripe[ERASURE_MAX_SHARDS][TEST_LENGTH], expected[ERASURE_MAX_SHARDS][TEST_LENGTH];
+    unsigned char *chunks[ERASURE_MAX_SHARDS];
+    struct erasure_code code;
+    TEST_CHECK(erasure_code_init(&code, data, parity) == 0, "%d + %d does not fit", data, parity);
+    for (int i = 0; i < shards; i++)
+    {
+        chunks[i] = stripe[i];
+    }
+    for (int j = 0; j < data; j++)
+    {
+        test_random_bytes(stripe[j], TEST_LENGTH);
+    }
+    erasure_code_encode(&code, chunks, TEST_LENGTH);
+    memcpy(expected, stripe, sizeof(stripe));
+    int patterns = 0;
+    for (unsigned int lost = 0; lost < (1u << shards); lost++)
+    {
+        int present[ERASURE_MAX_SHARDS];
+        int count = __builtin_popcount(lost);
+        if (count > parity + 1)
+        {
+            continue;
+        }
+        for (int i = 0; i < shards; i++)
+        {
+            present[i] = !(lost >> i & 1);
+            if (!present[i])
+            {
+                memset(stripe[i], 0x5a, TEST_LENGTH);
+            }
+        }
+        int result = erasure_code_reconstruct(&code, chunks, present, TEST_LENGTH);
+        if (count <= parity)
+        {
+            TEST_CHECK(result == 0 && memcmp(stripe, expected, (size_t)data * TEST_LENGTH) == 0,
+                       "%d + %d: lost chunks %#x not rebuilt", data, parity, lost);
+            patterns++;
+        }
+        else
+        {
+            TEST_CHECK(result == -1, "%d + %d: %d lost chunks were taken for enough", data, parity, count);
+        }
+        memcpy(stripe, expected, sizeof(stripe));
+    }
+    TEST_CHECK(patterns > 0, "no pattern was tried");
+}
+
+// this function opens shard file i of the test in folder
+static int test_open_shard(const char *folder, int i, int flags)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s/shard%d", folder, i);
+    return open(path, flags | O_CLOEXEC, 0644);
+}
+
+// this function reads the file back from its shards and returns 1 when it came back as content
+static int test_read_back(const char *folder, int shards, const unsigned char *content, size_t size)
+{
+    char path[512];
+    int fds[ERASURE_MAX_SHARDS];
+    struct erasure_reader reader;
+    for (int i = 0; i < shards; i++)
+    {
+        fds[i] = test_open_shard(folder, i, O_RDONLY);
+    }
+    snprintf(path, sizeof(path), "%s/out", folder);
+    int out = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    int same = erasure_reader_open(&reader, fds, shards) == 0 && erasure_reader_copy(&reader, out) == 0;
+    erasure_reader_close(&reader);
+    unsigned char *back = malloc(size + 1);
+    same = same && back != NULL && pread(out, back, size + 1, 0) == (ssize_t)size && memcmp(back, content, size) == 0;
+    free(back);
+    close(out);
+    return same;
+}
+
+// this function writes a file of size bytes into data + parity shard files, loses parity of them (the first
+// ones, which are data shards) and damages one byte of another, and reads it back
+static void test_shard_files(int data, int parity, size_t size)
+{
+    char folder[256];
+    int shards = data + parity;
+    int fds[ERASURE_MAX_SHARDS];
+    struct erasure_writer writer;
+    unsigned char *content = malloc(size + 1);
+    TEST_CHECK(content != NULL && test_make_folder(folder, sizeof(folder), "erasure_code_test") == 0, "no room for the test");
+    if (content == NULL)
+    {
+        return;
+    }
+    test_random_bytes(content, size);
+    for (int i = 0; i < shards; i++)
+    {
+        fds[i] = test_open_shard(folder, i, O_RDWR | O_CREAT | O_TRUNC);
+    }
+    TEST_CHECK(erasure_writer_open(&writer, data, parity, fds) == 0, "writer of %d + %d not opened", data, parity);
+    // written in uneven pieces, the writer gathers them into stripes
+    for (size_t offset = 0; offset < size;)
+    {
+        size_t piece = size - offset < 7777 ? size - offset : 7777;
+        erasure_writer_write(&writer, content + offset, piece);
+        offset += piece;
+    }
+    TEST_CHECK(erasure_writer_close(&writer) == shards, "not every shard of %zu bytes was written", size);
+    TEST_CHECK(test_read_back(folder, shards, content, size), "%zu bytes did not come back from all shards", size);
+    for (int i = 0; i < parity; i++)
+    {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/shard%d", folder, i);
+        unlink(path);
+    }
+    TEST_CHECK(parity == 0 || test_read_back(folder, shards, content, size), "%zu bytes did not come back without %d shards", size, parity);
+    // one more broken chunk is one more than the code can take, unless that chunk is in the part read
+    if (parity > 0 && size > 0)
+    {
+        int fd = test_open_shard(folder, parity, O_RDWR);
+        unsigned char byte = 0;
+        TEST_CHECK(pread(fd, &byte, 1, ERASURE_HEADER_SIZE) == 1, "shard %d is empty", parity);
+        byte ^= 0xff;
+        TEST_CHECK(pwrite(fd, &byte, 1, ERASURE_HEADER_SIZE) == 1, "shard %d not damaged", parity);
+        close(fd);
+        TEST_CHECK(!test_read_back(folder, shards, content, size), "%zu bytes came back from too few good shards", size);
+    }
+    test_remove_folder(folder);
+    free(content);
+}
+
+int main(void)
+{
+    test_regions();
+    test_stripe(4, 2);
+    test_stripe(6, 3);
+    test_stripe(10, 4);
+    test_stripe(1, 1);
+    test_shard_files(4, 2, 0);
+    test_shard_files(4, 2, 1);
+    test_shard_files(4, 2, 4 * ERASURE_CHUNK_SIZE);
+    test_shard_files(4, 2, 3 * 4 * ERASURE_CHUNK_SIZE + 12345);
+    test_shard_files(3, 1, 100003);
+    return test_finish("erasure_code");
+}
@@ -0,0 +1,153 @@
+// listing_page.h: pages of two servers of a replicated pool, merged like smain does it, list every file of the folder
+// once and in order when the cursor of one page is handed back for the next, and cursors survive the round trip
+#include "test_check.h"
+#include "listing_page.h"
+
+#define TEST_SERVERS 2
+// files of the first server, the second has the upper half of them and as many of its own
+#define TEST_FILES 700
+
+// only .txt files are listed, like a server only lists the extensions of its pool
+static int test_match(const char *name, void *argument)
+{
+    size_t length = strlen(name);
+    (*(int *)argument)++;
+    return length > 4 && strcmp(name + length - 4, ".txt") == 0;
+}
+
+// this function writes the name of file i, files are spread over a few folders
+static void test_file_name(int i, char *name, size_t name_size)
+{
+    snprintf(name, name_size, "f%d/file%04d.txt", i % 5, i);
+}
+
+static void test_create(const char *server, int i)
+{
+    char name[64], path[512];
+    test_file_name(i, name, sizeof(name));
+    snprintf(path, sizeof(path), "%s/f%d", server, i % 5);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/%s", server, name);
+    FILE *file = fopen(path, "w");
+    TEST_CHECK(file != NULL, "%s not created", path);
+    if (file != NULL)
+    {
+        fprintf(file, "%d", i);
+        fclose(file);
+    }
+}
+
+static int test_path_compare(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// this function checks that pages of the servers below folder list exactly the files named in expected, in order
+static void test_pages(char servers[TEST_SERVERS][512], char **expected, int expected_count)
+{
+    char after[512] = "", cursor[1100];
+    int listed = 0, pages = 0, visited = 0;
+    static struct listing_page page;
+    struct listing_entry *collected = malloc(TEST_SERVERS * LISTING_PAGE_SIZE * sizeof(struct listing_entry));
+    for (int more = 1; more && pages <= expected_count / LISTING_PAGE_SIZE + 1; pages++)
+    {
+        int count = 0;
+        more = 0;
+        // every server gives its smallest paths after the cursor
+        for (int s = 0; s < TEST_SERVERS; s++)
+        {
+            int folder_fd = open(servers[s], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            TEST_CHECK(folder_fd >= 0, "folder %s not opened", servers[s]);
+            listing_page_collect(&page, folder_fd, after, test_match, &visited);
+            close(folder_fd);
+            for (int i = 1; i < page.count; i++)
+            {
+                TEST_CHECK(strcmp(page.entries[i - 1].path, page.entries[i].path) < 0, "page of server %d out of order", s);
+            }
+            memcpy(collected + count, page.entries, page.count * sizeof(struct listing_entry));
+            count += page.count;
+            more |= page.more;
+        }
+        int unique = listing_page_merge(collected, count);
+        more |= unique > LISTING_PAGE_SIZE;
+        int sent = unique < LISTING_PAGE_SIZE ? unique : LISTING_PAGE_SIZE;
+        for (int i = 0; i < sent; i++, listed++)
+        {
+            TEST_CHECK(listed < expected_count && strcmp(collected[i].path, expected[listed]) == 0, "file %d of the listing is %s", listed, collected[i].path);
+        }
+        // the cursor goes out to the client and comes back with the next request
+        TEST_CHECK(sent == 0 || listing_cursor_encode(collected[sent - 1].path, cursor, sizeof(cursor)) == 0, "no cursor after page %d", pages);
+        TEST_CHECK(listing_cursor_decode(sent > 0 ? cursor : LISTING_FIRST_CURSOR, after, sizeof(after)) == 0, "cursor of page %d not read", pages);
+        for (int i = 0; i < unique; i++)
+        {
+            free(collected[i].path);
+        }
+    }
+    TEST_CHECK(listed == expected_count, "%d of %d files listed in %d pages", listed, expected_count, pages);
+    TEST_CHECK(visited > 0, "the match was never asked");
+    free(collected);
+}
+
+// this function checks cursors of odd paths, and that cursors which were not made by encode are refused
+static void test_cursors(void)
+{
+    const char *paths[] = {"", "a", "f1/a b.txt", "\xff\x01/\x7f", "f1/f2/f3/deep.txt"};
+    char cursor[256], path[128];
+    for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); i++)
+    {
+        TEST_CHECK(listing_cursor_encode(paths[i], cursor, sizeof(cursor)) == 0 && strchr(cursor, ' ') == NULL, "cursor of path %zu not made", i);
+        TEST_CHECK(listing_cursor_decode(cursor, path, sizeof(path)) == 0 && strcmp(path, paths[i]) == 0, "cursor of path %zu comes back as %s", i, path);
+    }
+    TEST_CHECK(listing_cursor_encode("abc", cursor, 6) == -1, "a cursor too long for its buffer was made");
+    TEST_CHECK(listing_cursor_decode("6", path, sizeof(path)) == -1, "a cursor of odd length was taken");
+    TEST_CHECK(listing_cursor_decode("6g", path, sizeof(path)) == -1, "a cursor with a bad digit was taken");
+    TEST_CHECK(listing_cursor_decode("6100", path, sizeof(path)) == -1, "a cursor with a zero byte was taken");
+    TEST_CHECK(listing_cursor_decode("616263", path, 3) == -1, "a cursor too long for the path was taken");
+}
+
+int main(void)
+{
+    char folder[256];
+    char servers[TEST_SERVERS][512];
+    char *expected[2 * TEST_FILES];
+    int expected_count = 0;
+    test_cursors();
+    TEST_CHECK(test_make_folder(folder, sizeof(folder), "listing_page_test") == 0, "no folder for the test");
+    for (int s = 0; s < TEST_SERVERS; s++)
+    {
+        snprintf(servers[s], sizeof(servers[s]), "%s/server%d", folder, s);
+        mkdir(servers[s], 0755);
+    }
+    // the first server has files 0 to TEST_FILES - 1, the second from TEST_FILES / 2 on, half of them are on both
+    for (int i = 0; i < TEST_FILES + TEST_FILES / 2; i++)
+    {
+        char name[64];
+        if (i < TEST_FILES)
+        {
+            test_create(servers[0], i);
+        }
+        if (i >= TEST_FILES / 2)
+        {
+            test_create(servers[1], i);
+        }
+        test_file_name(i, name, sizeof(name));
+        expected[expected_count++] = strdup(name);
+    }
+    // files of other types are left out
+    char other[600];
+    snprintf(other, sizeof(other), "%s/f1/other.c", servers[0]);
+    FILE *file = fopen(other, "w");
+    TEST_CHECK(file != NULL, "%s not created", other);
+    if (file != NULL)
+    {
+        fclose(file);
+    }
+    qsort(expected, expected_count, sizeof(expected[0]), test_path_compare);
+    test_pages(servers, expected, expected_count);
+    for (int i = 0; i < expected_count; i++)
+    {
+        free(expected[i]);
+    }
+    test_remove_folder(folder);
+    return test_finish("listing_page");
+}
@@ -0,0 +1,132 @@
+// membership_filter.h: a key which was added and not removed is always found, in the counters, in the exported bits
+// and after a walk of the storage folder, and removing keys lets the filter forget most of them again
+#include "test_check.h"
+#include "membership_filter.h"
+
+#define TEST_KEYS 20000
+
+static void test_key(int i, char *key, size_t key_size)
+{
+    snprintf(key, key_size, "f%d/f%d/file%d.txt", i % 7, i % 13, i);
+}
+
+// this function adds TEST_KEYS keys, removes every other one and checks what the filter still says about them
+static void test_add_remove(struct membership_filter *filter)
+{
+    char key[64];
+    int kept_missing = 0, removed_found = 0, others_found = 0;
+    for (int i = 0; i < TEST_KEYS; i++)
+    {
+        test_key(i, key, sizeof(key));
+        membership_filter_add(filter, key);
+    }
+    for (int i = 0; i < TEST_KEYS; i += 2)
+    {
+        test_key(i, key, sizeof(key));
+        membership_filter_remove(filter, key);
+    }
+    for (int i = 0; i < TEST_KEYS; i++)
+    {
+        test_key(i, key, sizeof(key));
+        if (i % 2 == 1)
+        {
+            kept_missing += !membership_filter_may_contain(filter, key);
+        }
+        else
+        {
+            removed_found += membership_filter_may_contain(filter, key);
+        }
+        // keys which were never added
+        test_key(TEST_KEYS + i, key, sizeof(key));
+        others_found += membership_filter_may_contain(filter, key);
+    }
+    TEST_CHECK(kept_missing == 0, "%d kept keys are said to be missing", kept_missing);
+    // far fewer keys than the filter is made for, so only a few of them may collide
+    TEST_CHECK(removed_found < TEST_KEYS / 200, "%d of %d removed keys are still found", removed_found, TEST_KEYS / 2);
+    TEST_CHECK(others_found < TEST_KEYS / 100, "%d of %d keys never added are found", others_found, TEST_KEYS);
+
+    // the bit copy smain keeps says the same as the counters it was made from
+    unsigned char *bits = malloc(MEMBERSHIP_FILTER_BYTES);
+    int differ = 0;
+    membership_filter_export(filter, bits);
+    for (int i = 0; i < 2 * TEST_KEYS; i++)
+    {
+        test_key(i, key, sizeof(key));
+        differ += membership_bits_may_contain(bits, key) != membership_filter_may_contain(filter, key);
+    }
+    TEST_CHECK(differ == 0, "the exported bits differ from the counters for %d keys", differ);
+    // a key smain sets in its copy after an upload is found there
+    unsigned int h1, h2;
+    membership_filter_hash("new/upload.txt", &h1, &h2);
+    membership_bits_set(bits, h1, h2);
+    TEST_CHECK(membership_bits_may_contain(bits, "new/upload.txt"), "a key set in the bits is not found");
+    free(bits);
+}
+
+// this function checks that a counter which got stuck at its highest value never lets a key which is still there go
+static void test_stuck(struct membership_filter *filter)
+{
+    for (int i = 0; i < MEMBERSHIP_FILTER_STUCK + 45; i++)
+    {
+        membership_filter_add(filter, "busy/key.txt");
+    }
+    for (int i = 0; i < MEMBERSHIP_FILTER_STUCK + 44; i++)
+    {
+        membership_filter_remove(filter, "busy/key.txt");
+    }
+    TEST_CHECK(membership_filter_may_contain(filter, "busy/key.txt"), "a key added once more than removed is missing");
+}
+
+// this function checks that loading a storage folder finds every file below it, by its path from the folder
+static void test_load_tree(void)
+{
+    char folder[256], path[512], key[64];
+    struct membership_filter *filter = membership_filter_create();
+    TEST_CHECK(filter != NULL && test_make_folder(folder, sizeof(folder), "membership_filter_test") == 0, "no room for the test");
+    if (filter == NULL)
+    {
+        return;
+    }
+    for (int i = 0; i < 200; i++)
+    {
+        snprintf(path, sizeof(path), "%s/f%d", folder, i % 7);
+        mkdir(path, 0755);
+        snprintf(path, sizeof(path), "%s/f%d/f%d", folder, i % 7, i % 13);
+        mkdir(path, 0755);
+        test_key(i, key, sizeof(key));
+        snprintf(path, sizeof(path), "%s/%s", folder, key);
+        FILE *file = fopen(path, "w");
+        TEST_CHECK(file != NULL, "%s not created", path);
+        if (file != NULL)
+        {
+            fclose(file);
+        }
+    }
+    int root_fd = open(folder, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    membership_filter_load_tree(filter, root_fd);
+    close(root_fd);
+    int missing = 0;
+    for (int i = 0; i < 200; i++)
+    {
+        test_key(i, key, sizeof(key));
+        missing += !membership_filter_may_contain(filter, key);
+    }
+    TEST_CHECK(missing == 0, "%d stored files are missing after the walk", missing);
+    munmap(filter, sizeof(*filter));
+    test_remove_folder(folder);
+}
+
+int main(void)
+{
+    struct membership_filter *filter = membership_filter_create();
+    TEST_CHECK(filter != NULL, "filter not created");
+    if (filter == NULL)
+    {
+        return test_finish("membership_filter");
+    }
+    test_add_remove(filter);
+    test_stuck(filter);
+    munmap(filter, sizeof(*filter));
+    test_load_tree();
+    return test_finish("membership_filter");
+}
@@ -0,0 +1,149 @@
+// round trip of files which end on a full chunk through a running smain, with the client library (dfs_client.h)
+// such a file is sent with one more byte to end on a short chunk, that byte must not be stored or handed back
+// every file is uploaded into the folder padding_test of smain and downloaded again, for each file type given
+// it is a manual integration check and not part of "make check", smain, stext and spdf have to be running
+//
+//   make integration                                   (or make integration SERVER="ip port [extension...]")
+//   ./padding_round_trip [ip port [extension...]]      (default 127.0.0.1 8053 .c .txt .pdf)
+//
+// it prints one line per file and exits with 1 when any file came back different
+#include "dfs_client.h"
+
+#define TEST_FOLDER "padding_test"
+
+struct test_file
+{
+    const char *name;
+    long long size;
+    // the last byte is a zero byte, like the padding, so it must come back
+    int zero_last;
+};
+
+static const struct test_file test_files[] = {
+    {"empty", 0, 0},
+    {"one_chunk", DFS_PROTOCOL_CHUNK, 0},
+    {"two_chunks", 2 * DFS_PROTOCOL_CHUNK, 0},
+    {"one_byte", 1, 0},
+    {"chunk_and_zero", DFS_PROTOCOL_CHUNK + 1, 1},
+};
+#define TEST_FILES (sizeof(test_files) / sizeof(test_files[0]))
+
+// this function fills content with the bytes of file
+static void test_content(const struct test_file *file, char *content)
+{
+    for (long long i = 0; i < file->size; i++)
+    {
+        content[i] = 'a' + i % 26;
+    }
+    if (file->zero_last && file->size > 0)
+    {
+        content[file->size - 1] = 0;
+    }
+}
+
+// this function writes size bytes of content to path, it returns 0 or -1
+static int test_write(const char *path, const char *content, long long size)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int written = fd >= 0 && write(fd, content, size) == size;
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    return written ? 0 : -1;
+}
+
+// this function returns 1 when path holds exactly size bytes of content
+static int test_same(const char *path, const char *content, long long size)
+{
+    char got[2 * DFS_PROTOCOL_CHUNK + 2];
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return 0;
+    }
+    ssize_t length = read(fd, got, sizeof(got));
+    close(fd);
+    return length == size && memcmp(got, content, size) == 0;
+}
+
+// this function runs every operation of client to its end and returns how many of them did not end with DFS_CLIENT_DONE
+static int test_run(struct dfs_client *client, struct dfs_client_operation **operations, int count, const char *what)
+{
+    int failed = 0;
+    while (dfs_client_poll(client, -1) > 0)
+        ;
+    for (int i = 0; i < count; i++)
+    {
+        if (operations[i] == NULL || operations[i]->result != DFS_CLIENT_DONE)
+        {
+            printf("%s %d failed: %s", what, i, operations[i] != NULL ? operations[i]->reply : "no memory\n");
+            failed++;
+        }
+    }
+    return failed;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *ip = argc > 2 ? argv[1] : "127.0.0.1";
+    int port = argc > 2 ? atoi(argv[2]) : 8053;
+    const char *default_extensions[] = {".c", ".txt", ".pdf"};
+    const char **extensions = argc > 3 ? (const char **)argv + 3 : default_extensions;
+    int extension_count = argc > 3 ? argc - 3 : 3;
+    int count = extension_count * TEST_FILES;
+    char content[TEST_FILES][2 * DFS_PROTOCOL_CHUNK + 1];
+    char local[64][128], stored[64][256], back[64][128];
+    struct dfs_client_operation *operations[64];
+    struct dfs_client client;
+    int failed = 0;
+    if (count > 64 || dfs_client_init(&client, ip, port, DFS_CLIENT_CONNECTIONS) != 0)
+    {
+        fprintf(stderr, "usage: %s [ip port [extension...]]\n", argv[0]);
+        return 2;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        const struct test_file *file = &test_files[i % TEST_FILES];
+        test_content(file, content[i % TEST_FILES]);
+        snprintf(local[i], sizeof(local[i]), "%s%s", file->name, extensions[i / TEST_FILES]);
+        snprintf(stored[i], sizeof(stored[i]), TEST_FOLDER "/%s", local[i]);
+        snprintf(back[i], sizeof(back[i]), "back_%s", local[i]);
+        if (test_write(local[i], content[i % TEST_FILES], file->size) != 0)
+        {
+            perror(local[i]);
+            return 2;
+        }
+        // half of the files go up from the disk, the other half through a write handle
+        if (i % 2 == 0)
+        {
+            operations[i] = dfs_client_upload(&client, local[i], TEST_FOLDER, NULL, NULL);
+        }
+        else
+        {
+            operations[i] = dfs_client_open_write(&client, local[i], TEST_FOLDER, i % 4 == 1 ? file->size : -1, NULL, NULL);
+            if (operations[i] != NULL)
+            {
+                dfs_client_write(operations[i], content[i % TEST_FILES], file->size);
+                dfs_client_close_write(operations[i]);
+            }
+        }
+    }
+    failed += test_run(&client, operations, count, "upload");
+    for (int i = 0; i < count; i++)
+    {
+        operations[i] = dfs_client_download(&client, stored[i], back[i], NULL, NULL);
+    }
+    failed += test_run(&client, operations, count, "download");
+    for (int i = 0; i < count; i++)
+    {
+        const struct test_file *file = &test_files[i % TEST_FILES];
+        int same = test_same(back[i], content[i % TEST_FILES], file->size);
+        printf("%-24s %5lld bytes  %s\n", local[i], file->size, same ? "ok" : "DIFFERENT");
+        failed += !same;
+        unlink(local[i]);
+        unlink(back[i]);
+    }
+    dfs_client_destroy(&client);
+    return failed > 0 ? 1 : 0;
+}
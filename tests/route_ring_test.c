@@ -0,0 +1,85 @@
+// route_ring.h: keys land on the same servers every time the ring is built, whatever the order of the backend lines,
+// they spread evenly, and a server added to a pool only takes keys for itself and about its share of them
+#include "test_check.h"
+#include "route_ring.h"
+
+#define TEST_KEYS 20000
+#define TEST_MAX_SERVERS 8
+
+static const int test_ports[TEST_MAX_SERVERS] = {8052, 8053, 8054, 8055, 8056, 8057, 8058, 8059};
+
+// this function builds the ring of the servers of test_ports listed in lines, lines[b] is the port index of backend b
+static int test_build(struct route_ring_point *ring, const int *lines, int servers)
+{
+    int ring_size = 0;
+    for (int b = 0; b < servers; b++)
+    {
+        route_ring_add(ring, &ring_size, "127.0.0.2", test_ports[lines[b]], b);
+    }
+    route_ring_sort(ring, ring_size);
+    return ring_size;
+}
+
+// this function writes the port index of the server key belongs to for every key into owners
+static void test_place(const struct route_ring_point *ring, int ring_size, const int *lines, int servers, int *owners)
+{
+    char key[64];
+    int order[TEST_MAX_SERVERS];
+    for (int i = 0; i < TEST_KEYS; i++)
+    {
+        snprintf(key, sizeof(key), "f%d/a%d.txt", i % 10, i);
+        int count = route_ring_order(ring, ring_size, servers, key, order);
+        TEST_CHECK(count == servers, "%s is placed on %d of %d servers", key, count, servers);
+        // every server shows up once in the order
+        for (int a = 0; a < count; a++)
+        {
+            for (int b = a + 1; b < count; b++)
+            {
+                TEST_CHECK(order[a] != order[b], "%s lists server %d twice", key, order[a]);
+            }
+        }
+        owners[i] = lines[order[0]];
+    }
+}
+
+int main(void)
+{
+    static struct route_ring_point ring[TEST_MAX_SERVERS * ROUTE_VIRTUAL_NODES];
+    static int before[TEST_KEYS], after[TEST_KEYS];
+    const int in_order[TEST_MAX_SERVERS] = {0, 1, 2, 3, 4};
+    const int reordered[TEST_MAX_SERVERS] = {2, 0, 3, 1};
+    const int added[TEST_MAX_SERVERS] = {4, 3, 0, 2, 1};
+    TEST_CHECK(route_hash("f1/a1.txt") == route_hash("f1/a1.txt") && route_hash("f1/a1.txt") != route_hash("f1/a2.txt"),
+               "the hash is not a function of the path");
+
+    // the same servers in another order of lines give every key the same owner
+    int ring_size = test_build(ring, in_order, 4);
+    test_place(ring, ring_size, in_order, 4, before);
+    ring_size = test_build(ring, reordered, 4);
+    test_place(ring, ring_size, reordered, 4, after);
+    int differ = 0;
+    int load[TEST_MAX_SERVERS] = {0};
+    for (int i = 0; i < TEST_KEYS; i++)
+    {
+        differ += before[i] != after[i];
+        load[before[i]]++;
+    }
+    TEST_CHECK(differ == 0, "%d keys moved when the backend lines were reordered", differ);
+    for (int s = 0; s < 4; s++)
+    {
+        TEST_CHECK(load[s] > TEST_KEYS / 4 * 7 / 10 && load[s] < TEST_KEYS / 4 * 13 / 10, "server %d has %d of %d keys", s, load[s], TEST_KEYS);
+    }
+
+    // a fifth server, listed first, only takes keys for itself and about a fifth of them
+    ring_size = test_build(ring, added, 5);
+    test_place(ring, ring_size, added, 5, after);
+    int moved = 0, elsewhere = 0;
+    for (int i = 0; i < TEST_KEYS; i++)
+    {
+        moved += before[i] != after[i];
+        elsewhere += before[i] != after[i] && after[i] != 4;
+    }
+    TEST_CHECK(elsewhere == 0, "%d keys moved between the old servers", elsewhere);
+    TEST_CHECK(moved > TEST_KEYS / 10 && moved < TEST_KEYS * 3 / 10, "%d of %d keys moved to the new server", moved, TEST_KEYS);
+    return test_finish("route_ring");
+}
@@ -0,0 +1,98 @@
+// shm_ring.h: a producer process streams a file through a ring much smaller than the file, so the ring wraps around
+// many times, and the consumer gets every byte once and in order, the end of the file included
+#include "test_check.h"
+#include <fcntl.h>
+#include <sys/wait.h>
+#include "shm_ring.h"
+
+#define TEST_RING_BYTES 4096
+
+// this function checks the room the ring offers without a second process, the free bytes stop at the end of the memory
+static void test_offsets(void)
+{
+    struct shm_ring ring;
+    unsigned char *space;
+    const unsigned char *data;
+    TEST_CHECK(shm_ring_create(&ring, TEST_RING_BYTES) == 0, "ring not created");
+    TEST_CHECK(shm_ring_reserve(&ring, &space, 0) == TEST_RING_BYTES && space == ring.data, "an empty ring is not free");
+    shm_ring_commit(&ring, TEST_RING_BYTES - 100);
+    TEST_CHECK(shm_ring_reserve(&ring, &space, 0) == 100, "the room before the end is not offered");
+    TEST_CHECK(shm_ring_peek(&ring, &data, 0) == TEST_RING_BYTES - 100 && data == ring.data, "the bytes are not offered");
+    shm_ring_consume(&ring, TEST_RING_BYTES - 200);
+    // the free bytes wrap around, only the part up to the end of the memory follows each other
+    TEST_CHECK(shm_ring_reserve(&ring, &space, 0) == 100 && space == ring.data + TEST_RING_BYTES - 100, "the room at the end is lost");
+    shm_ring_commit(&ring, 100);
+    TEST_CHECK(shm_ring_reserve(&ring, &space, 0) == TEST_RING_BYTES - 200 && space == ring.data, "the room after the wrap is lost");
+    TEST_CHECK(shm_ring_peek(&ring, &data, 0) == 200 && data == ring.data + TEST_RING_BYTES - 200, "the bytes before the wrap are lost");
+    shm_ring_consume(&ring, 200);
+    TEST_CHECK(shm_ring_peek(&ring, &data, 0) == -1, "an empty ring offers bytes");
+    shm_ring_close(&ring);
+    TEST_CHECK(shm_ring_peek(&ring, &data, 0) == 0, "a closed empty ring does not end");
+    shm_ring_destroy(&ring);
+}
+
+// this function streams size bytes through the ring from a forked producer, which attaches to the ring like a server
+static void test_stream(long long size)
+{
+    char folder[256], path[512];
+    struct shm_ring ring;
+    unsigned char *content = malloc(size > 0 ? size : 1);
+    TEST_CHECK(content != NULL && test_make_folder(folder, sizeof(folder), "shm_ring_test") == 0, "no room for the test");
+    test_random_bytes(content, size);
+    snprintf(path, sizeof(path), "%s/file", folder);
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    TEST_CHECK(fd >= 0 && write(fd, content, size) == size, "file of %lld bytes not written", size);
+    TEST_CHECK(shm_ring_create(&ring, TEST_RING_BYTES) == 0, "ring not created");
+    pid_t producer = fork();
+    if (producer == 0)
+    {
+        struct shm_ring theirs;
+        // the server gets its own descriptors and its own mapping, like over the unix socket
+        if (shm_ring_attach(&theirs, dup(ring.memfd), dup(ring.data_event), dup(ring.space_event)) != 0 ||
+            shm_ring_fill_from_file(&theirs, fd, size, SHM_RING_TIMEOUT_MS) != 0)
+        {
+            _exit(1);
+        }
+        shm_ring_close(&theirs);
+        _exit(0);
+    }
+    long long received = 0;
+    int same = 1;
+    for (;;)
+    {
+        const unsigned char *data;
+        ssize_t ready = shm_ring_peek(&ring, &data, SHM_RING_TIMEOUT_MS);
+        if (ready <= 0)
+        {
+            TEST_CHECK(ready == 0, "the producer stopped after %lld of %lld bytes", received, size);
+            break;
+        }
+        // taken in uneven pieces, so the tail is never where the producer expects it
+        size_t taken = 1000 + received % 7;
+        if (taken > (size_t)ready)
+        {
+            taken = ready;
+        }
+        same = same && received + (long long)taken <= size && memcmp(data, content + received, taken) == 0;
+        received += taken;
+        shm_ring_consume(&ring, taken);
+    }
+    int status = -1;
+    waitpid(producer, &status, 0);
+    TEST_CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0, "the producer failed");
+    TEST_CHECK(same && received == size, "%lld of %lld bytes came through in order", received, size);
+    shm_ring_destroy(&ring);
+    close(fd);
+    test_remove_folder(folder);
+    free(content);
+}
+
+int main(void)
+{
+    test_offsets();
+    test_stream(0);
+    test_stream(1);
+    test_stream(TEST_RING_BYTES);
+    test_stream(1000003);
+    return test_finish("shm_ring");
+}
@@ -0,0 +1,71 @@
+// checks shared by the test programs of the headers, every program runs on its own without any server
+// a failed check prints its line and the program goes on, test_finish() then makes it exit with 1
+#ifndef TEST_CHECK_H
+#define TEST_CHECK_H
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ftw.h>
+
+static int test_failures;
+
+#define TEST_CHECK(condition, ...)                                \
+    do                                                            \
+    {                                                             \
+        if (!(condition))                                         \
+        {                                                         \
+            test_failures++;                                      \
+            fprintf(stderr, "%s:%d: ", __FILE__, __LINE__);       \
+            fprintf(stderr, __VA_ARGS__);                         \
+            fputc('\n', stderr);                                  \
+        }                                                         \
+    } while (0)
+
+// random bytes which are the same in every run, so a failure can be run again
+static unsigned int test_seed = 12345;
+
+static inline unsigned char test_random_byte(void)
+{
+    test_seed = test_seed * 1103515245u + 12345u;
+    return (unsigned char)(test_seed >> 16);
+}
+
+static inline void test_random_bytes(unsigned char *data, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        data[i] = test_random_byte();
+    }
+}
+
+// this function makes an empty folder in /tmp for the files of a test and writes its path into path
+static inline int test_make_folder(char *path, size_t path_size, const char *name)
+{
+    snprintf(path, path_size, "/tmp/%s.XXXXXX", name);
+    return mkdtemp(path) != NULL ? 0 : -1;
+}
+
+static inline int test_remove_entry(const char *path, const struct stat *info, int type, struct FTW *walk)
+{
+    (void)info;
+    (void)type;
+    (void)walk;
+    return remove(path);
+}
+
+// this function removes the folder of a test with everything in it
+static inline void test_remove_folder(const char *path)
+{
+    nftw(path, test_remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+// this function prints the result of the program and returns its exit status
+static inline int test_finish(const char *name)
+{
+    printf("%-20s %s\n", name, test_failures == 0 ? "ok" : "FAILED");
+    return test_failures == 0 ? 0 : 1;
+}
+
+#endif
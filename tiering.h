@@ -0,0 +1,508 @@
+// hot and cold tiers of a storage folder, shared by smain, stext and spdf
+// the storage folder (~/smain, ~/stext, ~/spdf) is the fast tier and should only hold the files which are being read
+// every read is counted in a table in shared memory, so the forked children of a server all feed the same counts
+// a background pass moves files which have not been read for a while into the cold folder, compressed with gzip,
+// and leaves a small stub with the size and the modification time of the file under its name in the fast tier
+// the stub keeps the file in display, page and the membership filter, and a read which opens a stub first
+// brings the file back into the fast tier, so clients never see where a file lives
+// a file read often has to stay unread longer before it goes cold: it needs idle seconds * (1 + its recent reads)
+#ifndef TIERING_H
+#define TIERING_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/xattr.h>
+#include "path_resolver.h"
+
+// number of files whose reads are counted, a file which lost its slot only looks colder than it is
+#define TIERING_SLOTS 65536
+// slots looked at for one file before the least recently read of them is taken over
+#define TIERING_PROBES 8
+// seconds without a read after which a file goes to the cold tier, when the server is not told otherwise
+#define TIERING_DEFAULT_COLD_SECONDS (7 * 24 * 60 * 60)
+// the fast tier is looked over this often, the recent reads of every file are halved at each pass
+#define TIERING_PASS_SECONDS 300
+// smaller files are never moved, a stub would save nothing
+#define TIERING_MINIMUM_SIZE 4096
+// first word of a stub, the rest of the line is the size and the modification time of the cold file
+#define TIERING_STUB_FORMAT "TIERED_COLD %lld %lld\n"
+#define TIERING_STUB_MAXIMUM 64
+// cold files are stored under their path with this added
+#define TIERING_COLD_SUFFIX ".gz"
+// files being moved between the tiers have names starting with this, listings leave them out
+#define TIERING_TEMP_PREFIX ".tiering."
+
+// reads of one file, hash is 0 when the slot is free
+struct tiering_slot
+{
+    unsigned long long hash;
+    volatile long long last_read;
+    volatile unsigned int reads;
+};
+
+// the table lives in shared memory, mapped once before the server forks
+struct tiering_table
+{
+    struct tiering_slot slots[TIERING_SLOTS];
+};
+
+// one storage folder with its cold folder
+struct tiering_store
+{
+    // storage folder, owned by the caller
+    int hot_fd;
+    // cold folder, -1 when tiering is off
+    int cold_fd;
+    // folders of the cold folder which this process has open already
+    struct path_resolver cold_dirs;
+    struct tiering_table *table;
+    long long cold_seconds;
+};
+
+// FNV-1a of the path, never 0 because 0 marks a free slot
+static inline unsigned long long tiering_hash(const char *key)
+{
+    unsigned long long hash = 14695981039346656037ULL;
+    while (*key)
+    {
+        hash ^= (unsigned char)*key++;
+        hash *= 1099511628211ULL;
+    }
+    return hash != 0 ? hash : 1;
+}
+
+// this function opens (and creates) the cold folder cold_path for the storage folder hot_fd and maps the read counts
+// with cold_seconds 0 tiering stays off and every other function does nothing, returns 0 or -1 when tiering could not be turned on
+static inline int tiering_setup(struct tiering_store *store, int hot_fd, const char *cold_path, long long cold_seconds)
+{
+    store->hot_fd = hot_fd;
+    store->cold_fd = -1;
+    store->table = NULL;
+    store->cold_seconds = cold_seconds;
+    if (cold_seconds <= 0 || hot_fd < 0)
+    {
+        return 0;
+    }
+    if (mkdir(cold_path, 0755) != 0 && errno != EEXIST)
+    {
+        return -1;
+    }
+    store->cold_fd = open(cold_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    struct tiering_table *table = store->cold_fd >= 0 ? mmap(NULL, sizeof(*table), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0) : MAP_FAILED;
+    if (table == MAP_FAILED)
+    {
+        if (store->cold_fd >= 0)
+        {
+            close(store->cold_fd);
+            store->cold_fd = -1;
+        }
+        return -1;
+    }
+    store->table = table;
+    path_resolver_init(&store->cold_dirs, store->cold_fd);
+    return 0;
+}
+
+// returns the slot of key, taking over the least recently read slot of its probes when key has none
+static inline struct tiering_slot *tiering_slot_for(struct tiering_table *table, const char *key, int create)
+{
+    unsigned long long hash = tiering_hash(key);
+    struct tiering_slot *victim = NULL;
+    for (int probe = 0; probe < TIERING_PROBES; probe++)
+    {
+        struct tiering_slot *slot = &table->slots[(hash + probe) % TIERING_SLOTS];
+        if (slot->hash == hash)
+        {
+            return slot;
+        }
+        // a free slot is taken first, otherwise the one read longest ago
+        if (victim == NULL || (victim->hash != 0 && (slot->hash == 0 || slot->last_read < victim->last_read)))
+        {
+            victim = slot;
+        }
+    }
+    if (!create)
+    {
+        return NULL;
+    }
+    // two processes may take over the same slot at once, the counts of one of the files are lost which only makes it look colder
+    victim->hash = hash;
+    victim->reads = 0;
+    victim->last_read = 0;
+    return victim;
+}
+
+// this function counts a read of key
+static inline void tiering_note_read(struct tiering_store *store, const char *key)
+{
+    if (store->table == NULL)
+    {
+        return;
+    }
+    struct tiering_slot *slot = tiering_slot_for(store->table, key, 1);
+    slot->last_read = time(NULL);
+    __sync_fetch_and_add(&slot->reads, 1);
+}
+
+// returns the size of the cold file when fd is a stub, and fills mtime, otherwise -1
+static inline long long tiering_stub_size(int fd, long long *mtime)
+{
+    char text[TIERING_STUB_MAXIMUM + 1];
+    struct stat info;
+    long long size, modified;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size > TIERING_STUB_MAXIMUM)
+    {
+        return -1;
+    }
+    ssize_t got = pread(fd, text, TIERING_STUB_MAXIMUM, 0);
+    if (got <= 0)
+    {
+        return -1;
+    }
+    text[got] = '\0';
+    if (sscanf(text, TIERING_STUB_FORMAT, &size, &modified) != 2 || size < 0)
+    {
+        return -1;
+    }
+    if (mtime != NULL)
+    {
+        *mtime = modified;
+    }
+    return size;
+}
+
+// this function runs gzip with input and output as its standard input and output, -d unpacks, returns 0 when gzip succeeded
+// gzip is started directly and not through a shell, so paths need no quoting
+static inline int tiering_run_gzip(int input, int output, int unpack)
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        if (dup2(input, 0) < 0 || dup2(output, 1) < 0)
+        {
+            _exit(127);
+        }
+        execlp("gzip", "gzip", unpack ? "-dc" : "-c", (char *)NULL);
+        _exit(127);
+    }
+    int status;
+    if (pid < 0 || waitpid(pid, &status, 0) != pid)
+    {
+        return -1;
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+// this function splits key into its folder and its name, the folder is "" for a file of the storage folder itself
+// returns an allocated copy of the folder which the caller frees, name points into key
+static inline char *tiering_split(const char *key, const char **name)
+{
+    const char *last_slash = strrchr(key, '/');
+    size_t folder_length = last_slash != NULL ? (size_t)(last_slash - key) : 0;
+    char *folder = malloc(folder_length + 1);
+    if (folder != NULL)
+    {
+        memcpy(folder, key, folder_length);
+        folder[folder_length] = '\0';
+    }
+    *name = last_slash != NULL ? last_slash + 1 : key;
+    return folder;
+}
+
+// this function writes the path of name next to key into path, like "a/b/<name>" for key "a/b/c.txt"
+static inline void tiering_sibling(const char *key, const char *name, char *path, size_t path_size)
+{
+    const char *last_slash = strrchr(key, '/');
+    int folder_length = last_slash != NULL ? (int)(last_slash - key + 1) : 0;
+    snprintf(path, path_size, "%.*s%s", folder_length, key, name);
+}
+
+// this function copies the user extended attributes of the open file from to the open file to, like the content hash
+// of file_stat.h, so a file keeps them in both tiers
+static inline void tiering_copy_attributes(int from, int to)
+{
+    char names[1024], value[256];
+    ssize_t length = flistxattr(from, names, sizeof(names));
+    for (ssize_t i = 0; i < length; i += strlen(names + i) + 1)
+    {
+        ssize_t value_length;
+        if (strncmp(names + i, "user.", 5) == 0 && (value_length = fgetxattr(from, names + i, value, sizeof(value))) >= 0)
+        {
+            fsetxattr(to, names + i, value, value_length, 0);
+        }
+    }
+}
+
+// this function brings key back from the cold folder, the stub in the fast tier is replaced by the file
+// returns 0, also when someone else brought it back already, or -1 when the cold file could not be unpacked and the stub stays
+static inline int tiering_promote(struct tiering_store *store, const char *key)
+{
+    char cold_path[PATH_MAX], temp_name[64], temp_path[PATH_MAX];
+    long long mtime;
+    struct stat stub_info, current;
+    int result = -1;
+    snprintf(cold_path, sizeof(cold_path), "%s%s", key, TIERING_COLD_SUFFIX);
+    snprintf(temp_name, sizeof(temp_name), "%s%d.tmp", TIERING_TEMP_PREFIX, getpid());
+    tiering_sibling(key, temp_name, temp_path, sizeof(temp_path));
+    int stub = openat(store->hot_fd, key, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    long long size = stub >= 0 ? tiering_stub_size(stub, &mtime) : -1;
+    if (size < 0 || fstat(stub, &stub_info) != 0)
+    {
+        if (stub >= 0)
+        {
+            close(stub);
+        }
+        return 0;
+    }
+    int cold = openat(store->cold_fd, cold_path, O_RDONLY | O_CLOEXEC);
+    int temp = cold >= 0 ? openat(store->hot_fd, temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644) : -1;
+    if (temp >= 0 && tiering_run_gzip(cold, temp, 1) == 0 && fstat(temp, &current) == 0 && current.st_size == size)
+    {
+        // the file keeps its modification time, listings show it and the next pass ages it from its last read
+        // the stub has it to the nanosecond, the seconds of its text are only used when it lost them
+        struct timespec times[2] = {{0, UTIME_NOW}, stub_info.st_mtim};
+        if (stub_info.st_mtim.tv_sec != mtime)
+        {
+            times[1].tv_sec = mtime;
+            times[1].tv_nsec = 0;
+        }
+        tiering_copy_attributes(stub, temp);
+        futimens(temp, times);
+        fsync(temp);
+        // an upload may have replaced the stub while the file was unpacked, its file is newer and stays
+        if (fstatat(store->hot_fd, key, &current, AT_SYMLINK_NOFOLLOW) == 0 && current.st_ino == stub_info.st_ino &&
+            renameat(store->hot_fd, temp_path, store->hot_fd, key) == 0)
+        {
+            unlinkat(store->cold_fd, cold_path, 0);
+            result = 0;
+        }
+    }
+    if (temp >= 0)
+    {
+        close(temp);
+        // the rename above took the name away when it worked
+        unlinkat(store->hot_fd, temp_path, 0);
+    }
+    if (cold >= 0)
+    {
+        close(cold);
+    }
+    close(stub);
+    return result;
+}
+
+// this function opens key in the storage folder for reading and counts the read, a cold file is brought back first
+// returns the descriptor or -1 with errno set like openat()
+static inline int tiering_open(struct tiering_store *store, const char *key)
+{
+    int fd = openat(store->hot_fd, key, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || store->table == NULL)
+    {
+        return fd;
+    }
+    tiering_note_read(store, key);
+    if (tiering_stub_size(fd, NULL) < 0)
+    {
+        return fd;
+    }
+    close(fd);
+    if (tiering_promote(store, key) != 0)
+    {
+        errno = EIO;
+        return -1;
+    }
+    return openat(store->hot_fd, key, O_RDONLY | O_CLOEXEC);
+}
+
+// this function drops the cold copy of key, after key was removed or replaced by an upload
+static inline void tiering_forget(struct tiering_store *store, const char *key)
+{
+    char cold_path[PATH_MAX];
+    if (store->cold_fd < 0)
+    {
+        return;
+    }
+    snprintf(cold_path, sizeof(cold_path), "%s%s", key, TIERING_COLD_SUFFIX);
+    unlinkat(store->cold_fd, cold_path, 0);
+}
+
+// this function moves key into the cold folder and leaves a stub in its place, info is the stat the decision was made on
+// returns 0, or -1 when the file was left where it is, for example because it changed in the meantime
+static inline int tiering_demote(struct tiering_store *store, const char *key, const struct stat *info)
+{
+    char cold_path[PATH_MAX], temp_name[64], cold_temp[PATH_MAX], hot_temp[PATH_MAX];
+    char stub_text[TIERING_STUB_MAXIMUM];
+    struct stat current;
+    int owned, result = -1;
+    const char *name;
+    char *folder = tiering_split(key, &name);
+    int cold_dir = folder != NULL ? path_resolver_open_dir(&store->cold_dirs, folder, &owned) : -1;
+    free(folder);
+    if (cold_dir < 0)
+    {
+        return -1;
+    }
+    if (owned)
+    {
+        close(cold_dir);
+    }
+    snprintf(cold_path, sizeof(cold_path), "%s%s", key, TIERING_COLD_SUFFIX);
+    snprintf(temp_name, sizeof(temp_name), "%s%d.tmp", TIERING_TEMP_PREFIX, getpid());
+    tiering_sibling(key, temp_name, cold_temp, sizeof(cold_temp));
+    tiering_sibling(key, temp_name, hot_temp, sizeof(hot_temp));
+    int file = openat(store->hot_fd, key, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    int packed = file >= 0 ? openat(store->cold_fd, cold_temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644) : -1;
+    int stub = -1;
+    if (packed >= 0 && tiering_run_gzip(file, packed, 0) == 0 && fsync(packed) == 0 &&
+        renameat(store->cold_fd, cold_temp, store->cold_fd, cold_path) == 0)
+    {
+        // the stub carries the modification time of the file as well, so listings do not change, and its attributes
+        int length = snprintf(stub_text, sizeof(stub_text), TIERING_STUB_FORMAT, (long long)info->st_size, (long long)info->st_mtime);
+        struct timespec times[2] = {{0, UTIME_NOW}, info->st_mtim};
+        stub = openat(store->hot_fd, hot_temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (stub >= 0)
+        {
+            tiering_copy_attributes(file, stub);
+        }
+        if (stub >= 0 && write(stub, stub_text, length) == length && futimens(stub, times) == 0 && fsync(stub) == 0 &&
+            fstatat(store->hot_fd, key, &current, AT_SYMLINK_NOFOLLOW) == 0 && current.st_ino == info->st_ino &&
+            current.st_size == info->st_size && current.st_mtime == info->st_mtime &&
+            renameat(store->hot_fd, hot_temp, store->hot_fd, key) == 0)
+        {
+            result = 0;
+        }
+        // a file written while it was packed stays hot and the packed copy is thrown away
+        // an upload which starts between the check and the rename above is lost, the window is a single system call
+        if (result != 0)
+        {
+            unlinkat(store->cold_fd, cold_path, 0);
+        }
+    }
+    if (stub >= 0)
+    {
+        close(stub);
+        unlinkat(store->hot_fd, hot_temp, 0);
+    }
+    if (packed >= 0)
+    {
+        close(packed);
+        unlinkat(store->cold_fd, cold_temp, 0);
+    }
+    if (file >= 0)
+    {
+        close(file);
+    }
+    return result;
+}
+
+// called by path_resolver_walk() for every file of the fast tier during a pass
+static inline void tiering_visit(const char *path, void *argument)
+{
+    struct tiering_store *store = argument;
+    const char *last_slash = strrchr(path, '/');
+    struct stat info;
+    // names starting with a dot are files being written by the tiers or by smain's rebalancer
+    if ((last_slash != NULL ? last_slash[1] : path[0]) == '.' || fstatat(store->hot_fd, path, &info, AT_SYMLINK_NOFOLLOW) != 0 ||
+        !S_ISREG(info.st_mode) || info.st_size < TIERING_MINIMUM_SIZE)
+    {
+        return;
+    }
+    struct tiering_slot *slot = tiering_slot_for(store->table, path, 0);
+    long long last_read = info.st_mtime > info.st_atime ? info.st_mtime : info.st_atime;
+    unsigned int reads = 0;
+    if (slot != NULL)
+    {
+        last_read = slot->last_read > last_read ? slot->last_read : last_read;
+        reads = slot->reads;
+        // older reads count less and less, a file which was popular last month is not kept hot for ever
+        slot->reads = reads / 2;
+    }
+    if (time(NULL) - last_read >= store->cold_seconds * (1 + (long long)reads) && tiering_demote(store, path, &info) == 0)
+    {
+        printf("Tiering: %s moved to the cold tier\n", path);
+    }
+}
+
+// called for every file name by tiering_promote_all(), returns 1 for the files which are brought back
+typedef int (*tiering_match)(const char *name, void *argument);
+
+// the files being brought back by tiering_promote_all()
+struct tiering_promotion
+{
+    struct tiering_store *store;
+    tiering_match match;
+    void *argument;
+};
+
+static inline void tiering_promote_visit(const char *path, void *argument)
+{
+    struct tiering_promotion *promotion = argument;
+    const char *last_slash = strrchr(path, '/');
+    const char *name = last_slash != NULL ? last_slash + 1 : path;
+    struct stat info;
+    if (name[0] != '.' && promotion->match(name, promotion->argument) && fstatat(promotion->store->hot_fd, path, &info, AT_SYMLINK_NOFOLLOW) == 0 &&
+        S_ISREG(info.st_mode) && info.st_size <= TIERING_STUB_MAXIMUM)
+    {
+        tiering_promote(promotion->store, path);
+    }
+}
+
+// this function brings back every cold file whose name match accepts, for commands which hand the files of the
+// storage folder to other programs like tar and cannot read them through tiering_open()
+static inline void tiering_promote_all(struct tiering_store *store, tiering_match match, void *argument)
+{
+    struct tiering_promotion promotion = {store, match, argument};
+    size_t capacity = 256;
+    char *path = store->table != NULL ? malloc(capacity) : NULL;
+    if (path == NULL)
+    {
+        return;
+    }
+    path[0] = '\0';
+    path_resolver_walk_folder(store->hot_fd, &path, &capacity, 0, tiering_promote_visit, &promotion);
+    free(path);
+}
+
+// this function forks the process which moves cold files out of the fast tier, returns its pid or -1
+static inline pid_t tiering_start(struct tiering_store *store)
+{
+    if (store->table == NULL)
+    {
+        return -1;
+    }
+    // whatever the server printed so far would otherwise be printed again by the new process
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        for (;;)
+        {
+            size_t capacity = 256;
+            char *path = malloc(capacity);
+            if (path != NULL)
+            {
+                path[0] = '\0';
+                path_resolver_walk_folder(store->hot_fd, &path, &capacity, 0, tiering_visit, store);
+                free(path);
+            }
+            fflush(stdout);
+            sleep(TIERING_PASS_SECONDS);
+        }
+    }
+    if (pid < 0)
+    {
+        perror("Tiering not started, fork failed");
+    }
+    return pid;
+}
+
+#endif